@@ -324,17 +324,27 @@ const TYPE_STRING     = 0x20;
 const TYPE_ARRAY      = 0x21;
 const TYPE_ASSOCARRAY = 0x22;
 
-function __loadsmat(bytes, dtype, complex) {
+// dimeb v2 prologue length, and alignment of matrix data
+const V2_HDRLEN = 8;
+const ALIGN = 64;
+
+const NATIVE_LE = (new Uint8Array(new Uint16Array([1]).buffer)[0] === 1);
+
+function __align(pos, v2) {
+    return v2 ? pos + (ALIGN - pos % ALIGN) % ALIGN : pos;
+}
+
+function __loadsmat(bytes, pos, le, v2, dtype, complex) {
     let [constructor, method, itemsize] = dtype;
 
-    let dview = new DataView(bytes, 1);
+    let dview = new DataView(bytes, pos + 1);
     let rank = dview.getUint8(0);
 
-    dview = new DataView(bytes, 2);
+    dview = new DataView(bytes, pos + 2);
     let shape = [];
 
     for (let i = 0; i < rank; i++) {
-        shape.push(dview.getUint32(i * 4));
+        shape.push(dview.getUint32(i * 4, le));
     }
 
     if (shape.length === 1) {
@@ -342,26 +352,33 @@ function __loadsmat(bytes, dtype, complex) {
     }
 
     let nelems = shape.reduce((a, b) => a * b) * (complex ? 2 : 1);
+    let offset = __align(pos + 2 + 4 * rank, v2);
+    let array;
 
-    dview = new DataView(bytes, 2 + 4 * rank);
-    let array = new constructor(nelems);
+    if (le === NATIVE_LE && offset % itemsize === 0) {
+        // Use the received data in place
+        array = new constructor(bytes, offset, nelems);
+    } else {
+        dview = new DataView(bytes, offset);
+        array = new constructor(nelems);
 
-    for (let i = 0; i < nelems; i++) {
-        array[i] = dview[method](i * itemsize);
+        for (let i = 0; i < nelems; i++) {
+            array[i] = dview[method](i * itemsize, le);
+        }
     }
 
     let obj = new dime.NDArray("F", shape, array, complex);
-    let nread = 2 + 4 * rank + nelems * itemsize;
+    let nread = offset - pos + nelems * itemsize;
 
     return [obj, nread];
 }
 
-function __loads(bytes) {
+function __loads(bytes, pos, le, v2) {
     let obj, nread;
 
-    let dview = new DataView(bytes, 1);
+    let dview = new DataView(bytes, pos + 1);
 
-    switch (new DataView(bytes).getUint8(0)) {
+    switch (new DataView(bytes).getUint8(pos)) {
     case TYPE_NULL:
         obj = null;
         nread = 1;
@@ -387,19 +404,19 @@ function __loads(bytes) {
         break;
 
     case TYPE_I16:
-        obj = dview.getInt16(0);
+        obj = dview.getInt16(0, le);
         nread = 3;
 
         break;
 
     case TYPE_I32:
-        obj = dview.getInt32(0);
+        obj = dview.getInt32(0, le);
         nread = 5;
 
         break;
 
     case TYPE_I64:
-        obj = dview.getBigInt64(0);
+        obj = dview.getBigInt64(0, le);
         if (BigInt(-Number.MAX_SAFE_INTEGER) <= obj && obj <= BigInt(Number.MAX_SAFE_INTEGER)) {
             obj = Number(obj);
         }
@@ -415,19 +432,19 @@ function __loads(bytes) {
         break;
 
     case TYPE_U16:
-        obj = dview.getUint16(0);
+        obj = dview.getUint16(0, le);
         nread = 3;
 
         break;
 
     case TYPE_U32:
-        obj = dview.getUint32(0);
+        obj = dview.getUint32(0, le);
         nread = 5;
 
         break;
 
     case TYPE_U64:
-        obj = dview.getBigUint64(0);
+        obj = dview.getBigUint64(0, le);
         if (obj <= BigInt(Number.MAX_SAFE_INTEGER)) {
             obj = Number(obj);
         }
@@ -437,21 +454,21 @@ function __loads(bytes) {
         break;
 
     case TYPE_SINGLE:
-        obj = dview.getFloat32(0);
+        obj = dview.getFloat32(0, le);
         nread = 5;
 
         break;
 
     case TYPE_DOUBLE:
-        obj = dview.getFloat64(0);
+        obj = dview.getFloat64(0, le);
         nread = 9;
 
         break;
 
     case TYPE_COMPLEX_SINGLE:
         {
-            let realpart = dview.getFloat32(0);
-            let imagpart = dview.getFloat32(4);
+            let realpart = dview.getFloat32(0, le);
+            let imagpart = dview.getFloat32(4, le);
 
             obj = new Complex(realpart, imagpart);
         }
@@ -461,8 +478,8 @@ function __loads(bytes) {
 
     case TYPE_COMPLEX_DOUBLE:
         {
-            let realpart = dview.getFloat64(0);
-            let imagpart = dview.getFloat64(8);
+            let realpart = dview.getFloat64(0, le);
+            let imagpart = dview.getFloat64(8, le);
 
             obj = new Complex(realpart, imagpart);
         }
@@ -471,19 +488,19 @@ function __loads(bytes) {
         break;
 
     case TYPE_MAT_I8:
-        [obj, nread] = __loadsmat(bytes, [Int8Array, "getInt8", 1], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Int8Array, "getInt8", 1], false);
         break;
 
     case TYPE_MAT_I16:
-        [obj, nread] = __loadsmat(bytes, [Int16Array, "getInt16", 2], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Int16Array, "getInt16", 2], false);
         break;
 
     case TYPE_MAT_I32:
-        [obj, nread] = __loadsmat(bytes, [Int32Array, "getInt32", 4], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Int32Array, "getInt32", 4], false);
         break;
 
     case TYPE_MAT_I64:
-        [obj, nread] = __loadsmat(bytes, [BigInt64Array, "getBigInt64", 8], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [BigInt64Array, "getBigInt64", 8], false);
 
         if (obj.array.every((i) => BigInt(-Number.MAX_SAFE_INTEGER) <= i && i <= BigInt(Number.MAX_SAFE_INTEGER))) {
             let array = new Float64Array(Array.from(obj.array).map(Number));
@@ -493,19 +510,19 @@ function __loads(bytes) {
         break;
 
     case TYPE_MAT_U8:
-        [obj, nread] = __loadsmat(bytes, [Uint8Array, "getUint8", 1], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Uint8Array, "getUint8", 1], false);
         break;
 
     case TYPE_MAT_U16:
-        [obj, nread] = __loadsmat(bytes, [Uint16Array, "getUint16", 2], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Uint16Array, "getUint16", 2], false);
         break;
 
     case TYPE_MAT_U32:
-        [obj, nread] = __loadsmat(bytes, [Uint32Array, "getUint32", 4], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Uint32Array, "getUint32", 4], false);
         break;
 
     case TYPE_MAT_U64:
-        [obj, nread] = __loadsmat(bytes, [BigUint64Array, "getBigUint64", 8], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [BigUint64Array, "getBigUint64", 8], false);
 
         if (obj.array.every((i) => i <= BigInt(Number.MAX_SAFE_INTEGER))) {
             let array = new Float64Array.from(Array.from(obj.array).map(Number));
@@ -515,26 +532,26 @@ function __loads(bytes) {
         break;
 
     case TYPE_MAT_SINGLE:
-        [obj, nread] = __loadsmat(bytes, [Float32Array, "getFloat32", 4], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Float32Array, "getFloat32", 4], false);
         break;
 
     case TYPE_MAT_DOUBLE:
-        [obj, nread] = __loadsmat(bytes, [Float64Array, "getFloat64", 8], false);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Float64Array, "getFloat64", 8], false);
         break;
 
     case TYPE_MAT_COMPLEX_SINGLE:
-        [obj, nread] = __loadsmat(bytes, [Float32Array, "getFloat32", 4], true);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Float32Array, "getFloat32", 4], true);
         break;
 
     case TYPE_MAT_COMPLEX_DOUBLE:
-        [obj, nread] = __loadsmat(bytes, [Float64Array, "getFloat64", 8], true);
+        [obj, nread] = __loadsmat(bytes, pos, le, v2, [Float64Array, "getFloat64", 8], true);
         break;
 
     case TYPE_STRING:
         {
-            let len = dview.getUint32(0);
+            let len = dview.getUint32(0, le);
 
-            obj = new TextDecoder().decode(bytes.slice(5, len + 5));
+            obj = new TextDecoder().decode(bytes.slice(pos + 5, pos + len + 5));
             nread = len + 5;
         }
 
@@ -542,13 +559,13 @@ function __loads(bytes) {
 
     case TYPE_ARRAY:
         {
-            let len = dview.getUint32(0);
+            let len = dview.getUint32(0, le);
 
             obj = [];
             nread = 5;
 
             for (let i = 0; i < len; i++) {
-                let [elem, elem_siz] = __loads(bytes.slice(nread));
+                let [elem, elem_siz] = __loads(bytes, pos + nread, le, v2);
 
                 obj.push(elem);
                 nread += elem_siz;
@@ -559,16 +576,16 @@ function __loads(bytes) {
 
     case TYPE_ASSOCARRAY:
         {
-            let len = dview.getUint32(0);
+            let len = dview.getUint32(0, le);
 
             obj = {};
             nread = 5;
 
             for (let i = 0; i < len; i++) {
-                let [key, key_siz] = __loads(bytes.slice(nread));
+                let [key, key_siz] = __loads(bytes, pos + nread, le, v2);
                 nread += key_siz;
 
-                let [val, val_siz] = __loads(bytes.slice(nread));
+                let [val, val_siz] = __loads(bytes, pos + nread, le, v2);
                 nread += val_siz;
 
                 obj[key] = val;
@@ -585,12 +602,27 @@ function __loads(bytes) {
 }
 
 function dimebloads(bytes) {
-    let [obj, nread] = __loads(bytes);
+    let u8 = new Uint8Array(bytes);
+
+    // dimeb v2 starts with 0xFF, which is never a valid v1 type code
+    if (u8[0] === 0xFF) {
+        if (u8[1] !== 0x44 || u8[2] !== 0x42 || u8[3] !== 0x02 || (u8[4] !== 0x4C && u8[4] !== 0x42)) {
+            throw "Unsupported dimeb version";
+        }
+
+        let [obj, nread] = __loads(bytes, V2_HDRLEN, u8[4] === 0x4C, true);
+
+        return obj;
+    }
+
+    let [obj, nread] = __loads(bytes, 0, false, false);
 
     return obj;
 }
 
-function dimebdumps(obj) {
+// Encode obj as it will be placed at byte pos of the payload, which
+// determines the padding before matrix data in v2
+function __dumps(obj, pos, le, v2) {
     let bytes;
 
     if (obj === null) {
@@ -605,18 +637,18 @@ function dimebdumps(obj) {
 
         if (Number.isInteger(obj)) {
             bytes[0] = TYPE_I64;
-            dview.setBigInt64(0, BigInt(obj));
+            dview.setBigInt64(0, BigInt(obj), le);
         } else {
             bytes[0] = TYPE_DOUBLE;
-            dview.setFloat64(0, obj);
+            dview.setFloat64(0, obj, le);
         }
     } else if (obj instanceof Complex) {
         bytes = new Uint8Array(17);
         let dview = new DataView(bytes.buffer, 1);
 
         bytes[0] = TYPE_COMPLEX_DOUBLE;
-        dview.setFloat64(0, obj.real);
-        dview.setFloat64(8, obj.imag);
+        dview.setFloat64(0, obj.real, le);
+        dview.setFloat64(8, obj.imag, le);
     } else if (obj instanceof dime.NDArray) {
 		if (obj.order !== 'F') {
 			throw "C-order NDArrays are currently not supported for dimebdumps";
@@ -674,73 +706,108 @@ function dimebdumps(obj) {
 
         let rank = obj.shape.length;
         let nelems = obj.array.length;
+        let offset = __align(pos + 2 + 4 * rank, v2) - pos;
 
-        bytes = new Uint8Array(2 + 4 * rank + nelems * itemsize);
+        bytes = new Uint8Array(offset + nelems * itemsize);
         let dview = new DataView(bytes.buffer, 2);
 
         bytes[0] = dtype;
         bytes[1] = rank;
 
         for (let i = 0; i < rank; i++) {
-            dview.setUint32(i * 4, obj.shape[i]);
+            dview.setUint32(i * 4, obj.shape[i], le);
         }
 
-        dview = new DataView(bytes.buffer, 2 + 4 * rank);
+        if (le === NATIVE_LE && obj.array.BYTES_PER_ELEMENT === itemsize) {
+            bytes.set(new Uint8Array(obj.array.buffer, obj.array.byteOffset, nelems * itemsize), offset);
+        } else {
+            dview = new DataView(bytes.buffer, offset);
 
-        for (let i = 0; i < nelems; i++) {
-            dview[method](i * itemsize, obj.array[i]);
+            for (let i = 0; i < nelems; i++) {
+                dview[method](i * itemsize, obj.array[i], le);
+            }
         }
     } else if (typeof obj === "string") {
         let stringbytes = new TextEncoder().encode(obj);
 
         bytes = new Uint8Array(5 + stringbytes.length);
-        dview = new DataView(bytes.buffer, 1);
+        let dview = new DataView(bytes.buffer, 1);
 
         bytes[0] = TYPE_STRING;
-        dview.setUint32(0, stringbytes.length);
+        dview.setUint32(0, stringbytes.length, le);
         bytes.set(stringbytes, 5);
     } else if (Array.isArray(obj)) {
-        let elemsbytes = obj.map(dimebdumps);
+        let elemsbytes = [];
+        let elemspos = pos + 5;
 
-        bytes = new Uint8Array(5 + elemsbytes.reduce((acc, elembytes) => acc + elembytes.length, 0));
+        for (let elem of obj) {
+            elemsbytes.push(__dumps(elem, elemspos, le, v2));
+            elemspos += elemsbytes[elemsbytes.length - 1].length;
+        }
+
+        bytes = new Uint8Array(elemspos - pos);
         let dview = new DataView(bytes.buffer, 1);
 
         bytes[0] = TYPE_ARRAY;
-        dview.setUint32(0, elemsbytes.length);
+        dview.setUint32(0, elemsbytes.length, le);
 
-        let pos = 5;
+        let off = 5;
 
         for (let elembytes of elemsbytes) {
-            bytes.set(elembytes, pos);
-            pos += elembytes.length;
+            bytes.set(elembytes, off);
+            off += elembytes.length;
         }
     } else {
-        let elemsbytes = Array.prototype.concat.apply([], Object.entries(obj)).map(dimebdumps);
+        let elemsbytes = [];
+        let elemspos = pos + 5;
+
+        for (let elem of Array.prototype.concat.apply([], Object.entries(obj))) {
+            elemsbytes.push(__dumps(elem, elemspos, le, v2));
+            elemspos += elemsbytes[elemsbytes.length - 1].length;
+        }
 
-        bytes = new Uint8Array(5 + elemsbytes.reduce((acc, elembytes) => acc + elembytes.length, 0));
+        bytes = new Uint8Array(elemspos - pos);
         let dview = new DataView(bytes.buffer, 1);
 
         bytes[0] = TYPE_ASSOCARRAY;
-        dview.setUint32(0, elemsbytes.length / 2);
+        dview.setUint32(0, elemsbytes.length / 2, le);
 
-        let pos = 5;
+        let off = 5;
 
         for (let elembytes of elemsbytes) {
-            bytes.set(elembytes, pos);
-            pos += elembytes.length;
+            bytes.set(elembytes, off);
+            off += elembytes.length;
         }
     }
 
     return bytes;
 }
 
+// Version 1 uses network byte order throughout; version 2 uses the native
+// byte order and aligns matrix data, so that a receiver of the same byte
+// order can use it in place
+function dimebdumps(obj, version = 1) {
+    if (version < 2) {
+        return __dumps(obj, 0, false, false);
+    }
+
+    let body = __dumps(obj, V2_HDRLEN, NATIVE_LE, true);
+    let bytes = new Uint8Array(V2_HDRLEN + body.length);
+
+    bytes.set([0xFF, 0x44, 0x42, 0x02, NATIVE_LE ? 0x4C : 0x42]);
+    bytes.set(body, V2_HDRLEN);
+
+    return bytes;
+}
+
 class DimeClient {
-    constructor(hostname, port) {
+    constructor(hostname, port, serialization = "json") {
         const self = this;
 
         this.ws = null;
         this.workspace = {};
-        this.serialization = "json";
+        this.serialization = serialization;
+        this.dimeb_version = 1;
         this.recvbuffer = new ArrayBuffer(0);
         this.recvcallback = null;
 
@@ -772,7 +839,9 @@ class DimeClient {
                 self.__send({
                     command: "handshake",
                     serialization: self.serialization,
-                    tls: false
+                    tls: false,
+                    dimeb_version: 2,
+                    byteorder: NATIVE_LE ? "little" : "big"
                 });
 
                 self.__recv().then(function([jsondata, bindata]) {
@@ -781,11 +850,12 @@ class DimeClient {
                     }
 
                     self.serialization = jsondata.serialization;
+                    self.dimeb_version = jsondata.dimeb_version || 1;
 
                     // No serialization methods other than dimeb are supported (for now)
                     if (jsondata.serialization === "dimeb") {
                         self.loads = dimebloads;
-                        self.dumps = dimebdumps;
+                        self.dumps = (obj) => dimebdumps(obj, self.dimeb_version);
                     } else if (jsondata.serialization === "json") {
                         self.loads = jsonloads;
                         self.dumps = jsondumps;
@@ -28,6 +28,8 @@ classdef dime < handle
         send_ll       % Low-level send function
         recv_ll       % Low-level receive function
         close_ll      % Low-level close function
+        dimebdumps_ll % dimeb encoder
+        dimebloads_ll % dimeb decoder
     end
 
     methods
@@ -99,12 +101,35 @@ classdef dime < handle
                 end
             end
 
+            % Prefer the compiled dimeb codecs if they have been built. The
+            % MEX encoder writes dimeb v2 in our byte order, so matrix data is
+            % copied without swapping.
+            if exist('dimebdumps_mex', 'file') == 3 && exist('dimebloads_mex', 'file') == 3
+                obj.dimebdumps_ll = @(x) dimebdumps_mex(x, 2);
+                obj.dimebloads_ll = @dimebloads_mex;
+            else
+                obj.dimebdumps_ll = @dimebdumps;
+                obj.dimebloads_ll = @dimebloads;
+            end
+
             jsondata = struct();
 
             jsondata.command = 'handshake';
             jsondata.serialization = 'matlab';
             jsondata.tls = false;
 
+            % dimebloads accepts dimeb v2 in either byte order, but the
+            % server sends it in ours so it needs no byte swapping
+            [~, ~, ENDIANNESS] = computer;
+
+            jsondata.dimeb_version = 2;
+
+            if ENDIANNESS == 'L'
+                jsondata.byteorder = 'little';
+            else
+                jsondata.byteorder = 'big';
+            end
+
             sendmsg(obj, jsondata, uint8.empty);
             [jsondata, ~] = recvmsg(obj);
 
@@ -263,7 +288,7 @@ classdef dime < handle
                         bindata = getByteStreamFromArray(v.(k{j}));
 
                     case 'dimeb'
-                        bindata = dimebdumps(v.(k{j}));
+                        bindata = obj.dimebdumps_ll(v.(k{j}));
                     end
 
                     sendmsg(obj, jsondata, bindata);
@@ -354,7 +379,7 @@ classdef dime < handle
                         bindata = getByteStreamFromArray(v.(k{j}));
 
                     case 'dimeb'
-                        bindata = dimebdumps(v.(k{j}));
+                        bindata = obj.dimebdumps_ll(v.(k{j}));
                     end
 
                     sendmsg(obj, jsondata, bindata);
@@ -450,7 +475,7 @@ classdef dime < handle
                     x = getArrayFromByteStream(bindata);
 
                 case 'dimeb'
-                    x = dimebloads(bindata);
+                    x = obj.dimebloads_ll(bindata);
 
                 otherwise
                     m = m - 1;
@@ -0,0 +1,177 @@
+/*
+ * dimeb_mex.h - Shared definitions for the dimeb MEX codecs
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/*
+ * Type codes, class tables and byte-copying helpers used by both
+ * dimebloads_mex.c and dimebdumps_mex.c. Each MEX function is compiled
+ * on its own, so everything here is static.
+ */
+
+#ifndef __DIME_dimeb_mex_H
+#define __DIME_dimeb_mex_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mex.h"
+
+enum {
+    /* Boolean sentinels */
+    DIMEB_NULL  = 0x00,
+    DIMEB_TRUE  = 0x01,
+    DIMEB_FALSE = 0x02,
+
+    /* Scalar types */
+    DIMEB_I8  = 0x03,
+    DIMEB_I16 = 0x04,
+    DIMEB_I32 = 0x05,
+    DIMEB_I64 = 0x06,
+    DIMEB_U8  = 0x07,
+    DIMEB_U16 = 0x08,
+    DIMEB_U32 = 0x09,
+    DIMEB_U64 = 0x0A,
+
+    DIMEB_SINGLE         = 0x0B,
+    DIMEB_DOUBLE         = 0x0C,
+    DIMEB_COMPLEX_SINGLE = 0x0D,
+    DIMEB_COMPLEX_DOUBLE = 0x0E,
+
+    /* Matrix flag, OR'd with a scalar type */
+    DIMEB_MAT = 0x10,
+
+    /* Other types */
+    DIMEB_STRING     = 0x20,
+    DIMEB_ARRAY      = 0x21,
+    DIMEB_ASSOCARRAY = 0x22
+};
+
+/* Length of the dimeb v2 prologue, and alignment of its matrix data */
+#define DIMEB_V2_HDRLEN 8
+#define DIMEB_ALIGN 64
+
+static const mxClassID dimeb_classes[] = {
+    [DIMEB_I8] = mxINT8_CLASS,
+    [DIMEB_I16] = mxINT16_CLASS,
+    [DIMEB_I32] = mxINT32_CLASS,
+    [DIMEB_I64] = mxINT64_CLASS,
+    [DIMEB_U8] = mxUINT8_CLASS,
+    [DIMEB_U16] = mxUINT16_CLASS,
+    [DIMEB_U32] = mxUINT32_CLASS,
+    [DIMEB_U64] = mxUINT64_CLASS,
+    [DIMEB_SINGLE] = mxSINGLE_CLASS,
+    [DIMEB_DOUBLE] = mxDOUBLE_CLASS,
+    [DIMEB_COMPLEX_SINGLE] = mxSINGLE_CLASS,
+    [DIMEB_COMPLEX_DOUBLE] = mxDOUBLE_CLASS
+};
+
+/* Size of one element (one component, for complex types) */
+static const size_t dimeb_itemsizes[] = {
+    [DIMEB_I8] = 1,
+    [DIMEB_I16] = 2,
+    [DIMEB_I32] = 4,
+    [DIMEB_I64] = 8,
+    [DIMEB_U8] = 1,
+    [DIMEB_U16] = 2,
+    [DIMEB_U32] = 4,
+    [DIMEB_U64] = 8,
+    [DIMEB_SINGLE] = 4,
+    [DIMEB_DOUBLE] = 8,
+    [DIMEB_COMPLEX_SINGLE] = 4,
+    [DIMEB_COMPLEX_DOUBLE] = 8
+};
+
+static inline int dimeb_little(void) {
+    const uint16_t one = 1;
+
+    return *(const unsigned char *)&one;
+}
+
+/*
+ * Copy n elements of the given size, reversing the bytes of each one if
+ * swap is nonzero. This is the only pass made over matrix data.
+ */
+static inline void dimeb_copy(void *dst, const void *src, size_t n, size_t itemsize, int swap) {
+    size_t i;
+
+    if (!swap || itemsize == 1) {
+        memcpy(dst, src, n * itemsize);
+        return;
+    }
+
+    switch (itemsize) {
+    case 2:
+        for (i = 0; i < n; i++) {
+            uint16_t x;
+
+            memcpy(&x, (const unsigned char *)src + 2 * i, 2);
+            x = (uint16_t)((x >> 8) | (x << 8));
+            memcpy((unsigned char *)dst + 2 * i, &x, 2);
+        }
+
+        break;
+
+    case 4:
+        for (i = 0; i < n; i++) {
+            uint32_t x;
+
+            memcpy(&x, (const unsigned char *)src + 4 * i, 4);
+            x = ((x & 0xFF00FF00u) >> 8) | ((x & 0x00FF00FFu) << 8);
+            x = (x >> 16) | (x << 16);
+            memcpy((unsigned char *)dst + 4 * i, &x, 4);
+        }
+
+        break;
+
+    case 8:
+        for (i = 0; i < n; i++) {
+            uint64_t x;
+
+            memcpy(&x, (const unsigned char *)src + 8 * i, 8);
+            x = ((x & 0xFF00FF00FF00FF00ull) >> 8) | ((x & 0x00FF00FF00FF00FFull) << 8);
+            x = ((x & 0xFFFF0000FFFF0000ull) >> 16) | ((x & 0x0000FFFF0000FFFFull) << 16);
+            x = (x >> 32) | (x << 32);
+            memcpy((unsigned char *)dst + 8 * i, &x, 8);
+        }
+
+        break;
+    }
+}
+
+/* Split n interleaved (real, imaginary) pairs into separate arrays */
+static inline void dimeb_deinterleave(void *re, void *im, const void *src, size_t n, size_t itemsize, int swap) {
+    const unsigned char *p = src;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dimeb_copy((unsigned char *)re + i * itemsize, p + 2 * i * itemsize, 1, itemsize, swap);
+        dimeb_copy((unsigned char *)im + i * itemsize, p + (2 * i + 1) * itemsize, 1, itemsize, swap);
+    }
+}
+
+/* Inverse of dimeb_deinterleave */
+static inline void dimeb_interleave(void *dst, const void *re, const void *im, size_t n, size_t itemsize, int swap) {
+    unsigned char *p = dst;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dimeb_copy(p + 2 * i * itemsize, (const unsigned char *)re + i * itemsize, 1, itemsize, swap);
+        dimeb_copy(p + (2 * i + 1) * itemsize, (const unsigned char *)im + i * itemsize, 1, itemsize, swap);
+    }
+}
+
+#endif
@@ -0,0 +1,266 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "mex.h"
+
+#include "dimeb_mex.h"
+
+/*
+ * The output is built in a buffer from mxMalloc, which becomes the data
+ * of the returned uint8 array without being copied
+ */
+typedef struct {
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    int swap;
+    int aligned;
+} writer_t;
+
+static unsigned char *put(writer_t *w, size_t n) {
+    unsigned char *p;
+
+    if (w->cap - w->len < n) {
+        size_t cap = (w->cap * 3) / 2;
+
+        if (cap - w->len < n) {
+            cap = w->len + n;
+        }
+
+        w->buf = mxRealloc(w->buf, cap);
+        w->cap = cap;
+    }
+
+    p = w->buf + w->len;
+    w->len += n;
+
+    return p;
+}
+
+static void put_type(writer_t *w, int type) {
+    *put(w, 1) = type;
+}
+
+static void put_u32(writer_t *w, size_t x) {
+    uint32_t x32 = (uint32_t)x;
+
+    if (x > UINT32_MAX) {
+        mexErrMsgTxt("Variable is too large for dimeb");
+    }
+
+    dimeb_copy(put(w, 4), &x32, 1, 4, w->swap);
+}
+
+static int numeric_type(mxClassID cls) {
+    switch (cls) {
+    case mxINT8_CLASS:   return DIMEB_I8;
+    case mxINT16_CLASS:  return DIMEB_I16;
+    case mxINT32_CLASS:  return DIMEB_I32;
+    case mxINT64_CLASS:  return DIMEB_I64;
+    case mxUINT8_CLASS:  return DIMEB_U8;
+    case mxUINT16_CLASS: return DIMEB_U16;
+    case mxUINT32_CLASS: return DIMEB_U32;
+    case mxUINT64_CLASS: return DIMEB_U64;
+    case mxSINGLE_CLASS: return DIMEB_SINGLE;
+    case mxDOUBLE_CLASS: return DIMEB_DOUBLE;
+    default:             return -1;
+    }
+}
+
+static void dumps(writer_t *w, const mxArray *x);
+
+static void dumps_numeric(writer_t *w, const mxArray *x) {
+    int type = numeric_type(mxGetClassID(x));
+    size_t n = mxGetNumberOfElements(x);
+    size_t itemsize, i;
+
+    if (type < 0) {
+        mexErrMsgTxt("Cannot serialize variable of this type");
+    }
+
+    if (mxIsComplex(x)) {
+        if (type != DIMEB_SINGLE && type != DIMEB_DOUBLE) {
+            /* Complex integers are sent as complex doubles */
+            mxArray *y;
+
+            mexCallMATLAB(1, &y, 1, (mxArray **)&x, "double");
+            dumps_numeric(w, y);
+            mxDestroyArray(y);
+
+            return;
+        }
+
+        type = (type == DIMEB_SINGLE) ? DIMEB_COMPLEX_SINGLE : DIMEB_COMPLEX_DOUBLE;
+    }
+
+    itemsize = dimeb_itemsizes[type];
+
+    if (n == 1) {
+        put_type(w, type);
+    } else {
+        mwSize ndims = mxGetNumberOfDimensions(x);
+        const mwSize *dims = mxGetDimensions(x);
+
+        if (ndims > 255) {
+            mexErrMsgTxt("Variable has too many dimensions for dimeb");
+        }
+
+        put_type(w, DIMEB_MAT | type);
+        *put(w, 1) = ndims;
+
+        for (i = 0; i < ndims; i++) {
+            put_u32(w, dims[i]);
+        }
+
+        if (w->aligned) {
+            size_t pad = (DIMEB_ALIGN - w->len % DIMEB_ALIGN) % DIMEB_ALIGN;
+
+            memset(put(w, pad), 0, pad);
+        }
+    }
+
+    if (type == DIMEB_COMPLEX_SINGLE || type == DIMEB_COMPLEX_DOUBLE) {
+        unsigned char *p = put(w, 2 * n * itemsize);
+
+        dimeb_interleave(p, mxGetData(x), mxGetImagData(x), n, itemsize, w->swap);
+    } else {
+        dimeb_copy(put(w, n * itemsize), mxGetData(x), n, itemsize, w->swap);
+    }
+}
+
+static void dumps_string(writer_t *w, const mxArray *x) {
+    size_t n = mxGetNumberOfElements(x), i;
+    const mxChar *c = mxGetChars(x);
+    unsigned char *p;
+
+    put_type(w, DIMEB_STRING);
+    put_u32(w, n);
+
+    p = put(w, n);
+
+    /* Same as uint8(x), which saturates */
+    for (i = 0; i < n; i++) {
+        p[i] = (c[i] > 0xFF) ? 0xFF : c[i];
+    }
+}
+
+static void dumps_cstr(writer_t *w, const char *s) {
+    size_t n = strlen(s);
+
+    put_type(w, DIMEB_STRING);
+    put_u32(w, n);
+    memcpy(put(w, n), s, n);
+}
+
+static void dumps_map(writer_t *w, const mxArray *x) {
+    mxArray *keys, *vals;
+    size_t n, i;
+
+    mexCallMATLAB(1, &keys, 1, (mxArray **)&x, "keys");
+    mexCallMATLAB(1, &vals, 1, (mxArray **)&x, "values");
+
+    n = mxGetNumberOfElements(keys);
+
+    put_type(w, DIMEB_ASSOCARRAY);
+    put_u32(w, n);
+
+    for (i = 0; i < n; i++) {
+        dumps(w, mxGetCell(keys, i));
+        dumps(w, mxGetCell(vals, i));
+    }
+
+    mxDestroyArray(keys);
+    mxDestroyArray(vals);
+}
+
+static void dumps(writer_t *w, const mxArray *x) {
+    size_t n, i;
+
+    /* Unset cells and fields are empty matrices */
+    if (x == NULL) {
+        put_type(w, DIMEB_NULL);
+        return;
+    }
+
+    n = mxGetNumberOfElements(x);
+
+    if (mxIsCell(x)) {
+        put_type(w, DIMEB_ARRAY);
+        put_u32(w, n);
+
+        for (i = 0; i < n; i++) {
+            dumps(w, mxGetCell(x, i));
+        }
+    } else if (mxIsClass(x, "containers.Map")) {
+        dumps_map(w, x);
+    } else if (n == 0) {
+        put_type(w, DIMEB_NULL);
+    } else if (mxIsClass(x, "string")) {
+        mxArray *c;
+
+        mexCallMATLAB(1, &c, 1, (mxArray **)&x, "char");
+        dumps_string(w, c);
+        mxDestroyArray(c);
+    } else if (mxIsLogical(x) && n == 1) {
+        put_type(w, mxIsLogicalScalarTrue(x) ? DIMEB_TRUE : DIMEB_FALSE);
+    } else if (mxIsNumeric(x)) {
+        dumps_numeric(w, x);
+    } else if (mxIsChar(x)) {
+        dumps_string(w, x);
+    } else if (mxIsStruct(x) && n == 1) {
+        int nfields = mxGetNumberOfFields(x), f;
+
+        put_type(w, DIMEB_ASSOCARRAY);
+        put_u32(w, nfields);
+
+        for (f = 0; f < nfields; f++) {
+            dumps_cstr(w, mxGetFieldNameByNumber(x, f));
+            dumps(w, mxGetFieldByNumber(x, 0, f));
+        }
+    } else {
+        mexErrMsgTxt("Cannot serialize variable of this type");
+    }
+}
+
+void mexFunction(int nlhs, mxArray **plhs, int nrhs, const mxArray **prhs) {
+    writer_t w;
+    int version = 1;
+
+    if (nrhs != 1 && nrhs != 2) {
+        mexErrMsgTxt("Wrong number of arguments");
+    }
+
+    if (nrhs == 2) {
+        version = (int)mxGetScalar(prhs[1]);
+
+        if (version != 1 && version != 2) {
+            mexErrMsgTxt("Unsupported dimeb version");
+        }
+    }
+
+    w.cap = 4096;
+    w.len = 0;
+    w.buf = mxMalloc(w.cap);
+
+    if (version == 2) {
+        /* Native byte order, so matrix data is copied as-is */
+        unsigned char *hdr = put(&w, DIMEB_V2_HDRLEN);
+
+        memcpy(hdr, "\xFF" "DB\x02", 4);
+        hdr[4] = dimeb_little() ? 'L' : 'B';
+        hdr[5] = hdr[6] = hdr[7] = 0;
+
+        w.swap = 0;
+        w.aligned = 1;
+    } else {
+        w.swap = dimeb_little();
+        w.aligned = 0;
+    }
+
+    dumps(&w, prhs[0]);
+
+    plhs[0] = mxCreateNumericMatrix(0, 0, mxUINT8_CLASS, mxREAL);
+    mxSetData(plhs[0], w.buf);
+    mxSetM(plhs[0], 1);
+    mxSetN(plhs[0], w.len);
+}
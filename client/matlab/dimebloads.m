@@ -1,8 +1,23 @@
 function [obj] = dimebloads(bytes)
-    [obj, ~] = loads(bytes);
+    [~, ~, ENDIANNESS] = computer;
+
+    % dimeb v2 begins with 0xFF, which is never a valid v1 type code, and
+    % is followed by 'DB', the version and the byte order
+    if bytes(1) == 0xFF
+        if length(bytes) < 8 || ~isequal(bytes(2:4), uint8([68 66 2])) || ~any(bytes(5) == 'LB')
+            error('Unsupported dimeb version');
+        end
+
+        [obj, ~] = loads(bytes(9:end), 8, char(bytes(5)) ~= ENDIANNESS, true);
+    else
+        [obj, ~] = loads(bytes, 0, ENDIANNESS == 'L', false);
+    end
 end
 
-function [obj, nread] = loads(bytes)
+% pos is the offset of bytes within the payload, which determines the
+% padding before matrix data in dimeb v2. swap is true if the data is not
+% in the native byte order.
+function [obj, nread] = loads(bytes, pos, swap, aligned)
     % Boolean sentinels
     TYPE_NULL  = uint8(0x00);
     TYPE_TRUE  = uint8(0x01);
@@ -43,8 +58,6 @@ function [obj, nread] = loads(bytes)
     TYPE_ARRAY      = uint8(0x21);
     TYPE_ASSOCARRAY = uint8(0x22);
 
-    [~, ~, ENDIANNESS] = computer;
-
     switch bytes(1)
 
     case TYPE_NULL
@@ -65,7 +78,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_I16
         obj = typecast(bytes(2:3), 'int16');
-        if ENDIANNESS == 'L'
+        if swap
             obj = swapbytes(obj);
         end
 
@@ -73,7 +86,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_I32
         obj = typecast(bytes(2:5), 'int32');
-        if ENDIANNESS == 'L'
+        if swap
             obj = swapbytes(obj);
         end
 
@@ -81,7 +94,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_I64
         obj = typecast(bytes(2:9), 'int64');
-        if ENDIANNESS == 'L'
+        if swap
             obj = swapbytes(obj);
         end
 
@@ -93,7 +106,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_U16
         obj = typecast(bytes(2:3), 'uint16');
-        if ENDIANNESS == 'L'
+        if swap
             obj = swapbytes(obj);
         end
 
@@ -101,7 +114,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_U32
         obj = typecast(bytes(2:5), 'uint32');
-        if ENDIANNESS == 'L'
+        if swap
             obj = swapbytes(obj);
         end
 
@@ -109,7 +122,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_U64
         obj = typecast(bytes(2:9), 'uint64');
-        if ENDIANNESS == 'L'
+        if swap
             obj = swapbytes(obj);
         end
 
@@ -117,7 +130,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_SINGLE
         obj = typecast(bytes(2:5), 'single');
-        if ENDIANNESS == 'L'
+        if swap
             obj = swapbytes(obj);
         end
 
@@ -125,7 +138,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_DOUBLE
         obj = typecast(bytes(2:9), 'double');
-        if ENDIANNESS == 'L'
+        if swap
             obj = swapbytes(obj);
         end
 
@@ -134,7 +147,7 @@ function [obj, nread] = loads(bytes)
     case TYPE_COMPLEX_SINGLE
         realimag = typecast(bytes(2:9), 'single');
 
-        if ENDIANNESS == 'L'
+        if swap
             realimag = swapbytes(realimag);
         end
 
@@ -144,7 +157,7 @@ function [obj, nread] = loads(bytes)
     case TYPE_COMPLEX_DOUBLE
         realimag = typecast(bytes(2:17), 'double');
 
-        if ENDIANNESS == 'L'
+        if swap
             realimag = swapbytes(realimag);
         end
 
@@ -152,49 +165,50 @@ function [obj, nread] = loads(bytes)
         nread = 17;
 
     case TYPE_MAT_I8
-        [obj, nread] = loads_mat(bytes, 'int8', 1);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'int8', 1);
 
     case TYPE_MAT_I16
-        [obj, nread] = loads_mat(bytes, 'int16', 2);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'int16', 2);
 
     case TYPE_MAT_I32
-        [obj, nread] = loads_mat(bytes, 'int32', 4);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'int32', 4);
 
     case TYPE_MAT_I64
-        [obj, nread] = loads_mat(bytes, 'int64', 8);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'int64', 8);
 
     case TYPE_MAT_U8
-        [obj, nread] = loads_mat(bytes, 'uint8', 1);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'uint8', 1);
 
     case TYPE_MAT_U16
-        [obj, nread] = loads_mat(bytes, 'uint16', 2);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'uint16', 2);
 
     case TYPE_MAT_U32
-        [obj, nread] = loads_mat(bytes, 'uint32', 4);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'uint32', 4);
 
     case TYPE_MAT_U64
-        [obj, nread] = loads_mat(bytes, 'uint64', 8);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'uint64', 8);
 
     case TYPE_MAT_SINGLE
-        [obj, nread] = loads_mat(bytes, 'single', 4);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'single', 4);
 
     case TYPE_MAT_DOUBLE
-        [obj, nread] = loads_mat(bytes, 'double', 8);
+        [obj, nread] = loads_mat(bytes, pos, swap, aligned, 'double', 8);
 
     case TYPE_MAT_COMPLEX_SINGLE
         rank = bytes(2);
         shape = typecast(bytes(3:(4 * rank + 2)), 'uint32');
 
-        if ENDIANNESS == 'L'
+        if swap
             shape = swapbytes(shape);
         end
 
-        nread = 4 * rank + 2 + prod(shape) * 8;
-        realimag = typecast(bytes((4 * rank + 3):nread), 'single');
+        offset = data_offset(pos, rank, aligned);
+        nread = offset + prod(shape) * 8;
+        realimag = typecast(bytes((offset + 1):nread), 'single');
         realpart = realimag(1:2:length(realimag));
         imagpart = realimag(2:2:length(realimag));
 
-        if ENDIANNESS == 'L'
+        if swap
             realpart = swapbytes(realpart);
             imagpart = swapbytes(imagpart);
         end
@@ -205,16 +219,17 @@ function [obj, nread] = loads(bytes)
         rank = bytes(2);
         shape = typecast(bytes(3:(4 * rank + 2)), 'uint32');
 
-        if ENDIANNESS == 'L'
+        if swap
             shape = swapbytes(shape);
         end
 
-        nread = 4 * rank + 2 + prod(shape) * 16;
-        realimag = typecast(bytes((4 * rank + 3):nread), 'double');
+        offset = data_offset(pos, rank, aligned);
+        nread = offset + prod(shape) * 16;
+        realimag = typecast(bytes((offset + 1):nread), 'double');
         real = realimag(1:2:length(realimag));
         imag = realimag(2:2:length(realimag));
 
-        if ENDIANNESS == 'L'
+        if swap
             real = swapbytes(real);
             imag = swapbytes(imag);
         end
@@ -223,7 +238,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_STRING
         siz = typecast(bytes(2:5), 'uint32');
-        if ENDIANNESS == 'L'
+        if swap
             siz = swapbytes(siz);
         end
 
@@ -232,7 +247,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_ARRAY
         siz = typecast(bytes(2:5), 'uint32');
-        if ENDIANNESS == 'L'
+        if swap
             siz = swapbytes(siz);
         end
 
@@ -240,7 +255,7 @@ function [obj, nread] = loads(bytes)
         nread = 5;
 
         for i = 1:siz
-            [elem, elem_siz] = loads(bytes((nread + 1):length(bytes)));
+            [elem, elem_siz] = loads(bytes((nread + 1):length(bytes)), pos + nread, swap, aligned);
 
             obj{i} = elem;
             nread = nread + elem_siz;
@@ -248,7 +263,7 @@ function [obj, nread] = loads(bytes)
 
     case TYPE_ASSOCARRAY
         siz = typecast(bytes(2:5), 'uint32');
-        if ENDIANNESS == 'L'
+        if swap
             siz = swapbytes(siz);
         end
 
@@ -256,10 +271,10 @@ function [obj, nread] = loads(bytes)
         nread = 5;
 
         for i = 1:siz
-            [key, key_siz] = loads(bytes((nread + 1):length(bytes)));
+            [key, key_siz] = loads(bytes((nread + 1):length(bytes)), pos + nread, swap, aligned);
             nread = nread + key_siz;
 
-            [val, val_siz] = loads(bytes((nread + 1):length(bytes)));
+            [val, val_siz] = loads(bytes((nread + 1):length(bytes)), pos + nread, swap, aligned);
             nread = nread + val_siz;
 
             if isa(obj, 'struct')
@@ -283,13 +298,11 @@ function [obj, nread] = loads(bytes)
     nread = double(nread);
 end
 
-function [obj, nread] = loads_mat(bytes, dtype, itemsize)
-    [~, ~, ENDIANNESS] = computer;
-
+function [obj, nread] = loads_mat(bytes, pos, swap, aligned, dtype, itemsize)
     rank = bytes(2);
     shape = typecast(bytes(3:(4 * rank + 2)), 'uint32');
 
-    if ENDIANNESS == 'L'
+    if swap
         shape = swapbytes(shape);
     end
 
@@ -297,12 +310,22 @@ function [obj, nread] = loads_mat(bytes, dtype, itemsize)
         shape = [shape, 1];
     end
 
-    nread = 4 * rank + 2 + prod(shape) * itemsize;
-    obj = typecast(bytes((4 * rank + 3):nread), dtype);
+    offset = data_offset(pos, rank, aligned);
+    nread = offset + prod(shape) * itemsize;
+    obj = typecast(bytes((offset + 1):nread), dtype);
 
-    if ENDIANNESS == 'L'
+    if swap
         obj = swapbytes(obj);
     end
 
     obj = reshape(obj, shape);
 end
+
+% Offset of matrix data from the start of a matrix's type code
+function [offset] = data_offset(pos, rank, aligned)
+    offset = 4 * double(rank) + 2;
+
+    if aligned
+        offset = offset + mod(-(pos + offset), 64);
+    end
+end
@@ -0,0 +1,281 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mex.h"
+
+#include "dimeb_mex.h"
+
+typedef struct {
+    const unsigned char *buf;
+    size_t len;
+    size_t pos;
+    int swap;
+    int aligned;
+} reader_t;
+
+static const unsigned char *take(reader_t *r, size_t n) {
+    const unsigned char *p;
+
+    if (r->len - r->pos < n) {
+        mexErrMsgTxt("Truncated dimeb data");
+    }
+
+    p = r->buf + r->pos;
+    r->pos += n;
+
+    return p;
+}
+
+static uint32_t take_u32(reader_t *r) {
+    uint32_t x;
+
+    dimeb_copy(&x, take(r, 4), 1, 4, r->swap);
+
+    return x;
+}
+
+static mxArray *loads(reader_t *r);
+
+static mxArray *loads_mat(reader_t *r, int type) {
+    mwSize dims[256];
+    mwSize ndims = *take(r, 1);
+    size_t itemsize = dimeb_itemsizes[type];
+    size_t n = 1, i;
+    int complex = (type == DIMEB_COMPLEX_SINGLE || type == DIMEB_COMPLEX_DOUBLE);
+    const unsigned char *p;
+    mxArray *x;
+
+    for (i = 0; i < ndims; i++) {
+        dims[i] = take_u32(r);
+
+        if (dims[i] > 0 && n > SIZE_MAX / dims[i]) {
+            mexErrMsgTxt("Truncated dimeb data");
+        }
+
+        n *= dims[i];
+    }
+
+    /* Matlab arrays have at least two dimensions */
+    for (; ndims < 2; ndims++) {
+        dims[ndims] = 1;
+    }
+
+    if (r->aligned) {
+        take(r, (DIMEB_ALIGN - r->pos % DIMEB_ALIGN) % DIMEB_ALIGN);
+    }
+
+    if (complex) {
+        itemsize *= 2;
+    }
+
+    if (n > (r->len - r->pos) / itemsize) {
+        mexErrMsgTxt("Truncated dimeb data");
+    }
+
+    x = mxCreateNumericArray(ndims, dims, dimeb_classes[type], complex ? mxCOMPLEX : mxREAL);
+    p = take(r, n * itemsize);
+
+    if (complex) {
+        dimeb_deinterleave(mxGetData(x), mxGetImagData(x), p, n, itemsize / 2, r->swap);
+    } else {
+        dimeb_copy(mxGetData(x), p, n, itemsize, r->swap);
+    }
+
+    return x;
+}
+
+/* Valid struct field names are valid variable names */
+static int is_field_name(const mxArray *key) {
+    const mxChar *c;
+    size_t n, i;
+
+    if (!mxIsChar(key)) {
+        return 0;
+    }
+
+    c = mxGetChars(key);
+    n = mxGetNumberOfElements(key);
+
+    if (n == 0 || n > 63 || c[0] > 127 || !isalpha(c[0])) {
+        return 0;
+    }
+
+    for (i = 1; i < n; i++) {
+        if (c[i] > 127 || !(isalnum(c[i]) || c[i] == '_')) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static mxArray *loads_assocarray(reader_t *r) {
+    uint32_t n = take_u32(r), i;
+    mxArray *keys = mxCreateCellMatrix(1, n);
+    mxArray *vals = mxCreateCellMatrix(1, n);
+    mxArray *x;
+    int isstruct = 1;
+
+    for (i = 0; i < n; i++) {
+        mxSetCell(keys, i, loads(r));
+        mxSetCell(vals, i, loads(r));
+
+        isstruct = isstruct && is_field_name(mxGetCell(keys, i));
+    }
+
+    if (isstruct) {
+        x = mxCreateStructMatrix(1, 1, 0, NULL);
+
+        for (i = 0; i < n; i++) {
+            char *name = mxArrayToString(mxGetCell(keys, i));
+            int field = mxGetFieldNumber(x, name);
+
+            if (field < 0) {
+                field = mxAddField(x, name);
+            } else {
+                mxDestroyArray(mxGetFieldByNumber(x, 0, field));
+            }
+
+            /* Move the value out of the cell array */
+            mxSetFieldByNumber(x, 0, field, mxGetCell(vals, i));
+            mxSetCell(vals, i, NULL);
+
+            mxFree(name);
+        }
+    } else {
+        /* Keys that aren't valid field names need a containers.Map */
+        mxArray *args[4];
+
+        args[0] = keys;
+        args[1] = vals;
+        args[2] = mxCreateString("UniformValues");
+        args[3] = mxCreateLogicalScalar(0);
+
+        mexCallMATLAB(1, &x, 4, args, "containers.Map");
+
+        mxDestroyArray(args[2]);
+        mxDestroyArray(args[3]);
+    }
+
+    mxDestroyArray(keys);
+    mxDestroyArray(vals);
+
+    return x;
+}
+
+static mxArray *loads(reader_t *r) {
+    int type = *take(r, 1);
+    const unsigned char *p;
+    mxArray *x;
+    uint32_t n, i;
+
+    switch (type) {
+    case DIMEB_NULL:
+        return mxCreateDoubleMatrix(0, 0, mxREAL);
+
+    case DIMEB_TRUE:
+        return mxCreateLogicalScalar(1);
+
+    case DIMEB_FALSE:
+        return mxCreateLogicalScalar(0);
+
+    case DIMEB_I8:
+    case DIMEB_I16:
+    case DIMEB_I32:
+    case DIMEB_I64:
+    case DIMEB_U8:
+    case DIMEB_U16:
+    case DIMEB_U32:
+    case DIMEB_U64:
+    case DIMEB_SINGLE:
+    case DIMEB_DOUBLE:
+        x = mxCreateNumericMatrix(1, 1, dimeb_classes[type], mxREAL);
+        dimeb_copy(mxGetData(x), take(r, dimeb_itemsizes[type]), 1, dimeb_itemsizes[type], r->swap);
+
+        return x;
+
+    case DIMEB_COMPLEX_SINGLE:
+    case DIMEB_COMPLEX_DOUBLE:
+        x = mxCreateNumericMatrix(1, 1, dimeb_classes[type], mxCOMPLEX);
+        p = take(r, 2 * dimeb_itemsizes[type]);
+        dimeb_deinterleave(mxGetData(x), mxGetImagData(x), p, 1, dimeb_itemsizes[type], r->swap);
+
+        return x;
+
+    case DIMEB_STRING:
+        {
+            mwSize dims[2];
+            mxChar *c;
+
+            n = take_u32(r);
+            p = take(r, n);
+
+            dims[0] = 1;
+            dims[1] = n;
+
+            x = mxCreateCharArray(2, dims);
+            c = mxGetChars(x);
+
+            for (i = 0; i < n; i++) {
+                c[i] = p[i];
+            }
+        }
+
+        return x;
+
+    case DIMEB_ARRAY:
+        n = take_u32(r);
+        x = mxCreateCellMatrix(n > 0, n);
+
+        for (i = 0; i < n; i++) {
+            mxSetCell(x, i, loads(r));
+        }
+
+        return x;
+
+    case DIMEB_ASSOCARRAY:
+        return loads_assocarray(r);
+
+    default:
+        if ((type & DIMEB_MAT) && (type & ~DIMEB_MAT) >= DIMEB_I8 && (type & ~DIMEB_MAT) <= DIMEB_COMPLEX_DOUBLE) {
+            return loads_mat(r, type & ~DIMEB_MAT);
+        }
+
+        mexErrMsgTxt("Invalid dimeb type");
+        return NULL;
+    }
+}
+
+void mexFunction(int nlhs, mxArray **plhs, int nrhs, const mxArray **prhs) {
+    reader_t r;
+
+    if (nrhs != 1) {
+        mexErrMsgTxt("Wrong number of arguments");
+    }
+
+    if (mxGetClassID(prhs[0]) != mxUINT8_CLASS || mxIsComplex(prhs[0])) {
+        mexErrMsgTxt("Invalid argument");
+    }
+
+    r.buf = mxGetData(prhs[0]);
+    r.len = mxGetNumberOfElements(prhs[0]);
+    r.pos = 0;
+
+    /* dimeb v2 begins with 0xFF, which is never a valid v1 type code */
+    if (r.len > 0 && r.buf[0] == 0xFF) {
+        if (r.len < DIMEB_V2_HDRLEN || memcmp(r.buf + 1, "DB\x02", 3) != 0 ||
+            (r.buf[4] != 'L' && r.buf[4] != 'B')) {
+            mexErrMsgTxt("Unsupported dimeb version");
+        }
+
+        r.swap = ((r.buf[4] == 'L') != dimeb_little());
+        r.aligned = 1;
+        r.pos = DIMEB_V2_HDRLEN;
+    } else {
+        r.swap = dimeb_little();
+        r.aligned = 0;
+    }
+
+    plhs[0] = loads(&r);
+}
@@ -0,0 +1,957 @@
+/*
+ * Compiled implementation of the dimeb codec. Produces and accepts the
+ * same wire format as dimeb.py (v1 and v2), which is used instead
+ * whenever this extension has not been built.
+ *
+ * NumPy is only used through its Python interface, so no NumPy headers
+ * are required at build time.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+enum dimeb_type {
+    TYPE_NULL = 0x00,
+    TYPE_TRUE = 0x01,
+    TYPE_FALSE = 0x02,
+
+    TYPE_I8 = 0x03,
+    TYPE_I16 = 0x04,
+    TYPE_I32 = 0x05,
+    TYPE_I64 = 0x06,
+    TYPE_U8 = 0x07,
+    TYPE_U16 = 0x08,
+    TYPE_U32 = 0x09,
+    TYPE_U64 = 0x0A,
+
+    TYPE_SINGLE = 0x0B,
+    TYPE_DOUBLE = 0x0C,
+    TYPE_COMPLEX_SINGLE = 0x0D,
+    TYPE_COMPLEX_DOUBLE = 0x0E,
+
+    TYPE_MAT = 0x10,
+
+    TYPE_STRING = 0x20,
+    TYPE_ARRAY = 0x21,
+    TYPE_ASSOCARRAY = 0x22,
+
+    TYPE_V2 = 0xFF
+};
+
+/* dimeb v2 prologue length, and alignment of matrix data */
+#define V2_HDRLEN 8
+#define ALIGN 64
+
+/* Matrix element types, indexed by the low nibble of the type code */
+static const struct {
+    char kind;
+    Py_ssize_t itemsize;
+    const char *dtype;
+} mattypes[16] = {
+    [TYPE_I8] = {'i', 1, "i1"},
+    [TYPE_I16] = {'i', 2, "i2"},
+    [TYPE_I32] = {'i', 4, "i4"},
+    [TYPE_I64] = {'i', 8, "i8"},
+    [TYPE_U8] = {'u', 1, "u1"},
+    [TYPE_U16] = {'u', 2, "u2"},
+    [TYPE_U32] = {'u', 4, "u4"},
+    [TYPE_U64] = {'u', 8, "u8"},
+    [TYPE_SINGLE] = {'f', 4, "f4"},
+    [TYPE_DOUBLE] = {'f', 8, "f8"},
+    [TYPE_COMPLEX_SINGLE] = {'c', 8, "c8"},
+    [TYPE_COMPLEX_DOUBLE] = {'c', 16, "c16"}
+};
+
+static PyObject *np_frombuffer;  /* numpy.frombuffer */
+static PyObject *np_asarray;     /* numpy.asarray */
+static PyObject *np_ndarray;     /* numpy.ndarray */
+static PyObject *dtype_native[16]; /* Native-endian dtypes, by type code */
+static PyObject *dtype_little[16]; /* Little-endian dtypes, by type code */
+static PyObject *dtype_big[16];    /* Big-endian dtypes, by type code */
+static PyObject *kw_order_f;     /* {"order": "F"} */
+static PyObject *abc_sequence;   /* collections.abc.Sequence */
+static PyObject *abc_mapping;    /* collections.abc.Mapping */
+
+static int little_endian;
+
+/*
+ * Variant of dimeb being encoded or decoded. Alignment is relative to
+ * "base", the start of the payload.
+ */
+typedef struct {
+    int little;
+    int v2;
+    const unsigned char *base;
+} codec_t;
+
+static void store(const codec_t *c, unsigned char *p, uint64_t x, int n) {
+    for (int i = 0; i < n; i++) {
+        p[c->little ? i : n - 1 - i] = x;
+        x >>= 8;
+    }
+}
+
+static uint64_t load(const codec_t *c, const unsigned char *p, int n) {
+    uint64_t x = 0;
+
+    for (int i = 0; i < n; i++) {
+        x = (x << 8) | p[c->little ? n - 1 - i : i];
+    }
+
+    return x;
+}
+
+/* Offset of matrix data that would otherwise start at "off" */
+static Py_ssize_t align(const codec_t *c, Py_ssize_t off) {
+    return c->v2 ? off + (ALIGN - off % ALIGN) % ALIGN : off;
+}
+
+/* Map an ndarray's dtype to a dimeb matrix type code, or -1 with an exception set */
+static int ndarray_type(PyObject *x) {
+    PyObject *dtype = PyObject_GetAttrString(x, "dtype");
+    if (dtype == NULL) {
+        return -1;
+    }
+
+    PyObject *kind = PyObject_GetAttrString(dtype, "kind");
+    PyObject *itemsize = PyObject_GetAttrString(dtype, "itemsize");
+    Py_DECREF(dtype);
+
+    if (kind == NULL || itemsize == NULL) {
+        Py_XDECREF(kind);
+        Py_XDECREF(itemsize);
+        return -1;
+    }
+
+    const char *k = PyUnicode_AsUTF8(kind);
+    Py_ssize_t n = PyLong_AsSsize_t(itemsize);
+
+    int t = 0;
+
+    if (k != NULL) {
+        for (int i = TYPE_I8; i <= TYPE_COMPLEX_DOUBLE; i++) {
+            if (mattypes[i].kind == k[0] && mattypes[i].itemsize == n) {
+                t = i;
+                break;
+            }
+        }
+    }
+
+    Py_DECREF(kind);
+    Py_DECREF(itemsize);
+
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+
+    if (t == 0) {
+        PyErr_SetString(PyExc_TypeError, "Unsupported matrix dtype");
+        return -1;
+    }
+
+    return t;
+}
+
+static Py_ssize_t ssize_attr(PyObject *x, const char *name) {
+    PyObject *attr = PyObject_GetAttrString(x, name);
+    if (attr == NULL) {
+        return -1;
+    }
+
+    Py_ssize_t n = PyLong_AsSsize_t(attr);
+    Py_DECREF(attr);
+
+    return n;
+}
+
+/*
+ * Encoding is done in two passes: the first computes the exact size of
+ * the output, and the second writes directly into a bytes object of
+ * that size. Since v2 pads matrix data, the first pass tracks the
+ * position at which each value would be written, and returns the
+ * position just past it.
+ */
+static Py_ssize_t dumps_size(const codec_t *c, PyObject *x, Py_ssize_t pos);
+static unsigned char *dumps_write(const codec_t *c, PyObject *x, unsigned char *p, unsigned char *end);
+
+static Py_ssize_t dumps_size_items(const codec_t *c, PyObject *seq, int pairs, Py_ssize_t pos) {
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+
+    pos += 5;
+
+    for (Py_ssize_t i = 0; i < n && pos >= 0; i++) {
+        if (pairs) {
+            pos = dumps_size(c, PyTuple_GET_ITEM(items[i], 0), pos);
+
+            if (pos >= 0) {
+                pos = dumps_size(c, PyTuple_GET_ITEM(items[i], 1), pos);
+            }
+        } else {
+            pos = dumps_size(c, items[i], pos);
+        }
+    }
+
+    return pos;
+}
+
+static PyObject *mapping_items(PyObject *x) {
+    PyObject *items = PyMapping_Items(x);
+    if (items == NULL) {
+        return NULL;
+    }
+
+    PyObject *seq = PySequence_Fast(items, "items() must be iterable");
+    Py_DECREF(items);
+
+    return seq;
+}
+
+static Py_ssize_t dumps_size(const codec_t *c, PyObject *x, Py_ssize_t pos) {
+    if (x == Py_None || x == Py_True || x == Py_False) {
+        return pos + 1;
+    } else if (PyLong_Check(x)) {
+        return pos + 9;
+    } else if (PyFloat_Check(x)) {
+        return pos + 9;
+    } else if (PyComplex_Check(x)) {
+        return pos + 17;
+    } else if (PyObject_TypeCheck(x, (PyTypeObject *)np_ndarray)) {
+        int t = ndarray_type(x);
+        Py_ssize_t ndim = ssize_attr(x, "ndim");
+        Py_ssize_t size = ssize_attr(x, "size");
+
+        if (t < 0 || ndim < 0 || size < 0) {
+            return -1;
+        }
+
+        if (ndim > 255) {
+            PyErr_SetString(PyExc_ValueError, "Matrix rank is too large");
+            return -1;
+        }
+
+        return align(c, pos + 2 + 4 * ndim) + size * mattypes[t].itemsize;
+    } else if (PyUnicode_Check(x)) {
+        Py_ssize_t n;
+
+        if (PyUnicode_AsUTF8AndSize(x, &n) == NULL) {
+            return -1;
+        }
+
+        return pos + 5 + n;
+    } else if (PyList_Check(x) || PyTuple_Check(x) || PyObject_IsInstance(x, abc_sequence) == 1) {
+        if (Py_EnterRecursiveCall(" while encoding dimeb")) {
+            return -1;
+        }
+
+        PyObject *seq = PySequence_Fast(x, "expected a sequence");
+        Py_ssize_t siz = (seq != NULL) ? dumps_size_items(c, seq, 0, pos) : -1;
+
+        Py_XDECREF(seq);
+        Py_LeaveRecursiveCall();
+
+        return siz;
+    } else if (PyDict_Check(x) || PyObject_IsInstance(x, abc_mapping) == 1) {
+        if (Py_EnterRecursiveCall(" while encoding dimeb")) {
+            return -1;
+        }
+
+        PyObject *seq = mapping_items(x);
+        Py_ssize_t siz = (seq != NULL) ? dumps_size_items(c, seq, 1, pos) : -1;
+
+        Py_XDECREF(seq);
+        Py_LeaveRecursiveCall();
+
+        return siz;
+    }
+
+    if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_TypeError, "Cannot serialize object as dimeb");
+    }
+
+    return -1;
+}
+
+static unsigned char *overflow(void) {
+    PyErr_SetString(PyExc_RuntimeError, "Object changed size during serialization");
+    return NULL;
+}
+
+static unsigned char *dumps_write_matrix(const codec_t *c, PyObject *x, unsigned char *p, unsigned char *end) {
+    int t = ndarray_type(x);
+    if (t < 0) {
+        return NULL;
+    }
+
+    PyObject *shape = PyObject_GetAttrString(x, "shape");
+    if (shape == NULL) {
+        return NULL;
+    }
+
+    Py_ssize_t rank = PyTuple_Size(shape);
+
+    if (rank < 0 || end - p < 2 + 4 * rank) {
+        Py_DECREF(shape);
+        return rank < 0 ? NULL : overflow();
+    }
+
+    *p++ = TYPE_MAT | t;
+    *p++ = rank;
+
+    for (Py_ssize_t i = 0; i < rank; i++) {
+        size_t dim = PyLong_AsSize_t(PyTuple_GET_ITEM(shape, i));
+
+        if (dim == (size_t)-1 && PyErr_Occurred()) {
+            Py_DECREF(shape);
+            return NULL;
+        }
+
+        store(c, p, dim, 4);
+        p += 4;
+    }
+
+    Py_DECREF(shape);
+
+    unsigned char *data = (unsigned char *)c->base + align(c, p - c->base);
+
+    if (data > end) {
+        return overflow();
+    }
+
+    memset(p, 0, data - p);
+    p = data;
+
+    /* A single conversion to Fortran-ordered memory of the right byte order */
+    PyObject *args = PyTuple_Pack(2, x, c->little ? dtype_little[t] : dtype_big[t]);
+    if (args == NULL) {
+        return NULL;
+    }
+
+    PyObject *arr = PyObject_Call(np_asarray, args, kw_order_f);
+    Py_DECREF(args);
+
+    if (arr == NULL) {
+        return NULL;
+    }
+
+    Py_buffer view;
+
+    if (PyObject_GetBuffer(arr, &view, PyBUF_F_CONTIGUOUS) < 0) {
+        Py_DECREF(arr);
+        return NULL;
+    }
+
+    if (end - p < view.len) {
+        PyBuffer_Release(&view);
+        Py_DECREF(arr);
+        return overflow();
+    }
+
+    memcpy(p, view.buf, view.len);
+    p += view.len;
+
+    PyBuffer_Release(&view);
+    Py_DECREF(arr);
+
+    return p;
+}
+
+static unsigned char *dumps_write_items(const codec_t *c, PyObject *seq, int t, unsigned char *p, unsigned char *end) {
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+
+    if (end - p < 5) {
+        return overflow();
+    }
+
+    *p++ = t;
+    store(c, p, n, 4);
+    p += 4;
+
+    for (Py_ssize_t i = 0; i < n && p != NULL; i++) {
+        if (t == TYPE_ASSOCARRAY) {
+            p = dumps_write(c, PyTuple_GET_ITEM(items[i], 0), p, end);
+
+            if (p != NULL) {
+                p = dumps_write(c, PyTuple_GET_ITEM(items[i], 1), p, end);
+            }
+        } else {
+            p = dumps_write(c, items[i], p, end);
+        }
+    }
+
+    return p;
+}
+
+static unsigned char *dumps_write(const codec_t *c, PyObject *x, unsigned char *p, unsigned char *end) {
+    if (x == Py_None || x == Py_True || x == Py_False) {
+        if (end - p < 1) {
+            return overflow();
+        }
+
+        *p++ = (x == Py_None) ? TYPE_NULL : (x == Py_True) ? TYPE_TRUE : TYPE_FALSE;
+
+        return p;
+    } else if (PyLong_Check(x)) {
+        long long v = PyLong_AsLongLong(x);
+
+        if (v == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+
+        if (end - p < 9) {
+            return overflow();
+        }
+
+        *p++ = TYPE_I64;
+        store(c, p, (uint64_t)v, 8);
+
+        return p + 8;
+    } else if (PyFloat_Check(x)) {
+        double d = PyFloat_AS_DOUBLE(x);
+        uint64_t u;
+
+        if (end - p < 9) {
+            return overflow();
+        }
+
+        memcpy(&u, &d, sizeof(u));
+
+        *p++ = TYPE_DOUBLE;
+        store(c, p, u, 8);
+
+        return p + 8;
+    } else if (PyComplex_Check(x)) {
+        double d[2] = {PyComplex_RealAsDouble(x), PyComplex_ImagAsDouble(x)};
+        uint64_t u[2];
+
+        if (end - p < 17) {
+            return overflow();
+        }
+
+        memcpy(u, d, sizeof(u));
+
+        *p++ = TYPE_COMPLEX_DOUBLE;
+        store(c, p, u[0], 8);
+        store(c, p + 8, u[1], 8);
+
+        return p + 16;
+    } else if (PyObject_TypeCheck(x, (PyTypeObject *)np_ndarray)) {
+        return dumps_write_matrix(c, x, p, end);
+    } else if (PyUnicode_Check(x)) {
+        Py_ssize_t n;
+        const char *s = PyUnicode_AsUTF8AndSize(x, &n);
+
+        if (s == NULL) {
+            return NULL;
+        }
+
+        if (end - p < 5 + n) {
+            return overflow();
+        }
+
+        *p++ = TYPE_STRING;
+        store(c, p, n, 4);
+        memcpy(p + 4, s, n);
+
+        return p + 4 + n;
+    } else if (PyList_Check(x) || PyTuple_Check(x) || PyObject_IsInstance(x, abc_sequence) == 1) {
+        if (Py_EnterRecursiveCall(" while encoding dimeb")) {
+            return NULL;
+        }
+
+        PyObject *seq = PySequence_Fast(x, "expected a sequence");
+
+        if (seq != NULL) {
+            p = dumps_write_items(c, seq, TYPE_ARRAY, p, end);
+            Py_DECREF(seq);
+        } else {
+            p = NULL;
+        }
+
+        Py_LeaveRecursiveCall();
+
+        return p;
+    } else if (PyDict_Check(x) || PyObject_IsInstance(x, abc_mapping) == 1) {
+        if (Py_EnterRecursiveCall(" while encoding dimeb")) {
+            return NULL;
+        }
+
+        PyObject *seq = mapping_items(x);
+
+        if (seq != NULL) {
+            p = dumps_write_items(c, seq, TYPE_ASSOCARRAY, p, end);
+            Py_DECREF(seq);
+        } else {
+            p = NULL;
+        }
+
+        Py_LeaveRecursiveCall();
+
+        return p;
+    }
+
+    if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_TypeError, "Cannot serialize object as dimeb");
+    }
+
+    return NULL;
+}
+
+static PyObject *dimeb_dumps(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"x", "version", NULL};
+
+    PyObject *x;
+    int version = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", kwlist, &x, &version)) {
+        return NULL;
+    }
+
+    /* v2 is written in the native byte order */
+    codec_t c = {(version >= 2) ? little_endian : 0, version >= 2, NULL};
+    Py_ssize_t hdrlen = c.v2 ? V2_HDRLEN : 0;
+
+    Py_ssize_t siz = dumps_size(&c, x, hdrlen);
+    if (siz < 0) {
+        return NULL;
+    }
+
+    PyObject *ret = PyBytes_FromStringAndSize(NULL, siz);
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    unsigned char *p = (unsigned char *)PyBytes_AS_STRING(ret);
+    unsigned char *end = p + siz;
+
+    c.base = p;
+
+    if (c.v2) {
+        static const unsigned char hdr[V2_HDRLEN] = {TYPE_V2, 'D', 'B', 0x02};
+
+        memcpy(p, hdr, V2_HDRLEN);
+        p[4] = c.little ? 'L' : 'B';
+        p += V2_HDRLEN;
+    }
+
+    p = dumps_write(&c, x, p, end);
+
+    if (p == NULL) {
+        Py_DECREF(ret);
+        return NULL;
+    }
+
+    if (p != end) {
+        Py_DECREF(ret);
+        return (PyObject *)overflow();
+    }
+
+    return ret;
+}
+
+static PyObject *truncated(void) {
+    PyErr_SetString(PyExc_ValueError, "Truncated dimeb data");
+    return NULL;
+}
+
+static PyObject *loads_at(const codec_t *c, PyObject *obj, const unsigned char *s, Py_ssize_t len, Py_ssize_t *pos);
+
+static PyObject *loads_matrix(const codec_t *c, PyObject *obj, const unsigned char *s, Py_ssize_t len, Py_ssize_t *pos) {
+    int t = s[*pos] & 0x0F;
+
+    if (mattypes[t].itemsize == 0) {
+        PyErr_SetString(PyExc_ValueError, "Invalid dimeb matrix type");
+        return NULL;
+    }
+
+    if (len - *pos < 2) {
+        return truncated();
+    }
+
+    int rank = s[*pos + 1];
+    Py_ssize_t off = *pos + 2 + 4 * (Py_ssize_t)rank;
+
+    if (len < off || len < align(c, off)) {
+        return truncated();
+    }
+
+    Py_ssize_t count = 1;
+    Py_ssize_t dims[255];
+
+    for (int i = 0; i < rank; i++) {
+        dims[i] = load(c, s + *pos + 2 + 4 * i, 4);
+
+        if (dims[i] != 0 && count > (len - off) / dims[i]) {
+            return truncated();
+        }
+
+        count *= dims[i];
+    }
+
+    off = align(c, off);
+
+    if (count > (len - off) / mattypes[t].itemsize) {
+        return truncated();
+    }
+
+    /* Row and column vectors are returned as 1-D arrays, as in dimeb.py */
+    if (rank == 2 && dims[0] == 1) {
+        dims[0] = dims[1];
+        rank = 1;
+    } else if (rank == 2 && dims[1] == 1) {
+        rank = 1;
+    }
+
+    PyObject *shape = PyTuple_New(rank);
+    if (shape == NULL) {
+        return NULL;
+    }
+
+    for (int i = 0; i < rank; i++) {
+        PyObject *dim = PyLong_FromSsize_t(dims[i]);
+        if (dim == NULL) {
+            Py_DECREF(shape);
+            return NULL;
+        }
+
+        PyTuple_SET_ITEM(shape, i, dim);
+    }
+
+    PyObject *arr = PyObject_CallFunction(np_frombuffer, "OOnn", obj, dtype_native[t], count, off);
+    if (arr == NULL) {
+        Py_DECREF(shape);
+        return NULL;
+    }
+
+    PyObject *reshape = PyObject_GetAttrString(arr, "reshape");
+    Py_DECREF(arr);
+
+    if (reshape == NULL) {
+        Py_DECREF(shape);
+        return NULL;
+    }
+
+    PyObject *args = PyTuple_Pack(1, shape);
+    Py_DECREF(shape);
+
+    if (args == NULL) {
+        Py_DECREF(reshape);
+        return NULL;
+    }
+
+    arr = PyObject_Call(reshape, args, kw_order_f);
+    Py_DECREF(args);
+    Py_DECREF(reshape);
+
+    if (arr == NULL) {
+        return NULL;
+    }
+
+    /*
+     * The array is a view over obj unless the data is in the other byte
+     * order, in which case one vectorized pass converts it
+     */
+    if (c->little != little_endian) {
+        PyObject *swapped = PyObject_CallMethod(arr, "byteswap", NULL);
+        Py_DECREF(arr);
+
+        arr = swapped;
+    }
+
+    *pos = off + count * mattypes[t].itemsize;
+
+    return arr;
+}
+
+static PyObject *loads_at(const codec_t *c, PyObject *obj, const unsigned char *s, Py_ssize_t len, Py_ssize_t *pos) {
+    if (len - *pos < 1) {
+        return truncated();
+    }
+
+    unsigned int t = s[*pos];
+    const unsigned char *p = s + *pos + 1;
+    Py_ssize_t avail = len - *pos - 1;
+
+    if ((t & 0xF0) == TYPE_MAT) {
+        return loads_matrix(c, obj, s, len, pos);
+    }
+
+    switch (t) {
+    case TYPE_NULL:
+        *pos += 1;
+        Py_RETURN_NONE;
+
+    case TYPE_TRUE:
+        *pos += 1;
+        Py_RETURN_TRUE;
+
+    case TYPE_FALSE:
+        *pos += 1;
+        Py_RETURN_FALSE;
+
+    case TYPE_I8:
+    case TYPE_I16:
+    case TYPE_I32:
+    case TYPE_I64:
+        {
+            int n = mattypes[t].itemsize;
+
+            if (avail < n) {
+                return truncated();
+            }
+
+            uint64_t u = load(c, p, n);
+
+            if (n < 8 && (u >> (8 * n - 1)) != 0) {
+                u |= ~(uint64_t)0 << (8 * n);
+            }
+
+            *pos += 1 + n;
+            return PyLong_FromLongLong((long long)(int64_t)u);
+        }
+
+    case TYPE_U8:
+    case TYPE_U16:
+    case TYPE_U32:
+    case TYPE_U64:
+        {
+            int n = mattypes[t].itemsize;
+
+            if (avail < n) {
+                return truncated();
+            }
+
+            *pos += 1 + n;
+            return PyLong_FromUnsignedLongLong(load(c, p, n));
+        }
+
+    case TYPE_SINGLE:
+    case TYPE_COMPLEX_SINGLE:
+        {
+            int n = mattypes[t].itemsize;
+
+            if (avail < n) {
+                return truncated();
+            }
+
+            uint32_t u[2] = {load(c, p, 4), (t == TYPE_COMPLEX_SINGLE) ? load(c, p + 4, 4) : 0};
+            float f[2];
+
+            memcpy(f, u, sizeof(f));
+
+            *pos += 1 + n;
+
+            if (t == TYPE_SINGLE) {
+                return PyFloat_FromDouble(f[0]);
+            }
+
+            return PyComplex_FromDoubles(f[0], f[1]);
+        }
+
+    case TYPE_DOUBLE:
+    case TYPE_COMPLEX_DOUBLE:
+        {
+            int n = mattypes[t].itemsize;
+
+            if (avail < n) {
+                return truncated();
+            }
+
+            uint64_t u[2] = {load(c, p, 8), (t == TYPE_COMPLEX_DOUBLE) ? load(c, p + 8, 8) : 0};
+            double d[2];
+
+            memcpy(d, u, sizeof(d));
+
+            *pos += 1 + n;
+
+            if (t == TYPE_DOUBLE) {
+                return PyFloat_FromDouble(d[0]);
+            }
+
+            return PyComplex_FromDoubles(d[0], d[1]);
+        }
+
+    case TYPE_STRING:
+        {
+            if (avail < 4) {
+                return truncated();
+            }
+
+            Py_ssize_t n = load(c, p, 4);
+
+            if (avail - 4 < n) {
+                return truncated();
+            }
+
+            *pos += 5 + n;
+            return PyUnicode_DecodeUTF8((const char *)p + 4, n, NULL);
+        }
+
+    case TYPE_ARRAY:
+    case TYPE_ASSOCARRAY:
+        {
+            if (avail < 4) {
+                return truncated();
+            }
+
+            Py_ssize_t n = load(c, p, 4);
+
+            *pos += 5;
+
+            if (Py_EnterRecursiveCall(" while decoding dimeb")) {
+                return NULL;
+            }
+
+            PyObject *ret = (t == TYPE_ARRAY) ? PyList_New(0) : PyDict_New();
+
+            for (Py_ssize_t i = 0; i < n && ret != NULL; i++) {
+                PyObject *key = NULL;
+
+                if (t == TYPE_ASSOCARRAY) {
+                    key = loads_at(c, obj, s, len, pos);
+
+                    if (key == NULL) {
+                        Py_CLEAR(ret);
+                        break;
+                    }
+                }
+
+                PyObject *val = loads_at(c, obj, s, len, pos);
+                int err;
+
+                if (val == NULL) {
+                    err = -1;
+                } else if (t == TYPE_ARRAY) {
+                    err = PyList_Append(ret, val);
+                } else {
+                    err = PyDict_SetItem(ret, key, val);
+                }
+
+                Py_XDECREF(key);
+                Py_XDECREF(val);
+
+                if (err < 0) {
+                    Py_CLEAR(ret);
+                }
+            }
+
+            Py_LeaveRecursiveCall();
+
+            return ret;
+        }
+
+    default:
+        PyErr_Format(PyExc_ValueError, "Invalid dimeb type 0x%02X", t);
+        return NULL;
+    }
+}
+
+static PyObject *dimeb_loads(PyObject *self, PyObject *x) {
+    Py_buffer view;
+
+    if (PyObject_GetBuffer(x, &view, PyBUF_SIMPLE) < 0) {
+        return NULL;
+    }
+
+    const unsigned char *s = view.buf;
+    codec_t c = {0, 0, s};
+    Py_ssize_t pos = 0;
+
+    if (view.len > 0 && s[0] == TYPE_V2) {
+        if (view.len < V2_HDRLEN || memcmp(s + 1, "DB\x02", 3) != 0 || (s[4] != 'L' && s[4] != 'B')) {
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_ValueError, "Unsupported dimeb version");
+            return NULL;
+        }
+
+        c.little = (s[4] == 'L');
+        c.v2 = 1;
+        pos = V2_HDRLEN;
+    }
+
+    PyObject *ret = loads_at(&c, x, s, view.len, &pos);
+
+    PyBuffer_Release(&view);
+
+    return ret;
+}
+
+static PyMethodDef dimeb_methods[] = {
+    {"loads", dimeb_loads, METH_O, "Decode a dimeb-serialized object"},
+    {"dumps", (PyCFunction)(void (*)(void))dimeb_dumps, METH_VARARGS | METH_KEYWORDS, "Encode an object with dimeb serialization"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef dimeb_module = {
+    PyModuleDef_HEAD_INIT,
+    "_dimeb",
+    "Compiled dimeb codec",
+    -1,
+    dimeb_methods
+};
+
+PyMODINIT_FUNC PyInit__dimeb(void) {
+    uint16_t one = 1;
+
+    little_endian = (*(unsigned char *)&one == 1);
+
+    PyObject *np = PyImport_ImportModule("numpy");
+    if (np == NULL) {
+        return NULL;
+    }
+
+    np_frombuffer = PyObject_GetAttrString(np, "frombuffer");
+    np_asarray = PyObject_GetAttrString(np, "asarray");
+    np_ndarray = PyObject_GetAttrString(np, "ndarray");
+
+    PyObject *np_dtype = PyObject_GetAttrString(np, "dtype");
+    Py_DECREF(np);
+
+    if (np_frombuffer == NULL || np_asarray == NULL || np_ndarray == NULL || np_dtype == NULL) {
+        Py_XDECREF(np_dtype);
+        return NULL;
+    }
+
+    for (int i = TYPE_I8; i <= TYPE_COMPLEX_DOUBLE; i++) {
+        char little[8], big[8];
+
+        snprintf(little, sizeof(little), "<%s", mattypes[i].dtype);
+        snprintf(big, sizeof(big), ">%s", mattypes[i].dtype);
+
+        dtype_native[i] = PyObject_CallFunction(np_dtype, "s", mattypes[i].dtype);
+        dtype_little[i] = PyObject_CallFunction(np_dtype, "s", little);
+        dtype_big[i] = PyObject_CallFunction(np_dtype, "s", big);
+
+        if (dtype_native[i] == NULL || dtype_little[i] == NULL || dtype_big[i] == NULL) {
+            Py_DECREF(np_dtype);
+            return NULL;
+        }
+    }
+
+    Py_DECREF(np_dtype);
+
+    kw_order_f = Py_BuildValue("{ss}", "order", "F");
+    if (kw_order_f == NULL) {
+        return NULL;
+    }
+
+    PyObject *abc = PyImport_ImportModule("collections.abc");
+    if (abc == NULL) {
+        return NULL;
+    }
+
+    abc_sequence = PyObject_GetAttrString(abc, "Sequence");
+    abc_mapping = PyObject_GetAttrString(abc, "Mapping");
+    Py_DECREF(abc);
+
+    if (abc_sequence == NULL || abc_mapping == NULL) {
+        return NULL;
+    }
+
+    return PyModule_Create(&dimeb_module);
+}
@@ -1,17 +1,38 @@
 import base64
 import collections.abc
+import functools
 import itertools
 import json
 import pickle
 import re
 import socket
+import ssl
 import struct
+import sys
+import zlib
 
 from dime import dimeb
 from dime import json as dimejson
 
 __all__ = ["DimeClient"]
 
+# Compression codecs, by name: (codec number, compress, decompress)
+CODECS = {"zlib": (1, zlib.compress, zlib.decompress)}
+
+try:
+    import lz4.frame
+    CODECS["lz4"] = (2, lz4.frame.compress, lz4.frame.decompress)
+except ImportError:
+    pass
+
+try:
+    import zstandard
+    CODECS["zstd"] = (3, zstandard.ZstdCompressor().compress, zstandard.ZstdDecompressor().decompress)
+except ImportError:
+    pass
+
+CODEC_NAMES = {v[0]: k for k, v in CODECS.items()}
+
 ADDRESS_REGEX = re.compile(r"(?P<proto>[a-z]+)://(?P<hostname>([^:]|((?<=\\)(?:\\\\)*:))+)(:(?P<port>[0-9]+))?")
 
 class DimeClient(collections.abc.MutableMapping):
@@ -23,7 +44,7 @@ class DimeClient(collections.abc.MutableMapping):
     variables in the workspace.
     """
 
-    def __init__(self, proto = "ipc", *args):
+    def __init__(self, proto = "ipc", *args, compression = None, tls = None, udp = False, session = None, session_token = None):
         """Construct a dime instance
 
         Create a dime client via the specified protocol. The exact arguments
@@ -42,18 +63,69 @@ class DimeClient(collections.abc.MutableMapping):
 
         args : tuple
             Additional arguments, as described above.
+
+        compression : str or list of str, optional
+            Compression codec(s) to request from the server, in order of
+            preference ('zstd', 'lz4' or 'zlib'), or 'none'. By default, the
+            fastest available codec is requested over TCP, and no compression
+            is used over Unix domain sockets. Messages smaller than a
+            threshold chosen by the server are never compressed.
+
+        tls : bool or ssl.SSLContext, optional
+            Request TLS encryption after the handshake. If True, a default
+            SSLContext is used. Reopening the connection resumes the previous
+            TLS session where the server allows it.
+
+        udp : bool, optional
+            Receive small broadcasts as UDP datagrams, if the server offers
+            them (see the -u flag of the server) and TLS is not used.
+            Datagrams are unreliable; the number of datagrams known to be
+            lost is counted in the udp_lost attribute. When a variable
+            arrives both as a datagram and through the queue, the one the
+            server routed last is kept.
+
+        session : str, optional
+            Name of a session to open on the server. If the connection
+            drops, the server holds the client's queue and groups for a
+            while (see the -s flag of the server), and reopening the
+            connection resumes the session. Whether it was resumed is stored
+            in the session_resumed attribute, and how many messages the
+            server dropped meanwhile in session_lost.
+
+        session_token : str, optional
+            Token of the session to resume, e.g. the session_token attribute
+            of a client in a previous process. By default, a new session is
+            opened.
         """
 
         self.proto = proto
         self.args = args
+        self.compression_pref = compression
+        self.tls_pref = tls
+        self.tls_session = None
+        self.udp_pref = udp
+        self.udp = None
+        self.session = session
+        self.session_token = session_token
+        self.session_resumed = False
+        self.session_lost = 0
 
         self.workspace = {}
 
         self.open()
 
-    def open(self, proto = None, *args, use_json = False):
+    def open(self, proto = None, *args, use_json = False, compression = None, tls = None, udp = None):
         global __ADDRESS_REGEX
 
+        if compression is None:
+            compression = self.compression_pref
+
+        if tls is None:
+            tls = self.tls_pref
+
+        if udp is None:
+            udp = self.udp_pref
+
         if proto is None:
             proto = self.proto
             args = self.args
@@ -80,31 +152,96 @@ class DimeClient(collections.abc.MutableMapping):
             else:
                 args = (match.group("hostname"),)
 
-            self.open(proto, *args)
+            self.open(proto, *args, use_json = use_json, compression = compression, tls = tls, udp = udp)
             return
 
-        self.__send({"command": "handshake", "serialization": "json" if use_json else "pickle", "tls": False})
+        if compression is None:
+            compression = [c for c in ("lz4", "zstd", "zlib") if c in CODECS] if proto == "tcp" else "none"
+
+        self.compression = "none"
+        self.compression_threshold = 0
+
+        handshake = {"command": "handshake", "serialization": "json" if use_json else "pickle", "tls": bool(tls), "dimeb_version": 2, "byteorder": sys.byteorder}
+
+        if compression != "none":
+            handshake["compression"] = compression
+
+        if self.udp is not None:
+            self.udp.close()
+            self.udp = None
+
+        if udp and not tls:
+            # Datagrams are sent to this port, unless a multicast group is used
+            family = self.conn.family if proto == "tcp" else socket.AF_INET
+            self.udp = socket.socket(family, socket.SOCK_DGRAM)
+            self.udp.bind(("", 0))
+
+            handshake["udp"] = self.udp.getsockname()[1]
+
+        if self.session is not None:
+            handshake["session"] = self.session
+
+            if self.session_token is not None:
+                handshake["token"] = self.session_token
+
+        self.__send(handshake)
 
         jsondata, _ = self.__recv()
 
         if jsondata["status"] < 0:
-            raise RuntimeError(status["error"])
+            raise RuntimeError(jsondata["error"])
 
         self.serialization = jsondata["serialization"]
+        self.dimeb_version = jsondata.get("dimeb_version", 1)
+        self.compression = jsondata.get("compression", "none")
+        self.compression_threshold = jsondata.get("compression_threshold", 0)
+
+        if self.udp is not None:
+            self.__open_udp(jsondata.get("udp", False))
+
+        session = jsondata.get("session", False)
+
+        if session:
+            self.session_token = session["token"]
+            self.session_resumed = session["resumed"]
+            self.session_lost = session.get("lost", 0)
+        else:
+            self.session_resumed = False
+            self.session_lost = 0
+
+        if jsondata.get("tls", False):
+            if not isinstance(tls, ssl.SSLContext):
+                tls = ssl.create_default_context()
+
+            hostname = args[0] if proto == "tcp" else None
+
+            try:
+                self.conn = tls.wrap_socket(self.conn, server_hostname = hostname, session = self.tls_session)
+            except ValueError:
+                # Sessions can't be resumed across contexts or hosts
+                self.conn = tls.wrap_socket(self.conn, server_hostname = hostname)
 
         if jsondata["serialization"] == "pickle":
             self.loads = pickle.loads
             self.dumps = pickle.dumps
         elif jsondata["serialization"] == "dimeb":
             self.loads = dimeb.loads
-            self.dumps = dimeb.dumps
+            self.dumps = functools.partial(dimeb.dumps, version = self.dimeb_version)
         elif jsondata["serialization"] == "json":
             self.loads = dimejson.loads
             self.dumps = dimejson.dumps
 
     def close(self):
+        # TLS 1.3 tickets arrive after the handshake, so save them on close
+        if isinstance(self.conn, ssl.SSLSocket):
+            self.tls_session = self.conn.session
+
         self.conn.close()
 
+        if self.udp is not None:
+            self.udp.close()
+            self.udp = None
+
     def join(self, *names):
         """Send a "join" command to the server
 
@@ -125,7 +262,7 @@ class DimeClient(collections.abc.MutableMapping):
         jsondata, _ = self.__recv()
 
         if jsondata["status"] < 0:
-            raise RuntimeError(status["error"])
+            raise RuntimeError(jsondata["error"])
 
     def leave(self, *names):
         """Send a "leave" command to the server
@@ -147,9 +284,9 @@ class DimeClient(collections.abc.MutableMapping):
         jsondata, _ = self.__recv()
 
         if jsondata["status"] < 0:
-            raise RuntimeError(status["error"])
+            raise RuntimeError(jsondata["error"])
 
-    def send(self, name, *varnames):
+    def send(self, name, *varnames, priority = False, ttl = None):
         """Send a "send" command to the server
 
         Sends one or more variables from the mapping of this instance to all
@@ -165,9 +302,17 @@ class DimeClient(collections.abc.MutableMapping):
 
         varnames : tuple of str
            The variable name(s) in the mapping.
+
+        priority : bool, optional
+           Deliver the variables ahead of others that are already queued.
+
+        ttl : float, optional
+           Drop the variables unsent if they are still queued this many
+           seconds later, instead of the server's default for the group.
+           0 keeps them until they are sent.
         """
 
-        self.send_r(name, **{varname: self.workspace[varname] for varname in varnames})
+        self.__send_r(name, {varname: self.workspace[varname] for varname in varnames}, priority, ttl)
 
     def send_r(self, name, **kvpairs):
         """Send key value pairs to the server
@@ -185,7 +330,10 @@ class DimeClient(collections.abc.MutableMapping):
         **kvpairs : dict
             Keyword arguments representing the variable name(s) and their corresponding values.
         """
-        
+
+        self.__send_r(name, kvpairs, False, None)
+
+    def __send_r(self, name, kvpairs, priority, ttl):
         kviter = iter(kvpairs.items())
         serialization = self.serialization
 
@@ -206,6 +354,12 @@ class DimeClient(collections.abc.MutableMapping):
                 }
                 bindata = self.dumps(var)
 
+                if priority:
+                    jsondata["priority"] = 1
+
+                if ttl is not None:
+                    jsondata["ttl"] = ttl
+
                 self.__send(jsondata, bindata)
 
                 n += 1
@@ -214,13 +368,13 @@ class DimeClient(collections.abc.MutableMapping):
                 jsondata, _ = self.__recv()
 
                 if jsondata["status"] < 0:
-                    raise RuntimeError(status["error"])
+                    raise RuntimeError(jsondata["error"])
 
             if serialization != self.serialization:
-                self.send_r(name, **kvpairs)
+                self.__send_r(name, kvpairs, priority, ttl)
                 return
 
-    def broadcast(self, *varnames):
+    def broadcast(self, *varnames, reliable = False, priority = False, ttl = None):
         """Send a "broadcast" command to the server
 
         Sends one or more variables from the mapping of this instance to all
@@ -233,9 +387,20 @@ class DimeClient(collections.abc.MutableMapping):
 
         varnames : tuple of str
            The variable name(s) in the mapping.
+
+        reliable : bool, optional
+           Never send the variables to other clients as UDP datagrams.
+
+        priority : bool, optional
+           Deliver the variables ahead of others that are already queued.
+
+        ttl : float, optional
+           Drop the variables unsent if they are still queued this many
+           seconds later, instead of the server's default for the group.
+           0 keeps them until they are sent.
         """
 
-        self.broadcast_r(**{varname: self.workspace[varname] for varname in varnames})
+        self.__broadcast_r({varname: self.workspace[varname] for varname in varnames}, reliable, priority, ttl)
 
     def broadcast_r(self, **kvpairs):
         """Send a "broadcast" command to the server
@@ -250,6 +415,10 @@ class DimeClient(collections.abc.MutableMapping):
         **kvpairs : dict
             Keyword arguments representing the variable name(s) and their corresponding values.
         """
+
+        self.__broadcast_r(kvpairs, False, False, None)
+
+    def __broadcast_r(self, kvpairs, reliable, priority, ttl):
         kviter = iter(kvpairs.items())
         serialization = self.serialization
 
@@ -269,6 +438,15 @@ class DimeClient(collections.abc.MutableMapping):
                 }
                 bindata = self.dumps(var)
 
+                if reliable:
+                    jsondata["reliable"] = True
+
+                if priority:
+                    jsondata["priority"] = 1
+
+                if ttl is not None:
+                    jsondata["ttl"] = ttl
+
                 self.__send(jsondata, bindata)
 
                 n += 1
@@ -277,10 +455,10 @@ class DimeClient(collections.abc.MutableMapping):
                 jsondata, _ = self.__recv()
 
                 if jsondata["status"] < 0:
-                    raise RuntimeError(status["error"])
+                    raise RuntimeError(jsondata["error"])
 
             if serialization != self.serialization:
-                self.send_r(name, **kvpairs)
+                self.__broadcast_r(kvpairs, reliable, priority, ttl)
                 return
 
     def sync(self, n = -1):
@@ -334,9 +512,16 @@ class DimeClient(collections.abc.MutableMapping):
             If the received status is less than 0
         """
 
+        ret = {}
+
+        # Routing order of each variable in ret, to keep the last one sent
+        orders = {}
+
+        if self.udp is not None:
+            self.__recv_udp(ret, orders)
+
         self.__send({"command": "sync", "n": n})
 
-        ret = {}
         m = n
 
         while True:
@@ -344,7 +529,7 @@ class DimeClient(collections.abc.MutableMapping):
 
             if "status" in jsondata:
                 if jsondata["status"] < 0:
-                    raise RuntimeError(status["error"])
+                    raise RuntimeError(jsondata["error"])
 
                 break
 
@@ -358,7 +543,7 @@ class DimeClient(collections.abc.MutableMapping):
                 m -= 1
                 continue
 
-            ret[jsondata["varname"]] = var
+            self.__merge(ret, orders, jsondata, var)
 
         if n > 0 and m < n:
             ret.update(self.sync_r(n - m))
@@ -383,7 +568,7 @@ class DimeClient(collections.abc.MutableMapping):
         jsondata, _ = self.__recv()
 
         if jsondata["status"] < 0:
-            raise RuntimeError(status["error"])
+            raise RuntimeError(jsondata["error"])
 
         return jsondata["n"]
 
@@ -408,15 +593,157 @@ class DimeClient(collections.abc.MutableMapping):
         jsondata, _ = self.__recv()
 
         if jsondata["status"] < 0:
-            raise RuntimeError(status["error"])
+            raise RuntimeError(jsondata["error"])
 
         return jsondata["devices"]
 
+    def stats(self):
+        """Send a "stats" command to the server
+
+        Tell the server to send this client a snapshot of its counters.
+
+        Parameters
+        ----------
+        self : DimeClient
+            The dime instance.
+
+        Returns
+        -------
+        dict
+            Server-wide counters in "server", one dict per connection or
+            held session in "clients", and one dict per group in "groups".
+            Counters are totals since the server started, "uptime" seconds
+            ago.
+        """
+
+        self.__send({"command": "stats"})
+        jsondata, _ = self.__recv()
+
+        if jsondata["status"] < 0:
+            raise RuntimeError(jsondata["error"])
+
+        del jsondata["status"]
+
+        return jsondata
+
+    def latency(self, reset = False):
+        """Send a "latency" command to the server
+
+        Tell the server to send this client percentiles of the latency
+        of the messages it traced, in seconds, for each stage they pass
+        through: "route" (handling the send or broadcast), "queue"
+        (waiting for the recipient to sync) and "write" (waiting to be
+        sent on the recipient's connection).
+
+        Parameters
+        ----------
+        self : DimeClient
+            The dime instance.
+
+        reset : bool
+            Whether to empty the server's histograms afterwards, so that
+            the next call covers only the messages sent in between.
+
+        Returns
+        -------
+        dict
+            Stages of all traced messages in "stages", stages of the
+            messages sent to each group in "groups", and of broadcasts
+            in "broadcast". One in every "sample" messages is traced.
+        """
+
+        self.__send({"command": "latency", "reset": reset})
+        jsondata, _ = self.__recv()
+
+        if jsondata["status"] < 0:
+            raise RuntimeError(jsondata["error"])
+
+        del jsondata["status"]
+
+        return jsondata
+
+    def __open_udp(self, udp):
+        if not udp:
+            self.udp.close()
+            self.udp = None
+            return
+
+        if "group" in udp:
+            self.udp.close()
+
+            self.udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+            self.udp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            self.udp.bind(("" if sys.platform == "win32" else udp["group"], udp["port"]))
+
+            mreq = socket.inet_aton(udp["group"]) + socket.inet_aton(udp["interface"])
+            self.udp.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+
+        self.udp.setblocking(False)
+        self.udp_id = udp["id"]
+        self.udp_seq = None
+        self.udp_lost = 0
+
+    def __merge(self, ret, orders, jsondata, var):
+        # The server numbers messages while datagrams are in use; those
+        # queued before are older than any datagram
+        order = jsondata.get("order", -1)
+        varname = jsondata["varname"]
+
+        if varname not in ret or orders[varname] <= order:
+            ret[varname] = var
+            orders[varname] = order
+
+    def __recv_udp(self, ret, orders):
+        while True:
+            try:
+                data = bytearray(self.udp.recv(65536))
+            except BlockingIOError:
+                return
+
+            if len(data) < 20 or data[:4] != b"DiMU":
+                continue
+
+            seq, src, jsondata_len, bindata_len = struct.unpack("!IIII", data[4:20])
+
+            if len(data) != 20 + jsondata_len + bindata_len:
+                continue
+
+            # Sequence numbers wrap around; a late datagram was counted as lost
+            if self.udp_seq is None:
+                self.udp_seq = seq
+            elif (seq - self.udp_seq - 1) & 0xFFFFFFFF < 1 << 31:
+                self.udp_lost += (seq - self.udp_seq - 1) & 0xFFFFFFFF
+                self.udp_seq = seq
+            elif self.udp_lost > 0:
+                self.udp_lost -= 1
+
+            # Multicast clients receive their own broadcasts
+            if src == self.udp_id:
+                continue
+
+            jsondata = json.loads(data[20:20 + jsondata_len].decode("utf-8"))
+            bindata = data[20 + jsondata_len:]
+
+            if jsondata["serialization"] == "pickle":
+                self.__merge(ret, orders, jsondata, pickle.loads(bindata))
+            elif jsondata["serialization"] == "dimeb":
+                self.__merge(ret, orders, jsondata, dimeb.loads(bindata))
+            elif jsondata["serialization"] == "json":
+                self.__merge(ret, orders, jsondata, dimejson.loads(bindata))
+
     def __send(self, jsondata, bindata = b""):
         #print("->", jsondata)
 
         jsondata = json.dumps(jsondata).encode("utf-8")
 
+        if self.compression != "none" and 12 + len(jsondata) + len(bindata) >= self.compression_threshold:
+            codec, compress, _ = CODECS[self.compression]
+            zdata = compress(jsondata + bindata)
+
+            if 20 + len(zdata) < 12 + len(jsondata) + len(bindata):
+                self.conn.sendall(b"DiMZ" + struct.pack("!IIIB3x", len(jsondata), len(bindata), len(zdata), codec) + zdata)
+                return
+
         data = b"DiME" + \
                struct.pack("!II", len(jsondata), len(bindata)) + \
                jsondata + \
@@ -424,17 +751,48 @@ class DimeClient(collections.abc.MutableMapping):
 
         self.conn.sendall(data)
 
+    def __recvall(self, n):
+        # Read straight into a mutable buffer, so that dimeb v2 matrices can
+        # be used in place
+        buf = bytearray(n)
+        view = memoryview(buf)
+        nread = 0
+
+        while nread < n:
+            m = self.conn.recv_into(view[nread:], n - nread)
+
+            if m == 0:
+                raise RuntimeError("Connection closed by server")
+
+            nread += m
+
+        return buf
+
     def __recv(self):
-        header = self.conn.recv(12, socket.MSG_WAITALL)
+        header = self.__recvall(12)
 
-        if header[:4] != b"DiME":
-            raise RuntimeError("Invalid DiME message")
+        if header[:4] == b"DiME":
+            jsondata_len, bindata_len = struct.unpack("!II", header[4:])
+
+            jsondata = json.loads(self.__recvall(jsondata_len).decode("utf-8"))
+            bindata = self.__recvall(bindata_len)
+        elif header[:4] == b"DiMZ":
+            jsondata_len, bindata_len = struct.unpack("!II", header[4:])
+            zdata_len, codec = struct.unpack("!IB3x", self.__recvall(8))
+
+            if codec not in CODEC_NAMES:
+                raise RuntimeError("Unsupported compression codec")
 
-        jsondata_len, bindata_len = struct.unpack("!II", header[4:])
+            data = bytearray(CODECS[CODEC_NAMES[codec]][2](self.__recvall(zdata_len)))
 
-        data = self.conn.recv(jsondata_len + bindata_len, socket.MSG_WAITALL)
-        jsondata = json.loads(data[:jsondata_len].decode("utf-8"))
-        bindata = data[jsondata_len:]
+            if len(data) != jsondata_len + bindata_len:
+                raise RuntimeError("Invalid compressed DiME message")
+
+            jsondata = json.loads(data[:jsondata_len].decode("utf-8"))
+            del data[:jsondata_len]
+            bindata = data
+        else:
+            raise RuntimeError("Invalid DiME message")
 
         if "status" in jsondata and jsondata["status"] > 0 and "meta" in jsondata and jsondata["meta"]:
             self.__meta(jsondata)
@@ -453,7 +811,7 @@ class DimeClient(collections.abc.MutableMapping):
                 self.dumps = pickle.dumps
             elif jsondata["serialization"] == "dimeb":
                 self.loads = dimeb.loads
-                self.dumps = dimeb.dumps
+                self.dumps = functools.partial(dimeb.dumps, version = self.dimeb_version)
             elif jsondata["serialization"] == "json":
                 self.loads = dimejson.loads
                 self.dumps = dimejson.dumps
@@ -47,58 +47,69 @@ TYPE_STRING     = 0x20
 TYPE_ARRAY      = 0x21
 TYPE_ASSOCARRAY = 0x22
 
-def loads_null(s):
-    return None, 1
+# dimeb v2 prologue: a marker that is never a valid v1 type code, the
+# version, and the byte order of everything that follows. Matrix data is
+# aligned to ALIGN bytes from the start of the payload, so that it can be
+# used in place.
+V2_MAGIC = b"\xffDB\x02"
+V2_HDRLEN = 8
+ALIGN = 64
 
-def loads_true(s):
-    return True, 1
+def align(i, aligned):
+    return i + (-i % ALIGN) if aligned else i
 
-def loads_false(s):
-    return False, 1
+def loads_null(s, i, order, aligned):
+    return None, i + 1
 
-def loads_i8(s):
-    return ctypes.c_int8(s[1]).value, 2
+def loads_true(s, i, order, aligned):
+    return True, i + 1
 
-def loads_i16(s):
-    return struct.unpack("!h", s[1:3])[0], 3
+def loads_false(s, i, order, aligned):
+    return False, i + 1
 
-def loads_i32(s):
-    return struct.unpack("!i", s[1:5])[0], 5
+def loads_i8(s, i, order, aligned):
+    return ctypes.c_int8(s[i + 1]).value, i + 2
 
-def loads_i64(s):
-    return struct.unpack("!q", s[1:9])[0], 9
+def loads_i16(s, i, order, aligned):
+    return struct.unpack_from(order + "h", s, i + 1)[0], i + 3
 
-def loads_u8(s):
-    return s[1], 2
+def loads_i32(s, i, order, aligned):
+    return struct.unpack_from(order + "i", s, i + 1)[0], i + 5
 
-def loads_u16(s):
-    return struct.unpack("!H", s[1:3])[0], 3
+def loads_i64(s, i, order, aligned):
+    return struct.unpack_from(order + "q", s, i + 1)[0], i + 9
 
-def loads_u32(s):
-    return struct.unpack("!I", s[1:5])[0], 5
+def loads_u8(s, i, order, aligned):
+    return s[i + 1], i + 2
 
-def loads_u64(s):
-    return struct.unpack("!Q", s[1:9])[0], 9
+def loads_u16(s, i, order, aligned):
+    return struct.unpack_from(order + "H", s, i + 1)[0], i + 3
 
-def loads_single(s):
-    return struct.unpack("!f", s[1:5])[0], 5
+def loads_u32(s, i, order, aligned):
+    return struct.unpack_from(order + "I", s, i + 1)[0], i + 5
 
-def loads_double(s):
-    return struct.unpack("!d", s[1:9])[0], 9
+def loads_u64(s, i, order, aligned):
+    return struct.unpack_from(order + "Q", s, i + 1)[0], i + 9
 
-def loads_complex_single(s):
-    real, imag = struct.unpack("!ff", s[1:9])
-    return complex(real, imag), 9
+def loads_single(s, i, order, aligned):
+    return struct.unpack_from(order + "f", s, i + 1)[0], i + 5
 
-def loads_complex_double(s):
-    real, imag = struct.unpack("!dd", s[1:17])
-    return complex(real, imag), 17
+def loads_double(s, i, order, aligned):
+    return struct.unpack_from(order + "d", s, i + 1)[0], i + 9
 
-def loads_mat(s, dtype):
-    rank = s[1]
-    offset = 4 * rank + 2
-    shape = struct.unpack("!" + "I" * rank, s[2:offset])
-    count = np.prod(shape)
+def loads_complex_single(s, i, order, aligned):
+    real, imag = struct.unpack_from(order + "ff", s, i + 1)
+    return complex(real, imag), i + 9
+
+def loads_complex_double(s, i, order, aligned):
+    real, imag = struct.unpack_from(order + "dd", s, i + 1)
+    return complex(real, imag), i + 17
+
+def loads_mat(s, i, order, aligned, dtype):
+    rank = s[i + 1]
+    shape = struct.unpack_from(order + "I" * rank, s, i + 2)
+    count = int(np.prod(shape))
+    offset = align(i + 4 * rank + 2, aligned)
 
     if len(shape) == 2:
         if shape[0] == 1:
@@ -106,84 +117,81 @@ def loads_mat(s, dtype):
         elif shape[1] == 1:
             shape = (shape[0],)
 
-    arr = np.frombuffer(s, dtype, count, offset).reshape(shape, order = "F")
-    if sys.byteorder != "big":
-        arr = arr.byteswap()
+    # A view over the received buffer, which is only copied if the sender
+    # used the other byte order
+    arr = np.frombuffer(s, dtype.newbyteorder(order), count, offset).reshape(shape, order = "F")
+    if not arr.dtype.isnative:
+        arr = arr.astype(dtype)
 
-    return arr, count * dtype.itemsize + offset
+    return arr, offset + count * dtype.itemsize
 
-def loads_mat_i8(s):
-    return loads_mat(s, np.dtype(np.int8))
+def loads_mat_i8(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.int8))
 
-def loads_mat_i16(s):
-    return loads_mat(s, np.dtype(np.int16))
+def loads_mat_i16(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.int16))
 
-def loads_mat_i32(s):
-    return loads_mat(s, np.dtype(np.int32))
+def loads_mat_i32(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.int32))
 
-def loads_mat_i64(s):
-    return loads_mat(s, np.dtype(np.int64))
+def loads_mat_i64(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.int64))
 
-def loads_mat_u8(s):
-    return loads_mat(s, np.dtype(np.uint8))
+def loads_mat_u8(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.uint8))
 
-def loads_mat_u16(s):
-    return loads_mat(s, np.dtype(np.uint16))
+def loads_mat_u16(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.uint16))
 
-def loads_mat_u32(s):
-    return loads_mat(s, np.dtype(np.uint32))
+def loads_mat_u32(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.uint32))
 
-def loads_mat_u64(s):
-    return loads_mat(s, np.dtype(np.uint64))
+def loads_mat_u64(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.uint64))
 
-def loads_mat_single(s):
-    return loads_mat(s, np.dtype(np.float32))
+def loads_mat_single(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.float32))
 
-def loads_mat_double(s):
-    return loads_mat(s, np.dtype(np.float64))
+def loads_mat_double(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.float64))
 
-def loads_mat_complex_single(s):
-    return loads_mat(s, np.dtype(np.complex64))
+def loads_mat_complex_single(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.complex64))
 
-def loads_mat_complex_double(s):
-    return loads_mat(s, np.dtype(np.complex128))
+def loads_mat_complex_double(s, i, order, aligned):
+    return loads_mat(s, i, order, aligned, np.dtype(np.complex128))
 
-def loads_string(s):
-    siz = struct.unpack("!I", s[1:5])[0]
-    return s[5:(siz + 5)].decode("utf-8"), siz + 5
+def loads_string(s, i, order, aligned):
+    siz = struct.unpack_from(order + "I", s, i + 1)[0]
+    return bytes(s[(i + 5):(i + siz + 5)]).decode("utf-8"), i + siz + 5
 
-def loads_array(s):
-    siz = struct.unpack("!I", s[1:5])[0]
+def loads_array(s, i, order, aligned):
+    siz = struct.unpack_from(order + "I", s, i + 1)[0]
 
     ret = []
-    i = 5
+    i += 5
 
     for _ in range(siz):
-        element, element_siz = _loads(s[i:])
-
+        element, i = _loads(s, i, order, aligned)
         ret.append(element)
-        i += element_siz
 
     return ret, i
 
-def loads_assocarray(s):
-    siz = struct.unpack("!I", s[1:5])[0]
+def loads_assocarray(s, i, order, aligned):
+    siz = struct.unpack_from(order + "I", s, i + 1)[0]
 
     ret = {}
-    i = 5
+    i += 5
 
     for _ in range(siz):
-        key, key_siz = _loads(s[i:])
-        i += key_siz
-
-        val, val_siz = _loads(s[i:])
-        i += val_siz
+        key, i = _loads(s, i, order, aligned)
+        val, i = _loads(s, i, order, aligned)
 
         ret[key] = val
 
     return ret, i
 
-def _loads(s):
+def _loads(s, i, order, aligned):
     tab = {
         TYPE_NULL:  loads_null,
         TYPE_TRUE:  loads_true,
@@ -222,29 +230,39 @@ def _loads(s):
         TYPE_ASSOCARRAY: loads_assocarray
     }
 
-    return tab[s[0]](s)
+    return tab[s[i]](s, i, order, aligned)
 
 def loads(x):
-    return _loads(x)[0]
+    """Decode a dimeb v1 or v2 value
+
+    Matrices in a v2 value of the native byte order are returned as views
+    over x, which are writable if x is (e.g. a bytearray).
+    """
 
-def dumps(x):
+    if x[:4] == V2_MAGIC:
+        order = {b"L": "<", b"B": ">"}[bytes(x[4:5])]
+        return _loads(x, V2_HDRLEN, order, True)[0]
+
+    return _loads(x, 0, ">", False)[0]
+
+def _dumps(x, out, order, aligned):
     if x is None:
-        return bytes((TYPE_NULL,))
+        out.append(TYPE_NULL)
 
     elif x is True:
-        return bytes((TYPE_TRUE,))
+        out.append(TYPE_TRUE)
 
     elif x is False:
-        return bytes((TYPE_FALSE,))
+        out.append(TYPE_FALSE)
 
     elif isinstance(x, int):
-        return struct.pack("!Bq", TYPE_I64, x)
+        out += struct.pack(order + "Bq", TYPE_I64, x)
 
     elif isinstance(x, float):
-        return struct.pack("!Bd", TYPE_DOUBLE, x)
+        out += struct.pack(order + "Bd", TYPE_DOUBLE, x)
 
     elif isinstance(x, complex):
-        return struct.pack("!Bdd", TYPE_COMPLEX_DOUBLE, x.real, x.imag)
+        out += struct.pack(order + "Bdd", TYPE_COMPLEX_DOUBLE, x.real, x.imag)
 
     elif isinstance(x, np.ndarray):
         tab = {
@@ -262,33 +280,52 @@ def dumps(x):
             ("c", 16): TYPE_MAT_COMPLEX_DOUBLE
         }
 
-        if not (x.dtype.byteorder == ">" or (x.dtype.byteorder == "=" and sys.byteorder == "big")):
-            x = x.byteswap()
-
-        shapedata = struct.pack("!BB" + "I" * len(x.shape), tab[(x.dtype.kind, x.dtype.itemsize)], len(x.shape), *x.shape)
-
-        return shapedata + x.tobytes(order = "F")
+        out += struct.pack(order + "BB" + "I" * len(x.shape), tab[(x.dtype.kind, x.dtype.itemsize)], len(x.shape), *x.shape)
+        out += bytes(align(len(out), aligned) - len(out))
+        out += x.astype(x.dtype.newbyteorder(order), copy = False).tobytes(order = "F")
 
     elif isinstance(x, str):
         x = x.encode("utf-8")
-        return struct.pack("!BI", TYPE_STRING, len(x)) + x
+        out += struct.pack(order + "BI", TYPE_STRING, len(x))
+        out += x
 
     elif isinstance(x, collections.abc.Sequence):
-        elements = bytearray()
+        out += struct.pack(order + "BI", TYPE_ARRAY, len(x))
 
         for elem in x:
-            elements += dumps(elem)
-
-        return struct.pack("!BI", TYPE_ARRAY, len(x)) + bytes(elements)
+            _dumps(elem, out, order, aligned)
 
     elif isinstance(x, collections.abc.Mapping):
-        keyvalpairs = bytearray()
+        out += struct.pack(order + "BI", TYPE_ASSOCARRAY, len(x))
 
         for key, val in x.items():
-            keyvalpairs += dumps(key)
-            keyvalpairs += dumps(val)
-
-        return struct.pack("!BI", TYPE_ASSOCARRAY, len(x)) + bytes(keyvalpairs)
+            _dumps(key, out, order, aligned)
+            _dumps(val, out, order, aligned)
 
     else:
         raise TypeError
+
+def dumps(x, version = 1):
+    """Encode a value with dimeb
+
+    Version 1 uses network byte order throughout. Version 2 uses the
+    native byte order and aligns matrix data, so that a receiver of the
+    same byte order can use it without conversion.
+    """
+
+    out = bytearray()
+
+    if version >= 2:
+        out += V2_MAGIC + (b"L" if sys.byteorder == "little" else b"B") + bytes(3)
+        _dumps(x, out, "<" if sys.byteorder == "little" else ">", True)
+    else:
+        _dumps(x, out, ">", False)
+
+    return bytes(out)
+
+# Prefer the compiled codec if it was built; the definitions above remain the
+# reference implementation and the fallback
+try:
+    from dime._dimeb import loads, dumps
+except ImportError:
+    pass
@@ -22,7 +22,7 @@ class DimeJSONEncoder(json.JSONEncoder):
                              "float32", "float64", "complex64", "complex128"}:
                 raise TypeError()
 
-            data = base64.b64encode(np.asfortranarray(obj).tobytes()).decode('ascii')
+            data = base64.b64encode(obj.tobytes(order = "F")).decode('ascii')
             shape = list(obj.shape)
 
             return {
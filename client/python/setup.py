@@ -1,7 +1,7 @@
 #!/usr/bin/env python3
 # See https://packaging.python.org/tutorials/packaging-projects/ for reference
 
-from setuptools import setup
+from setuptools import Extension, setup
 
 with open("README.md", "r") as file:
     long_description = file.read()
@@ -17,6 +17,10 @@ setup(
     license = "GNU License V3",
     url = "https://github.com/zmalkmus/dimedev",
     packages = ["dime"],
+    # Compiled dimeb codec; dime.dimeb falls back to pure Python without it
+    ext_modules = [
+        Extension("dime._dimeb", ["dime/_dimeb.c"], optional = True),
+    ],
     classifiers=[
         "Programming Language :: Python :: 3",
         "License :: OSI Approved :: GNU General Public License v3 (GPLv3)",
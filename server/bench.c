@@ -0,0 +1,890 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <jansson.h>
+#include "hdr.h"
+
+/*
+ * Load generator for the DiME server. Opens a number of clients that
+ * speak the wire protocol directly (with opaque payloads, so nothing is
+ * (de)serialized on either end), has them send and broadcast messages to
+ * each other in a given mix and at a given rate, and receive them with
+ * "wait" and "sync" or by polling with "sync". Throughput and percentiles
+ * of acknowledgement and delivery latency are written as JSON.
+ *
+ * Each payload carries the time it was meant to be sent, so latency is
+ * measured from when a message should have been sent rather than when it
+ * was, and a server that falls behind a fixed rate is not flattered by
+ * the load generator slowing down with it.
+ */
+
+enum bench_cmd {
+    BENCH_SEND,
+    BENCH_BROADCAST,
+    BENCH_SYNC
+};
+
+enum bench_recv {
+    BENCH_RECV_WAIT,
+    BENCH_RECV_SYNC
+};
+
+typedef struct {
+    int cmd;
+    uint64_t t;
+} bench_pending_t;
+
+typedef struct {
+    int fd;
+    size_t id;
+    char group[32];  /* Group the client joins */
+    char target[32]; /* Group the client sends to */
+    uint64_t rng;
+
+    unsigned char *out;
+    size_t out_len, out_off, out_cap;
+
+    unsigned char *in;
+    size_t in_len, in_cap;
+
+    bench_pending_t *pending; /* Commands awaiting a status, oldest first */
+    size_t pending_head, pending_len, pending_cap;
+
+    size_t inflight; /* Sends and broadcasts awaiting a status */
+    int syncing, waiting;
+    uint64_t next; /* Time the next message should be sent */
+} bench_client_t;
+
+static struct {
+    const char *addr;
+    size_t clients;
+    size_t groups;
+    size_t size;
+    size_t window;
+    double rate;
+    double duration;
+    double warmup;
+    unsigned int weights[2];
+    int recv;
+    const char *output;
+} cfg = {
+    "unix:/tmp/dime.sock", 8, 1, 64, 16, 0, 10, 1, {1, 0}, BENCH_RECV_WAIT, NULL
+};
+
+static struct {
+    uint64_t start, end; /* Measured interval */
+    uint64_t sent, acked, received, received_bytes, errors;
+    dime_hdr_t ack, delivery;
+} stats;
+
+static uint64_t bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64 */
+static uint64_t bench_rand(bench_client_t *clnt) {
+    clnt->rng ^= clnt->rng << 13;
+    clnt->rng ^= clnt->rng >> 7;
+    clnt->rng ^= clnt->rng << 17;
+
+    return clnt->rng;
+}
+
+static int bench_reserve(unsigned char **buf, size_t *cap, size_t len) {
+    if (len <= *cap) {
+        return 0;
+    }
+
+    size_t ncap = (*cap > 0) ? *cap : 4096;
+
+    while (ncap < len) {
+        ncap = (ncap * 3) / 2;
+    }
+
+    unsigned char *nbuf = realloc(*buf, ncap);
+    if (nbuf == NULL) {
+        return -1;
+    }
+
+    *buf = nbuf;
+    *cap = ncap;
+
+    return 0;
+}
+
+/* Queue a message for the server */
+static int bench_push(bench_client_t *clnt, const char *jsondata, const void *bindata, size_t bindata_len) {
+    size_t jsondata_len = strlen(jsondata);
+
+    if (bench_reserve(&clnt->out, &clnt->out_cap, clnt->out_len + 12 + jsondata_len + bindata_len) < 0) {
+        return -1;
+    }
+
+    unsigned char *p = clnt->out + clnt->out_len;
+
+    memcpy(p, "DiME", 4);
+    p[4] = jsondata_len >> 24;
+    p[5] = jsondata_len >> 16;
+    p[6] = jsondata_len >> 8;
+    p[7] = jsondata_len;
+    p[8] = bindata_len >> 24;
+    p[9] = bindata_len >> 16;
+    p[10] = bindata_len >> 8;
+    p[11] = bindata_len;
+
+    memcpy(p + 12, jsondata, jsondata_len);
+
+    if (bindata_len > 0) {
+        memcpy(p + 12 + jsondata_len, bindata, bindata_len);
+    }
+
+    clnt->out_len += 12 + jsondata_len + bindata_len;
+
+    return 0;
+}
+
+static int bench_expect(bench_client_t *clnt, int cmd, uint64_t t) {
+    if (clnt->pending_len == clnt->pending_cap) {
+        size_t ncap = (clnt->pending_cap > 0) ? (clnt->pending_cap * 3) / 2 : 16;
+        bench_pending_t *npending = malloc(ncap * sizeof(bench_pending_t));
+        if (npending == NULL) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < clnt->pending_len; i++) {
+            npending[i] = clnt->pending[(clnt->pending_head + i) % clnt->pending_cap];
+        }
+
+        free(clnt->pending);
+        clnt->pending = npending;
+        clnt->pending_head = 0;
+        clnt->pending_cap = ncap;
+    }
+
+    bench_pending_t *pending = &clnt->pending[(clnt->pending_head + clnt->pending_len) % clnt->pending_cap];
+
+    pending->cmd = cmd;
+    pending->t = t;
+    clnt->pending_len++;
+
+    return 0;
+}
+
+/* Write as much queued data as the socket accepts */
+static int bench_flush(bench_client_t *clnt) {
+    while (clnt->out_off < clnt->out_len) {
+        ssize_t n = write(clnt->fd, clnt->out + clnt->out_off, clnt->out_len - clnt->out_off);
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        clnt->out_off += n;
+    }
+
+    if (clnt->out_off == clnt->out_len) {
+        clnt->out_off = 0;
+        clnt->out_len = 0;
+    }
+
+    return 0;
+}
+
+/* Parse a complete message at the start of a buffer, if there is one */
+static int bench_pop(const unsigned char *in, size_t in_len, json_t **jsondata, const unsigned char **bindata, size_t *bindata_len, size_t *consumed) {
+    if (in_len < 12) {
+        return 0;
+    }
+
+    if (memcmp(in, "DiME", 4) != 0) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    size_t jsondata_len = ((size_t)in[4] << 24) | ((size_t)in[5] << 16) | ((size_t)in[6] << 8) | in[7];
+    *bindata_len = ((size_t)in[8] << 24) | ((size_t)in[9] << 16) | ((size_t)in[10] << 8) | in[11];
+
+    if (in_len < 12 + jsondata_len + *bindata_len) {
+        return 0;
+    }
+
+    *jsondata = json_loadb((const char *)in + 12, jsondata_len, 0, NULL);
+    if (*jsondata == NULL) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    *bindata = in + 12 + jsondata_len;
+    *consumed = 12 + jsondata_len + *bindata_len;
+
+    return 1;
+}
+
+static void bench_record(dime_hdr_t *hdr, uint64_t t, uint64_t now) {
+    if (t >= stats.start && t < stats.end) {
+        dime_hdr_record(hdr, (now > t) ? now - t : 0);
+    }
+}
+
+/* Handle one message from the server */
+static int bench_handle(bench_client_t *clnt, json_t *jsondata, const unsigned char *bindata, size_t bindata_len, uint64_t now) {
+    json_int_t status;
+
+    if (json_object_get(jsondata, "meta") != NULL) {
+        return 0;
+    }
+
+    if (json_unpack(jsondata, "{sI}", "status", &status) < 0) {
+        /* A variable, sent in reply to a "sync" */
+        uint64_t t;
+
+        if (bindata_len >= sizeof(t)) {
+            memcpy(&t, bindata, sizeof(t));
+            bench_record(&stats.delivery, t, now);
+
+            if (t >= stats.start && t < stats.end) {
+                stats.received++;
+                stats.received_bytes += bindata_len;
+            }
+        }
+
+        return 0;
+    }
+
+    /* Only the reply to a "wait" has a count, after which the messages
+     * that arrived are collected */
+    if (clnt->waiting && json_object_get(jsondata, "n") != NULL) {
+        clnt->waiting = 0;
+
+        if (bench_push(clnt, "{\"command\":\"sync\",\"n\":-1}", NULL, 0) < 0 || bench_expect(clnt, BENCH_SYNC, now) < 0) {
+            return -1;
+        }
+
+        clnt->syncing = 1;
+
+        return 0;
+    }
+
+    if (clnt->pending_len == 0) {
+        fprintf(stderr, "Client %zu received an unexpected reply\n", clnt->id);
+        errno = EPROTO;
+
+        return -1;
+    }
+
+    bench_pending_t *pending = &clnt->pending[clnt->pending_head];
+
+    clnt->pending_head = (clnt->pending_head + 1) % clnt->pending_cap;
+    clnt->pending_len--;
+
+    if (status < 0) {
+        const char *error = "(unknown)";
+
+        json_unpack(jsondata, "{ss}", "error", &error);
+        fprintf(stderr, "Client %zu received an error: %s\n", clnt->id, error);
+
+        stats.errors++;
+    }
+
+    if (pending->cmd == BENCH_SYNC) {
+        clnt->syncing = 0;
+    } else {
+        clnt->inflight--;
+
+        if (pending->t >= stats.start && pending->t < stats.end) {
+            stats.acked++;
+        }
+
+        bench_record(&stats.ack, pending->t, now);
+    }
+
+    return 0;
+}
+
+static int bench_read(bench_client_t *clnt) {
+    for (;;) {
+        if (bench_reserve(&clnt->in, &clnt->in_cap, clnt->in_len + 65536) < 0) {
+            return -1;
+        }
+
+        ssize_t n = read(clnt->fd, clnt->in + clnt->in_len, clnt->in_cap - clnt->in_len);
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+
+        clnt->in_len += n;
+    }
+
+    uint64_t now = bench_now();
+    size_t off = 0;
+
+    for (;;) {
+        json_t *jsondata;
+        const unsigned char *bindata;
+        size_t bindata_len, consumed;
+
+        int popped = bench_pop(clnt->in + off, clnt->in_len - off, &jsondata, &bindata, &bindata_len, &consumed);
+
+        if (popped < 0) {
+            return -1;
+        } else if (popped == 0) {
+            break;
+        }
+
+        int handled = bench_handle(clnt, jsondata, bindata, bindata_len, now);
+
+        json_decref(jsondata);
+        off += consumed;
+
+        if (handled < 0) {
+            return -1;
+        }
+    }
+
+    memmove(clnt->in, clnt->in + off, clnt->in_len - off);
+    clnt->in_len -= off;
+
+    return 0;
+}
+
+/* Read a single message while connecting, and check its status */
+static int bench_recv_status(bench_client_t *clnt) {
+    for (;;) {
+        json_t *jsondata;
+        const unsigned char *bindata;
+        size_t bindata_len, consumed;
+
+        int popped = bench_pop(clnt->in, clnt->in_len, &jsondata, &bindata, &bindata_len, &consumed);
+
+        if (popped < 0) {
+            return -1;
+        } else if (popped > 0) {
+            json_int_t status = -1;
+            const char *error = "(unknown)";
+
+            json_unpack(jsondata, "{sI}", "status", &status);
+
+            if (status < 0) {
+                json_unpack(jsondata, "{ss}", "error", &error);
+                fprintf(stderr, "Client %zu received an error: %s\n", clnt->id, error);
+            }
+
+            json_decref(jsondata);
+
+            memmove(clnt->in, clnt->in + consumed, clnt->in_len - consumed);
+            clnt->in_len -= consumed;
+
+            return (status < 0) ? -1 : 0;
+        }
+
+        if (bench_reserve(&clnt->in, &clnt->in_cap, clnt->in_len + 4096) < 0) {
+            return -1;
+        }
+
+        ssize_t n = read(clnt->fd, clnt->in + clnt->in_len, clnt->in_cap - clnt->in_len);
+
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (n == 0) {
+                errno = ECONNRESET;
+            }
+
+            return -1;
+        }
+
+        clnt->in_len += n;
+    }
+}
+
+static int bench_connect(const char *addr) {
+    char buf[256];
+    int fd = -1;
+
+    strncpy(buf, addr, sizeof(buf));
+    buf[sizeof(buf) - 1] = '\0';
+
+    char *type = strtok(buf, ":");
+
+    if (type != NULL && (strcmp(type, "unix") == 0 || strcmp(type, "ipc") == 0)) {
+        const char *pathname = strtok(NULL, "");
+        struct sockaddr_un sa;
+
+        if (pathname == NULL || strlen(pathname) >= sizeof(sa.sun_path)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strcpy(sa.sun_path, pathname);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+
+        if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else if (type != NULL && strcmp(type, "tcp") == 0) {
+        const char *host = strtok(NULL, ":");
+        const char *port = strtok(NULL, "");
+        struct addrinfo hints, *res, *ai;
+
+        if (host == NULL || port == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        int err = getaddrinfo(host, port, &hints, &res);
+        if (err != 0) {
+            fprintf(stderr, "Failed to resolve %s: %s\n", host, gai_strerror(err));
+            errno = EINVAL;
+
+            return -1;
+        }
+
+        for (ai = res; ai != NULL; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                break;
+            }
+
+            close(fd);
+            fd = -1;
+        }
+
+        freeaddrinfo(res);
+
+        if (fd < 0) {
+            return -1;
+        }
+
+        int one = 1;
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return fd;
+}
+
+static int bench_open(bench_client_t *clnt, size_t id) {
+    char jsondata[128];
+
+    memset(clnt, 0, sizeof(bench_client_t));
+
+    clnt->id = id;
+    clnt->rng = 0x9e3779b97f4a7c15ull * (id + 1);
+    snprintf(clnt->group, sizeof(clnt->group), "bench%zu", id % cfg.groups);
+    snprintf(clnt->target, sizeof(clnt->target), "bench%zu", (id + 1) % cfg.groups);
+
+    clnt->fd = bench_connect(cfg.addr);
+    if (clnt->fd < 0) {
+        return -1;
+    }
+
+    /* Payloads are opaque, so any serialization that every client
+     * shares will do without being transcoded */
+    if (bench_push(clnt, "{\"command\":\"handshake\",\"serialization\":\"pickle\",\"tls\":false}", NULL, 0) < 0) {
+        return -1;
+    }
+
+    snprintf(jsondata, sizeof(jsondata), "{\"command\":\"join\",\"name\":[\"%s\"]}", clnt->group);
+
+    if (bench_flush(clnt) < 0 || bench_recv_status(clnt) < 0 ||
+        bench_push(clnt, jsondata, NULL, 0) < 0 ||
+        bench_flush(clnt) < 0 || bench_recv_status(clnt) < 0) {
+        return -1;
+    }
+
+    int flags = fcntl(clnt->fd, F_GETFL);
+
+    if (flags < 0 || fcntl(clnt->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Queue as many commands as the client may send right now */
+static int bench_step(bench_client_t *clnt, unsigned char *payload, uint64_t now, uint64_t end) {
+    char jsondata[128];
+
+    while (now < end && clnt->inflight < cfg.window && (cfg.rate == 0 || clnt->next <= now)) {
+        uint64_t t = (cfg.rate == 0) ? now : clnt->next;
+        int cmd = (bench_rand(clnt) % (cfg.weights[0] + cfg.weights[1]) < cfg.weights[0]) ? BENCH_SEND : BENCH_BROADCAST;
+
+        if (cmd == BENCH_SEND) {
+            snprintf(jsondata, sizeof(jsondata), "{\"command\":\"send\",\"name\":\"%s\",\"varname\":\"x\",\"serialization\":\"pickle\"}", clnt->target);
+        } else {
+            strcpy(jsondata, "{\"command\":\"broadcast\",\"varname\":\"x\",\"serialization\":\"pickle\"}");
+        }
+
+        memcpy(payload, &t, sizeof(t));
+
+        if (bench_push(clnt, jsondata, payload, cfg.size) < 0 || bench_expect(clnt, cmd, t) < 0) {
+            return -1;
+        }
+
+        clnt->inflight++;
+
+        if (t >= stats.start && t < stats.end) {
+            stats.sent++;
+        }
+
+        if (cfg.rate > 0) {
+            clnt->next += 1e9 / cfg.rate;
+        }
+    }
+
+    if (now < end && !clnt->syncing && !clnt->waiting) {
+        if (cfg.recv == BENCH_RECV_WAIT) {
+            if (bench_push(clnt, "{\"command\":\"wait\"}", NULL, 0) < 0) {
+                return -1;
+            }
+
+            clnt->waiting = 1;
+        } else {
+            if (bench_push(clnt, "{\"command\":\"sync\",\"n\":-1}", NULL, 0) < 0 || bench_expect(clnt, BENCH_SYNC, now) < 0) {
+                return -1;
+            }
+
+            clnt->syncing = 1;
+        }
+    }
+
+    return 0;
+}
+
+static json_t *bench_summary(const dime_hdr_t *hdr) {
+    return json_pack("{sIsfsfsfsfsfsfsf}",
+                     "count", (json_int_t)hdr->total,
+                     "min", hdr->min / 1e9,
+                     "mean", (hdr->total > 0) ? hdr->sum / hdr->total / 1e9 : 0.0,
+                     "p50", dime_hdr_percentile(hdr, 50) / 1e9,
+                     "p90", dime_hdr_percentile(hdr, 90) / 1e9,
+                     "p99", dime_hdr_percentile(hdr, 99) / 1e9,
+                     "p999", dime_hdr_percentile(hdr, 99.9) / 1e9,
+                     "max", hdr->max / 1e9);
+}
+
+static int bench_report(void) {
+    double elapsed = (stats.end - stats.start) / 1e9;
+
+    json_t *report = json_pack("{s{sssIsIsIsIsfsfsfs{sIsI}ss}sIsIsIsIsIs{sfsfsf}s{soso}}",
+                               "config",
+                                   "address", cfg.addr,
+                                   "clients", (json_int_t)cfg.clients,
+                                   "groups", (json_int_t)cfg.groups,
+                                   "size", (json_int_t)cfg.size,
+                                   "window", (json_int_t)cfg.window,
+                                   "rate", cfg.rate,
+                                   "duration", cfg.duration,
+                                   "warmup", cfg.warmup,
+                                   "mix",
+                                       "send", (json_int_t)cfg.weights[0],
+                                       "broadcast", (json_int_t)cfg.weights[1],
+                                   "receive", (cfg.recv == BENCH_RECV_WAIT) ? "wait" : "sync",
+                               "sent", (json_int_t)stats.sent,
+                               "acked", (json_int_t)stats.acked,
+                               "received", (json_int_t)stats.received,
+                               "received_bytes", (json_int_t)stats.received_bytes,
+                               "errors", (json_int_t)stats.errors,
+                               "throughput",
+                                   "sent", stats.sent / elapsed,
+                                   "received", stats.received / elapsed,
+                                   "received_bytes", stats.received_bytes / elapsed,
+                               "latency",
+                                   "ack", bench_summary(&stats.ack),
+                                   "delivery", bench_summary(&stats.delivery));
+
+    if (report == NULL) {
+        return -1;
+    }
+
+    char *str = json_dumps(report, JSON_INDENT(2));
+
+    json_decref(report);
+
+    if (str == NULL) {
+        return -1;
+    }
+
+    FILE *f = (cfg.output != NULL) ? fopen(cfg.output, "w") : stdout;
+    int ret = (f != NULL && fprintf(f, "%s\n", str) >= 0) ? 0 : -1;
+
+    if (f != NULL && f != stdout) {
+        fclose(f);
+    }
+
+    free(str);
+
+    return ret;
+}
+
+static int parse_mix(char *spec) {
+    cfg.weights[0] = 0;
+    cfg.weights[1] = 0;
+
+    for (char *tok = strtok(spec, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        char *eq = strchr(tok, '=');
+        unsigned int weight = 1;
+
+        if (eq != NULL) {
+            *eq = '\0';
+            weight = strtoul(eq + 1, NULL, 0);
+        }
+
+        if (strcmp(tok, "send") == 0) {
+            cfg.weights[0] = weight;
+        } else if (strcmp(tok, "broadcast") == 0) {
+            cfg.weights[1] = weight;
+        } else if (strcmp(tok, "wait") == 0) {
+            cfg.recv = BENCH_RECV_WAIT;
+        } else if (strcmp(tok, "sync") == 0) {
+            cfg.recv = BENCH_RECV_SYNC;
+        } else {
+            return -1;
+        }
+    }
+
+    return (cfg.weights[0] + cfg.weights[1] > 0) ? 0 : -1;
+}
+
+static void usage(const char *argv0) {
+    printf("Usage: %s [options]\n"
+           "\n"
+           "Options:\n"
+           "-a <protocol>:<info>   Specifies the server to connect to, either \n"
+           "                       unix:<socket file> or tcp:<host>:<port>. \n"
+           "                       Defaults to unix:/tmp/dime.sock.\n"
+           "-c <n>                 Specifies the number of clients. Defaults to 8.\n"
+           "-d <seconds>           Specifies how long to measure for. Defaults to 10.\n"
+           "-g <n>                 Specifies the number of groups. Client i joins \n"
+           "                       group i mod n and sends to group i + 1 mod n. \n"
+           "                       Defaults to 1.\n"
+           "-h                     Displays this help message.\n"
+           "-m <command>[=<weight>],...\n"
+           "                       Specifies the mix of commands. send and \n"
+           "                       broadcast are weighted; wait (the default) \n"
+           "                       receives with a wait followed by a sync, and \n"
+           "                       sync polls with sync alone. Defaults to send.\n"
+           "-n <n>                 Specifies how many sends or broadcasts each \n"
+           "                       client may await a reply to. Defaults to 16.\n"
+           "-o <file>              Writes the results to a file instead of stdout.\n"
+           "-r <rate>              Specifies the messages per second sent by each \n"
+           "                       client, or 0 to send as fast as replies allow. \n"
+           "                       Defaults to 0.\n"
+           "-s <bytes>             Specifies the size of payloads, at least 8. \n"
+           "                       Defaults to 64.\n"
+           "-w <seconds>           Specifies how long to run before measuring. \n"
+           "                       Defaults to 1.\n",
+           argv0);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:c:d:g:hm:n:o:r:s:w:")) >= 0) {
+        switch (opt) {
+        case 'a':
+            cfg.addr = optarg;
+            break;
+
+        case 'c':
+            cfg.clients = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'd':
+            cfg.duration = strtod(optarg, NULL);
+            break;
+
+        case 'g':
+            cfg.groups = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'h':
+            usage(argv[0]);
+            return 0;
+
+        case 'm':
+            if (parse_mix(optarg) < 0) {
+                goto usage_err;
+            }
+
+            break;
+
+        case 'n':
+            cfg.window = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'o':
+            cfg.output = optarg;
+            break;
+
+        case 'r':
+            cfg.rate = strtod(optarg, NULL);
+            break;
+
+        case 's':
+            cfg.size = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'w':
+            cfg.warmup = strtod(optarg, NULL);
+            break;
+
+        default:
+            goto usage_err;
+        }
+    }
+
+    if (optind < argc || cfg.clients == 0 || cfg.groups == 0 || cfg.window == 0 ||
+        cfg.size < sizeof(uint64_t) || cfg.duration <= 0 || cfg.warmup < 0 || cfg.rate < 0) {
+        goto usage_err;
+    }
+
+    bench_client_t *clnts = calloc(cfg.clients, sizeof(bench_client_t));
+    struct pollfd *pfds = calloc(cfg.clients, sizeof(struct pollfd));
+    unsigned char *payload = malloc(cfg.size);
+
+    if (clnts == NULL || pfds == NULL || payload == NULL) {
+        perror("Failed to allocate clients");
+        return 1;
+    }
+
+    memset(payload, 0xa5, cfg.size);
+    dime_hdr_init(&stats.ack);
+    dime_hdr_init(&stats.delivery);
+
+    for (size_t i = 0; i < cfg.clients; i++) {
+        if (bench_open(&clnts[i], i) < 0) {
+            fprintf(stderr, "Failed to connect client %zu to %s: %s\n", i, cfg.addr, strerror(errno));
+            return 1;
+        }
+
+        pfds[i].fd = clnts[i].fd;
+    }
+
+    uint64_t now = bench_now();
+
+    stats.start = now + (uint64_t)(cfg.warmup * 1e9);
+    stats.end = stats.start + (uint64_t)(cfg.duration * 1e9);
+
+    for (size_t i = 0; i < cfg.clients; i++) {
+        /* Spread clients evenly over the first interval */
+        clnts[i].next = now + ((cfg.rate > 0) ? (uint64_t)(1e9 / cfg.rate * i / cfg.clients) : 0);
+    }
+
+    while (now < stats.end) {
+        uint64_t next = stats.end;
+
+        for (size_t i = 0; i < cfg.clients; i++) {
+            if (bench_step(&clnts[i], payload, now, stats.end) < 0 || bench_flush(&clnts[i]) < 0) {
+                fprintf(stderr, "Client %zu failed: %s\n", i, strerror(errno));
+                return 1;
+            }
+
+            pfds[i].events = POLLIN | ((clnts[i].out_len > 0) ? POLLOUT : 0);
+
+            if (cfg.rate > 0 && clnts[i].inflight < cfg.window && clnts[i].next < next) {
+                next = clnts[i].next;
+            }
+        }
+
+        int timeout = (next > now) ? (int)((next - now + 999999) / 1000000) : 0;
+
+        if (poll(pfds, cfg.clients, timeout) < 0 && errno != EINTR) {
+            perror("Failed to poll clients");
+            return 1;
+        }
+
+        for (size_t i = 0; i < cfg.clients; i++) {
+            if ((pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) && bench_read(&clnts[i]) < 0) {
+                fprintf(stderr, "Client %zu failed: %s\n", i, strerror(errno));
+                return 1;
+            }
+        }
+
+        now = bench_now();
+    }
+
+    if (bench_report() < 0) {
+        perror("Failed to write results");
+        return 1;
+    }
+
+    for (size_t i = 0; i < cfg.clients; i++) {
+        close(clnts[i].fd);
+        free(clnts[i].out);
+        free(clnts[i].in);
+        free(clnts[i].pending);
+    }
+
+    free(clnts);
+    free(pfds);
+    free(payload);
+    dime_hdr_destroy(&stats.ack);
+    dime_hdr_destroy(&stats.delivery);
+
+    return 0;
+
+usage_err:
+    fprintf(stderr, "Usage: %s [options]\nTry \"%s -h\" for more information\n",
+            argv[0], argv[0]);
+    return 1;
+}
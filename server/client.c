@@ -23,15 +23,558 @@
 
 #include <jansson.h>
 #include "client.h"
+#include "compress.h"
 #include "deque.h"
+#include "latency.h"
 #include "log.h"
+#include "metrics.h"
+#include "peer.h"
+#include "probes.h"
 #include "server.h"
+#include "session.h"
+#include "spill.h"
 #include "socket.h"
 #include "table.h"
+#include "transcode.h"
+#include "ttl.h"
+#include "udp.h"
+
+static const char *serialization_names[] = {
+    [DIME_MATLAB] = "matlab",
+    [DIME_PICKLE] = "pickle",
+    [DIME_DIMEB] = "dimeb",
+    [DIME_JSON] = "json"
+};
+
+static int serialization_from_str(const char *s) {
+    for (int i = DIME_MATLAB; i <= DIME_JSON; i++) {
+        if (strcmp(s, serialization_names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return DIME_NO_SERIALIZATION;
+}
+
+static const char *format_names[] = {
+    [DIME_FORMAT_OPAQUE] = "opaque",
+    [DIME_FORMAT_JSON] = "json",
+    [DIME_FORMAT_DIMEB] = "dimeb",
+    [DIME_FORMAT_DIMEB2_LE] = "dimeb v2 (little-endian)",
+    [DIME_FORMAT_DIMEB2_BE] = "dimeb v2 (big-endian)"
+};
+
+/*
+ * Format in which the client "to" should receive a message. Returns
+ * the message's own format if it can be passed through as-is, another
+ * format if it must be transcoded, or a negative value if the payload
+ * is opaque (MATLAB or pickle) and cannot be understood by the
+ * recipient. Every client that decodes dimeb accepts v1, so dimeb is
+ * only transcoded when a v2 payload's byte order differs from the
+ * recipient's.
+ */
+static int payload_format(const dime_client_t *to, const dime_rcmessage_t *msg) {
+    int from = msg->format;
+
+    if (to->serialization == DIME_NO_SERIALIZATION || msg->serialization == DIME_NO_SERIALIZATION) {
+        return from;
+    }
+
+    if (from == DIME_FORMAT_OPAQUE) {
+        return (to->serialization == msg->serialization) ? from : -1;
+    }
+
+    switch (to->serialization) {
+    case DIME_JSON:
+        return DIME_FORMAT_JSON;
+
+    case DIME_PICKLE:
+        /* The Python client decodes every language-neutral format */
+        if (from == DIME_FORMAT_JSON) {
+            return from;
+        }
+
+        /* Fall through */
+
+    default:
+        if (from == DIME_FORMAT_DIMEB || from == to->dimeb_format) {
+            return from;
+        }
+
+        return to->dimeb_format;
+    }
+}
+
+static void rcmessage_free(dime_rcmessage_t *msg, dime_server_t *srv) {
+    srv->msgs_live--;
+    srv->msgs_bytes -= msg->size;
+
+    if (msg->spilled) {
+        dime_spill_free(&srv->spill, msg->spill_off, msg->bindata_len);
+    }
+
+    free(msg->jsondata);
+    free(msg->bindata);
+
+    for (size_t i = 0; i < msg->xs_len; i++) {
+        free(msg->xs[i].jsondata);
+        free(msg->xs[i].bindata);
+    }
+
+    for (size_t i = 0; i <= msg->xs_len; i++) {
+        for (int codec = 0; codec < DIME_COMPRESS_MAX; codec++) {
+            free(msg->zs[i][codec].frame);
+        }
+    }
+
+    free(msg);
+}
+
+/*
+ * Determine the serialization and format of a message that is about to
+ * be relayed, and reset its transcoded and compressed copies
+ */
+static void rcmessage_init(dime_rcmessage_t *msg, dime_server_t *srv, json_t *jsondata) {
+    const char *serialization;
+
+    if (json_unpack(jsondata, "{ss}", "serialization", &serialization) < 0) {
+        serialization = "";
+    }
+
+    msg->serialization = serialization_from_str(serialization);
+    msg->format = dime_format_detect(msg->serialization, msg->bindata, msg->bindata_len);
+    msg->xs_len = 0;
+    msg->size = strlen(msg->jsondata) + msg->bindata_len;
+
+    memset(msg->zs, 0, sizeof(msg->zs));
+
+    msg->latency = NULL;
+    msg->traced = 0;
+    msg->queued = 0;
+    msg->spilled = 0;
+    msg->expires = 0;
+
+    /* "priority" may be a boolean or a level, of which only >0 counts */
+    json_t *priority = json_object_get(jsondata, "priority");
+
+    msg->urgent = json_is_true(priority) ||
+                  (json_is_integer(priority) && json_integer_value(priority) > 0);
+
+    srv->msgs_total++;
+    srv->msgs_live++;
+    srv->msgs_bytes += msg->size;
+}
+
+/*
+ * Number a message in the order it is routed while any client receives
+ * datagrams, so that clients can tell whether a datagram or a copy from
+ * their queue is the later one
+ */
+static void rcmessage_order(json_t *jsondata, dime_server_t *srv) {
+    if (srv->udp_clnts > 0) {
+        json_object_set_new(jsondata, "order", json_integer((json_int_t)srv->msgs_total + 1));
+    }
+}
+
+/*
+ * Look up the payload to send to the client "clnt", which is either
+ * the message itself or one of its transcoded copies. Returns 0 for the
+ * message itself, or 1 plus the index of the transcoded copy.
+ */
+static size_t rcmessage_payload(const dime_rcmessage_t *msg, const dime_client_t *clnt, const char **pjsondata, const void **pbindata, size_t *pbindata_len) {
+    int fmt = payload_format(clnt, msg);
+
+    for (size_t i = 0; i < msg->xs_len; i++) {
+        if (msg->xs[i].format == fmt) {
+            *pjsondata = msg->xs[i].jsondata;
+            *pbindata = msg->xs[i].bindata;
+            *pbindata_len = msg->xs[i].bindata_len;
+
+            return i + 1;
+        }
+    }
+
+    *pjsondata = msg->jsondata;
+    *pbindata = msg->bindata;
+    *pbindata_len = msg->bindata_len;
+
+    return 0;
+}
+
+/*
+ * Push a copy of a message to the client "clnt", compressing it first
+ * if the client negotiated compression. The compressed frame is cached
+ * in the message, so each copy is compressed at most once per codec no
+ * matter how many recipients share it.
+ */
+static ssize_t rcmessage_push(dime_rcmessage_t *msg, dime_client_t *clnt, dime_server_t *srv) {
+    const char *msgjson;
+    const void *msgbin;
+    size_t msgbin_len;
+
+    size_t slot = rcmessage_payload(msg, clnt, &msgjson, &msgbin, &msgbin_len);
+
+    /* Spilled messages are copied to the socket straight from the store */
+    if (slot == 0 && msg->spilled) {
+        msgbin = dime_spill_ptr(&srv->spill, msg->spill_off);
+    }
+    size_t msgjson_len = strlen(msgjson);
+    int codec = clnt->sock.compress.codec;
+
+    clnt->msgs_out++;
+    srv->msgs_out++;
+
+    ssize_t ret;
+
+    if (codec == DIME_COMPRESS_NONE || 12 + msgjson_len + msgbin_len < clnt->sock.compress.threshold) {
+        ret = dime_socket_push_str(&clnt->sock, msgjson, msgbin, msgbin_len);
+    } else {
+        if (!msg->zs[slot][codec].tried) {
+            msg->zs[slot][codec].tried = 1;
+
+            if (dime_compress_frame(codec, clnt->sock.compress.level, msgjson, msgjson_len, msgbin, msgbin_len, &msg->zs[slot][codec].frame, &msg->zs[slot][codec].frame_len) <= 0) {
+                msg->zs[slot][codec].frame = NULL;
+            } else if (srv->verbosity >= 3) {
+                dime_info("Compressed a variable with %s (%zu to %zu bytes)", dime_compress_name(codec), 12 + msgjson_len + msgbin_len, msg->zs[slot][codec].frame_len);
+            }
+        }
+
+        if (msg->zs[slot][codec].frame == NULL) {
+            ret = dime_socket_push_str(&clnt->sock, msgjson, msgbin, msgbin_len);
+        } else {
+            ret = dime_socket_push_frame(&clnt->sock, msg->zs[slot][codec].frame, msg->zs[slot][codec].frame_len);
+        }
+    }
+
+    dime_client_outbuf(clnt, srv);
+
+    return ret;
+}
+
+/* Whether a forwarded message is skipped for the client "to" */
+static int rcmessage_undecodable(const dime_rcmessage_t *msg, const dime_client_t *from, const dime_client_t *to) {
+    return from->peer && payload_format(to, msg) < 0;
+}
+
+/*
+ * Check that every recipient can understand a message, building a
+ * transcoded copy for each format that any of them needs. Returns 0 if
+ * the message can be relayed, 1 if the sender was asked to reregister
+ * with "dimeb" and resend (the message should be dropped), or -1 on
+ * failure (an error response has already been queued for the sender).
+ * A message forwarded by a peer cannot be resent, so it is relayed to
+ * the recipients that can decode it, and skipped for the others (see
+ * rcmessage_undecodable).
+ */
+static int rcmessage_prepare(dime_rcmessage_t *msg, dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, dime_client_t **clnts, size_t clnts_len) {
+    for (size_t i = 0; i < clnts_len; i++) {
+        int fmt = payload_format(clnts[i], msg);
+
+        if (fmt < 0 && clnt->peer) {
+            if (srv->verbosity >= 1) {
+                dime_warn("Dropped a %s payload forwarded by %s for %s, which cannot decode it", serialization_names[msg->serialization], clnt->addr, clnts[i]->addr);
+            }
+
+            srv->msgs_undecodable++;
+
+            continue;
+        }
+
+        if (fmt < 0) {
+            if (srv->verbosity >= 2) {
+                dime_info("%s sent a %s payload that %s cannot decode, asking it to reregister", clnt->addr, serialization_names[msg->serialization], clnts[i]->addr);
+            }
+
+            json_t *meta = json_pack("{sisbssss}", "status", 1, "meta", 1, "command", "reregister", "serialization", "dimeb");
+            if (meta == NULL) {
+                strncpy(srv->err, strerror(errno), sizeof(srv->err));
+                srv->err[sizeof(srv->err) - 1] = '\0';
+
+                return -1;
+            }
+
+            if (dime_socket_push(&clnt->sock, meta, NULL, 0) < 0) {
+                json_decref(meta);
+
+                strncpy(srv->err, strerror(errno), sizeof(srv->err));
+                srv->err[sizeof(srv->err) - 1] = '\0';
+
+                return -1;
+            }
+
+            json_decref(meta);
+
+            return 1;
+        }
+
+        if (fmt == msg->format) {
+            continue;
+        }
+
+        size_t j;
+
+        for (j = 0; j < msg->xs_len; j++) {
+            if (msg->xs[j].format == fmt) {
+                break;
+            }
+        }
+
+        if (j < msg->xs_len) {
+            continue;
+        }
+
+        void *bindata;
+        size_t bindata_len;
+        char *xjsondata;
+
+        if (dime_transcode(msg->format, fmt, msg->bindata, msg->bindata_len, &bindata, &bindata_len) < 0) {
+            strncpy(srv->err, "Cannot transcode variable to ", sizeof(srv->err));
+            strncat(srv->err, format_names[fmt], sizeof(srv->err) - strlen(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            json_t *response = json_pack("{siss+}", "status", -1, "error", "Cannot transcode variable to ", format_names[fmt]);
+            if (response != NULL) {
+                dime_socket_push(&clnt->sock, response, NULL, 0);
+                json_decref(response);
+            }
+
+            return -1;
+        }
+
+        const char *serialization = serialization_names[(fmt == DIME_FORMAT_JSON) ? DIME_JSON : DIME_DIMEB];
+
+        if (json_object_set_new(jsondata, "serialization", json_string(serialization)) < 0 ||
+            (xjsondata = json_dumps(jsondata, JSON_COMPACT)) == NULL) {
+            free(bindata);
+
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            json_t *response = json_pack("{siss}", "status", -1, "error", strerror(errno));
+            if (response != NULL) {
+                dime_socket_push(&clnt->sock, response, NULL, 0);
+                json_decref(response);
+            }
+
+            return -1;
+        }
+
+        msg->xs[j].format = fmt;
+        msg->xs[j].jsondata = xjsondata;
+        msg->xs[j].bindata = bindata;
+        msg->xs[j].bindata_len = bindata_len;
+        msg->xs_len++;
+
+        if (srv->verbosity >= 3) {
+            dime_info("Transcoded a variable from %s to %s (%zu to %zu bytes)", format_names[msg->format], format_names[fmt], msg->bindata_len, bindata_len);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Move the binary portion of a message that was just queued to the
+ * spill store if the messages and outbuffers in memory are over the
+ * server's budget.
+ * Being at the back of its queues, it is the last to be sent. Urgent
+ * and transcoded messages, and small ones, are kept in memory.
+ */
+static void rcmessage_spill(dime_rcmessage_t *msg, dime_server_t *srv) {
+    if (srv->mem_max == 0 || srv->msgs_bytes - srv->spill.bytes + srv->outbuf_bytes <= srv->mem_max ||
+        msg->urgent || msg->xs_len > 0 || msg->bindata_len < DIME_SPILL_MIN) {
+        return;
+    }
+
+    if (dime_spill_write(&srv->spill, msg->bindata, msg->bindata_len, &msg->spill_off) < 0) {
+        if (srv->verbosity >= 1) {
+            dime_warn("Could not spill a message to %s (%s)", srv->spill.dir, strerror(errno));
+        }
+
+        return;
+    }
+
+    free(msg->bindata);
+    msg->bindata = NULL;
+    msg->spilled = 1;
+
+    /* Frames compressed for peers are made again from the store if needed */
+    for (int codec = 0; codec < DIME_COMPRESS_MAX; codec++) {
+        free(msg->zs[0][codec].frame);
+
+        msg->zs[0][codec].frame = NULL;
+        msg->zs[0][codec].tried = 0;
+    }
+}
+
+/*
+ * Send an urgent message to the client "clnt" as part of a sync reply
+ * that is still being sent, ahead of the variables in it that have not
+ * gone out yet. Returns 1 if the message was sent this way, 0 if it
+ * should be queued instead, or -1 on failure.
+ */
+static int rcmessage_splice(dime_rcmessage_t *msg, dime_client_t *clnt, dime_server_t *srv) {
+    /* A sync that is still being sent takes urgent messages off the queue */
+    if (clnt->waiting || clnt->syncing || (clnt->session != NULL && clnt->session->held)) {
+        return 0;
+    }
+
+    size_t ahead = dime_socket_urgentlen(&clnt->sock);
+
+    if (ahead == SIZE_MAX) {
+        return 0;
+    }
+
+    uint64_t at = clnt->bytes_out + ahead;
+
+    /* Clients read a sync reply until its status, so only it can take more */
+    if (at < clnt->sync_begin || at > clnt->sync_end ||
+        clnt->sync_end >= clnt->bytes_out + dime_socket_sendlen(&clnt->sock)) {
+        return 0;
+    }
+
+    dime_socket_lane(&clnt->sock, DIME_LANE_URGENT);
+
+    ssize_t len = rcmessage_push(msg, clnt, srv);
+
+    dime_socket_lane(&clnt->sock, DIME_LANE_BULK);
+
+    if (len < 0) {
+        return -1;
+    }
+
+    clnt->sync_end += len;
+
+    dime_latency_spliced(clnt, msg, at, len);
+
+    return 1;
+}
+
+/*
+ * Add a message to the queue of the client "clnt". Urgent messages go
+ * ahead of the bulk ones, but after the urgent messages before them.
+ */
+static int rcmessage_enqueue(dime_rcmessage_t *msg, dime_client_t *clnt) {
+    if (!msg->urgent) {
+        return dime_deque_pushr(&clnt->queue, msg);
+    }
+
+    if (dime_deque_insert(&clnt->queue, clnt->queue_urgent, msg) < 0) {
+        return -1;
+    }
+
+    clnt->queue_urgent++;
+
+    return 0;
+}
+
+/*
+ * Set when the message "msg" expires from its "ttl" field, which
+ * overrides the default "ttl" of its destination. A TTL of 0 means the
+ * message never expires.
+ */
+static void rcmessage_ttl(dime_rcmessage_t *msg, json_t *jsondata, double ttl) {
+    json_t *field = json_object_get(jsondata, "ttl");
+
+    if (json_is_number(field)) {
+        ttl = json_number_value(field);
+    }
+
+    if (ttl > 0) {
+        msg->expires = dime_socket_now() + ttl;
+    }
+}
+
+/*
+ * Account for the queue of the client "clnt" changing from "depth"
+ * messages of "bytes" bytes to what it holds now
+ */
+static void rcmessage_requeued(dime_client_t *clnt, dime_server_t *srv, size_t depth, size_t bytes) {
+    dime_metrics_queue(srv, depth, dime_deque_len(&clnt->queue), bytes, clnt->queue_bytes);
+}
+
+/* Drop an expired message from the queue of the client "clnt" */
+static void rcmessage_expire(dime_rcmessage_t *msg, dime_client_t *clnt, dime_server_t *srv) {
+    if (msg->urgent) {
+        clnt->queue_urgent--;
+    }
+
+    clnt->queue_bytes -= msg->size;
+    clnt->msgs_expired++;
+    srv->msgs_expired++;
+
+    msg->refs--;
+
+    if (msg->refs == 0) {
+        rcmessage_free(msg, srv);
+    }
+}
+
+/*
+ * Account for a message queued for a held session, dropping the oldest
+ * messages once its queue outgrows the server's budget. Bulk messages
+ * are dropped before urgent ones, and the message just queued is always
+ * kept.
+ */
+static void rcmessage_hold(dime_rcmessage_t *msg, dime_client_t *clnt, dime_server_t *srv) {
+    dime_session_t *sess = clnt->session;
+    size_t depth = dime_deque_len(&clnt->queue), bytes = clnt->queue_bytes;
+
+    while (clnt->queue_bytes > srv->session_max && dime_deque_len(&clnt->queue) > 1) {
+        /* The message just queued is the last of its lane */
+        size_t bulk = dime_deque_len(&clnt->queue) - clnt->queue_urgent - (msg->urgent ? 0 : 1);
+        size_t i = (bulk > 0) ? clnt->queue_urgent : 0;
+
+        dime_rcmessage_t *old = dime_deque_remove(&clnt->queue, i);
+
+        if (old->urgent) {
+            clnt->queue_urgent--;
+        }
+
+        clnt->queue_bytes -= old->size;
+        sess->lost++;
+
+        old->refs--;
+
+        if (old->refs == 0) {
+            rcmessage_free(old, srv);
+        }
+    }
+
+    rcmessage_requeued(clnt, srv, depth, bytes);
+}
 
 int dime_client_init(dime_client_t *clnt, int fd, const struct sockaddr *addr) {
     clnt->fd = fd;
     clnt->waiting = 0;
+    clnt->ready = 0;
+    clnt->serialization = DIME_NO_SERIALIZATION;
+    clnt->dimeb_format = DIME_FORMAT_DIMEB;
+    clnt->peer = 0;
+    clnt->outbound = 0;
+    clnt->active = 0;
+    clnt->node = NULL;
+    clnt->udp = 0;
+    clnt->udp_id = 0;
+    clnt->session = NULL;
+    clnt->queue_bytes = 0;
+    clnt->queue_urgent = 0;
+    clnt->msgs_expired = 0;
+    clnt->expires = 0;
+    clnt->ttl_slot = 0;
+    clnt->ttl_idx = 0;
+    clnt->sync_begin = 0;
+    clnt->sync_end = 0;
+    clnt->syncing = 0;
+    clnt->sync_n = 0;
+    clnt->sync_left = 0;
+    clnt->sync_bulk = 0;
+    clnt->outbuf_len = 0;
+    clnt->bytes_in = 0;
+    clnt->bytes_out = 0;
+    clnt->msgs_in = 0;
+    clnt->msgs_out = 0;
+    clnt->traces_len = 0;
     clnt->err[0] = '\0';
 
     switch (addr->sa_family) {
@@ -131,6 +674,13 @@ int dime_client_init(dime_client_t *clnt, int fd, const struct sockaddr *addr) {
 }
 
 void dime_client_destroy(dime_client_t *clnt) {
+    DIME_PROBE4(close, clnt->fd, clnt->addr, clnt->bytes_in, clnt->bytes_out);
+
+    dime_session_release(clnt->srv, clnt);
+    dime_ttl_reset(clnt->srv, clnt, 0);
+
+    clnt->srv->outbuf_bytes -= clnt->outbuf_len;
+
     for (size_t i = 0; i < clnt->groups_len; i++) {
         dime_group_t *group = clnt->groups[i];
 
@@ -142,6 +692,14 @@ void dime_client_destroy(dime_client_t *clnt) {
                 break;
             }
         }
+
+        if (group->clnts_len == 0) {
+            dime_peer_update(clnt->srv, group->name, 0);
+        }
+    }
+
+    if (dime_deque_len(&clnt->queue) > 0) {
+        dime_metrics_queue(clnt->srv, dime_deque_len(&clnt->queue), 0, clnt->queue_bytes, 0);
     }
 
     dime_deque_iter_t it;
@@ -154,16 +712,35 @@ void dime_client_destroy(dime_client_t *clnt) {
         msg->refs--;
 
         if (msg->refs == 0) {
-            free(msg->jsondata);
-            free(msg->bindata);
-            free(msg);
+            rcmessage_free(msg, clnt->srv);
         }
     }
 
+    if (clnt->peer) {
+        dime_table_iter_t tit;
+
+        dime_table_iter_init(&tit, &clnt->peer_groups);
+
+        while (dime_table_iter_next(&tit)) {
+            free(tit.val);
+        }
+
+        dime_table_destroy(&clnt->peer_groups);
+    }
+
+    if (clnt->udp) {
+        clnt->srv->udp_clnts--;
+    }
+
+    free(clnt->node);
     free(clnt->addr);
     free(clnt->groups);
     dime_deque_destroy(&clnt->queue);
-    dime_socket_destroy(&clnt->sock);
+
+    /* Held clients have no connection */
+    if (clnt->fd >= 0) {
+        dime_socket_destroy(&clnt->sock);
+    }
 }
 
 int dime_client_handshake(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len) {
@@ -186,70 +763,71 @@ int dime_client_handshake(dime_client_t *clnt, dime_server_t *srv, json_t *jsond
         return -1;
     }
 
-    int serialization_i;
+    int serialization_i = serialization_from_str(serialization);
+
+    if (serialization_i == DIME_NO_SERIALIZATION) {
+        strncpy(srv->err, "Unknown serialization: ", sizeof(srv->err));
+        strncat(srv->err, serialization, sizeof(srv->err) - strlen(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        json_t *response = json_pack("{siss+}", "status", -1, "error", "Unknown serialization: ", serialization);
+        if (response != NULL) {
+            dime_socket_push(&clnt->sock, response, NULL, 0);
+            json_decref(response);
+        }
 
-    if (strcmp(serialization, "matlab") == 0) {
-        serialization_i = DIME_MATLAB;
-    } else if (strcmp(serialization, "pickle") == 0) {
-        serialization_i = DIME_PICKLE;
-    } else if (strcmp(serialization, "dimeb") == 0) {
-        serialization_i = DIME_DIMEB;
-    } else if (strcmp(serialization, "json") == 0) {
-        serialization_i = DIME_JSON;
-    } else {
         return -1;
     }
 
-    if (srv->serialization == DIME_NO_SERIALIZATION) {
-        srv->serialization = serialization_i;
-    } else if (srv->serialization != serialization_i && srv->serialization != DIME_DIMEB && srv->serialization != DIME_JSON) {
-        json_t *meta = json_pack("{sisbssss}", "status", 1, "meta", 1, "command", "reregister", "serialization", "dimeb");
-        if (meta == NULL) {
-            return -1;
-        }
+    json_int_t dimeb_version = 1;
+    const char *byteorder = "";
 
-        char *meta_str = json_dumps(meta, JSON_COMPACT);
-        if (meta_str == NULL) {
-            json_decref(meta);
+    json_t *compression = NULL;
+    json_t *udp = NULL;
+    const char *session = NULL;
+    const char *token = NULL;
 
-            return -1;
-        }
+    json_unpack(jsondata, "{s?I}", "dimeb_version", &dimeb_version);
+    json_unpack(jsondata, "{s?s}", "byteorder", &byteorder);
+    json_unpack(jsondata, "{s?o}", "compression", &compression);
+    json_unpack(jsondata, "{s?o}", "udp", &udp);
+    json_unpack(jsondata, "{s?s}", "session", &session);
+    json_unpack(jsondata, "{s?s}", "token", &token);
 
-        json_decref(meta);
+    /* Pick the client's most preferred codec that the server allows */
+    int codec = DIME_COMPRESS_NONE;
 
-        dime_table_iter_t it;
-        dime_table_iter_init(&it, &srv->fd2clnt);
+    for (size_t i = 0; compression != NULL && codec == DIME_COMPRESS_NONE; i++) {
+        json_t *name = json_is_array(compression) ? json_array_get(compression, i) : compression;
 
-        while (dime_table_iter_next(&it)) {
-            dime_client_t *other = it.val;
+        if (!json_is_string(name)) {
+            break;
+        }
 
-            if (other != clnt && dime_socket_push_str(&other->sock, meta_str, NULL, 0) < 0) {
-                free(meta_str);
+        int c = dime_compress_from_str(json_string_value(name));
 
-                return -1;
-            }
+        if (c > DIME_COMPRESS_NONE && (srv->compress_codecs & (1u << c))) {
+            codec = c;
         }
 
-        free(meta_str);
-        srv->serialization = DIME_DIMEB;
+        if (!json_is_array(compression)) {
+            break;
+        }
     }
 
-    switch (srv->serialization) {
-    case DIME_MATLAB:
-        serialization = "matlab";
-        break;
-
-    case DIME_PICKLE:
-        serialization = "pickle";
-        break;
+    clnt->serialization = serialization_i;
+    clnt->dimeb_format = DIME_FORMAT_DIMEB;
 
-    case DIME_DIMEB:
-        serialization = "dimeb";
-        break;
+    if (dimeb_version >= 2) {
+        if (strcmp(byteorder, "little") == 0) {
+            clnt->dimeb_format = DIME_FORMAT_DIMEB2_LE;
+        } else if (strcmp(byteorder, "big") == 0) {
+            clnt->dimeb_format = DIME_FORMAT_DIMEB2_BE;
+        }
+    }
 
-    case DIME_JSON:
-        serialization = "json";
-        break;
+    if (srv->verbosity >= 2) {
+        dime_info("%s registered with serialization \"%s\"", clnt->addr, serialization);
     }
 
     tls = (tls && srv->tlsctx != NULL);
@@ -259,6 +837,44 @@ int dime_client_handshake(dime_client_t *clnt, dime_server_t *srv, json_t *jsond
         return -1;
     }
 
+    if (clnt->dimeb_format != DIME_FORMAT_DIMEB) {
+        json_object_set_new(response, "dimeb_version", json_integer(2));
+        json_object_set_new(response, "byteorder", json_string(byteorder));
+    }
+
+    if (compression != NULL) {
+        json_object_set_new(response, "compression", json_string(dime_compress_name(codec)));
+        json_object_set_new(response, "compression_threshold", json_integer(srv->compress_threshold));
+    }
+
+    /* Datagrams are not encrypted, so they are only for plaintext clients */
+    if (udp != NULL) {
+        json_int_t port = json_integer_value(udp);
+        json_t *reply = (!tls && !clnt->udp && port > 0 && port <= 65535) ? dime_udp_register(clnt, srv, port) : json_false();
+
+        if (reply == NULL || json_object_set_new(response, "udp", reply) < 0) {
+            json_decref(response);
+
+            return -1;
+        }
+
+        if (clnt->udp && srv->verbosity >= 2) {
+            dime_info("%s receives small broadcasts as datagrams", clnt->addr);
+        }
+    }
+
+    if (session != NULL && dime_session_open(clnt, srv, session, token, response) < 0) {
+        json_decref(response);
+
+        response = json_pack("{siss}", "status", -1, "error", srv->err);
+        if (response != NULL) {
+            dime_socket_push(&clnt->sock, response, NULL, 0);
+            json_decref(response);
+        }
+
+        return -1;
+    }
+
     if (dime_socket_push(&clnt->sock, response, NULL, 0) < 0) {
         json_decref(response);
 
@@ -267,17 +883,27 @@ int dime_client_handshake(dime_client_t *clnt, dime_server_t *srv, json_t *jsond
 
     json_decref(response);
 
-    if (tls) {
-        if (srv->verbosity >= 1) {
-            dime_warn("Temporarily pausing event loop to handle a TLS handshake");
+    if (codec != DIME_COMPRESS_NONE) {
+        if (dime_socket_init_compress(&clnt->sock, codec, srv->compress_levels[codec], srv->compress_threshold) < 0) {
+            return -1;
         }
 
+        if (srv->verbosity >= 2) {
+            dime_info("%s negotiated %s compression", clnt->addr, dime_compress_name(codec));
+        }
+    }
+
+    /* The handshake itself is driven by the event loop */
+    if (tls) {
         if (dime_socket_init_tls(&clnt->sock, srv->tlsctx) < 0) {
+            strncpy(srv->err, clnt->sock.err, sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
             return -1;
         }
 
-        if (srv->verbosity >= 1) {
-            dime_warn("TLS handshake established with %s", clnt->addr);
+        if (srv->verbosity >= 2) {
+            dime_info("Starting TLS handshake with %s", clnt->addr);
         }
     }
 
@@ -370,6 +996,10 @@ int dime_client_join(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
 
             group->clnts_len = 0;
             group->clnts_cap = 4;
+            group->msgs = 0;
+            group->bytes = 0;
+            group->deliveries = 0;
+            group->ttl = dime_ttl_default(srv, name);
 
             group->clnts = malloc(sizeof(dime_client_t *) * group->clnts_cap);
             if (group->clnts == NULL) {
@@ -457,6 +1087,16 @@ int dime_client_join(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
         if (srv->verbosity >= 2) {
             dime_info("%s joined group \"%s\"", clnt->addr, group->name);
         }
+
+        if (group->clnts_len == 1 && dime_peer_update(srv, group->name, 1) < 0) {
+            json_t *response = json_pack("{siss}", "status", -1, "error", srv->err);
+            if (response != NULL) {
+                dime_socket_push(&clnt->sock, response, NULL, 0);
+                json_decref(response);
+            }
+
+            return -1;
+        }
     }
 
     if (dime_socket_push_str(&clnt->sock, "{\"status\":0}", NULL, 0) < 0) {
@@ -527,6 +1167,16 @@ int dime_client_leave(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
                             dime_info("%s left group \"%s\"", clnt->addr, group->name);
                         }
 
+                        if (group->clnts_len == 0 && dime_peer_update(srv, group->name, 0) < 0) {
+                            json_t *response = json_pack("{siss}", "status", -1, "error", srv->err);
+                            if (response != NULL) {
+                                dime_socket_push(&clnt->sock, response, NULL, 0);
+                                json_decref(response);
+                            }
+
+                            return -1;
+                        }
+
                         goto next;
                     }
                 }
@@ -586,7 +1236,27 @@ int dime_client_send(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
     }
 
     dime_group_t *group = dime_table_search(&srv->name2clnt, name);
-    if (group == NULL || group->clnts_len == 0) {
+    dime_client_t **clnts = (group != NULL) ? group->clnts : NULL;
+    size_t clnts_len = (group != NULL) ? group->clnts_len : 0;
+    size_t npeers = 0;
+
+    /* Messages forwarded by peers are only delivered locally */
+    if (!clnt->peer) {
+        for (size_t i = 0; i < srv->peers_len; i++) {
+            npeers += dime_peer_has_group(srv->peers[i], name);
+        }
+    }
+
+    if (clnts_len == 0 && clnt->peer) {
+        /* The group's last member left while the message was in flight */
+        if (srv->verbosity >= 2) {
+            dime_info("Dropped a variable forwarded by %s to empty group \"%s\"", clnt->addr, name);
+        }
+
+        return 0;
+    }
+
+    if (clnts_len == 0 && npeers == 0) {
         strncpy(srv->err, "No such group exists: ", sizeof(srv->err));
         strncat(srv->err, name, sizeof(srv->err) - strlen(srv->err));
         srv->err[sizeof(srv->err) - 1] = '\0';
@@ -614,6 +1284,8 @@ int dime_client_send(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
         return -1;
     }
 
+    rcmessage_order(jsondata, srv);
+
     msg->jsondata = json_dumps(jsondata, JSON_COMPACT);
     if (msg->jsondata == NULL) {
         free(msg);
@@ -636,12 +1308,49 @@ int dime_client_send(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
 
     *pbindata = NULL;
 
-    for (size_t i = 0; i < group->clnts_len; i++) {
-        if (dime_deque_pushr(&group->clnts[i]->queue, msg) < 0) {
+    rcmessage_init(msg, srv, jsondata);
+    rcmessage_ttl(msg, jsondata, (group != NULL) ? group->ttl : dime_ttl_default(srv, name));
+    dime_latency_trace(srv, msg, name);
+
+    switch (rcmessage_prepare(msg, clnt, srv, jsondata, clnts, clnts_len)) {
+    case 0:
+        break;
+
+    case 1:
+        rcmessage_free(msg, srv);
+
+        if (dime_socket_push_str(&clnt->sock, "{\"status\":0}", NULL, 0) < 0) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+
+        return 0;
+
+    default:
+        rcmessage_free(msg, srv);
+
+        return -1;
+    }
+
+    size_t spliced = 0;
+
+    for (size_t i = 0; i < clnts_len; i++) {
+        if (rcmessage_undecodable(msg, clnt, clnts[i])) {
+            continue;
+        }
+
+        int ret = msg->urgent ? rcmessage_splice(msg, clnts[i], srv) : 0;
+
+        if (ret > 0) {
+            spliced++;
+            continue;
+        }
+
+        if (ret < 0 || rcmessage_enqueue(msg, clnts[i]) < 0) {
             if (msg->refs == 0) {
-                free(msg->jsondata);
-                free(msg->bindata);
-                free(msg);
+                rcmessage_free(msg, srv);
             }
 
             strncpy(srv->err, strerror(errno), sizeof(srv->err));
@@ -656,22 +1365,22 @@ int dime_client_send(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
             return -1;
         }
 
-        if (group->clnts[i]->waiting) {
-            json_t *response = json_pack("{sisI}", "status", 0, "n", (json_int_t)dime_deque_len(&group->clnts[i]->queue));
+        if (clnts[i]->waiting) {
+            json_t *response = json_pack("{sisI}", "status", 0, "n", (json_int_t)dime_deque_len(&clnts[i]->queue));
             if (response == NULL) {
                 strncpy(srv->err, strerror(errno), sizeof(srv->err));
                 srv->err[sizeof(srv->err) - 1] = '\0';
 
                 response = json_pack("{siss}", "status", -1, "error", strerror(errno));
                 if (response != NULL) {
-                    dime_socket_push(&group->clnts[i]->sock, response, NULL, 0);
+                    dime_socket_push(&clnts[i]->sock, response, NULL, 0);
                     json_decref(response);
                 }
 
                 return -1;
             }
 
-            if (dime_socket_push(&group->clnts[i]->sock, response, NULL, 0) < 0) {
+            if (dime_socket_push(&clnts[i]->sock, response, NULL, 0) < 0) {
                 json_decref(response);
 
                 strncpy(srv->err, strerror(errno), sizeof(srv->err));
@@ -679,21 +1388,69 @@ int dime_client_send(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
 
                 response = json_pack("{siss}", "status", -1, "error", strerror(errno));
                 if (response != NULL) {
-                    dime_socket_push(&group->clnts[i]->sock, response, NULL, 0);
+                    dime_socket_push(&clnts[i]->sock, response, NULL, 0);
                     json_decref(response);
                 }
 
                 return -1;
             }
 
-            group->clnts[i]->waiting = 0;
+            clnts[i]->waiting = 0;
             json_decref(response);
+
+            DIME_PROBE2(wait_wake, clnts[i]->fd, dime_deque_len(&clnts[i]->queue));
         }
 
         msg->refs++;
+        clnts[i]->queue_bytes += msg->size;
+
+        rcmessage_requeued(clnts[i], srv, dime_deque_len(&clnts[i]->queue) - 1, clnts[i]->queue_bytes - msg->size);
+
+        DIME_PROBE4(enqueue, clnts[i]->fd, name, msg->size, dime_deque_len(&clnts[i]->queue));
+
+        if (msg->expires > 0) {
+            dime_ttl_schedule(srv, clnts[i], msg->expires);
+        }
+
+        if (clnts[i]->session != NULL && clnts[i]->session->held) {
+            rcmessage_hold(msg, clnts[i], srv);
+        }
+    }
+
+    if (msg->latency != NULL && (msg->refs > 0 || spliced > 0)) {
+        dime_latency_queued(msg);
+    }
+
+    for (size_t i = 0; i < srv->peers_len && npeers > 0; i++) {
+        if (dime_peer_has_group(srv->peers[i], name) && rcmessage_push(msg, srv->peers[i], srv) < 0) {
+            if (msg->refs == 0) {
+                rcmessage_free(msg, srv);
+            }
+
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            json_t *response = json_pack("{siss}", "status", -1, "error", strerror(errno));
+            if (response != NULL) {
+                dime_socket_push(&clnt->sock, response, NULL, 0);
+                json_decref(response);
+            }
+
+            return -1;
+        }
     }
 
-    assert(msg->refs > 0);
+    if (group != NULL) {
+        group->msgs++;
+        group->bytes += msg->size;
+        group->deliveries += clnts_len;
+    }
+
+    if (msg->refs == 0) {
+        rcmessage_free(msg, srv);
+    } else {
+        rcmessage_spill(msg, srv);
+    }
 
     if (srv->verbosity >= 2) {
         const char *varname;
@@ -702,7 +1459,12 @@ int dime_client_send(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
             varname = "(unknown)";
         }
 
-        dime_info("%s sent a variable \"%s\" to group \"%s\"", clnt->addr, varname, group->name);
+        dime_info("%s sent a variable \"%s\" to group \"%s\"", clnt->addr, varname, name);
+    }
+
+    /* Forwarded messages are not acknowledged */
+    if (clnt->peer) {
+        return 0;
     }
 
     if (dime_socket_push_str(&clnt->sock, "{\"status\":0}", NULL, 0) < 0) {
@@ -737,6 +1499,8 @@ int dime_client_broadcast(dime_client_t *clnt, dime_server_t *srv, json_t *jsond
         return -1;
     }
 
+    rcmessage_order(jsondata, srv);
+
     msg->jsondata = json_dumps(jsondata, JSON_COMPACT);
     if (msg->jsondata == NULL) {
         free(msg);
@@ -759,19 +1523,100 @@ int dime_client_broadcast(dime_client_t *clnt, dime_server_t *srv, json_t *jsond
 
     *pbindata = NULL;
 
-    dime_table_iter_t it;
+    rcmessage_init(msg, srv, jsondata);
+    rcmessage_ttl(msg, jsondata, dime_ttl_default(srv, NULL));
+    dime_latency_trace(srv, msg, NULL);
 
-    dime_table_iter_init(&it, &srv->fd2clnt);
+    /* Held sessions receive broadcasts too */
+    int prepared = rcmessage_prepare(msg, clnt, srv, jsondata, srv->clnts, srv->clnts_len);
 
-    while (dime_table_iter_next(&it)) {
-        dime_client_t *other = it.val;
+    if (prepared == 0) {
+        prepared = rcmessage_prepare(msg, clnt, srv, jsondata, srv->held, srv->held_len);
+    }
+
+    switch (prepared) {
+    case 0:
+        break;
+
+    case 1:
+        rcmessage_free(msg, srv);
+
+        if (dime_socket_push_str(&clnt->sock, "{\"status\":0}", NULL, 0) < 0) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+
+        return 0;
+
+    default:
+        rcmessage_free(msg, srv);
+
+        return -1;
+    }
+
+    /* Small broadcasts reach datagram clients without being queued */
+    int reliable = 0;
+    size_t msgjson_len = strlen(msg->jsondata);
+
+    json_unpack(jsondata, "{s?b}", "reliable", &reliable);
+
+    int udp = (srv->udp_clnts > 0 && !reliable &&
+               DIME_UDP_HDRLEN + msgjson_len + msg->bindata_len <= srv->udp_max);
+
+    /*
+     * A multicast datagram reaches every client in the group, so unless
+     * all of them can decode it as sent, it goes through the queues
+     * instead, or some would get it twice
+     */
+    for (size_t i = 0; udp && srv->udp_mode == DIME_UDP_MULTICAST && i < srv->clnts_len + srv->held_len; i++) {
+        dime_client_t *other = (i < srv->clnts_len) ? srv->clnts[i] : srv->held[i - srv->clnts_len];
+
+        if (clnt != other && other->udp && !rcmessage_undecodable(msg, clnt, other) &&
+            payload_format(other, msg) != msg->format) {
+            udp = 0;
+        }
+    }
+
+    if (udp && srv->udp_mode == DIME_UDP_MULTICAST &&
+        dime_udp_send(srv, (struct sockaddr *)&srv->udp_group, sizeof(srv->udp_group), srv->udp_seq++, clnt->udp_id,
+                      msg->jsondata, msgjson_len, msg->bindata, msg->bindata_len) < 0 &&
+        srv->verbosity >= 3) {
+        dime_warn("Dropped a datagram to the multicast group (%s)", strerror(errno));
+    }
+
+    size_t spliced = 0;
+
+    for (size_t i = 0; i < srv->clnts_len + srv->held_len; i++) {
+        dime_client_t *other = (i < srv->clnts_len) ? srv->clnts[i] : srv->held[i - srv->clnts_len];
+
+        if (clnt != other && !other->peer && !rcmessage_undecodable(msg, clnt, other)) {
+            /* With fan-out, clients that cannot decode the datagram get a copy queued */
+            if (udp && other->udp && payload_format(other, msg) == msg->format) {
+                other->msgs_out++;
+                srv->msgs_out++;
+
+                if (srv->udp_mode == DIME_UDP_FANOUT &&
+                    dime_udp_send(srv, (struct sockaddr *)&other->udp_addr, other->udp_addrlen, other->udp_seq++, clnt->udp_id,
+                                  msg->jsondata, msgjson_len, msg->bindata, msg->bindata_len) < 0 &&
+                    srv->verbosity >= 3) {
+                    dime_warn("Dropped a datagram to %s (%s)", other->addr, strerror(errno));
+                }
 
-        if (clnt->fd != other->fd) {
-            if (dime_deque_pushr(&other->queue, msg) < 0) {
+                continue;
+            }
+
+            int ret = msg->urgent ? rcmessage_splice(msg, other, srv) : 0;
+
+            if (ret > 0) {
+                spliced++;
+                continue;
+            }
+
+            if (ret < 0 || rcmessage_enqueue(msg, other) < 0) {
                 if (msg->refs == 0) {
-                    free(msg->jsondata);
-                    free(msg->bindata);
-                    free(msg);
+                    rcmessage_free(msg, srv);
                 }
 
                 strncpy(srv->err, strerror(errno), sizeof(srv->err));
@@ -818,16 +1663,55 @@ int dime_client_broadcast(dime_client_t *clnt, dime_server_t *srv, json_t *jsond
 
                 other->waiting = 0;
                 json_decref(response);
+
+                DIME_PROBE2(wait_wake, other->fd, dime_deque_len(&other->queue));
             }
 
             msg->refs++;
+            other->queue_bytes += msg->size;
+
+            rcmessage_requeued(other, srv, dime_deque_len(&other->queue) - 1, other->queue_bytes - msg->size);
+
+            DIME_PROBE4(enqueue, other->fd, (const char *)NULL, msg->size, dime_deque_len(&other->queue));
+
+            if (msg->expires > 0) {
+                dime_ttl_schedule(srv, other, msg->expires);
+            }
+
+            if (other->session != NULL && other->session->held) {
+                rcmessage_hold(msg, other, srv);
+            }
+        }
+    }
+
+    if (msg->latency != NULL && (msg->refs > 0 || spliced > 0)) {
+        dime_latency_queued(msg);
+    }
+
+    /* Messages forwarded by peers are only delivered locally */
+    for (size_t i = 0; i < srv->peers_len && !clnt->peer; i++) {
+        if (rcmessage_push(msg, srv->peers[i], srv) < 0) {
+            if (msg->refs == 0) {
+                rcmessage_free(msg, srv);
+            }
+
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            json_t *response = json_pack("{siss}", "status", -1, "error", strerror(errno));
+            if (response != NULL) {
+                dime_socket_push(&clnt->sock, response, NULL, 0);
+                json_decref(response);
+            }
+
+            return -1;
         }
     }
 
     if (msg->refs == 0) {
-        free(msg->jsondata);
-        free(msg->bindata);
-        free(msg);
+        rcmessage_free(msg, srv);
+    } else {
+        rcmessage_spill(msg, srv);
     }
 
     if (srv->verbosity >= 2) {
@@ -840,6 +1724,10 @@ int dime_client_broadcast(dime_client_t *clnt, dime_server_t *srv, json_t *jsond
         dime_info("%s broadcasted a variable \"%s\"", clnt->addr, varname);
     }
 
+    if (clnt->peer) {
+        return 0;
+    }
+
     if (dime_socket_push_str(&clnt->sock, "{\"status\":0}", NULL, 0) < 0) {
         strncpy(srv->err, strerror(errno), sizeof(srv->err));
         srv->err[sizeof(srv->err) - 1] = '\0';
@@ -865,33 +1753,117 @@ int dime_client_sync(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
 
     size_t m = (size_t)(n < 0 ? -1 : n);
 
-    for (size_t i = 0; i < m; i++) {
+    /* The variables and the reply go out as one burst */
+    if (m > 0 && dime_deque_len(&clnt->queue) > 0) {
+        dime_socket_cork(&clnt->sock);
+    }
+
+    /* Urgent messages may still join a full sync until its reply is sent */
+    if (n < 0) {
+        clnt->sync_begin = clnt->bytes_out + dime_socket_sendlen(&clnt->sock);
+    }
+
+    /* Bulk messages queued from here on are left for the next sync */
+    clnt->syncing = 1;
+    clnt->sync_n = n;
+    clnt->sync_left = m;
+    clnt->sync_bulk = dime_deque_len(&clnt->queue) - clnt->queue_urgent;
+
+    return (dime_client_sync_resume(clnt, srv) < 0) ? -1 : 0;
+}
+
+int dime_client_sync_resume(dime_client_t *clnt, dime_server_t *srv) {
+    if (!clnt->syncing) {
+        return 0;
+    }
+
+    double now = dime_socket_now();
+    size_t depth = dime_deque_len(&clnt->queue), bytes = clnt->queue_bytes;
+    int paused = 0;
+
+    while (clnt->sync_left > 0 && (clnt->queue_urgent > 0 || clnt->sync_bulk > 0)) {
         dime_rcmessage_t *msg = dime_deque_popl(&clnt->queue);
 
         if (msg == NULL) {
             break;
         }
 
-        if (dime_socket_push_str(&clnt->sock, msg->jsondata, msg->bindata, msg->bindata_len) < 0) {
+        /* Expired messages do not count towards "n" */
+        if (msg->expires > 0 && msg->expires <= now) {
+            if (!msg->urgent) {
+                clnt->sync_bulk--;
+            }
+
+            rcmessage_expire(msg, clnt, srv);
+            continue;
+        }
+
+        /* Spilled messages are read back only as fast as the socket takes them */
+        if (msg->spilled && dime_socket_sendlen(&clnt->sock) >= DIME_SPILL_WATERMARK) {
+            dime_deque_pushl(&clnt->queue, msg);
+
+            paused = 1;
+
+            break;
+        }
+
+        if (!msg->urgent) {
+            clnt->sync_bulk--;
+        }
+
+        if (msg->urgent) {
+            clnt->queue_urgent--;
+        }
+
+        if (rcmessage_push(msg, clnt, srv) < 0) {
             dime_deque_pushl(&clnt->queue, msg);
 
+            if (msg->urgent) {
+                clnt->queue_urgent++;
+            } else {
+                clnt->sync_bulk++;
+            }
+
+            rcmessage_requeued(clnt, srv, depth, bytes);
+
+            clnt->syncing = 0;
+
             return -1;
         }
 
+        if (msg->latency != NULL) {
+            dime_latency_dequeued(clnt, msg);
+        }
+
+        clnt->queue_bytes -= msg->size;
         msg->refs--;
 
         if (msg->refs == 0) {
-            free(msg->jsondata);
-            free(msg->bindata);
-            free(msg);
+            rcmessage_free(msg, srv);
         }
+
+        clnt->sync_left--;
+    }
+
+    rcmessage_requeued(clnt, srv, depth, bytes);
+
+    if (paused) {
+        return 1;
     }
 
+    clnt->syncing = 0;
+
+    if (clnt->sync_n < 0) {
+        clnt->sync_end = clnt->bytes_out + dime_socket_sendlen(&clnt->sock);
+    }
+
+    DIME_PROBE3(sync_drain, clnt->fd, (size_t)(clnt->sync_n < 0 ? -1 : clnt->sync_n) - clnt->sync_left, dime_deque_len(&clnt->queue));
+
     if (srv->verbosity >= 2) {
-        if (n < 0) {
+        if (clnt->sync_n < 0) {
             dime_info("%s synchronized all variables", clnt->addr);
         } else {
-            dime_info("%s synchronized up to %lld variables", clnt->addr, (long long)n);
+            dime_info("%s synchronized up to %lld variables", clnt->addr, (long long)clnt->sync_n);
         }
     }
 
@@ -911,6 +1883,43 @@ int dime_client_sync(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
     return 0;
 }
 
+void dime_client_outbuf(dime_client_t *clnt, dime_server_t *srv) {
+    size_t len = dime_socket_sendlen(&clnt->sock);
+
+    srv->outbuf_bytes = srv->outbuf_bytes - clnt->outbuf_len + len;
+    clnt->outbuf_len = len;
+}
+
+void dime_client_expire(dime_client_t *clnt, dime_server_t *srv, double now) {
+    size_t n = dime_deque_len(&clnt->queue), bytes = clnt->queue_bytes;
+    size_t sync_until = clnt->queue_urgent + clnt->sync_bulk;
+    double expires = 0;
+
+    /* Rotate the queue once, which keeps the order of what is left */
+    for (size_t i = 0; i < n; i++) {
+        dime_rcmessage_t *msg = dime_deque_popl(&clnt->queue);
+
+        if (msg->expires > 0 && msg->expires <= now) {
+            /* The sync being sent has one message less to reach */
+            if (!msg->urgent && i < sync_until) {
+                clnt->sync_bulk--;
+            }
+
+            rcmessage_expire(msg, clnt, srv);
+            continue;
+        }
+
+        dime_deque_pushr(&clnt->queue, msg);
+
+        if (msg->expires > 0 && (expires == 0 || msg->expires < expires)) {
+            expires = msg->expires;
+        }
+    }
+
+    rcmessage_requeued(clnt, srv, n, bytes);
+    dime_ttl_reset(srv, clnt, expires);
+}
+
 int dime_client_wait(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len) {
     if (dime_deque_len(&clnt->queue) > 0) {
         json_t *response = json_pack("{sisI}", "status", 0, "n", (json_int_t)dime_deque_len(&clnt->queue));
@@ -1007,6 +2016,36 @@ int dime_client_devices(dime_client_t *clnt, dime_server_t *srv, json_t *jsondat
         }
     }
 
+    /* Groups with members on other servers, listed once each */
+    for (size_t i = 0; i < srv->peers_len; i++) {
+        dime_table_iter_init(&it, &srv->peers[i]->peer_groups);
+
+        while (dime_table_iter_next(&it)) {
+            const char *name = it.val;
+            dime_group_t *group = dime_table_search(&srv->name2clnt, name);
+            int seen = (group != NULL && group->clnts_len > 0);
+
+            for (size_t j = 0; j < i && !seen; j++) {
+                seen = dime_peer_has_group(srv->peers[j], name);
+            }
+
+            if (!seen && json_array_append_new(arr, json_string(name)) < 0) {
+                json_decref(arr);
+
+                strncpy(srv->err, strerror(errno), sizeof(srv->err));
+                srv->err[sizeof(srv->err) - 1] = '\0';
+
+                json_t *response = json_pack("{siss}", "status", -1, "error", strerror(errno));
+                if (response != NULL) {
+                    dime_socket_push(&clnt->sock, response, NULL, 0);
+                    json_decref(response);
+                }
+
+                return -1;
+            }
+        }
+    }
+
     json_t *response = json_pack("{siso}", "status", 0, "devices", arr);
     if (response == NULL) {
         json_decref(arr);
@@ -1042,3 +2081,109 @@ int dime_client_devices(dime_client_t *clnt, dime_server_t *srv, json_t *jsondat
 
     return 0;
 }
+
+int dime_client_stats(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len) {
+    json_t *clnts = json_array();
+    json_t *groups = json_array();
+    json_t *response = NULL;
+
+    if (clnts == NULL || groups == NULL) {
+        goto stats_err;
+    }
+
+    /* Held sessions are listed along with live connections */
+    for (size_t i = 0; i < srv->clnts_len + srv->held_len; i++) {
+        dime_client_t *other = (i < srv->clnts_len) ? srv->clnts[i] : srv->held[i - srv->clnts_len];
+        json_t *names = json_array();
+
+        for (size_t j = 0; names != NULL && j < other->groups_len; j++) {
+            if (json_array_append_new(names, json_string(other->groups[j]->name)) < 0) {
+                json_decref(names);
+                names = NULL;
+            }
+        }
+
+        json_t *entry = json_pack("{ssss?sosbsbsIsIsIsIsIsIsIsI}",
+                                  "address", other->addr,
+                                  "session", (other->session != NULL) ? other->session->name : NULL,
+                                  "groups", names,
+                                  "peer", other->peer,
+                                  "held", other->fd < 0,
+                                  "bytes_in", (json_int_t)other->bytes_in,
+                                  "bytes_out", (json_int_t)other->bytes_out,
+                                  "messages_in", (json_int_t)other->msgs_in,
+                                  "messages_out", (json_int_t)other->msgs_out,
+                                  "queue", (json_int_t)dime_deque_len(&other->queue),
+                                  "queue_bytes", (json_int_t)other->queue_bytes,
+                                  "messages_expired", (json_int_t)other->msgs_expired,
+                                  "backlog", (json_int_t)((other->fd >= 0) ? dime_socket_sendlen(&other->sock) : 0));
+
+        if (json_array_append_new(clnts, entry) < 0) {
+            goto stats_err;
+        }
+    }
+
+    dime_table_iter_t it;
+
+    dime_table_iter_init(&it, &srv->name2clnt);
+
+    while (dime_table_iter_next(&it)) {
+        dime_group_t *group = it.val;
+
+        json_t *entry = json_pack("{sssIsIsIsI}",
+                                  "name", group->name,
+                                  "members", (json_int_t)group->clnts_len,
+                                  "messages", (json_int_t)group->msgs,
+                                  "bytes", (json_int_t)group->bytes,
+                                  "deliveries", (json_int_t)group->deliveries);
+
+        if (json_array_append_new(groups, entry) < 0) {
+            goto stats_err;
+        }
+    }
+
+    response = json_pack("{sisfs{sIsIsIsIsIsIsIsIsIsIsI}soso}",
+                         "status", 0,
+                         "uptime", dime_socket_now() - srv->started,
+                         "server",
+                             "accepts", (json_int_t)srv->accepts,
+                             "clients", (json_int_t)srv->clnts_len,
+                             "held", (json_int_t)srv->held_len,
+                             "peers", (json_int_t)srv->peers_len,
+                             "messages", (json_int_t)srv->msgs_total,
+                             "messages_live", (json_int_t)srv->msgs_live,
+                             "messages_bytes", (json_int_t)srv->msgs_bytes,
+                             "messages_resident", (json_int_t)(srv->msgs_bytes - srv->spill.bytes),
+                             "messages_spilled", (json_int_t)srv->spill.bytes,
+                             "messages_expired", (json_int_t)srv->msgs_expired,
+                             "messages_undecodable", (json_int_t)srv->msgs_undecodable,
+                         "clients", clnts,
+                         "groups", groups);
+
+    /* The arrays belong to the response now, even on failure */
+    clnts = groups = NULL;
+
+    if (response == NULL || dime_socket_push(&clnt->sock, response, NULL, 0) < 0) {
+        goto stats_err;
+    }
+
+    json_decref(response);
+
+    return 0;
+
+stats_err:
+    json_decref(clnts);
+    json_decref(groups);
+    json_decref(response);
+
+    strncpy(srv->err, strerror(errno), sizeof(srv->err));
+    srv->err[sizeof(srv->err) - 1] = '\0';
+
+    response = json_pack("{siss}", "status", -1, "error", strerror(errno));
+    if (response != NULL) {
+        dime_socket_push(&clnt->sock, response, NULL, 0);
+        json_decref(response);
+    }
+
+    return -1;
+}
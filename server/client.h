@@ -28,10 +28,18 @@
 
 #include <stdint.h>
 
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <sys/socket.h>
+#endif
+
 #include <jansson.h>
+#include "compress.h"
 #include "deque.h"
 #include "server.h"
 #include "socket.h"
+#include "table.h"
 
 #ifndef __DIME_client_H
 #define __DIME_client_H
@@ -62,6 +70,12 @@ extern "C" {
  */
 typedef struct __dime_client dime_client_t;
 
+struct __dime_session;
+struct __dime_latency;
+
+/** Number of traced messages being sent to a client whose latency is recorded */
+#define DIME_CLIENT_TRACES 8
+
 /**
  * @brief Reference-counted message
  *
@@ -70,6 +84,13 @@ typedef struct __dime_client dime_client_t;
  * introduced to manage this struct; the reference count is managed
  * directly by the functions in this file, and when the reference count
  * reaches zero, it is deallocated manually by said functions.
+ *
+ * If some recipients use a different serialization or dimeb variant
+ * than the sender, the message also carries transcoded copies (see
+ * @link dime_transcode @endlink), one per target format, built once
+ * when the message is relayed and shared by every recipient that needs
+ * them. Likewise, each copy is compressed at most once per codec, for
+ * recipients that negotiated compression.
  */
 typedef struct {
     unsigned int refs; /** Reference count */
@@ -77,6 +98,35 @@ typedef struct {
     char *jsondata;     /** JSON portion of the message as a string */
     void *bindata;      /** Binary portion of the message */
     size_t bindata_len; /** Length of binary portion of the message */
+
+    int serialization; /** Serialization of bindata */
+    int format;        /** Format of bindata, from @link dime_format @endlink */
+    size_t size;       /** Size of the JSON and binary portions, for accounting */
+
+    struct __dime_latency *latency; /** Histograms of the message's group, if it is traced (see latency.h) */
+    double traced;                  /** Time the message arrived, if it is traced */
+    double queued;                  /** Time the message was queued, if it is traced */
+
+    int urgent; /** Whether the message has priority over bulk messages */
+
+    double expires; /** Time after which the message is dropped from queues, or 0 */
+
+    int spilled;      /** Whether bindata was moved to the server's spill store */
+    size_t spill_off; /** Offset of bindata in the spill store, if spilled */
+
+    struct {
+        int format;         /** Format of this copy */
+        char *jsondata;     /** JSON portion for this copy */
+        void *bindata;      /** Transcoded binary portion */
+        size_t bindata_len; /** Length of transcoded binary portion */
+    } xs[3];       /** Transcoded copies */
+    size_t xs_len; /** Number of transcoded copies */
+
+    struct {
+        void *frame;      /** Compressed frame, or NULL */
+        size_t frame_len; /** Length of compressed frame */
+        int tried;        /** Whether compression was attempted */
+    } zs[4][DIME_COMPRESS_MAX]; /** Compressed frames, per copy and codec */
 } dime_rcmessage_t;
 
 /**
@@ -90,11 +140,22 @@ typedef struct {
     dime_client_t **clnts; /** Array of clients */
     size_t clnts_len;      /** Length of client array */
     size_t clnts_cap;      /** Capacity of client array */
+
+    uint64_t msgs;       /** Messages sent to the group */
+    uint64_t bytes;      /** Bytes sent to the group */
+    uint64_t deliveries; /** Copies of those messages queued for members */
+
+    double ttl; /** Default TTL of messages sent to the group, or 0 */
 } dime_group_t;
 
 struct __dime_client {
     int fd;      /** File descriptor */
     int waiting; /** Whether or not this client is waiting for a new message */
+    int serialization; /** Serialization this client decodes */
+    int dimeb_format;  /** Variant of dimeb this client prefers */
+    size_t idx;  /** Index in the server's dense client array */
+    int ready;        /** Whether messages are left in the buffer for a later wakeup */
+    size_t ready_idx; /** Index in the server's array of ready clients */
 
     char *addr; /** Address of connection, as a human-readable string */
 
@@ -104,9 +165,50 @@ struct __dime_client {
 
     dime_socket_t sock; /** DiME socket */
     dime_deque_t queue; /** Queue of reference-counted messages */
+    size_t queue_bytes; /** Size of the messages in the queue */
+    size_t queue_urgent; /** Number of urgent messages, which are at the front of the queue */
+
+    uint64_t msgs_expired; /** Queued messages dropped as expired */
+    double expires;        /** When the queue is next checked for expired messages, or 0 */
+    size_t ttl_slot;       /** Slot of the server's timer wheel, if expires is set */
+    size_t ttl_idx;        /** Index in that slot */
+
+    uint64_t sync_begin; /** Value of bytes_out where the last full sync's variables begin */
+    uint64_t sync_end;   /** Value of bytes_out where the last full sync's reply begins */
+    int syncing;         /** Whether a sync waits for the outbuffer to drain before sending more */
+    json_int_t sync_n;   /** "n" of that sync */
+    size_t sync_left;    /** Variables that sync may still send */
+    size_t sync_bulk;    /** Bulk messages queued before that sync that it has not reached */
+    size_t outbuf_len;   /** Bytes of the outbuffer counted in the server's outbuf_bytes */
+
+    uint64_t bytes_in;  /** Bytes received on the connection */
+    uint64_t bytes_out; /** Bytes sent on the connection */
+    uint64_t msgs_in;   /** Messages received */
+    uint64_t msgs_out;  /** Messages relayed to the client */
+
+    struct {
+        uint64_t end;               /** Value of bytes_out once the message is sent */
+        double dequeued;            /** Time the message was taken off the queue */
+        struct __dime_latency *lat; /** Histograms the message is traced in */
+    } traces[DIME_CLIENT_TRACES]; /** Traced messages being sent, oldest first */
+    size_t traces_len;            /** Number of traced messages being sent */
 
     dime_server_t *srv;
 
+    int peer;                 /** Whether this is a link to another server */
+    int outbound;             /** Whether this server dialed the link */
+    int active;               /** Whether the link is used to reach its node */
+    char *node;               /** Node ID of the other server, if known */
+    dime_table_t peer_groups; /** Groups with members on the other server */
+
+    int udp;                           /** Whether small broadcasts arrive as datagrams */
+    uint32_t udp_id;                   /** Source ID of this client's datagrams */
+    uint32_t udp_seq;                  /** Sequence number of the next datagram (if fan-out) */
+    struct sockaddr_storage udp_addr;  /** Datagram address (if fan-out) */
+    socklen_t udp_addrlen;             /** Length of udp_addr */
+
+    struct __dime_session *session; /** Resumable session (see session.h), or NULL */
+
     char err[81]; /** Error string */
 };
 
@@ -130,6 +232,9 @@ int dime_client_init(dime_client_t *clnt, int fd, const struct sockaddr *addr);
  * initialize the client. Pass a file descriptor created with @c dup if
  * this behavior is undesirable.
  *
+ * If the client has a session that can be held, its queue and group
+ * memberships are handed to a held client instead of being released.
+ *
  * @param clnt Pointer to a @link dime_client_t @endlink struct
  *
  * @see dime_client_init
@@ -139,8 +244,32 @@ void dime_client_destroy(dime_client_t *clnt);
 /**
  * @brief Handle a "handshake" command
  *
- * The "handshake" command mostly does housekeeping w.r.t. the
- * serialization method.
+ * The "handshake" command records the serialization method the client
+ * intends to use. Messages relayed to the client are transcoded into
+ * that method where needed, so clients using different methods can
+ * share a server without renegotiating.
+ *
+ * Clients may also send @c dimeb_version 2 and their native
+ * @c byteorder ("little" or "big") to receive dimeb v2 payloads in
+ * that byte order; the response echoes both fields if they were
+ * accepted.
+ *
+ * Clients may request compression by sending @c compression, either a
+ * codec name or an array of codec names in order of preference. The
+ * response contains the codec chosen by the server ("none" if no codec
+ * was acceptable) and @c compression_threshold, the size of the
+ * smallest message either side should compress.
+ *
+ * Clients may ask to receive small broadcasts as datagrams (see udp.h)
+ * by sending @c udp, the UDP port they listen on. The response's
+ * @c udp is either false or the client's source ID, plus the group,
+ * port and interface to join if the server uses multicast. Clients
+ * that negotiate TLS never receive datagrams.
+ *
+ * Clients may open a resumable session (see session.h) by sending
+ * @c session, a name for it, and resume it after reconnecting by also
+ * sending @c token, the token returned in the response's @c session
+ * field.
  *
  * @param clnt Pointer to a @link dime_client_t @endlink struct
  * @param srv Pointer to the @link dime_server_t @endlink struct from
@@ -202,6 +331,8 @@ int dime_client_leave(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
  *
  * The "send" command instructs the server to relay the message to all
  * clients in the group specified in the JSON field @c name.
+ * The message is also forwarded to linked servers with members of the
+ * group (see peer.h).
  *
  * @param clnt Pointer to a @link dime_client_t @endlink struct
  * @param srv Pointer to the @link dime_server_t @endlink struct from
@@ -224,6 +355,7 @@ int dime_client_send(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
  *
  * The "broadcast" command instructs the server to relay the message to
  * all other clients.
+ * The message is also forwarded to every linked server (see peer.h).
  *
  * @param clnt Pointer to a @link dime_client_t @endlink struct
  * @param srv Pointer to the @link dime_server_t @endlink struct from
@@ -265,6 +397,55 @@ int dime_client_broadcast(dime_client_t *clnt, dime_server_t *srv, json_t *jsond
  */
 int dime_client_sync(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len);
 
+/**
+ * @brief Send more of a sync that is waiting for the outbuffer to drain
+ *
+ * A sync stops before copying a spilled message into an outbuffer that
+ * holds @c DIME_SPILL_WATERMARK bytes or more, so that spilled messages
+ * are read back from the store as the socket drains rather than all at
+ * once. No other command from the client @em clnt is handled until the
+ * sync is done.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to the @link dime_server_t @endlink struct from
+ * which the client connection was accepted
+ *
+ * @return 0 once no sync is left, 1 if the sync is still waiting, or a
+ * negative value on failure
+ *
+ * @see dime_client_sync
+ */
+int dime_client_sync_resume(dime_client_t *clnt, dime_server_t *srv);
+
+/**
+ * @brief Account for the bytes in a client's outbuffer
+ *
+ * Updates the server's count of bytes in outbuffers, which counts
+ * towards its memory budget (see @c -M), with the outbuffer of the
+ * client @em clnt.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to the @link dime_server_t @endlink struct from
+ * which the client connection was accepted
+ */
+void dime_client_outbuf(dime_client_t *clnt, dime_server_t *srv);
+
+/**
+ * @brief Drop the expired messages from a client's queue
+ *
+ * Drops the messages in the queue of the client @em clnt whose
+ * time-to-live has passed by @em now, and reschedules the client in
+ * the server's timer wheel for the earliest of the remaining ones.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to the @link dime_server_t @endlink struct from
+ * which the client connection was accepted
+ * @param now Current time, as returned by dime_socket_now
+ *
+ * @see dime_ttl_expire
+ */
+void dime_client_expire(dime_client_t *clnt, dime_server_t *srv, double now);
+
 /**
  * @brief Handle a "wait" command
  *
@@ -292,7 +473,8 @@ int dime_client_wait(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
  * @brief Handle a "devices" command
  *
  * The "devices" command instructs the server to send the client a list
- * of the groups with active clients in them.
+ * of the groups with active clients in them, on this server or on any
+ * linked server.
  *
  * @param clnt Pointer to a @link dime_client_t @endlink struct
  * @param srv Pointer to the @link dime_server_t @endlink struct from
@@ -306,6 +488,31 @@ int dime_client_wait(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata,
  */
 int dime_client_devices(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len);
 
+/**
+ * @brief Handle a "stats" command
+ *
+ * The "stats" command instructs the server to send the client a
+ * snapshot of its counters: server-wide totals in @c server, one entry
+ * per connection or held session in @c clients (bytes and messages in
+ * each direction, queue depth and size, and unsent bytes in
+ * @c backlog), and one entry per group in @c groups (members,
+ * messages and bytes sent to it, and copies queued for its members in
+ * @c deliveries). Counters are totals since the server
+ * started, @c uptime seconds ago, so rates are found by comparing two
+ * snapshots.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to the @link dime_server_t @endlink struct from
+ * which the client connection was accepted
+ * @param jsondata JSON portion of the message
+ * @param pbindata Binary portion of the message
+ * @param bindata_len Length of binary portion of the message
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_client_stats(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len);
+
 #ifdef __cplusplus
 }
 #endif
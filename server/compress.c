@@ -0,0 +1,268 @@
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <arpa/inet.h>
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+#ifdef DIME_USE_LZ4
+#   include <lz4frame.h>
+#endif
+#ifdef DIME_USE_ZSTD
+#   include <zstd.h>
+#endif
+
+#include "compress.h"
+
+static const char *codec_names[] = {
+    [DIME_COMPRESS_NONE] = "none",
+    [DIME_COMPRESS_ZLIB] = "zlib",
+    [DIME_COMPRESS_LZ4] = "lz4",
+    [DIME_COMPRESS_ZSTD] = "zstd"
+};
+
+int dime_compress_from_str(const char *name) {
+    for (int i = DIME_COMPRESS_NONE; i < DIME_COMPRESS_MAX; i++) {
+        if (strcmp(name, codec_names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+const char *dime_compress_name(int codec) {
+    return codec_names[codec];
+}
+
+int dime_compress_available(int codec) {
+    switch (codec) {
+    case DIME_COMPRESS_ZLIB:
+        return 1;
+
+#ifdef DIME_USE_LZ4
+    case DIME_COMPRESS_LZ4:
+        return 1;
+#endif
+
+#ifdef DIME_USE_ZSTD
+    case DIME_COMPRESS_ZSTD:
+        return 1;
+#endif
+
+    default:
+        return 0;
+    }
+}
+
+int dime_compress_default_level(int codec) {
+    switch (codec) {
+    case DIME_COMPRESS_ZLIB:
+        return Z_DEFAULT_COMPRESSION;
+
+    case DIME_COMPRESS_ZSTD:
+        return 3;
+
+    default:
+        return 0;
+    }
+}
+
+static int compress_zlib(int level, const void *in1, size_t in1_len, const void *in2, size_t in2_len, unsigned char *out, size_t *pout_len) {
+    z_stream strm;
+
+    memset(&strm, 0, sizeof(strm));
+
+    if (in1_len > UINT_MAX || in2_len > UINT_MAX || *pout_len > UINT_MAX) {
+        return -1;
+    }
+
+    if (deflateInit(&strm, level) != Z_OK) {
+        return -1;
+    }
+
+    strm.next_out = out;
+    strm.avail_out = *pout_len;
+
+    strm.next_in = (unsigned char *)in1;
+    strm.avail_in = in1_len;
+
+    int err = deflate(&strm, Z_NO_FLUSH);
+
+    /* Z_BUF_ERROR only means that in1 was empty */
+    if (err == Z_OK || err == Z_BUF_ERROR) {
+        strm.next_in = (unsigned char *)in2;
+        strm.avail_in = in2_len;
+
+        err = deflate(&strm, Z_FINISH);
+    }
+
+    *pout_len = strm.total_out;
+    deflateEnd(&strm);
+
+    return (err == Z_STREAM_END) ? 0 : -1;
+}
+
+size_t dime_compress_bound(int codec, size_t len) {
+    switch (codec) {
+    case DIME_COMPRESS_ZLIB:
+        return compressBound(len) + 64;
+
+#ifdef DIME_USE_LZ4
+    case DIME_COMPRESS_LZ4:
+        return LZ4F_compressFrameBound(len, NULL);
+#endif
+
+#ifdef DIME_USE_ZSTD
+    case DIME_COMPRESS_ZSTD:
+        return ZSTD_compressBound(len);
+#endif
+
+    default:
+        return 0;
+    }
+}
+
+int dime_compress_frame(int codec, int level,
+                        const char *jsonstr, size_t jsondata_len,
+                        const void *bindata, size_t bindata_len,
+                        void **pframe, size_t *pframe_len) {
+    if (!dime_compress_available(codec) || jsondata_len > UINT32_MAX || bindata_len > UINT32_MAX) {
+        return -1;
+    }
+
+    size_t len = jsondata_len + bindata_len;
+    size_t bound = dime_compress_bound(codec, len);
+
+    unsigned char *frame = malloc(DIME_COMPRESS_HDRLEN + bound);
+    if (frame == NULL) {
+        return -1;
+    }
+
+    unsigned char *out = frame + DIME_COMPRESS_HDRLEN;
+    size_t out_len = bound;
+    int err;
+
+    if (codec == DIME_COMPRESS_ZLIB) {
+        err = compress_zlib(level, jsonstr, jsondata_len, bindata, bindata_len, out, &out_len);
+    } else {
+        /* The other codecs are given a single contiguous input */
+        unsigned char *in = malloc(len > 0 ? len : 1);
+        if (in == NULL) {
+            free(frame);
+            return -1;
+        }
+
+        memcpy(in, jsonstr, jsondata_len);
+        memcpy(in + jsondata_len, bindata, bindata_len);
+
+        err = -1;
+
+#ifdef DIME_USE_LZ4
+        if (codec == DIME_COMPRESS_LZ4) {
+            LZ4F_preferences_t prefs;
+
+            memset(&prefs, 0, sizeof(prefs));
+            prefs.compressionLevel = level;
+            prefs.frameInfo.contentSize = len;
+
+            out_len = LZ4F_compressFrame(out, bound, in, len, &prefs);
+            err = LZ4F_isError(out_len) ? -1 : 0;
+        }
+#endif
+
+#ifdef DIME_USE_ZSTD
+        if (codec == DIME_COMPRESS_ZSTD) {
+            out_len = ZSTD_compress(out, bound, in, len, level);
+            err = ZSTD_isError(out_len) ? -1 : 0;
+        }
+#endif
+
+        free(in);
+    }
+
+    if (err < 0) {
+        free(frame);
+        return -1;
+    }
+
+    if (out_len > UINT32_MAX || DIME_COMPRESS_HDRLEN + out_len >= 12 + len) {
+        free(frame);
+        return 0;
+    }
+
+    uint32_t hdr[3] = {htonl(jsondata_len), htonl(bindata_len), htonl(out_len)};
+
+    memcpy(frame, "DiMZ", 4);
+    memcpy(frame + 4, hdr, sizeof(hdr));
+    frame[16] = codec;
+    frame[17] = frame[18] = frame[19] = 0;
+
+    *pframe = frame;
+    *pframe_len = DIME_COMPRESS_HDRLEN + out_len;
+
+    return 1;
+}
+
+int dime_decompress(int codec, const void *in, size_t in_len, void *out, size_t out_len) {
+    switch (codec) {
+    case DIME_COMPRESS_ZLIB:
+        {
+            z_stream strm;
+
+            memset(&strm, 0, sizeof(strm));
+
+            if (in_len > UINT_MAX || out_len > UINT_MAX || inflateInit(&strm) != Z_OK) {
+                return -1;
+            }
+
+            strm.next_in = (unsigned char *)in;
+            strm.avail_in = in_len;
+            strm.next_out = out;
+            strm.avail_out = out_len;
+
+            int err = inflate(&strm, Z_FINISH);
+            size_t total = strm.total_out;
+
+            inflateEnd(&strm);
+
+            return (err == Z_STREAM_END && total == out_len) ? 0 : -1;
+        }
+
+#ifdef DIME_USE_LZ4
+    case DIME_COMPRESS_LZ4:
+        {
+            LZ4F_dctx *dctx;
+
+            if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+                return -1;
+            }
+
+            size_t dst_len = out_len;
+            size_t src_len = in_len;
+            size_t ret = LZ4F_decompress(dctx, out, &dst_len, in, &src_len, NULL);
+
+            LZ4F_freeDecompressionContext(dctx);
+
+            return (ret == 0 && dst_len == out_len && src_len == in_len) ? 0 : -1;
+        }
+#endif
+
+#ifdef DIME_USE_ZSTD
+    case DIME_COMPRESS_ZSTD:
+        {
+            size_t ret = ZSTD_decompress(out, out_len, in, in_len);
+
+            return (!ZSTD_isError(ret) && ret == out_len) ? 0 : -1;
+        }
+#endif
+
+    default:
+        return -1;
+    }
+}
@@ -0,0 +1,162 @@
+/*
+ * compress.h - Compressed DiME frames
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file compress.h
+ * @brief Compressed DiME frames
+ * @author Nicholas West
+ * @date 2020
+ *
+ * Clients may negotiate a compression codec in the "handshake"
+ * command. Afterwards, either side may send any message as a compressed
+ * frame instead of a plain DiME message. A compressed frame consists of
+ * the following data:
+ * - A 4-byte magic value ("DiMZ" in ASCII)
+ * - A 4 byte big-endian value for the size in bytes of the JSON portion
+ *   of the message
+ * - A 4 byte big-endian value for the size in bytes of the binary
+ *   portion of the message
+ * - A 4 byte big-endian value for the size in bytes of the compressed
+ *   data
+ * - A 1 byte codec, from @link dime_compress_codec @endlink
+ * - 3 zero bytes
+ * - The JSON portion followed by the binary portion, compressed as a
+ *   single zlib stream, LZ4 frame or Zstandard frame
+ *
+ * zlib is always available. LZ4 and Zstandard are only available if the
+ * server is built with @c DIME_USE_LZ4 or @c DIME_USE_ZSTD,
+ * respectively.
+ */
+
+#include <stddef.h>
+
+#ifndef __DIME_compress_H
+#define __DIME_compress_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Length of a compressed frame's header */
+#define DIME_COMPRESS_HDRLEN 20
+
+/** Default size of the smallest message that is compressed */
+#define DIME_COMPRESS_THRESHOLD 4096
+
+/**
+ * @brief Compression codec
+ */
+enum dime_compress_codec {
+    DIME_COMPRESS_NONE, /** No compression */
+    DIME_COMPRESS_ZLIB, /** zlib */
+    DIME_COMPRESS_LZ4,  /** LZ4 frame format */
+    DIME_COMPRESS_ZSTD, /** Zstandard */
+    DIME_COMPRESS_MAX
+};
+
+/**
+ * @brief Look up a codec by name
+ *
+ * @param name Codec name ("zlib", "lz4" or "zstd")
+ *
+ * @return A value from @link dime_compress_codec @endlink, or a
+ * negative value if there is no such codec
+ */
+int dime_compress_from_str(const char *name);
+
+/**
+ * @brief Get the name of a codec
+ *
+ * @param codec A value from @link dime_compress_codec @endlink
+ *
+ * @return Codec name
+ */
+const char *dime_compress_name(int codec);
+
+/**
+ * @brief Check whether a codec was compiled in
+ *
+ * @param codec A value from @link dime_compress_codec @endlink
+ *
+ * @return Nonzero if the codec can be used, zero otherwise
+ */
+int dime_compress_available(int codec);
+
+/**
+ * @brief Get the default compression level of a codec
+ *
+ * @param codec A value from @link dime_compress_codec @endlink
+ *
+ * @return Compression level
+ */
+int dime_compress_default_level(int codec);
+
+/**
+ * @brief Get the worst-case size of compressed data
+ *
+ * @param codec A value from @link dime_compress_codec @endlink
+ * @param len Length of the data before compression
+ *
+ * @return Largest size the data can compress to, or 0 if the codec
+ * can't be used
+ */
+size_t dime_compress_bound(int codec, size_t len);
+
+/**
+ * @brief Build a compressed frame
+ *
+ * Compresses a message into a complete compressed frame, header
+ * included. On success, @em *pframe is set to a newly allocated buffer
+ * that the caller must free.
+ *
+ * @param codec A value from @link dime_compress_codec @endlink
+ * @param level Compression level
+ * @param jsonstr JSON portion of the message
+ * @param jsondata_len Length of @em jsonstr
+ * @param bindata Binary portion of the message
+ * @param bindata_len Length of @em bindata
+ * @param pframe Pointer to the output buffer
+ * @param pframe_len Pointer to the length of the output buffer
+ *
+ * @return A positive value if the frame was built, zero if compression
+ * would not make the message smaller (no frame is built), or a negative
+ * value on failure
+ */
+int dime_compress_frame(int codec, int level,
+                        const char *jsonstr, size_t jsondata_len,
+                        const void *bindata, size_t bindata_len,
+                        void **pframe, size_t *pframe_len);
+
+/**
+ * @brief Decompress the body of a compressed frame
+ *
+ * @param codec A value from @link dime_compress_codec @endlink
+ * @param in Compressed data
+ * @param in_len Length of @em in
+ * @param out Output buffer
+ * @param out_len Expected length of the decompressed data
+ *
+ * @return A nonnegative value on success, or a negative value if the
+ * data is malformed or does not decompress to exactly @em out_len bytes
+ */
+int dime_decompress(int codec, const void *in, size_t in_len, void *out, size_t out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
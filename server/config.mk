@@ -19,6 +19,10 @@ LDFLAGS := ${LDFLAGS} -pie -pthread
 # Uncomment the lines below for a release build
 #CFLAGS += -DNDEBUG -O3
 
+# Uncomment the line below to use AVX2 where SSE2 would be used otherwise,
+# e.g. for unmasking WebSocket frames (the binary won't run on older CPUs)
+#CFLAGS += -march=native
+
 # Uncomment the lines below for a debug build
 CFLAGS += -Og -g -fstack-protector-strong
 
@@ -29,3 +33,14 @@ CFLAGS += -Og -g -fstack-protector-strong
 # Uncomment the lines below to compile for Windows
 #CC := x86_64-w64-mingw32-gcc
 #LDFLAGS += -lws2_32
+
+# Uncomment the lines below to enable LZ4 and/or Zstandard compression
+# (zlib is always available)
+#CFLAGS += -DDIME_USE_LZ4
+#LDFLAGS += -llz4
+#CFLAGS += -DDIME_USE_ZSTD
+#LDFLAGS += -lzstd
+
+# Uncomment the line below to add USDT probes, for e.g. bpftrace (requires
+# sys/sdt.h from SystemTap)
+#CFLAGS += -DDIME_USE_USDT
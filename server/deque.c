@@ -85,6 +85,47 @@ int dime_deque_pushr(dime_deque_t *deck, void *p) {
     return 0;
 }
 
+int dime_deque_insert(dime_deque_t *deck, size_t i, void *p) {
+    if (dime_deque_pushl(deck, p) < 0) {
+        return -1;
+    }
+
+    /* Move the elements before it forward, rather than the rest back */
+    size_t j = deck->begin;
+
+    for (size_t k = 0; k < i; k++) {
+        size_t next = (j + 1 == deck->cap) ? 0 : j + 1;
+
+        deck->arr[j] = deck->arr[next];
+        j = next;
+    }
+
+    deck->arr[j] = p;
+
+    return 0;
+}
+
+void *dime_deque_remove(dime_deque_t *deck, size_t i) {
+    if (i >= deck->len) {
+        return NULL;
+    }
+
+    size_t j = (deck->begin + i) % deck->cap;
+    void *p = deck->arr[j];
+
+    for (size_t k = 0; k < i; k++) {
+        size_t prev = (j == 0) ? deck->cap - 1 : j - 1;
+
+        deck->arr[j] = deck->arr[prev];
+        j = prev;
+    }
+
+    /* The head is now a duplicate of the element after it */
+    dime_deque_popl(deck);
+
+    return p;
+}
+
 void *dime_deque_popl(dime_deque_t *deck) {
     if (deck->len == 0) {
         return NULL;
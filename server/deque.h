@@ -47,6 +47,8 @@ extern "C" {
  * @see dime_deque_pushr
  * @see dime_deque_popl
  * @see dime_deque_popr
+ * @see dime_deque_insert
+ * @see dime_deque_remove
  * @see dime_deque_len
  * @see dime_deque_iter_t
  */
@@ -109,6 +111,37 @@ int dime_deque_pushl(dime_deque_t *deck, void *p);
  */
 int dime_deque_pushr(dime_deque_t *deck, void *p);
 
+/**
+ * @brief Insert an element into the deque
+ *
+ * Takes time proportional to @em i, so it suits inserting near the head.
+ *
+ * @param deck Pointer to a @link dime_deque_t @endlink struct
+ * @param i Index the element will have, from zero (the head) to the
+ * length of the deque
+ * @param p Element
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ *
+ * @see dime_deque_remove
+ */
+int dime_deque_insert(dime_deque_t *deck, size_t i, void *p);
+
+/**
+ * @brief Remove an element from the deque
+ *
+ * Takes time proportional to @em i, so it suits removing near the head.
+ *
+ * @param deck Pointer to a @link dime_deque_t @endlink struct
+ * @param i Index of the element, from zero (the head)
+ *
+ * @return The element, or NULL if @em i is out of range
+ *
+ * @see dime_deque_insert
+ */
+void *dime_deque_remove(dime_deque_t *deck, size_t i);
+
 /**
  * @brief Pop an element from the head of the deque
  *
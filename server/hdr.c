@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdr.h"
+
+/* Index of the bucket that counts a value */
+static size_t hdr_index(uint64_t val) {
+    if (val >> (DIME_HDR_SUB_BITS + 1) == 0) {
+        return val;
+    }
+
+    unsigned int msb = 63;
+
+    while (!(val >> msb)) {
+        msb--;
+    }
+
+    unsigned int shift = msb - DIME_HDR_SUB_BITS;
+
+    return ((size_t)shift << DIME_HDR_SUB_BITS) + (val >> shift);
+}
+
+/* Largest value counted in a bucket */
+static uint64_t hdr_value(size_t idx) {
+    if (idx >> (DIME_HDR_SUB_BITS + 1) == 0) {
+        return idx;
+    }
+
+    unsigned int shift = (idx >> DIME_HDR_SUB_BITS) - 1;
+    uint64_t sub = idx - ((size_t)shift << DIME_HDR_SUB_BITS);
+
+    return ((sub + 1) << shift) - 1;
+}
+
+void dime_hdr_init(dime_hdr_t *hdr) {
+    hdr->counts = NULL;
+    hdr->total = 0;
+    hdr->min = 0;
+    hdr->max = 0;
+    hdr->sum = 0;
+}
+
+void dime_hdr_destroy(dime_hdr_t *hdr) {
+    free(hdr->counts);
+}
+
+void dime_hdr_reset(dime_hdr_t *hdr) {
+    if (hdr->counts != NULL) {
+        memset(hdr->counts, 0, DIME_HDR_LEN * sizeof(uint32_t));
+    }
+
+    hdr->total = 0;
+    hdr->min = 0;
+    hdr->max = 0;
+    hdr->sum = 0;
+}
+
+int dime_hdr_record(dime_hdr_t *hdr, uint64_t val) {
+    if (hdr->counts == NULL) {
+        hdr->counts = calloc(DIME_HDR_LEN, sizeof(uint32_t));
+        if (hdr->counts == NULL) {
+            return -1;
+        }
+    }
+
+    if (hdr->total == 0 || val < hdr->min) {
+        hdr->min = val;
+    }
+
+    if (val > hdr->max) {
+        hdr->max = val;
+    }
+
+    hdr->total++;
+    hdr->sum += val;
+
+    if (val >> DIME_HDR_MAX_BITS) {
+        val = ((uint64_t)1 << DIME_HDR_MAX_BITS) - 1;
+    }
+
+    hdr->counts[hdr_index(val)]++;
+
+    return 0;
+}
+
+int dime_hdr_add(dime_hdr_t *dst, const dime_hdr_t *src) {
+    if (src->total == 0) {
+        return 0;
+    }
+
+    if (dst->counts == NULL) {
+        dst->counts = calloc(DIME_HDR_LEN, sizeof(uint32_t));
+        if (dst->counts == NULL) {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < DIME_HDR_LEN; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+
+    if (dst->total == 0 || src->min < dst->min) {
+        dst->min = src->min;
+    }
+
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+
+    dst->total += src->total;
+    dst->sum += src->sum;
+
+    return 0;
+}
+
+uint64_t dime_hdr_percentile(const dime_hdr_t *hdr, double p) {
+    if (hdr->total == 0) {
+        return 0;
+    }
+
+    /* Rank of the percentile, rounded up, among the values recorded */
+    double exact = p / 100 * hdr->total;
+    uint64_t rank = exact;
+    uint64_t seen = 0;
+
+    if (rank < exact || rank == 0) {
+        rank++;
+    }
+
+    for (size_t i = 0; i < DIME_HDR_LEN; i++) {
+        seen += hdr->counts[i];
+
+        if (seen >= rank) {
+            uint64_t val = hdr_value(i);
+
+            /* The top bucket also counts clamped values */
+            return (val < hdr->max) ? val : hdr->max;
+        }
+    }
+
+    return hdr->max;
+}
@@ -0,0 +1,123 @@
+/*
+ * hdr.h - High dynamic range histograms
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file hdr.h
+ * @brief High dynamic range histograms
+ * @author Nicholas West
+ * @date 2020
+ *
+ * Histograms of integer values (e.g. nanoseconds) that keep about two
+ * significant digits over the whole range of values, after HdrHistogram.
+ * Values below 2^(@c DIME_HDR_SUB_BITS + 1) are counted exactly. Above
+ * that, each power of two is divided into 2^@c DIME_HDR_SUB_BITS
+ * equally sized buckets, so recording a value is a few shifts and an
+ * increment no matter how large it is.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __DIME_hdr_H
+#define __DIME_hdr_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Log base 2 of the number of buckets per power of two */
+#define DIME_HDR_SUB_BITS 7
+
+/** Log base 2 of the largest value recorded; larger values are clamped */
+#define DIME_HDR_MAX_BITS 40
+
+/** Number of buckets in a histogram */
+#define DIME_HDR_LEN ((DIME_HDR_MAX_BITS - DIME_HDR_SUB_BITS + 1) << DIME_HDR_SUB_BITS)
+
+/**
+ * @brief High dynamic range histogram
+ *
+ * The buckets are allocated when the first value is recorded, so that
+ * unused histograms are cheap.
+ */
+typedef struct {
+    uint32_t *counts; /** Buckets, or NULL if nothing was recorded */
+    uint64_t total;   /** Number of values recorded */
+    uint64_t min;     /** Smallest value recorded */
+    uint64_t max;     /** Largest value recorded */
+    double sum;       /** Sum of the values recorded */
+} dime_hdr_t;
+
+/**
+ * @brief Initialize an empty histogram
+ *
+ * @param hdr Pointer to a @link dime_hdr_t @endlink struct
+ */
+void dime_hdr_init(dime_hdr_t *hdr);
+
+/**
+ * @brief Free resources used by a histogram
+ *
+ * @param hdr Pointer to a @link dime_hdr_t @endlink struct
+ */
+void dime_hdr_destroy(dime_hdr_t *hdr);
+
+/**
+ * @brief Empty a histogram
+ *
+ * @param hdr Pointer to a @link dime_hdr_t @endlink struct
+ */
+void dime_hdr_reset(dime_hdr_t *hdr);
+
+/**
+ * @brief Record a value
+ *
+ * @param hdr Pointer to a @link dime_hdr_t @endlink struct
+ * @param val Value to record
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_hdr_record(dime_hdr_t *hdr, uint64_t val);
+
+/**
+ * @brief Add the values of one histogram to another
+ *
+ * @param dst Pointer to the histogram to add to
+ * @param src Pointer to the histogram to add
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_hdr_add(dime_hdr_t *dst, const dime_hdr_t *src);
+
+/**
+ * @brief Find a percentile of the values recorded
+ *
+ * @param hdr Pointer to a @link dime_hdr_t @endlink struct
+ * @param p Percentile, between 0 and 100
+ *
+ * @return The largest value that is counted in the same bucket as the
+ * percentile, or 0 if nothing was recorded
+ */
+uint64_t dime_hdr_percentile(const dime_hdr_t *hdr, double p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
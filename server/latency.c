@@ -0,0 +1,281 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+#include "client.h"
+#include "hdr.h"
+#include "latency.h"
+#include "log.h"
+#include "server.h"
+#include "socket.h"
+#include "table.h"
+
+static const char *stage_names[DIME_LATENCY_STAGES] = {"route", "queue", "write"};
+
+static dime_latency_t *latency_new(void) {
+    dime_latency_t *lat = malloc(sizeof(dime_latency_t));
+    if (lat == NULL) {
+        return NULL;
+    }
+
+    for (int i = 0; i < DIME_LATENCY_STAGES; i++) {
+        dime_hdr_init(&lat->stages[i]);
+    }
+
+    return lat;
+}
+
+static void latency_free(dime_latency_t *lat) {
+    if (lat == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < DIME_LATENCY_STAGES; i++) {
+        dime_hdr_destroy(&lat->stages[i]);
+    }
+
+    free(lat);
+}
+
+static dime_latency_t *latency_lookup(dime_server_t *srv, const char *name) {
+    if (name == NULL) {
+        if (srv->latency_bcast == NULL) {
+            srv->latency_bcast = latency_new();
+        }
+
+        return srv->latency_bcast;
+    }
+
+    dime_latency_t *lat = dime_table_search(&srv->latency, name);
+
+    if (lat == NULL) {
+        char *key = strdup(name);
+
+        lat = latency_new();
+
+        if (key == NULL || lat == NULL || dime_table_insert(&srv->latency, key, lat) < 0) {
+            free(key);
+            latency_free(lat);
+
+            return NULL;
+        }
+    }
+
+    return lat;
+}
+
+static void latency_record(dime_latency_t *lat, int stage, double seconds) {
+    dime_hdr_record(&lat->stages[stage], (seconds > 0) ? (uint64_t)(seconds * 1e9) : 0);
+}
+
+void dime_latency_trace(dime_server_t *srv, dime_rcmessage_t *msg, const char *name) {
+    if (srv->latency_sample == 0 || srv->msgs_total % srv->latency_sample != 0) {
+        return;
+    }
+
+    /* Failing to allocate histograms only loses the sample */
+    msg->latency = latency_lookup(srv, name);
+
+    if (msg->latency != NULL) {
+        msg->traced = dime_socket_now();
+    }
+}
+
+void dime_latency_queued(dime_rcmessage_t *msg) {
+    msg->queued = dime_socket_now();
+
+    latency_record(msg->latency, DIME_LATENCY_ROUTE, msg->queued - msg->traced);
+}
+
+void dime_latency_dequeued(dime_client_t *clnt, dime_rcmessage_t *msg) {
+    double now = dime_socket_now();
+
+    latency_record(msg->latency, DIME_LATENCY_QUEUE, now - msg->queued);
+
+    /* Messages are sent in order, so the oldest trace is completed first */
+    if (clnt->traces_len < DIME_CLIENT_TRACES) {
+        clnt->traces[clnt->traces_len].end = clnt->bytes_out + dime_socket_sendlen(&clnt->sock);
+        clnt->traces[clnt->traces_len].dequeued = now;
+        clnt->traces[clnt->traces_len].lat = msg->latency;
+        clnt->traces_len++;
+    }
+}
+
+void dime_latency_spliced(dime_client_t *clnt, dime_rcmessage_t *msg, uint64_t at, size_t len) {
+    size_t i = clnt->traces_len;
+
+    /* Everything that was to be sent after the message now ends later */
+    while (i > 0 && clnt->traces[i - 1].end > at) {
+        clnt->traces[i - 1].end += len;
+        i--;
+    }
+
+    if (msg->latency == NULL || clnt->traces_len == DIME_CLIENT_TRACES) {
+        return;
+    }
+
+    double now = dime_socket_now();
+
+    /* An urgent message never waits in the queue */
+    latency_record(msg->latency, DIME_LATENCY_QUEUE, 0);
+
+    memmove(clnt->traces + i + 1, clnt->traces + i, (clnt->traces_len - i) * sizeof(clnt->traces[0]));
+
+    clnt->traces[i].end = at + len;
+    clnt->traces[i].dequeued = now;
+    clnt->traces[i].lat = msg->latency;
+    clnt->traces_len++;
+}
+
+void dime_latency_written(dime_client_t *clnt) {
+    size_t done = 0;
+    double now = 0;
+
+    while (done < clnt->traces_len && clnt->traces[done].end <= clnt->bytes_out) {
+        if (done == 0) {
+            now = dime_socket_now();
+        }
+
+        latency_record(clnt->traces[done].lat, DIME_LATENCY_WRITE, now - clnt->traces[done].dequeued);
+        done++;
+    }
+
+    if (done > 0) {
+        clnt->traces_len -= done;
+        memmove(clnt->traces, clnt->traces + done, clnt->traces_len * sizeof(clnt->traces[0]));
+    }
+}
+
+void dime_latency_destroy(dime_server_t *srv) {
+    dime_table_iter_t it;
+
+    dime_table_iter_init(&it, &srv->latency);
+
+    while (dime_table_iter_next(&it)) {
+        free((char *)it.key);
+        latency_free(it.val);
+    }
+
+    latency_free(srv->latency_bcast);
+    dime_table_destroy(&srv->latency);
+}
+
+/* Summarize each stage of a group */
+static json_t *latency_summary(dime_latency_t *lat) {
+    json_t *summary = json_object();
+    if (summary == NULL) {
+        return NULL;
+    }
+
+    for (int i = 0; i < DIME_LATENCY_STAGES; i++) {
+        const dime_hdr_t *hdr = &lat->stages[i];
+
+        json_t *stage = json_pack("{sIsfsfsfsfsfsfsf}",
+                                  "count", (json_int_t)hdr->total,
+                                  "min", hdr->min / 1e9,
+                                  "mean", (hdr->total > 0) ? hdr->sum / hdr->total / 1e9 : 0.0,
+                                  "p50", dime_hdr_percentile(hdr, 50) / 1e9,
+                                  "p90", dime_hdr_percentile(hdr, 90) / 1e9,
+                                  "p99", dime_hdr_percentile(hdr, 99) / 1e9,
+                                  "p999", dime_hdr_percentile(hdr, 99.9) / 1e9,
+                                  "max", hdr->max / 1e9);
+
+        if (json_object_set_new(summary, stage_names[i], stage) < 0) {
+            json_decref(summary);
+
+            return NULL;
+        }
+    }
+
+    return summary;
+}
+
+int dime_latency_query(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len) {
+    int reset = 0;
+    dime_latency_t *total = latency_new();
+    json_t *groups = json_object();
+    json_t *response = NULL;
+
+    json_unpack(jsondata, "{s?b}", "reset", &reset);
+
+    if (total == NULL || groups == NULL) {
+        goto latency_err;
+    }
+
+    dime_table_iter_t it;
+
+    dime_table_iter_init(&it, &srv->latency);
+
+    while (dime_table_iter_next(&it)) {
+        dime_latency_t *lat = it.val;
+
+        for (int i = 0; i < DIME_LATENCY_STAGES; i++) {
+            if (dime_hdr_add(&total->stages[i], &lat->stages[i]) < 0) {
+                goto latency_err;
+            }
+        }
+
+        if (json_object_set_new(groups, it.key, latency_summary(lat)) < 0) {
+            goto latency_err;
+        }
+    }
+
+    for (int i = 0; srv->latency_bcast != NULL && i < DIME_LATENCY_STAGES; i++) {
+        if (dime_hdr_add(&total->stages[i], &srv->latency_bcast->stages[i]) < 0) {
+            goto latency_err;
+        }
+    }
+
+    response = json_pack("{sisIsososo}",
+                         "status", 0,
+                         "sample", (json_int_t)srv->latency_sample,
+                         "stages", latency_summary(total),
+                         "groups", groups,
+                         "broadcast", (srv->latency_bcast != NULL) ? latency_summary(srv->latency_bcast) : json_null());
+
+    /* The object belongs to the response now, even on failure */
+    groups = NULL;
+
+    if (response == NULL || dime_socket_push(&clnt->sock, response, NULL, 0) < 0) {
+        goto latency_err;
+    }
+
+    json_decref(response);
+    latency_free(total);
+
+    if (reset) {
+        dime_table_iter_init(&it, &srv->latency);
+
+        while (dime_table_iter_next(&it)) {
+            dime_latency_t *lat = it.val;
+
+            for (int i = 0; i < DIME_LATENCY_STAGES; i++) {
+                dime_hdr_reset(&lat->stages[i]);
+            }
+        }
+
+        for (int i = 0; srv->latency_bcast != NULL && i < DIME_LATENCY_STAGES; i++) {
+            dime_hdr_reset(&srv->latency_bcast->stages[i]);
+        }
+    }
+
+    return 0;
+
+latency_err:
+    latency_free(total);
+    json_decref(groups);
+    json_decref(response);
+
+    strncpy(srv->err, strerror(errno), sizeof(srv->err));
+    srv->err[sizeof(srv->err) - 1] = '\0';
+
+    response = json_pack("{siss}", "status", -1, "error", strerror(errno));
+    if (response != NULL) {
+        dime_socket_push(&clnt->sock, response, NULL, 0);
+        json_decref(response);
+    }
+
+    return -1;
+}
@@ -0,0 +1,167 @@
+/*
+ * latency.h - Sampled tracing of message latency
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file latency.h
+ * @brief Sampled tracing of message latency
+ * @author Nicholas West
+ * @date 2020
+ *
+ * One in every @c -t messages sent or broadcast is timestamped as it
+ * passes through the server, and the time it spends in each of three
+ * stages is recorded in @link dime_hdr_t @endlink histograms kept per
+ * group (and one for broadcasts):
+ * - @c route: from the "send" or "broadcast" command being handled to
+ *   the message being queued for all of its recipients, including any
+ *   transcoding
+ * - @c queue: from being queued to being taken off a recipient's queue
+ *   by a "sync" command, i.e. how long the recipient took to ask for it
+ * - @c write: from being taken off the queue to the last of its bytes
+ *   being accepted by the kernel, i.e. how long it waited behind other
+ *   data on a slow connection
+ *
+ * The "latency" command reports percentiles of each, so that a slow
+ * consumer (@c queue), a saturated connection (@c write) and the server
+ * itself (@c route) can be told apart.
+ */
+
+#include <stdint.h>
+
+#include <jansson.h>
+#include "client.h"
+#include "hdr.h"
+#include "server.h"
+
+#ifndef __DIME_latency_H
+#define __DIME_latency_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default number of messages per traced message */
+#define DIME_LATENCY_SAMPLE 64
+
+enum dime_latency_stage {
+    DIME_LATENCY_ROUTE,
+    DIME_LATENCY_QUEUE,
+    DIME_LATENCY_WRITE,
+    DIME_LATENCY_STAGES
+};
+
+/**
+ * @brief Latency histograms of a group
+ *
+ * Kept until the server is destroyed, even if the group is emptied, so
+ * that traced messages may point to them.
+ */
+typedef struct __dime_latency dime_latency_t;
+
+struct __dime_latency {
+    dime_hdr_t stages[DIME_LATENCY_STAGES]; /** Histograms, in nanoseconds */
+};
+
+/**
+ * @brief Decide whether to trace a message that is about to be relayed
+ *
+ * Samples one in every @c latency_sample messages. A traced message is
+ * timestamped and pointed to the histograms of its group.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param msg Pointer to a message
+ * @param name Name of the group the message is sent to, or NULL for a
+ * broadcast
+ */
+void dime_latency_trace(dime_server_t *srv, dime_rcmessage_t *msg, const char *name);
+
+/**
+ * @brief Record that a traced message was queued for its recipients
+ *
+ * @param msg Pointer to a message
+ */
+void dime_latency_queued(dime_rcmessage_t *msg);
+
+/**
+ * @brief Record that a traced message was taken off a client's queue
+ *
+ * Must be called after the message is pushed to the client's socket,
+ * so that its last byte can be recognized when it is sent.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param msg Pointer to a message
+ */
+void dime_latency_dequeued(dime_client_t *clnt, dime_rcmessage_t *msg);
+
+/**
+ * @brief Record that a message was pushed ahead of others already
+ * being sent
+ *
+ * Must be called after the message is pushed to the client's socket.
+ * Traced messages that were to be sent after the position @em at are
+ * moved back by @em len bytes, and the message itself is traced if it
+ * is sampled.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param msg Pointer to a message
+ * @param at Value of @c bytes_out where the message begins
+ * @param len Length of the message as it is sent
+ */
+void dime_latency_spliced(dime_client_t *clnt, dime_rcmessage_t *msg, uint64_t at, size_t len);
+
+/**
+ * @brief Record traced messages whose last byte was sent
+ *
+ * Called whenever @c bytes_out of a client grows.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ */
+void dime_latency_written(dime_client_t *clnt);
+
+/**
+ * @brief Free the latency histograms of a server
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ */
+void dime_latency_destroy(dime_server_t *srv);
+
+/**
+ * @brief Handle a "latency" command
+ *
+ * The "latency" command instructs the server to send the client the
+ * count, minimum, mean, maximum and 50th, 90th, 99th and 99.9th
+ * percentiles in seconds of each stage, over all traced messages in
+ * @c stages, per group in @c groups, and for broadcasts in
+ * @c broadcast. If the command's @c reset field is true, the
+ * histograms are emptied afterwards.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to the @link dime_server_t @endlink struct from
+ * which the client connection was accepted
+ * @param jsondata JSON portion of the message
+ * @param pbindata Binary portion of the message
+ * @param bindata_len Length of binary portion of the message
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_latency_query(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
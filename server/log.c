@@ -1,50 +1,628 @@
-#include <assert.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
+#include <pthread.h>
+
 #include "log.h"
 
-static void dime_print(const char *typestr, const char *fmt, va_list args) {
-    time_t t;
-    struct tm timeval;
+/* Number of records in the ring, a power of two */
+#define LOG_RING 1024
+
+/* Arguments kept per record, counting "*" widths and precisions */
+#define LOG_ARGS 12
+
+/* Longest formatted message */
+#define LOG_MSG 512
+
+/* Bytes kept per record for copies of string arguments, which are only
+ * cut short where the message would be */
+#define LOG_STRS LOG_MSG
+
+/* Bytes of output buffered before they are written */
+#define LOG_OUT 65536
+
+enum log_type {
+    LOG_NONE,
+    LOG_INT,
+    LOG_LONG,
+    LOG_LLONG,
+    LOG_SIZE,
+    LOG_INTMAX,
+    LOG_PTRDIFF,
+    LOG_DOUBLE,
+    LOG_LDOUBLE,
+    LOG_STR,
+    LOG_PTR
+};
+
+/* A conversion specification, e.g. "%-*.3zu" */
+typedef struct {
+    size_t len;        /* Length, from the "%" to the conversion */
+    int stars;         /* Number of "*" widths and precisions */
+    enum log_type type;
+} log_spec_t;
+
+typedef union {
+    int i;
+    long l;
+    long long ll;
+    size_t z;
+    intmax_t j;
+    ptrdiff_t t;
+    double d;
+    long double ld;
+    const void *p;
+    size_t str; /* Offset of a string in strs */
+} log_arg_t;
+
+typedef struct {
+    struct timespec ts;
+    const char *fmt;
+    int level;
+    unsigned int suppressed;
+    unsigned int nargs;
+    log_arg_t args[LOG_ARGS];
+    char strs[LOG_STRS];
+} log_record_t;
+
+static log_record_t ring[LOG_RING];
+static size_t ring_head; /* Written by the logging thread */
+static size_t ring_tail; /* Written by the background thread */
+static unsigned int dropped;
+
+static pthread_t thread;
+static int running, stopping;
+static int format = DIME_LOG_TEXT;
+
+/* The background thread sleeps on "wake" while the ring is empty, and
+ * sets "sleeping" first so that logging only signals it then */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static int sleeping;
+
+/* Only used by one thread at a time: the background thread while it
+ * runs, or the logging thread otherwise */
+static char out[LOG_OUT];
+static size_t out_len;
+static time_t timestr_sec = -1;
+static char timestr[40];
+
+static const char *text_levels[] = {
+    "\033[34mINFO\033[0m",
+    "\033[33mWARN\033[0m",
+    "\033[31mERR \033[0m"
+};
+
+static const char *json_levels[] = {"info", "warn", "err"};
+
+/* Parse the conversion specification at p, which follows a "%" */
+static void log_parse(const char *p, log_spec_t *spec) {
+    const char *start = p;
+    int len = 0;
+
+    spec->stars = 0;
+    spec->type = LOG_NONE;
 
-    time(&t);
-    //localtime_r(&t, &timeval);
-    timeval = *localtime(&t);
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+        p++;
+    }
 
+    for (int part = 0; part < 2; part++) {
+        if (*p == '*') {
+            spec->stars++;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
 
-    char timestr[32], outstr[161];
+        if (part == 0 && *p == '.') {
+            p++;
+        } else {
+            break;
+        }
+    }
 
-    strftime(timestr, sizeof(timestr), "%a, %d %b %Y %T %z", &timeval);
-    vsnprintf(outstr, sizeof(outstr), fmt, args);
+    if (p[0] == 'h' && p[1] == 'h') {
+        p += 2;
+    } else if (p[0] == 'l' && p[1] == 'l') {
+        len = 'q';
+        p += 2;
+    } else if (*p != '\0' && strchr("hlzjtL", *p) != NULL) {
+        len = *p;
+        p++;
+    }
 
-    fprintf(stderr, "[%s %s] %s\n", typestr, timestr, outstr);
+    switch (*p) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+        switch (len) {
+        case 'l': spec->type = LOG_LONG; break;
+        case 'q': spec->type = LOG_LLONG; break;
+        case 'z': spec->type = LOG_SIZE; break;
+        case 'j': spec->type = LOG_INTMAX; break;
+        case 't': spec->type = LOG_PTRDIFF; break;
+        default: spec->type = LOG_INT;
+        }
+
+        break;
+
+    case 'c':
+        spec->type = LOG_INT;
+        break;
+
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        spec->type = (len == 'L') ? LOG_LDOUBLE : LOG_DOUBLE;
+        break;
+
+    case 's':
+        spec->type = LOG_STR;
+        break;
+
+    case 'p':
+        spec->type = LOG_PTR;
+        break;
+    }
+
+    if (*p != '\0') {
+        p++;
+    }
+
+    spec->len = p - start + 1;
 }
 
-void dime_info(const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
+/* Copy the arguments a format string refers to into a record */
+static void log_capture(log_record_t *rec, va_list args) {
+    size_t strs_len = 0;
+    const char *p = rec->fmt;
 
-    dime_print("\033[34mINFO\033[0m", fmt, args);
+    rec->nargs = 0;
+    rec->strs[LOG_STRS - 1] = '\0';
 
-    va_end(args);
+    while ((p = strchr(p, '%')) != NULL) {
+        log_spec_t spec;
+
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+
+        log_parse(p + 1, &spec);
+        p += spec.len;
+
+        if (spec.type == LOG_NONE) {
+            break;
+        }
+
+        if (rec->nargs + spec.stars + 1 > LOG_ARGS) {
+            break;
+        }
+
+        for (int i = 0; i < spec.stars; i++) {
+            rec->args[rec->nargs++].i = va_arg(args, int);
+        }
+
+        log_arg_t *arg = &rec->args[rec->nargs++];
+
+        switch (spec.type) {
+        case LOG_INT: arg->i = va_arg(args, int); break;
+        case LOG_LONG: arg->l = va_arg(args, long); break;
+        case LOG_LLONG: arg->ll = va_arg(args, long long); break;
+        case LOG_SIZE: arg->z = va_arg(args, size_t); break;
+        case LOG_INTMAX: arg->j = va_arg(args, intmax_t); break;
+        case LOG_PTRDIFF: arg->t = va_arg(args, ptrdiff_t); break;
+        case LOG_DOUBLE: arg->d = va_arg(args, double); break;
+        case LOG_LDOUBLE: arg->ld = va_arg(args, long double); break;
+        case LOG_PTR: arg->p = va_arg(args, void *); break;
+
+        case LOG_STR: {
+            const char *s = va_arg(args, const char *);
+
+            if (s == NULL) {
+                s = "(null)";
+            }
+
+            /* Strings that don't fit are truncated */
+            if (strs_len < LOG_STRS - 1) {
+                size_t n = strlen(s);
+
+                if (n > LOG_STRS - 1 - strs_len - 1) {
+                    n = LOG_STRS - 1 - strs_len - 1;
+                }
+
+                memcpy(rec->strs + strs_len, s, n);
+                rec->strs[strs_len + n] = '\0';
+
+                arg->str = strs_len;
+                strs_len += n + 1;
+            } else {
+                arg->str = LOG_STRS - 1;
+            }
+
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+}
+
+/* Format the message of a record into buf, like vsnprintf would */
+static void log_message(const log_record_t *rec, char *buf, size_t size) {
+    size_t len = 0;
+    unsigned int argi = 0;
+    const char *p = rec->fmt;
+
+    buf[0] = '\0';
+
+    while (*p != '\0' && len < size - 1) {
+        const char *pct = strchr(p, '%');
+
+        if (pct == NULL) {
+            pct = p + strlen(p);
+        }
+
+        size_t n = pct - p;
+
+        if (n > size - 1 - len) {
+            n = size - 1 - len;
+        }
+
+        memcpy(buf + len, p, n);
+        len += n;
+        buf[len] = '\0';
+        p = pct;
+
+        if (*p == '\0' || len >= size - 1) {
+            break;
+        }
+
+        if (p[1] == '%') {
+            buf[len++] = '%';
+            buf[len] = '\0';
+            p += 2;
+            continue;
+        }
+
+        log_spec_t spec;
+        char specstr[64];
+        size_t speclen = 0;
+
+        log_parse(p + 1, &spec);
+
+        if (spec.type == LOG_NONE || argi + spec.stars + 1 > rec->nargs || spec.len + 24 > sizeof(specstr)) {
+            break;
+        }
+
+        /* Substitute "*" widths and precisions with their values */
+        for (size_t i = 0; i < spec.len; i++) {
+            if (p[i] != '*') {
+                specstr[speclen++] = p[i];
+            } else if (i > 0 && p[i - 1] == '.' && rec->args[argi].i < 0) {
+                /* A negative precision is taken as if it were omitted */
+                speclen--;
+                argi++;
+            } else {
+                speclen += sprintf(specstr + speclen, "%d", rec->args[argi++].i);
+            }
+        }
+
+        specstr[speclen] = '\0';
+        p += spec.len;
+
+        const log_arg_t *arg = &rec->args[argi++];
+        char *dst = buf + len;
+        size_t avail = size - len;
+        int ret = 0;
+
+        switch (spec.type) {
+        case LOG_INT: ret = snprintf(dst, avail, specstr, arg->i); break;
+        case LOG_LONG: ret = snprintf(dst, avail, specstr, arg->l); break;
+        case LOG_LLONG: ret = snprintf(dst, avail, specstr, arg->ll); break;
+        case LOG_SIZE: ret = snprintf(dst, avail, specstr, arg->z); break;
+        case LOG_INTMAX: ret = snprintf(dst, avail, specstr, arg->j); break;
+        case LOG_PTRDIFF: ret = snprintf(dst, avail, specstr, arg->t); break;
+        case LOG_DOUBLE: ret = snprintf(dst, avail, specstr, arg->d); break;
+        case LOG_LDOUBLE: ret = snprintf(dst, avail, specstr, arg->ld); break;
+        case LOG_STR: ret = snprintf(dst, avail, specstr, rec->strs + arg->str); break;
+        case LOG_PTR: ret = snprintf(dst, avail, specstr, arg->p); break;
+        default: break;
+        }
+
+        if (ret > 0) {
+            len += ((size_t)ret < avail) ? (size_t)ret : avail - 1;
+        }
+    }
 }
 
-void dime_warn(const char *fmt, ...) {
+static void log_flush(void) {
+    if (out_len > 0) {
+        fwrite(out, 1, out_len, stderr);
+        fflush(stderr);
+        out_len = 0;
+    }
+}
+
+static void log_append(const char *s, size_t n) {
+    if (out_len + n > sizeof(out)) {
+        log_flush();
+
+        if (n > sizeof(out)) {
+            n = sizeof(out);
+        }
+    }
+
+    memcpy(out + out_len, s, n);
+    out_len += n;
+}
+
+static void log_appendf(const char *fmt, ...) {
+    char buf[128];
     va_list args;
+
     va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
 
-    dime_print("\033[33mWARN\033[0m", fmt, args);
+    if (n > 0) {
+        log_append(buf, ((size_t)n < sizeof(buf)) ? (size_t)n : sizeof(buf) - 1);
+    }
+}
 
-    va_end(args);
+/* Append a string with the characters JSON requires escaped */
+static void log_append_json(const char *s) {
+    for (; *s != '\0'; s++) {
+        char esc[8];
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\';
+            esc[1] = c;
+            log_append(esc, 2);
+        } else if (c < 0x20) {
+            log_append(esc, sprintf(esc, "\\u%04x", c));
+        } else {
+            log_append(s, 1);
+        }
+    }
+}
+
+/* Format a record and append it to the output buffer */
+static void log_write(const log_record_t *rec) {
+    char msg[LOG_MSG];
+    int level = (rec->level >= DIME_LOG_INFO && rec->level <= DIME_LOG_ERR) ? rec->level : DIME_LOG_ERR;
+
+    log_message(rec, msg, sizeof(msg));
+
+    /* Most records share the second of the one before them */
+    if (rec->ts.tv_sec != timestr_sec) {
+        time_t t = rec->ts.tv_sec;
+        struct tm timeval;
+
+#ifdef _WIN32
+        timeval = *localtime(&t);
+#else
+        localtime_r(&t, &timeval);
+#endif
+
+        strftime(timestr, sizeof(timestr), (format == DIME_LOG_JSON) ? "%Y-%m-%dT%H:%M:%S" : "%a, %d %b %Y %T %z", &timeval);
+
+        if (format == DIME_LOG_JSON) {
+            /* The offset follows the milliseconds */
+            size_t n = strlen(timestr);
+
+            strftime(timestr + n + 1, sizeof(timestr) - n - 1, "%z", &timeval);
+        }
+
+        timestr_sec = rec->ts.tv_sec;
+    }
+
+    if (format == DIME_LOG_JSON) {
+        log_appendf("{\"time\":\"%s.%03ld%s\",\"level\":\"%s\",\"message\":\"",
+                    timestr, (long)(rec->ts.tv_nsec / 1000000), timestr + strlen(timestr) + 1, json_levels[level]);
+        log_append_json(msg);
+
+        if (rec->suppressed > 0) {
+            log_appendf("\",\"suppressed\":%u}\n", rec->suppressed);
+        } else {
+            log_append("\"}\n", 3);
+        }
+    } else {
+        log_appendf("[%s %s] ", text_levels[level], timestr);
+        log_append(msg, strlen(msg));
+
+        if (rec->suppressed > 0) {
+            log_appendf(" (%u similar suppressed)", rec->suppressed);
+        }
+
+        log_append("\n", 1);
+    }
+}
+
+/* Report records dropped since the last report */
+static void log_dropped(void) {
+    unsigned int n = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+
+    if (n > 0) {
+        log_record_t rec;
+
+        clock_gettime(CLOCK_REALTIME, &rec.ts);
+        rec.fmt = "Dropped %u log records, the log ring was full";
+        rec.level = DIME_LOG_WARN;
+        rec.suppressed = 0;
+        rec.nargs = 1;
+        rec.args[0].i = n;
+
+        log_write(&rec);
+    }
 }
 
-void dime_err(const char *fmt, ...) {
+/* Format and write every record in the ring */
+static int log_drain(void) {
+    size_t tail = ring_tail;
+    size_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    for (; tail != head; tail++, n++) {
+        log_write(&ring[tail & (LOG_RING - 1)]);
+
+        __atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    log_dropped();
+    log_flush();
+
+    return n;
+}
+
+/* Wake the background thread if it is waiting for records */
+static void log_wake(void) {
+    if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+static void *log_thread(void *arg) {
+    for (;;) {
+        if (log_drain() > 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&lock);
+
+        /* Records logged after this are seen below, or signal the wait */
+        __atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+
+        int stop = __atomic_load_n(&stopping, __ATOMIC_SEQ_CST);
+
+        if (!stop && __atomic_load_n(&ring_head, __ATOMIC_SEQ_CST) == ring_tail) {
+            pthread_cond_wait(&wake, &lock);
+        }
+
+        __atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&lock);
+
+        if (stop) {
+            log_drain();
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+void dime_log(dime_log_site_t *site, int level, const char *fmt, ...) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    /* Refill the call site's token bucket; errors are never suppressed */
+    if (level < DIME_LOG_ERR) {
+        double now = ts.tv_sec + ts.tv_nsec / 1e9;
+
+        if (site->last == 0) {
+            site->tokens = DIME_LOG_BURST;
+        } else {
+            site->tokens += (now - site->last) * DIME_LOG_RATE;
+
+            if (site->tokens > DIME_LOG_BURST) {
+                site->tokens = DIME_LOG_BURST;
+            }
+        }
+
+        site->last = now;
+
+        if (site->tokens < 1) {
+            site->suppressed++;
+            return;
+        }
+
+        site->tokens--;
+    }
+
+    log_record_t local, *rec = &local;
+    size_t head = ring_head;
+
+    if (running) {
+        if (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= LOG_RING) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        rec = &ring[head & (LOG_RING - 1)];
+    }
+
     va_list args;
     va_start(args, fmt);
 
-    dime_print("\033[31mERR \033[0m", fmt, args);
+    rec->ts = ts;
+    rec->fmt = fmt;
+    rec->level = level;
+    rec->suppressed = site->suppressed;
+    log_capture(rec, args);
 
     va_end(args);
+
+    site->suppressed = 0;
+
+    if (running) {
+        __atomic_store_n(&ring_head, head + 1, __ATOMIC_SEQ_CST);
+        log_wake();
+    } else {
+        log_write(rec);
+        log_flush();
+    }
+}
+
+int dime_log_start(int fmt) {
+    if (running) {
+        return 0;
+    }
+
+    format = fmt;
+    timestr_sec = -1;
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+
+    /* Signals are left to the event loop, which the thread inherits */
+    sigset_t all, old;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    int err = pthread_create(&thread, NULL, log_thread, NULL);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err != 0) {
+        return -1;
+    }
+
+    running = 1;
+
+    return 0;
+}
+
+void dime_log_stop(void) {
+    if (!running) {
+        return;
+    }
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(thread, NULL);
+
+    running = 0;
+    log_drain();
 }
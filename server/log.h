@@ -25,8 +25,24 @@
  * @link dime_client_t @endlink and @link dime_server_t @endlink. These
  * methods should not be called unless at least one "-v" flag was
  * specified at runtime.
+ *
+ * Once @link dime_log_start @endlink has been called, logging does not
+ * format anything on the calling thread. A record of the time, level,
+ * format string and arguments (with strings copied) is put in a
+ * lock-free ring, and a background thread formats records and writes
+ * them to standard error in batches, sleeping while the ring is empty.
+ * If the ring is full, records are dropped and counted rather than
+ * blocking the caller. Before the thread is started, records are
+ * written immediately.
+ *
+ * Each call site of @link dime_info @endlink or @link dime_warn @endlink
+ * may log at most @c DIME_LOG_RATE records per second, after an initial
+ * burst of @c DIME_LOG_BURST; the next record written from that call
+ * site says how many were suppressed. Errors are not rate limited.
  */
 
+#include <stdarg.h>
+
 #ifndef __DIME_log_H
 #define __DIME_log_H
 
@@ -34,6 +50,60 @@
 extern "C" {
 #endif
 
+/** Records per second each call site may log */
+#define DIME_LOG_RATE 100
+
+/** Records each call site may log at once before being rate limited */
+#define DIME_LOG_BURST 1000
+
+enum dime_log_level {
+    DIME_LOG_INFO,
+    DIME_LOG_WARN,
+    DIME_LOG_ERR
+};
+
+enum dime_log_format {
+    DIME_LOG_TEXT, /** Colored lines for a terminal */
+    DIME_LOG_JSON  /** One JSON object per line */
+};
+
+/**
+ * @brief Rate limit of a call site
+ *
+ * Zero-initialized, one per call site of @link dime_info @endlink,
+ * @link dime_warn @endlink or @link dime_err @endlink.
+ */
+typedef struct {
+    double tokens;           /** Records that may be logged now */
+    double last;             /** Time tokens were last added */
+    unsigned int suppressed; /** Records suppressed since the last one logged */
+} dime_log_site_t;
+
+/**
+ * @brief Log a record from a call site
+ *
+ * Usually called through @link dime_info @endlink,
+ * @link dime_warn @endlink or @link dime_err @endlink.
+ *
+ * @param site Rate limit of the call site
+ * @param level One of @c dime_log_level
+ * @param fmt Format string, which must outlive the server (e.g. a
+ * string literal)
+ * @param ... Additional arguments
+ */
+void dime_log(dime_log_site_t *site, int level, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+/** Log a record with its own rate limit */
+#define DIME_LOG(level, ...) \
+    do { \
+        static dime_log_site_t dime_log_site_; \
+        dime_log(&dime_log_site_, (level), __VA_ARGS__); \
+    } while (0)
+
 /**
  * @brief Send a formated "INFO" line to stderr
  *
@@ -43,7 +113,7 @@ extern "C" {
  * @param fmt Format string
  * @param ... Additional arguments
  */
-void dime_info(const char *fmt, ...);
+#define dime_info(...) DIME_LOG(DIME_LOG_INFO, __VA_ARGS__)
 
 /**
  * @brief Send a formated "WARN" line to stderr
@@ -54,7 +124,7 @@ void dime_info(const char *fmt, ...);
  * @param fmt Format string
  * @param ... Additional arguments
  */
-void dime_warn(const char *fmt, ...);
+#define dime_warn(...) DIME_LOG(DIME_LOG_WARN, __VA_ARGS__)
 
 /**
  * @brief Send a formated "ERR" line to stderr
@@ -65,7 +135,27 @@ void dime_warn(const char *fmt, ...);
  * @param fmt Format string
  * @param ... Additional arguments
  */
-void dime_err(const char *fmt, ...);
+#define dime_err(...) DIME_LOG(DIME_LOG_ERR, __VA_ARGS__)
+
+/**
+ * @brief Start writing records from a background thread
+ *
+ * Must be called after the process has daemonized, if at all, since
+ * threads do not survive a fork.
+ *
+ * @param format One of @c dime_log_format
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure, in which case records are still written immediately
+ */
+int dime_log_start(int format);
+
+/**
+ * @brief Write all pending records and stop the background thread
+ *
+ * Records logged afterwards are written immediately.
+ */
+void dime_log_stop(void);
 
 #ifdef __cplusplus
 }
@@ -2,8 +2,11 @@
 #   include <winsock2.h>
 #   include <ws2tcpip.h>
 #   pragma comment(lib, "Ws2_32.lib")
+#else
+#   include <sys/socket.h>
 #endif
 
+#include <limits.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,17 +14,171 @@
 #include <string.h>
 
 #include <openssl/ssl.h>
+#include "latency.h"
+#include "log.h"
 #include "server.h"
+#include "session.h"
+#include "udp.h"
 
 static dime_server_t srv;
 
-static void sighandler(int signal) {
-    exit(0);
+/* Parse a list of codecs for -z, e.g. "zstd:5,zlib" */
+static int parse_compress(char *spec) {
+    srv.compress_codecs = 0;
+
+    for (char *tok = strtok(spec, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        char *level = strchr(tok, ':');
+        if (level != NULL) {
+            *level++ = '\0';
+        }
+
+        int codec = dime_compress_from_str(tok);
+
+        if (codec == DIME_COMPRESS_NONE) {
+            continue;
+        } else if (codec < 0 || !dime_compress_available(codec)) {
+            fprintf(stderr, "Compression codec \"%s\" is not available\n", tok);
+            return -1;
+        }
+
+        srv.compress_codecs |= 1u << codec;
+
+        if (level != NULL) {
+            srv.compress_levels[codec] = strtol(level, NULL, 0);
+        }
+    }
+
+    return 0;
+}
+
+/* Parse a list of socket options for -o, e.g. "backlog=1024,quickack" */
+static int parse_sockopts(char *spec) {
+    for (char *tok = strtok(spec, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        char *val = strchr(tok, '=');
+        if (val != NULL) {
+            *val++ = '\0';
+        }
+
+        /* Flags are set when no value is given */
+        long n = (val != NULL) ? strtol(val, NULL, 0) : 1;
+
+        if (strcmp(tok, "nodelay") == 0) {
+            srv.nodelay = (n != 0);
+        } else if (strcmp(tok, "quickack") == 0) {
+            srv.quickack = (n != 0);
+        } else if (strcmp(tok, "cork") == 0) {
+            srv.cork = (n != 0);
+        } else if (val != NULL && n >= 0 && n <= INT_MAX && strcmp(tok, "backlog") == 0) {
+            srv.backlog = n;
+        } else if (val != NULL && n >= 0 && n <= INT_MAX && strcmp(tok, "sndbuf") == 0) {
+            srv.sndbuf = n;
+        } else if (val != NULL && n >= 0 && n <= INT_MAX && strcmp(tok, "rcvbuf") == 0) {
+            srv.rcvbuf = n;
+        } else {
+            fprintf(stderr, "Invalid socket option \"%s\"\n", tok);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Parse a grace period, budget and number of sessions for -s, e.g. "60:1048576:100" */
+static int parse_session(const char *spec) {
+    char *end;
+    double grace = strtod(spec, &end);
+
+    if (end == spec || grace < 0) {
+        return -1;
+    }
+
+    srv.session_grace = grace;
+
+    if (*end == ':') {
+        srv.session_max = strtoul(end + 1, &end, 0);
+    }
+
+    if (*end == ':') {
+        srv.session_held_max = strtoul(end + 1, &end, 0);
+    }
+
+    return (*end == '\0') ? 0 : -1;
+}
+
+/* Parse a per-wakeup budget for -b, e.g. "64:1048576" */
+static int parse_budget(const char *spec) {
+    char *end;
+
+    srv.budget_msgs = strtoul(spec, &end, 0);
+
+    if (end == spec) {
+        return -1;
+    }
+
+    if (*end == ':') {
+        srv.budget_bytes = strtoul(end + 1, &end, 0);
+    }
+
+    return (*end == '\0') ? 0 : -1;
+}
+
+/* Parse a memory budget for -M, e.g. "1073741824:/var/tmp" */
+static int parse_memory(const char *spec) {
+    char *end;
+
+    srv.mem_max = strtoul(spec, &end, 0);
+
+    if (end == spec) {
+        return -1;
+    }
+
+    if (*end == ':') {
+        if (end[1] == '\0') {
+            return -1;
+        }
+
+        srv.spill_dir = end + 1;
+        return 0;
+    }
+
+    return (*end == '\0') ? 0 : -1;
+}
+
+/* Parse a time-to-live for -T, e.g. "5" or "telemetry:0.5" */
+static int parse_ttl(char *spec) {
+    char *colon = strrchr(spec, ':');
+    char *secs = (colon != NULL) ? colon + 1 : spec;
+    char *end;
+
+    double ttl = strtod(secs, &end);
+
+    if (end == secs || *end != '\0' || ttl < 0) {
+        return -1;
+    }
+
+    if (colon == NULL) {
+        srv.ttl_default = ttl;
+        return 0;
+    }
+
+    if (colon == spec) {
+        return -1;
+    }
+
+    /* Group names may contain colons themselves */
+    *colon = '\0';
+
+    srv.ttl_names[srv.ttl_len] = spec;
+    srv.ttl_secs[srv.ttl_len] = ttl;
+    srv.ttl_len++;
+
+    return 0;
 }
 
 static void cleanup() {
     EVP_cleanup();
     dime_server_destroy(&srv);
+    dime_log_stop();
 }
 
 int main(int argc, char **argv) {
@@ -29,19 +186,20 @@ int main(int argc, char **argv) {
     SSL_load_error_strings();
     atexit(cleanup);
 
-    signal(SIGTERM, sighandler);
-    signal(SIGINT, sighandler);
-
+    /* SIGINT, SIGTERM and SIGHUP make dime_server_loop return, and the server is shut down at exit */
 #ifdef SIGPIPE
     signal(SIGPIPE, SIG_IGN);
 #endif
 
-#ifdef SIGHUP
-    signal(SIGHUP, sighandler);
-#endif
-
     char *listens[(argc + 1) / 2];
     size_t listens_len = 0;
+    dime_link_t links[(argc + 1) / 2];
+    size_t links_len = 0;
+    const char *ttl_names[(argc + 1) / 2];
+    double ttl_secs[(argc + 1) / 2];
+    const char *udp = NULL;
+    uint16_t metrics_port = 0;
+    int log_format = DIME_LOG_TEXT;
 #ifdef _WIN32
     char listens_default[] = "tcp:5000";
     WSADATA _d;
@@ -58,6 +216,28 @@ int main(int argc, char **argv) {
 
     srv.verbosity = 0;
     srv.threads = 1;
+    srv.ktls = 1;
+    srv.nodelay = 1;
+    srv.cork = 1;
+    srv.backlog = SOMAXCONN;
+    srv.compress_threshold = DIME_COMPRESS_THRESHOLD;
+    srv.udp_max = DIME_UDP_MAX;
+    srv.session_grace = DIME_SESSION_GRACE;
+    srv.session_max = DIME_SESSION_MAX;
+    srv.session_held_max = DIME_SESSION_HELD_MAX;
+    srv.latency_sample = DIME_LATENCY_SAMPLE;
+    srv.ttl_names = ttl_names;
+    srv.ttl_secs = ttl_secs;
+    srv.budget_msgs = DIME_BUDGET_MSGS;
+    srv.budget_bytes = DIME_BUDGET_BYTES;
+
+    for (int codec = DIME_COMPRESS_NONE + 1; codec < DIME_COMPRESS_MAX; codec++) {
+        srv.compress_levels[codec] = dime_compress_default_level(codec);
+
+        if (dime_compress_available(codec)) {
+            srv.compress_codecs |= 1u << codec;
+        }
+    }
 
     for (int argi = 1; argi < argc; argi++) {
         int skip = 0;
@@ -65,6 +245,18 @@ int main(int argc, char **argv) {
         if (argv[argi][0] == '-') {
             for (unsigned int j = 1; argv[argi][j] != '\0'; j++) {
                 switch (argv[argi][j]) {
+                case 'b':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    if (parse_budget(argv[argi + 1]) < 0) {
+                        goto usage_err;
+                    }
+
+                    break;
+
                 case 'c':
                     if (argi + 1 > argc) {
                         goto usage_err;
@@ -83,28 +275,106 @@ int main(int argc, char **argv) {
                 case 'h':
                     printf("Usage: %s [options]\n"
                            "\n"
-                           "Options:\n"
-                           "-c <certfile>          Specifies a certificate file to use for TLS "
-                           "                       encryption. Requires -k to be specified as well. \n"
-                           "                       Note that TLS is a work in progress, and is \n"
-                           "                       currently only supported by the Python client.\n"
-                           "-d                     Forks the process to the background Only works on \n"
-                           "                       Unix-like systems.\n"
-                           "-h                     Displays this help message.\n"
-                           "-k <privkeyfile>       Specifies a private key file to use for TLS \n"
-                           "                       encryption. Requires -c to be specified as well. \n"
-                           "                       Note that TLS is a work in progress, and is \n"
-                           "                       currently only supported by the Python client.\n"
-                           "-l <protocol>:<info>   Specifies an additional method for clients to \n"
-                           "                       connect to the server. Valid protocols are unix, \n"
-                           "                       ipc (an alias for unix), tcp, and ws. Additional \n"
-                           "                       information is either a socket file (in the case \n"
-                           "                       of unix) or a port on the local machine (in the \n"
-                           "                       case of tcp and ws). The unix protocol only works \n"
-                           "                       on Unix-like systems.\n"
-                           "-v                     Increases the verbosity of the server.\n",
-                           argv[0]);
-                        
+                           "Options:\n", argv[0]);
+
+                    /* Split up, as C99 compilers need only support strings of 4095 characters */
+                    fputs("-b <messages>[:<bytes>]\n"
+                          "                       Specifies how many messages, and optionally how \n"
+                          "                       many bytes of them, are handled from one client \n"
+                          "                       before the other clients get their turn. The rest \n"
+                          "                       are handled on the next pass of the event loop. \n"
+                          "                       Defaults to 64 and 1 MiB; 0 means no limit.\n"
+                          "-c <certfile>          Specifies a certificate file to use for TLS "
+                          "                       encryption. Requires -k to be specified as well. \n"
+                          "                       Note that TLS is a work in progress, and is \n"
+                          "                       currently only supported by the Python client.\n"
+                          "-d                     Forks the process to the background Only works on \n"
+                          "                       Unix-like systems.\n"
+                          "-h                     Displays this help message.\n"
+                          "-J                     Writes log lines (see -v) as JSON objects, one \n"
+                          "                       per line, instead of text.\n"
+                          "-k <privkeyfile>       Specifies a private key file to use for TLS \n"
+                          "                       encryption. Requires -c to be specified as well. \n"
+                          "                       Note that TLS is a work in progress, and is \n"
+                          "                       currently only supported by the Python client.\n"
+                          "-K                     Disables kernel TLS offload, which is otherwise \n"
+                          "                       used on Linux where OpenSSL and the negotiated \n"
+                          "                       cipher support it.\n"
+                          "-l <protocol>:<info>   Specifies an additional method for clients to \n"
+                          "                       connect to the server. Valid protocols are unix, \n"
+                          "                       ipc (an alias for unix), tcp, and ws. Additional \n"
+                          "                       information is either a socket file (in the case \n"
+                          "                       of unix) or a port on the local machine (in the \n"
+                          "                       case of tcp and ws). The unix protocol only works \n"
+                          "                       on Unix-like systems.\n", stdout);
+                    fputs("-m <port>              Serves metrics in the OpenMetrics text format \n"
+                          "                       (e.g. for Prometheus) over HTTP on a TCP port: \n"
+                          "                       connections, traffic, queue depths, groups, and \n"
+                          "                       event loop lag. At most 16 requests are served \n"
+                          "                       at once, each for up to 10 seconds.\n"
+                          "-M <bytes>[:<directory>]\n"
+                          "                       Specifies how many bytes of queued and outgoing \n"
+                          "                       messages are kept in memory. Beyond that, the \n"
+                          "                       binary portions of newly queued messages are \n"
+                          "                       spilled to a file in the directory (defaults to \n"
+                          "                       $TMPDIR or /tmp) and read back as they are sent. \n"
+                          "                       Defaults to 0, no limit.\n"
+                          "-o <option>[=<value>],...\n"
+                          "                       Sets options of TCP and WebSocket connections. \n"
+                          "                       Valid options are backlog (pending connections \n"
+                          "                       per listener, defaults to SOMAXCONN), sndbuf and \n"
+                          "                       rcvbuf (socket buffer sizes in bytes, default \n"
+                          "                       chosen by the OS), and the flags nodelay \n"
+                          "                       (TCP_NODELAY, on by default), cork (batch bursts \n"
+                          "                       of messages with TCP_CORK, on by default) and \n"
+                          "                       quickack (TCP_QUICKACK, off by default). Flags \n"
+                          "                       are turned off with e.g. nodelay=0.\n"
+                          "-P <host>:<port>       Links to another server listening on a TCP port, \n"
+                          "                       so that clients of either can send variables to \n"
+                          "                       each other. May be given more than once; every \n"
+                          "                       pair of servers must be linked (from either \n"
+                          "                       side). IPv6 hosts are written in brackets. Links \n"
+                          "                       that go down are dialed again.\n", stdout);
+                    fputs("-s <seconds>[:<bytes>[:<sessions>]]\n"
+                          "                       Specifies how long the queue and groups of a \n"
+                          "                       disconnected client with a session are held for \n"
+                          "                       it to resume, and optionally how many bytes may \n"
+                          "                       be queued for it meanwhile before the oldest \n"
+                          "                       messages are dropped, and how many sessions are \n"
+                          "                       held at once. Defaults to 30 seconds, 16 MiB and \n"
+                          "                       1024 sessions; 0 seconds disables sessions.\n"
+                          "-S <secret>            Specifies a secret that servers linking to this \n"
+                          "                       one (see -P) must present, and that this server \n"
+                          "                       presents to them. Without it, only the links \n"
+                          "                       given with -P are accepted. The secret is sent \n"
+                          "                       in the clear.\n"
+                          "-t <n>                 Traces the latency of one in every n messages \n"
+                          "                       through the server, for the latency command. \n"
+                          "                       Defaults to 64; 0 disables tracing.\n"
+                          "-T [<group>:]<seconds> Specifies how long messages sent to the group, or \n"
+                          "                       to any group or by broadcast if none is given, \n"
+                          "                       stay queued before they are dropped unsent. A \n"
+                          "                       \"ttl\" field of a message overrides it. May be \n"
+                          "                       given more than once. Defaults to 0, forever.\n"
+                          "-u <group>:<port>[@<interface>]\n"
+                          "-u fanout              Lets clients receive small broadcasts as UDP \n"
+                          "                       datagrams, either sent once to an IPv4 multicast \n"
+                          "                       group (optionally on the interface with the given \n"
+                          "                       address), or sent to each client in turn.\n"
+                          "-U <bytes>             Specifies the size of the largest broadcast sent \n"
+                          "                       as a datagram. Defaults to 1400, and is at most \n"
+                          "                       65507.\n"
+                          "-v                     Increases the verbosity of the server.\n"
+                          "-z <codec>[:<level>],...\n"
+                          "                       Specifies which compression codecs clients may \n"
+                          "                       negotiate, and optionally their compression \n"
+                          "                       levels. Valid codecs are zlib, lz4 and zstd (the \n"
+                          "                       latter two only if compiled in), or none to \n"
+                          "                       disable compression. Defaults to all available \n"
+                          "                       codecs.\n"
+                          "-Z <bytes>             Specifies the size of the smallest message that \n"
+                          "                       is compressed. Defaults to 4096.\n", stdout);
+
                     return 0;
 
                 case 'j':
@@ -133,6 +403,14 @@ int main(int argc, char **argv) {
 
                     break;
 
+                case 'J':
+                    log_format = DIME_LOG_JSON;
+                    break;
+
+                case 'K':
+                    srv.ktls = 0;
+                    break;
+
                 case 'l':
                     if (argi + 1 > argc) {
                         goto usage_err;
@@ -143,10 +421,151 @@ int main(int argc, char **argv) {
 
                     break;
 
+                case 'm':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    metrics_port = strtoul(argv[argi + 1], NULL, 0);
+                    if (metrics_port == 0) {
+                        goto usage_err;
+                    }
+
+                    srv.metrics = 1;
+
+                    break;
+
+                case 'M':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    if (parse_memory(argv[argi + 1]) < 0) {
+                        goto usage_err;
+                    }
+
+                    break;
+
+                case 'o':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    if (parse_sockopts(argv[argi + 1]) < 0) {
+                        return 1;
+                    }
+
+                    break;
+
+                case 'P':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    memset(&links[links_len], 0, sizeof(dime_link_t));
+                    links[links_len++].addr = argv[argi + 1];
+
+                    break;
+
+                case 's':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    if (parse_session(argv[argi + 1]) < 0) {
+                        goto usage_err;
+                    }
+
+                    break;
+
+                case 'S':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    srv.link_secret = argv[argi + 1];
+
+                    break;
+
+                case 't':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    srv.latency_sample = strtoul(argv[argi + 1], NULL, 0);
+
+                    break;
+
+                case 'T':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    if (parse_ttl(argv[argi + 1]) < 0) {
+                        goto usage_err;
+                    }
+
+                    break;
+
+                case 'u':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    udp = argv[argi + 1];
+
+                    break;
+
+                case 'U':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    srv.udp_max = strtoul(argv[argi + 1], NULL, 0);
+
+                    /* Larger broadcasts could never be sent, and go through the queues */
+                    if (srv.udp_max > DIME_UDP_LIMIT) {
+                        srv.udp_max = DIME_UDP_LIMIT;
+                    }
+
+                    break;
+
                 case 'v':
                     srv.verbosity++;
                     break;
 
+                case 'z':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    if (parse_compress(argv[argi + 1]) < 0) {
+                        return 1;
+                    }
+
+                    break;
+
+                case 'Z':
+                    if (argi + 1 >= argc) {
+                        goto usage_err;
+                    }
+
+                    skip = 1;
+                    srv.compress_threshold = strtoul(argv[argi + 1], NULL, 0);
+
+                    break;
+
                 default:
                     goto usage_err;
                 }
@@ -216,12 +635,26 @@ int main(int argc, char **argv) {
         listens_len = 1;
     }
 
+    srv.links = links;
+    srv.links_len = links_len;
+
     if (dime_server_init(&srv) < 0) {
         fprintf(stderr, "Fatal error while initializing server: %s\n", srv.err);
 
         return -1;
     }
 
+    /* Started after daemonizing, since the thread would not survive it */
+    if (srv.verbosity >= 1 && dime_log_start(log_format) < 0) {
+        dime_warn("Failed to start logging thread, logging synchronously");
+    }
+
+    if (udp != NULL && dime_udp_init(&srv, udp) < 0) {
+        fprintf(stderr, "Fatal error while initializing server: %s\n", srv.err);
+
+        return -1;
+    }
+
     for (size_t i = 0; i < listens_len; i++) {
         char *type;
 
@@ -288,6 +721,12 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (metrics_port != 0 && dime_server_add(&srv, DIME_METRICS, metrics_port) < 0) {
+        fprintf(stderr, "Fatal error while initializing server: %s\n", srv.err);
+
+        return -1;
+    }
+
     if (dime_server_loop(&srv) < 0) {
         fprintf(stderr, "Fatal error while running server: %s\n", srv.err);
         return -1;
@@ -0,0 +1,455 @@
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/socket.h>
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "client.h"
+#include "metrics.h"
+#include "server.h"
+#include "socket.h"
+#include "table.h"
+
+#ifdef _WIN32
+#   define close closesocket
+#endif
+
+/* Upper bounds of all but the last bucket of the loop lag histogram */
+static const double lag_bounds[DIME_LAG_BUCKETS - 1] = {0.0001, 0.001, 0.01, 0.1, 1};
+
+/* The same bounds as OpenMetrics labels, which must be canonical floats */
+static const char *const lag_labels[DIME_LAG_BUCKETS - 1] = {"0.0001", "0.001", "0.01", "0.1", "1.0"};
+
+/* Upper bounds of all but the last bucket of the queue depth histogram */
+static const size_t queue_bounds[DIME_QUEUE_BUCKETS] = {0, 1, 10, 100, 1000, 10000};
+
+/* Bucket of the queue depth histogram that counts a queue of "depth" messages */
+static size_t queue_bucket(size_t depth) {
+    size_t i = 0;
+
+    while (i < DIME_QUEUE_BUCKETS && depth > queue_bounds[i]) {
+        i++;
+    }
+
+    return i;
+}
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} metrics_buf_t;
+
+static int metrics_printf(metrics_buf_t *page, const char *fmt, ...) {
+    while (1) {
+        va_list args;
+
+        va_start(args, fmt);
+        int n = vsnprintf(page->buf + page->len, page->cap - page->len, fmt, args);
+        va_end(args);
+
+        if (n < 0) {
+            return -1;
+        }
+
+        if ((size_t)n < page->cap - page->len) {
+            page->len += n;
+
+            return 0;
+        }
+
+        size_t ncap = (page->cap * 3) / 2;
+
+        while (ncap - page->len <= (size_t)n) {
+            ncap = (ncap * 3) / 2;
+        }
+
+        char *nbuf = realloc(page->buf, ncap);
+        if (nbuf == NULL) {
+            return -1;
+        }
+
+        page->buf = nbuf;
+        page->cap = ncap;
+    }
+}
+
+/* Write a group name as a label value, escaping it as OpenMetrics requires */
+static int metrics_label(metrics_buf_t *page, const char *metric, const char *name, unsigned long long val) {
+    if (metrics_printf(page, "%s{group=\"", metric) < 0) {
+        return -1;
+    }
+
+    for (const char *c = name; *c != '\0'; c++) {
+        int err;
+
+        if (*c == '\\' || *c == '"') {
+            err = metrics_printf(page, "\\%c", *c);
+        } else if (*c == '\n') {
+            err = metrics_printf(page, "\\n");
+        } else {
+            err = metrics_printf(page, "%c", *c);
+        }
+
+        if (err < 0) {
+            return -1;
+        }
+    }
+
+    return metrics_printf(page, "\"} %llu\n", val);
+}
+
+static int metrics_render(dime_server_t *srv, metrics_buf_t *page) {
+    unsigned long long clnts = srv->clnts_len - srv->peers_len;
+
+    if (metrics_printf(page,
+                       "# TYPE dime_uptime_seconds gauge\n"
+                       "# HELP dime_uptime_seconds Time since the server started.\n"
+                       "dime_uptime_seconds %.3f\n"
+                       "# TYPE dime_connections gauge\n"
+                       "# HELP dime_connections Open connections and held sessions.\n"
+                       "dime_connections{kind=\"client\"} %llu\n"
+                       "dime_connections{kind=\"peer\"} %llu\n"
+                       "dime_connections{kind=\"held\"} %llu\n"
+                       "# TYPE dime_accepted_connections counter\n"
+                       "# HELP dime_accepted_connections Connections accepted.\n"
+                       "dime_accepted_connections_total %llu\n"
+                       "# TYPE dime_received_messages counter\n"
+                       "# HELP dime_received_messages Commands received from clients and peers.\n"
+                       "dime_received_messages_total %llu\n"
+                       "# TYPE dime_sent_messages counter\n"
+                       "# HELP dime_sent_messages Messages relayed to clients and peers.\n"
+                       "dime_sent_messages_total %llu\n"
+                       "# TYPE dime_received_bytes counter\n"
+                       "# HELP dime_received_bytes Bytes received on all connections.\n"
+                       "dime_received_bytes_total %llu\n"
+                       "# TYPE dime_sent_bytes counter\n"
+                       "# HELP dime_sent_bytes Bytes sent on all connections.\n"
+                       "dime_sent_bytes_total %llu\n"
+                       "# TYPE dime_routed_messages counter\n"
+                       "# HELP dime_routed_messages Messages sent or broadcast by clients.\n"
+                       "dime_routed_messages_total %llu\n"
+                       "# TYPE dime_expired_messages counter\n"
+                       "# HELP dime_expired_messages Messages dropped from a queue when their time-to-live passed.\n"
+                       "dime_expired_messages_total %llu\n"
+                       "# TYPE dime_live_messages gauge\n"
+                       "# HELP dime_live_messages Messages still queued for a recipient.\n"
+                       "dime_live_messages %llu\n"
+                       "# TYPE dime_live_message_bytes gauge\n"
+                       "# HELP dime_live_message_bytes Size of the messages still queued.\n"
+                       "dime_live_message_bytes %llu\n"
+                       "# TYPE dime_spilled_message_bytes gauge\n"
+                       "# HELP dime_spilled_message_bytes Size of the portions of queued messages spilled to disk rather than kept in memory.\n"
+                       "dime_spilled_message_bytes %llu\n"
+                       "# TYPE dime_queued_bytes gauge\n"
+                       "# HELP dime_queued_bytes Size of the queues of all clients, counting shared messages once per client.\n"
+                       "dime_queued_bytes %llu\n"
+                       "# TYPE dime_queue_depth histogram\n"
+                       "# HELP dime_queue_depth Messages queued for each client.\n",
+                       dime_socket_now() - srv->started,
+                       clnts,
+                       (unsigned long long)srv->peers_len,
+                       (unsigned long long)srv->held_len,
+                       (unsigned long long)srv->accepts,
+                       (unsigned long long)srv->msgs_in,
+                       (unsigned long long)srv->msgs_out,
+                       (unsigned long long)srv->bytes_in,
+                       (unsigned long long)srv->bytes_out,
+                       (unsigned long long)srv->msgs_total,
+                       (unsigned long long)srv->msgs_expired,
+                       (unsigned long long)srv->msgs_live,
+                       (unsigned long long)srv->msgs_bytes,
+                       (unsigned long long)srv->spill.bytes,
+                       (unsigned long long)srv->queued_bytes) < 0) {
+        return -1;
+    }
+
+    /* Only clients with messages queued are counted by bucket, the rest have none */
+    unsigned long long beyond = 0;
+
+    for (size_t j = 1; j <= DIME_QUEUE_BUCKETS; j++) {
+        beyond += srv->queue_depth[j];
+    }
+
+    for (size_t j = 0; j < DIME_QUEUE_BUCKETS; j++) {
+        beyond -= srv->queue_depth[j];
+
+        if (metrics_printf(page, "dime_queue_depth_bucket{le=\"%zu.0\"} %llu\n",
+                           queue_bounds[j], clnts + srv->held_len - beyond) < 0) {
+            return -1;
+        }
+    }
+
+    if (metrics_printf(page,
+                       "dime_queue_depth_bucket{le=\"+Inf\"} %llu\n"
+                       "dime_queue_depth_count %llu\n"
+                       "dime_queue_depth_sum %llu\n",
+                       clnts + srv->held_len, clnts + srv->held_len, (unsigned long long)srv->queued_msgs) < 0) {
+        return -1;
+    }
+
+    /* Each family is written in one block, so the table is walked once per family */
+    static const struct {
+        const char *type;
+        const char *name;
+        const char *help;
+    } families[] = {
+        {"gauge", "dime_group_members", "Members of each group."},
+        {"counter", "dime_group_messages", "Messages sent to each group."},
+        {"counter", "dime_group_bytes", "Bytes sent to each group."},
+        {"counter", "dime_group_deliveries", "Copies of messages queued for the members of each group."}
+    };
+
+    for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); f++) {
+        char metric[64];
+
+        snprintf(metric, sizeof(metric), (f == 0) ? "%s" : "%s_total", families[f].name);
+
+        if (metrics_printf(page, "# TYPE %s %s\n# HELP %s %s\n",
+                           families[f].name, families[f].type,
+                           families[f].name, families[f].help) < 0) {
+            return -1;
+        }
+
+        dime_table_iter_t it;
+
+        dime_table_iter_init(&it, &srv->name2clnt);
+
+        while (dime_table_iter_next(&it)) {
+            dime_group_t *group = it.val;
+            uint64_t vals[] = {group->clnts_len, group->msgs, group->bytes, group->deliveries};
+
+            if (metrics_label(page, metric, group->name, vals[f]) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    if (metrics_printf(page,
+                       "# TYPE dime_event_loop_lag_seconds histogram\n"
+                       "# HELP dime_event_loop_lag_seconds Time spent handling each wakeup of the event loop, during which other connections wait.\n") < 0) {
+        return -1;
+    }
+
+    unsigned long long lag = 0;
+
+    for (size_t j = 0; j < DIME_LAG_BUCKETS - 1; j++) {
+        lag += srv->lag[j];
+
+        if (metrics_printf(page, "dime_event_loop_lag_seconds_bucket{le=\"%s\"} %llu\n", lag_labels[j], lag) < 0) {
+            return -1;
+        }
+    }
+
+    lag += srv->lag[DIME_LAG_BUCKETS - 1];
+
+    return metrics_printf(page,
+                          "dime_event_loop_lag_seconds_bucket{le=\"+Inf\"} %llu\n"
+                          "dime_event_loop_lag_seconds_count %llu\n"
+                          "dime_event_loop_lag_seconds_sum %.6f\n"
+                          "# EOF\n",
+                          lag, lag, srv->lag_sum);
+}
+
+/* Prepare the HTTP response to a complete request */
+static int metrics_respond(dime_server_t *srv, dime_scrape_t *scrape) {
+    metrics_buf_t page;
+
+    page.len = 0;
+    page.cap = 4096;
+    page.buf = malloc(page.cap);
+    if (page.buf == NULL) {
+        return -1;
+    }
+
+    if (strncmp(scrape->req, "GET ", 4) != 0) {
+        if (metrics_printf(&page, "HTTP/1.1 405 Method Not Allowed\r\n"
+                                  "Allow: GET\r\n"
+                                  "Content-Length: 0\r\n"
+                                  "Connection: close\r\n\r\n") < 0) {
+            free(page.buf);
+
+            return -1;
+        }
+    } else {
+        char hdr[192];
+
+        /* The header is written in front of the page once its length is known */
+        if (metrics_render(srv, &page) < 0) {
+            free(page.buf);
+
+            return -1;
+        }
+
+        int hdr_len = snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\n"
+                                                 "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                                 "Content-Length: %zu\r\n"
+                                                 "Connection: close\r\n\r\n", page.len);
+
+        if (page.cap - page.len < (size_t)hdr_len) {
+            char *nbuf = realloc(page.buf, page.len + hdr_len);
+            if (nbuf == NULL) {
+                free(page.buf);
+
+                return -1;
+            }
+
+            page.buf = nbuf;
+        }
+
+        memmove(page.buf + hdr_len, page.buf, page.len);
+        memcpy(page.buf, hdr, hdr_len);
+        page.len += hdr_len;
+    }
+
+    scrape->page = page.buf;
+    scrape->page_len = page.len;
+    scrape->page_off = 0;
+
+    return 0;
+}
+
+dime_scrape_t *dime_metrics_accept(dime_server_t *srv, int fd) {
+    int sfd = accept(fd, NULL, NULL);
+    if (sfd < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return NULL;
+    }
+
+    /* Further requests are refused until one is done or times out */
+    if (srv->scrapes_len == DIME_METRICS_CONNS) {
+        strncpy(srv->err, "Too many metrics requests", sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        close(sfd);
+
+        return NULL;
+    }
+
+#ifdef __unix__
+    int flags = fcntl(sfd, F_GETFL, 0);
+
+    if (flags >= 0) {
+        fcntl(sfd, F_SETFL, flags | O_NONBLOCK);
+    }
+#endif
+
+    dime_scrape_t *scrape = malloc(sizeof(dime_scrape_t));
+
+    if (scrape == NULL || dime_server_fdtab_reserve(srv, sfd) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        free(scrape);
+        close(sfd);
+
+        return NULL;
+    }
+
+    scrape->fd = sfd;
+    scrape->srv = srv;
+    scrape->req_len = 0;
+    scrape->page = NULL;
+    scrape->page_len = 0;
+    scrape->page_off = 0;
+    scrape->deadline = dime_socket_now() + DIME_METRICS_TIMEOUT;
+
+    srv->scrapes[srv->scrapes_len] = scrape;
+    srv->scrapes_len++;
+
+    dime_fdent_t *ent = &srv->fdtab[sfd];
+
+    ent->type = DIME_FDENT_SCRAPE;
+    ent->events = DIME_FDENT_READ;
+    ent->thread = 0;
+    ent->u.scrape = scrape;
+
+    return scrape;
+}
+
+int dime_metrics_serve(dime_server_t *srv, dime_scrape_t *scrape) {
+    if (scrape->page == NULL) {
+        ssize_t n = recv(scrape->fd, scrape->req + scrape->req_len, sizeof(scrape->req) - 1 - scrape->req_len, 0);
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return DIME_FDENT_READ;
+        } else if (n <= 0) {
+            return -1;
+        }
+
+        scrape->req_len += n;
+        scrape->req[scrape->req_len] = '\0';
+
+        /* Only the request line matters, but the whole request is read first */
+        if (strstr(scrape->req, "\r\n\r\n") == NULL && strstr(scrape->req, "\n\n") == NULL) {
+            return (scrape->req_len < sizeof(scrape->req) - 1) ? DIME_FDENT_READ : -1;
+        }
+
+        if (metrics_respond(srv, scrape) < 0) {
+            return -1;
+        }
+    }
+
+    while (scrape->page_off < scrape->page_len) {
+        ssize_t n = send(scrape->fd, scrape->page + scrape->page_off, scrape->page_len - scrape->page_off, 0);
+
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? DIME_FDENT_WRITE : -1;
+        }
+
+        scrape->page_off += n;
+    }
+
+    return 0;
+}
+
+void dime_metrics_close(dime_server_t *srv, dime_scrape_t *scrape) {
+    for (size_t i = 0; i < srv->scrapes_len; i++) {
+        if (srv->scrapes[i] == scrape) {
+            srv->scrapes_len--;
+            srv->scrapes[i] = srv->scrapes[srv->scrapes_len];
+
+            break;
+        }
+    }
+
+    memset(&srv->fdtab[scrape->fd], 0, sizeof(dime_fdent_t));
+
+    close(scrape->fd);
+    free(scrape->page);
+    free(scrape);
+}
+
+void dime_metrics_queue(dime_server_t *srv, size_t depth, size_t ndepth, size_t bytes, size_t nbytes) {
+    if (depth > 0) {
+        srv->queue_depth[queue_bucket(depth)]--;
+    }
+
+    if (ndepth > 0) {
+        srv->queue_depth[queue_bucket(ndepth)]++;
+    }
+
+    srv->queued_msgs += ndepth - depth;
+    srv->queued_bytes += nbytes - bytes;
+}
+
+void dime_metrics_lag(dime_server_t *srv, double seconds) {
+    size_t i = 0;
+
+    while (i < DIME_LAG_BUCKETS - 1 && seconds > lag_bounds[i]) {
+        i++;
+    }
+
+    srv->lag[i]++;
+    srv->lag_sum += seconds;
+}
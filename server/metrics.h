@@ -0,0 +1,150 @@
+/*
+ * metrics.h - OpenMetrics exporter
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file metrics.h
+ * @brief OpenMetrics exporter
+ * @author Nicholas West
+ * @date 2020
+ *
+ * With @c -m, the server listens on a separate TCP port for HTTP
+ * requests from e.g. Prometheus, and answers each with a page of
+ * metrics in the OpenMetrics text format. Requests are served by the
+ * same event loop as clients, one page per connection. At most
+ * @c DIME_METRICS_CONNS requests are served at once, and each is closed
+ * if it is not done within @c DIME_METRICS_TIMEOUT seconds.
+ *
+ * The page is rendered from the counters the server keeps anyway (see
+ * the "stats" command), so routing messages costs nothing more with
+ * the exporter enabled. The histogram of queue depths is kept up to
+ * date as messages are queued and dequeued, so rendering the page does
+ * not visit each client. Only the event loop lag, the time spent
+ * handling each wakeup of the loop, is measured for the exporter alone.
+ */
+
+#include <stddef.h>
+
+#ifdef DIME_USE_LIBEV
+#   include <ev.h>
+#endif
+#include "server.h"
+
+#ifndef __DIME_metrics_H
+#define __DIME_metrics_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of the largest HTTP request accepted */
+#define DIME_METRICS_REQMAX 4096
+
+/** Seconds a metrics request may take from accepting it to sending the page */
+#define DIME_METRICS_TIMEOUT 10
+
+/**
+ * @brief Metrics request state
+ *
+ * One per connection to the metrics port, from accepting it until the
+ * page is sent.
+ */
+typedef struct __dime_scrape dime_scrape_t;
+
+struct __dime_scrape {
+    int fd;             /** File descriptor */
+    dime_server_t *srv; /** Server that accepted the connection */
+
+    char req[DIME_METRICS_REQMAX]; /** Request received so far */
+    size_t req_len;                /** Length of request */
+
+    char *page;      /** Response, or NULL until the request is complete */
+    size_t page_len; /** Length of response */
+    size_t page_off; /** Bytes of the response sent so far */
+
+    double deadline; /** Time at which the request is closed if not done */
+
+#ifdef DIME_USE_LIBEV
+    ev_io watcher;   /** Read or write watcher, as needed */
+    ev_timer timer;  /** Closes the request at its deadline */
+#endif
+};
+
+/**
+ * @brief Accept a connection on the metrics port
+ *
+ * If @c DIME_METRICS_CONNS requests are already being served, the
+ * connection is closed right away and this fails.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param fd Listening file descriptor
+ *
+ * @return The new request, registered in the server's file descriptor
+ * table, or NULL on failure
+ */
+dime_scrape_t *dime_metrics_accept(dime_server_t *srv, int fd);
+
+/**
+ * @brief Make progress on a metrics request
+ *
+ * Reads the request until its headers are complete, then renders the
+ * page and sends as much of it as the socket takes.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param scrape Pointer to a @link dime_scrape_t @endlink struct
+ *
+ * @return @c DIME_FDENT_READ or @c DIME_FDENT_WRITE if the request
+ * should be resumed when its connection is readable or writable, 0 if
+ * it is done, or a negative value on failure. In the latter two cases,
+ * it should be closed with @link dime_metrics_close @endlink.
+ */
+int dime_metrics_serve(dime_server_t *srv, dime_scrape_t *scrape);
+
+/**
+ * @brief Close a metrics request and free its resources
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param scrape Pointer to a @link dime_scrape_t @endlink struct
+ */
+void dime_metrics_close(dime_server_t *srv, dime_scrape_t *scrape);
+
+/**
+ * @brief Account for a change in the queue of a client
+ *
+ * Called whenever messages are queued for or dequeued from a client,
+ * including when a client is destroyed, which empties its queue.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param depth Messages in the queue before the change
+ * @param ndepth Messages in the queue after the change
+ * @param bytes Size of the queue before the change
+ * @param nbytes Size of the queue after the change
+ */
+void dime_metrics_queue(dime_server_t *srv, size_t depth, size_t ndepth, size_t bytes, size_t nbytes);
+
+/**
+ * @brief Record the time spent handling a wakeup of the event loop
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param seconds Time between the wakeup and the next wait for events
+ */
+void dime_metrics_lag(dime_server_t *srv, double seconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
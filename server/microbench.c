@@ -0,0 +1,531 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <jansson.h>
+#include "deque.h"
+#include "ringbuffer.h"
+#include "socket.h"
+#include "table.h"
+
+/*
+ * Microbenchmarks of the server's containers and frame parsing. Each
+ * benchmark runs an operation enough times to take at least
+ * MB_ROUND_NS, then repeats that MB_ROUNDS times; the median and fastest
+ * rounds are written as JSON, e.g. to compare a data structure before
+ * and after a change.
+ */
+
+#define MB_ROUNDS 5
+#define MB_ROUND_NS 20000000
+
+typedef struct {
+    const char *name;
+    void (*setup)(void *ctx);
+    void (*run)(void *ctx, size_t iters);
+    void (*teardown)(void *ctx);
+    size_t ops;   /* Operations per call of run with iters = 1 */
+    size_t bytes; /* Bytes processed per operation, or 0 */
+} mb_bench_t;
+
+/* Keeps results alive so the compiler cannot drop the work */
+static volatile size_t mb_sink;
+
+static uint64_t mb_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void mb_fail(const char *what) {
+    fprintf(stderr, "%s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+/* Ring buffer: write, peek and discard a chunk, with other bytes left
+ * in the buffer so that the readable bytes keep crossing the wrap point */
+
+typedef struct {
+    size_t chunk;
+    dime_ringbuffer_t ring;
+    unsigned char *buf;
+} mb_ring_t;
+
+static void ring_setup(void *p) {
+    mb_ring_t *ctx = p;
+
+    ctx->buf = calloc(1, ctx->chunk);
+
+    if (ctx->buf == NULL || dime_ringbuffer_init(&ctx->ring) < 0 ||
+        dime_ringbuffer_write(&ctx->ring, ctx->buf, ctx->chunk / 2 + 1) < 0) {
+        mb_fail("ring_setup");
+    }
+}
+
+static void ring_run(void *p, size_t iters) {
+    mb_ring_t *ctx = p;
+
+    for (size_t i = 0; i < iters; i++) {
+        if (dime_ringbuffer_write(&ctx->ring, ctx->buf, ctx->chunk) < 0) {
+            mb_fail("dime_ringbuffer_write");
+        }
+
+        mb_sink += dime_ringbuffer_peek(&ctx->ring, ctx->buf, ctx->chunk);
+        dime_ringbuffer_discard(&ctx->ring, ctx->chunk);
+    }
+}
+
+static void ring_teardown(void *p) {
+    mb_ring_t *ctx = p;
+
+    dime_ringbuffer_destroy(&ctx->ring);
+    free(ctx->buf);
+}
+
+/* Ring buffer: fill a new buffer with a chunk at a time, so that it
+ * grows from its initial size */
+
+typedef struct {
+    size_t chunk;
+    size_t total;
+    unsigned char *buf;
+} mb_grow_t;
+
+static void grow_setup(void *p) {
+    mb_grow_t *ctx = p;
+
+    ctx->buf = calloc(1, ctx->chunk);
+    if (ctx->buf == NULL) {
+        mb_fail("grow_setup");
+    }
+}
+
+static void grow_run(void *p, size_t iters) {
+    mb_grow_t *ctx = p;
+
+    for (size_t i = 0; i < iters; i++) {
+        dime_ringbuffer_t ring;
+
+        if (dime_ringbuffer_init(&ring) < 0) {
+            mb_fail("dime_ringbuffer_init");
+        }
+
+        for (size_t n = 0; n < ctx->total; n += ctx->chunk) {
+            if (dime_ringbuffer_write(&ring, ctx->buf, ctx->chunk) < 0) {
+                mb_fail("dime_ringbuffer_write");
+            }
+        }
+
+        mb_sink += dime_ringbuffer_len(&ring);
+        dime_ringbuffer_destroy(&ring);
+    }
+}
+
+static void grow_teardown(void *p) {
+    mb_grow_t *ctx = p;
+
+    free(ctx->buf);
+}
+
+/* Deques: push a message onto the queue of every recipient and pop one
+ * off each, as "send" and "sync" do, with a standing backlog */
+
+#define MB_DEQUE_BACKLOG 64
+
+typedef struct {
+    size_t fanout;
+    dime_deque_t *queues;
+} mb_deque_t;
+
+static void deque_setup(void *p) {
+    mb_deque_t *ctx = p;
+
+    ctx->queues = malloc(ctx->fanout * sizeof(dime_deque_t));
+    if (ctx->queues == NULL) {
+        mb_fail("deque_setup");
+    }
+
+    for (size_t i = 0; i < ctx->fanout; i++) {
+        if (dime_deque_init(&ctx->queues[i]) < 0) {
+            mb_fail("dime_deque_init");
+        }
+
+        for (size_t j = 0; j < MB_DEQUE_BACKLOG; j++) {
+            if (dime_deque_pushr(&ctx->queues[i], ctx) < 0) {
+                mb_fail("dime_deque_pushr");
+            }
+        }
+    }
+}
+
+static void deque_run(void *p, size_t iters) {
+    mb_deque_t *ctx = p;
+
+    for (size_t i = 0; i < iters; i++) {
+        for (size_t j = 0; j < ctx->fanout; j++) {
+            if (dime_deque_pushr(&ctx->queues[j], ctx) < 0) {
+                mb_fail("dime_deque_pushr");
+            }
+        }
+
+        for (size_t j = 0; j < ctx->fanout; j++) {
+            mb_sink += (size_t)dime_deque_popl(&ctx->queues[j]);
+        }
+    }
+}
+
+static void deque_teardown(void *p) {
+    mb_deque_t *ctx = p;
+
+    for (size_t i = 0; i < ctx->fanout; i++) {
+        dime_deque_destroy(&ctx->queues[i]);
+    }
+
+    free(ctx->queues);
+}
+
+/* Tables: keyed by group names. A table grows once it is over 1/2
+ * full, so its load factor is between 1/4 and 1/2; these fill a table
+ * of MB_TABLE_CAP elements to points in that range */
+
+#define MB_TABLE_CAP 4096
+
+enum mb_table_op {
+    MB_TABLE_INSERT,
+    MB_TABLE_HIT,
+    MB_TABLE_MISS,
+    MB_TABLE_CHURN
+};
+
+typedef struct {
+    int op;
+    size_t len;
+    char (*keys)[32];   /* Keys in the table */
+    char (*absent)[32]; /* Keys never inserted */
+    dime_table_t tbl;
+} mb_table_t;
+
+static void table_fill(mb_table_t *ctx) {
+    if (dime_table_init(&ctx->tbl, dime_table_cmp_str, dime_table_hash_str) < 0) {
+        mb_fail("dime_table_init");
+    }
+
+    for (size_t i = 0; i < ctx->len; i++) {
+        if (dime_table_insert(&ctx->tbl, ctx->keys[i], ctx->keys[i]) < 0) {
+            mb_fail("dime_table_insert");
+        }
+    }
+}
+
+static void table_setup(void *p) {
+    mb_table_t *ctx = p;
+
+    ctx->keys = malloc(ctx->len * sizeof(ctx->keys[0]));
+    ctx->absent = malloc(ctx->len * sizeof(ctx->absent[0]));
+
+    if (ctx->keys == NULL || ctx->absent == NULL) {
+        mb_fail("table_setup");
+    }
+
+    for (size_t i = 0; i < ctx->len; i++) {
+        snprintf(ctx->keys[i], sizeof(ctx->keys[i]), "group%zu", i);
+        snprintf(ctx->absent[i], sizeof(ctx->absent[i]), "absent%zu", i);
+    }
+
+    table_fill(ctx);
+}
+
+/* Each iteration is a pass over all keys */
+static void table_run(void *p, size_t iters) {
+    mb_table_t *ctx = p;
+
+    for (size_t i = 0; i < iters; i++) {
+        switch (ctx->op) {
+        case MB_TABLE_INSERT:
+            dime_table_destroy(&ctx->tbl);
+            table_fill(ctx);
+            break;
+
+        case MB_TABLE_HIT:
+            for (size_t j = 0; j < ctx->len; j++) {
+                mb_sink += (size_t)dime_table_search(&ctx->tbl, ctx->keys[j]);
+            }
+
+            break;
+
+        case MB_TABLE_MISS:
+            for (size_t j = 0; j < ctx->len; j++) {
+                mb_sink += (size_t)dime_table_search(&ctx->tbl, ctx->absent[j]);
+            }
+
+            break;
+
+        case MB_TABLE_CHURN:
+            /* Remove and reinsert each key, as groups are left and joined */
+            for (size_t j = 0; j < ctx->len; j++) {
+                mb_sink += (size_t)dime_table_remove(&ctx->tbl, ctx->keys[j]);
+
+                if (dime_table_insert(&ctx->tbl, ctx->keys[j], ctx->keys[j]) < 0) {
+                    mb_fail("dime_table_insert");
+                }
+            }
+
+            break;
+        }
+    }
+}
+
+static void table_teardown(void *p) {
+    mb_table_t *ctx = p;
+
+    dime_table_destroy(&ctx->tbl);
+    free(ctx->keys);
+    free(ctx->absent);
+}
+
+/* Frame parsing: append a message to a socket's inbuffer, as a read
+ * would, and pop it */
+
+typedef struct {
+    size_t bindata_len;
+    dime_socket_t sock;
+    unsigned char *frame;
+    size_t frame_len;
+} mb_frame_t;
+
+static void frame_setup(void *p) {
+    mb_frame_t *ctx = p;
+    const char *jsondata = "{\"command\":\"send\",\"name\":\"group0\",\"varname\":\"x\",\"serialization\":\"pickle\"}";
+    size_t jsondata_len = strlen(jsondata);
+    uint32_t lens[2] = {htonl(jsondata_len), htonl(ctx->bindata_len)};
+
+    ctx->frame_len = 12 + jsondata_len + ctx->bindata_len;
+    ctx->frame = calloc(1, ctx->frame_len);
+
+    if (ctx->frame == NULL || dime_socket_init(&ctx->sock, -1) < 0) {
+        mb_fail("frame_setup");
+    }
+
+    memcpy(ctx->frame, "DiME", 4);
+    memcpy(ctx->frame + 4, lens, sizeof(lens));
+    memcpy(ctx->frame + 12, jsondata, jsondata_len);
+}
+
+static void frame_run(void *p, size_t iters) {
+    mb_frame_t *ctx = p;
+
+    for (size_t i = 0; i < iters; i++) {
+        json_t *jsondata;
+        void *bindata;
+        size_t bindata_len;
+
+        if (dime_ringbuffer_write(&ctx->sock.rbuf, ctx->frame, ctx->frame_len) < 0 ||
+            dime_socket_pop(&ctx->sock, &jsondata, &bindata, &bindata_len) <= 0) {
+            fprintf(stderr, "dime_socket_pop: %s\n", ctx->sock.err);
+            exit(1);
+        }
+
+        mb_sink += bindata_len;
+
+        json_decref(jsondata);
+        free(bindata);
+    }
+}
+
+static void frame_teardown(void *p) {
+    mb_frame_t *ctx = p;
+
+    dime_socket_destroy(&ctx->sock);
+    free(ctx->frame);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static json_t *mb_measure(const mb_bench_t *bench, void *ctx, json_t *params) {
+    uint64_t rounds[MB_ROUNDS];
+    size_t iters = 1;
+
+    bench->setup(ctx);
+
+    /* Find how many operations take a round's worth of time */
+    for (;;) {
+        uint64_t t = mb_now();
+
+        bench->run(ctx, iters);
+        t = mb_now() - t;
+
+        if (t >= MB_ROUND_NS) {
+            break;
+        }
+
+        iters = (t > MB_ROUND_NS / 100) ? (size_t)((double)iters * MB_ROUND_NS / t) + 1 : iters * 10;
+    }
+
+    for (int i = 0; i < MB_ROUNDS; i++) {
+        uint64_t t = mb_now();
+
+        bench->run(ctx, iters);
+        rounds[i] = mb_now() - t;
+    }
+
+    bench->teardown(ctx);
+
+    qsort(rounds, MB_ROUNDS, sizeof(uint64_t), cmp_u64);
+
+    size_t ops = iters * bench->ops;
+    double median = (double)rounds[MB_ROUNDS / 2] / ops;
+    double min = (double)rounds[0] / ops;
+
+    char *desc = json_dumps(params, JSON_COMPACT);
+
+    fprintf(stderr, "%-20s %-48s %12.1f ns/op\n", bench->name, (desc != NULL) ? desc : "", median);
+    free(desc);
+
+    json_t *result = json_pack("{sssosIsfsfsf}",
+                               "name", bench->name,
+                               "params", params,
+                               "iterations", (json_int_t)ops,
+                               "ns_per_op", median,
+                               "ns_per_op_min", min,
+                               "ops_per_sec", 1e9 / median);
+
+    if (result != NULL && bench->bytes > 0) {
+        json_object_set_new(result, "bytes_per_sec", json_real(bench->bytes * 1e9 / median));
+    }
+
+    return result;
+}
+
+static int mb_add(json_t *results, const char *filter, const mb_bench_t *bench, void *ctx, json_t *params) {
+    if (filter != NULL && strstr(bench->name, filter) == NULL) {
+        json_decref(params);
+        return 0;
+    }
+
+    json_t *result = mb_measure(bench, ctx, params);
+
+    return (result != NULL) ? json_array_append_new(results, result) : -1;
+}
+
+int main(int argc, char **argv) {
+    const char *filter = NULL;
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:ho:")) >= 0) {
+        switch (opt) {
+        case 'f':
+            filter = optarg;
+            break;
+
+        case 'h':
+            printf("Usage: %s [options]\n"
+                   "\n"
+                   "Options:\n"
+                   "-f <name>              Runs only the benchmarks whose names contain \n"
+                   "                       the given string, e.g. ringbuffer or table.\n"
+                   "-h                     Displays this help message.\n"
+                   "-o <file>              Writes the results to a file instead of stdout.\n",
+                   argv[0]);
+            return 0;
+
+        case 'o':
+            output = optarg;
+            break;
+
+        default:
+            fprintf(stderr, "Usage: %s [options]\nTry \"%s -h\" for more information\n",
+                    argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    json_t *results = json_array();
+    if (results == NULL) {
+        mb_fail("json_array");
+    }
+
+    int err = 0;
+
+    static const size_t ring_chunks[] = {64, 1024, 65536};
+
+    for (size_t i = 0; i < sizeof(ring_chunks) / sizeof(ring_chunks[0]); i++) {
+        mb_ring_t ctx = {ring_chunks[i]};
+        mb_bench_t bench = {"ringbuffer/wrap", ring_setup, ring_run, ring_teardown, 1, ring_chunks[i]};
+
+        err |= mb_add(results, filter, &bench, &ctx, json_pack("{sI}", "chunk", (json_int_t)ring_chunks[i]));
+    }
+
+    static const size_t grow_chunks[] = {512, 65536};
+
+    for (size_t i = 0; i < sizeof(grow_chunks) / sizeof(grow_chunks[0]); i++) {
+        mb_grow_t ctx = {grow_chunks[i], 1 << 22};
+        mb_bench_t bench = {"ringbuffer/grow", grow_setup, grow_run, grow_teardown, 1, 1 << 22};
+
+        err |= mb_add(results, filter, &bench, &ctx, json_pack("{sIsI}", "chunk", (json_int_t)grow_chunks[i], "total", (json_int_t)ctx.total));
+    }
+
+    static const size_t fanouts[] = {1, 16, 256};
+
+    for (size_t i = 0; i < sizeof(fanouts) / sizeof(fanouts[0]); i++) {
+        mb_deque_t ctx = {fanouts[i]};
+        mb_bench_t bench = {"deque/fanout", deque_setup, deque_run, deque_teardown, 1, 0};
+
+        err |= mb_add(results, filter, &bench, &ctx, json_pack("{sIsI}", "fanout", (json_int_t)fanouts[i], "backlog", (json_int_t)MB_DEQUE_BACKLOG));
+    }
+
+    static const size_t table_lens[] = {MB_TABLE_CAP / 4 + 1, 3 * MB_TABLE_CAP / 8, MB_TABLE_CAP / 2};
+    static const char *table_ops[] = {"table/insert", "table/search_hit", "table/search_miss", "table/churn"};
+
+    for (int op = MB_TABLE_INSERT; op <= MB_TABLE_CHURN; op++) {
+        for (size_t i = 0; i < sizeof(table_lens) / sizeof(table_lens[0]); i++) {
+            mb_table_t ctx = {op, table_lens[i]};
+            mb_bench_t bench = {table_ops[op], table_setup, table_run, table_teardown, table_lens[i], 0};
+
+            err |= mb_add(results, filter, &bench, &ctx, json_pack("{sfsIsI}", "load", (double)table_lens[i] / MB_TABLE_CAP, "capacity", (json_int_t)MB_TABLE_CAP, "keys", (json_int_t)table_lens[i]));
+        }
+    }
+
+    static const size_t frame_sizes[] = {64, 1 << 20};
+
+    for (size_t i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++) {
+        mb_frame_t ctx = {frame_sizes[i]};
+        mb_bench_t bench = {"socket/pop", frame_setup, frame_run, frame_teardown, 1, frame_sizes[i]};
+
+        err |= mb_add(results, filter, &bench, &ctx, json_pack("{sI}", "bindata_len", (json_int_t)frame_sizes[i]));
+    }
+
+    if (err) {
+        mb_fail("Failed to record results");
+    }
+
+    char *str = json_dumps(results, JSON_INDENT(2));
+
+    json_decref(results);
+
+    FILE *f = (output != NULL) ? fopen(output, "w") : stdout;
+
+    if (str == NULL || f == NULL || fprintf(f, "%s\n", str) < 0) {
+        mb_fail("Failed to write results");
+    }
+
+    if (f != stdout) {
+        fclose(f);
+    }
+
+    free(str);
+
+    return 0;
+}
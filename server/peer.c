@@ -0,0 +1,678 @@
+#ifdef _WIN32
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#   pragma comment(lib, "Ws2_32.lib")
+#else
+#   include <fcntl.h>
+#   include <netdb.h>
+#   include <unistd.h>
+#   include <sys/socket.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+#include <openssl/crypto.h>
+#include "client.h"
+#include "compress.h"
+#include "log.h"
+#include "peer.h"
+#include "server.h"
+#include "socket.h"
+#include "table.h"
+
+#ifdef _WIN32
+#   define close closesocket
+#endif
+
+/* Codecs offered to peers, in order of preference */
+static const int peer_codecs[] = {
+    DIME_COMPRESS_LZ4,
+    DIME_COMPRESS_ZSTD,
+    DIME_COMPRESS_ZLIB
+};
+
+static int peer_activate(dime_server_t *srv, dime_client_t *clnt) {
+    if (srv->peers_len >= srv->peers_cap) {
+        size_t ncap = (srv->peers_cap * 3) / 2;
+
+        dime_client_t **npeers = realloc(srv->peers, sizeof(dime_client_t *) * ncap);
+        if (npeers == NULL) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+
+        srv->peers = npeers;
+        srv->peers_cap = ncap;
+    }
+
+    srv->peers[srv->peers_len++] = clnt;
+    clnt->active = 1;
+
+    return 0;
+}
+
+static void peer_deactivate(dime_server_t *srv, dime_client_t *clnt) {
+    for (size_t i = 0; i < srv->peers_len; i++) {
+        if (srv->peers[i] == clnt) {
+            srv->peers_len--;
+            srv->peers[i] = srv->peers[srv->peers_len];
+
+            break;
+        }
+    }
+
+    clnt->active = 0;
+}
+
+static int peer_init(dime_client_t *clnt) {
+    if (dime_table_init(&clnt->peer_groups, dime_table_cmp_str, dime_table_hash_str) < 0) {
+        return -1;
+    }
+
+    clnt->peer = 1;
+
+    return 0;
+}
+
+/* Queue a "peer" message describing this server */
+static int peer_send_hello(dime_client_t *clnt, dime_server_t *srv) {
+    json_t *groups = json_array();
+    json_t *codecs = json_array();
+
+    if (groups == NULL || codecs == NULL) {
+        json_decref(groups);
+        json_decref(codecs);
+
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return -1;
+    }
+
+    dime_table_iter_t it;
+
+    dime_table_iter_init(&it, &srv->name2clnt);
+
+    while (dime_table_iter_next(&it)) {
+        dime_group_t *group = it.val;
+
+        if (group->clnts_len > 0) {
+            json_array_append_new(groups, json_string(group->name));
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(peer_codecs) / sizeof(peer_codecs[0]); i++) {
+        if (srv->compress_codecs & (1u << peer_codecs[i])) {
+            json_array_append_new(codecs, json_string(dime_compress_name(peer_codecs[i])));
+        }
+    }
+
+    json_t *hello = json_pack("{sssssoso}", "command", "peer", "node", srv->node, "groups", groups, "compression", codecs);
+    if (hello != NULL && srv->link_secret != NULL &&
+        json_object_set_new(hello, "secret", json_string(srv->link_secret)) < 0) {
+        json_decref(hello);
+        hello = NULL;
+    }
+
+    if (hello == NULL) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return -1;
+    }
+
+    if (dime_socket_push(&clnt->sock, hello, NULL, 0) < 0) {
+        json_decref(hello);
+
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return -1;
+    }
+
+    json_decref(hello);
+
+    return 0;
+}
+
+/* Add or remove the group names in the array "arr" for a link */
+static int peer_apply(dime_client_t *clnt, json_t *arr, int present) {
+    size_t i;
+    json_t *v;
+
+    json_array_foreach(arr, i, v) {
+        const char *name = json_string_value(v);
+        if (name == NULL) {
+            continue;
+        }
+
+        if (present) {
+            if (dime_table_search(&clnt->peer_groups, name) != NULL) {
+                continue;
+            }
+
+            char *key = strdup(name);
+            if (key == NULL) {
+                return -1;
+            }
+
+            if (dime_table_insert(&clnt->peer_groups, key, key) < 0) {
+                free(key);
+
+                return -1;
+            }
+        } else {
+            free(dime_table_remove(&clnt->peer_groups, name));
+        }
+    }
+
+    return 0;
+}
+
+/* Check the secret of a link dialed by another server */
+static int peer_authorized(const dime_server_t *srv, json_t *jsondata) {
+    const char *secret;
+
+    if (srv->link_secret == NULL || json_unpack(jsondata, "{ss}", "secret", &secret) < 0) {
+        return 0;
+    }
+
+    size_t len = strlen(srv->link_secret);
+
+    /* Only the length may leak through timing */
+    return strlen(secret) == len && CRYPTO_memcmp(secret, srv->link_secret, len) == 0;
+}
+
+static dime_link_t *peer_link(dime_server_t *srv, const dime_client_t *clnt) {
+    for (size_t i = 0; i < srv->links_len; i++) {
+        if (srv->links[i].clnt == clnt) {
+            return &srv->links[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Wait before dialing a link again, twice as long as the last time */
+static void peer_backoff(dime_link_t *link) {
+    if (link->backoff < DIME_LINK_BACKOFF_MIN) {
+        link->backoff = DIME_LINK_BACKOFF_MIN;
+    }
+
+    link->clnt = NULL;
+    link->retry = dime_socket_now() + link->backoff;
+
+    link->backoff *= 2;
+
+    if (link->backoff > DIME_LINK_BACKOFF_MAX) {
+        link->backoff = DIME_LINK_BACKOFF_MAX;
+    }
+}
+
+dime_client_t *dime_peer_connect(dime_server_t *srv, const char *addr) {
+    char host[256];
+    const char *port;
+
+    if (addr[0] == '[') {
+        const char *end = strchr(addr, ']');
+
+        if (end == NULL || end[1] != ':' || (size_t)(end - addr) > sizeof(host)) {
+            strncpy(srv->err, "Invalid peer address", sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return NULL;
+        }
+
+        memcpy(host, addr + 1, end - addr - 1);
+        host[end - addr - 1] = '\0';
+        port = end + 2;
+    } else {
+        const char *sep = strrchr(addr, ':');
+
+        if (sep == NULL || (size_t)(sep - addr) >= sizeof(host)) {
+            strncpy(srv->err, "Invalid peer address", sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return NULL;
+        }
+
+        memcpy(host, addr, sep - addr);
+        host[sep - addr] = '\0';
+        port = sep + 1;
+    }
+
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        strncpy(srv->err, gai_strerror(err), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return NULL;
+    }
+
+    struct sockaddr_storage sa;
+    int fd = -1;
+
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+
+        /*
+         * The connection completes in the background, and a failure shows
+         * up as an error on the first read or write, which closes the link
+         */
+#ifdef __unix__
+        int flags = fcntl(fd, F_GETFL, 0);
+
+        if (flags >= 0) {
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        }
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS) {
+#else
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+#endif
+            memcpy(&sa, ai->ai_addr, ai->ai_addrlen);
+            break;
+        }
+
+        err = errno;
+        close(fd);
+        errno = err;
+
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return NULL;
+    }
+
+    dime_client_t *clnt = malloc(sizeof(dime_client_t));
+    if (clnt == NULL) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        close(fd);
+
+        return NULL;
+    }
+
+    if (dime_client_init(clnt, fd, (struct sockaddr *)&sa) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        close(fd);
+        free(clnt);
+
+        return NULL;
+    }
+
+    clnt->srv = srv;
+    clnt->outbound = 1;
+
+    if (dime_socket_init_tcp(&clnt->sock, srv->nodelay, srv->quickack, srv->cork) < 0 &&
+        srv->verbosity >= 1) {
+        dime_warn("Failed to set TCP options for %s (%s)", clnt->addr, clnt->sock.err);
+    }
+
+    if (peer_init(clnt) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        dime_client_destroy(clnt);
+        free(clnt);
+
+        return NULL;
+    }
+
+    if (dime_server_attach(srv, clnt) < 0) {
+        dime_client_destroy(clnt);
+        free(clnt);
+
+        return NULL;
+    }
+
+    if (peer_send_hello(clnt, srv) < 0) {
+        dime_server_detach(srv, clnt);
+        dime_client_destroy(clnt);
+        free(clnt);
+
+        return NULL;
+    }
+
+    return clnt;
+}
+
+dime_client_t *dime_peer_redial(dime_server_t *srv, double *ptimeleft) {
+    double now = dime_socket_now();
+    double timeleft = HUGE_VAL;
+
+    for (size_t i = 0; i < srv->links_len; i++) {
+        dime_link_t *link = &srv->links[i];
+
+        if (link->clnt != NULL) {
+            continue;
+        }
+
+        if (link->retry > now) {
+            if (link->retry - now < timeleft) {
+                timeleft = link->retry - now;
+            }
+
+            continue;
+        }
+
+        dime_client_t *clnt = dime_peer_connect(srv, link->addr);
+
+        if (clnt == NULL) {
+            peer_backoff(link);
+
+            if (srv->verbosity >= 1) {
+                dime_warn("Could not link to %s (%s), trying again in %g seconds", link->addr, srv->err, link->retry - now);
+            }
+
+            if (link->retry - now < timeleft) {
+                timeleft = link->retry - now;
+            }
+
+            continue;
+        }
+
+        link->clnt = clnt;
+
+        if (srv->verbosity >= 1) {
+            dime_info("Dialed link to %s", link->addr);
+        }
+
+        /* The caller watches the link before the rest are looked at */
+        *ptimeleft = 0;
+
+        return clnt;
+    }
+
+    *ptimeleft = timeleft;
+
+    return NULL;
+}
+
+void dime_peer_remove(dime_server_t *srv, dime_client_t *clnt) {
+    dime_link_t *link = clnt->outbound ? peer_link(srv, clnt) : NULL;
+
+    if (link != NULL) {
+        peer_backoff(link);
+
+        if (srv->verbosity >= 1) {
+            dime_warn("Link to %s is down, dialing it again in %g seconds", link->addr, link->retry - dime_socket_now());
+        }
+    }
+
+    if (!clnt->peer || !clnt->active) {
+        return;
+    }
+
+    peer_deactivate(srv, clnt);
+
+    /* Fall back to a standby link to the same node, if there is one */
+    for (size_t i = 0; i < srv->clnts_len; i++) {
+        dime_client_t *other = srv->clnts[i];
+
+        if (other != clnt && other->peer && !other->active &&
+            other->node != NULL && strcmp(other->node, clnt->node) == 0) {
+            if (peer_activate(srv, other) >= 0 && srv->verbosity >= 1) {
+                dime_info("Switched link to node %s over to %s", other->node, other->addr);
+            }
+
+            break;
+        }
+    }
+}
+
+int dime_peer_has_group(dime_client_t *clnt, const char *name) {
+    return clnt->peer && dime_table_search(&clnt->peer_groups, name) != NULL;
+}
+
+int dime_peer_update(dime_server_t *srv, const char *name, int present) {
+    json_t *update = NULL;
+
+    for (size_t i = 0; i < srv->clnts_len; i++) {
+        dime_client_t *clnt = srv->clnts[i];
+
+        if (!clnt->peer) {
+            continue;
+        }
+
+        if (update == NULL) {
+            update = json_pack("{sss[s]}", "command", "groups", present ? "add" : "remove", name);
+            if (update == NULL) {
+                strncpy(srv->err, strerror(errno), sizeof(srv->err));
+                srv->err[sizeof(srv->err) - 1] = '\0';
+
+                return -1;
+            }
+        }
+
+        if (dime_socket_push(&clnt->sock, update, NULL, 0) < 0) {
+            json_decref(update);
+
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+    }
+
+    json_decref(update);
+
+    return 0;
+}
+
+int dime_peer_hello(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len) {
+    const char *node;
+    json_t *groups;
+    json_t *compression = NULL;
+    json_error_t err;
+
+    if (json_unpack_ex(jsondata, &err, 0, "{ssso}", "node", &node, "groups", &groups) < 0) {
+        strncpy(srv->err, "JSON parsing error: ", sizeof(srv->err));
+        strncat(srv->err, err.text, sizeof(srv->err) - strlen(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        json_t *response = json_pack("{siss+}", "status", -1, "error", "JSON parsing error: ", err.text);
+        if (response != NULL) {
+            dime_socket_push(&clnt->sock, response, NULL, 0);
+            json_decref(response);
+        }
+
+        return -1;
+    }
+
+    json_unpack(jsondata, "{s?o}", "compression", &compression);
+
+    /* Links dialed by this server are trusted, the others must know the secret */
+    if (!clnt->outbound && !peer_authorized(srv, jsondata)) {
+        strncpy(srv->err, "Not authorized to link", sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        json_t *response = json_pack("{siss}", "status", -1, "error", "Not authorized to link");
+        if (response != NULL) {
+            dime_socket_push(&clnt->sock, response, NULL, 0);
+            json_decref(response);
+        }
+
+        return -1;
+    }
+
+    if (strcmp(node, srv->node) == 0 || clnt->node != NULL) {
+        const char *msg = (clnt->node != NULL) ? "Link is already established" : "Server is linked to itself";
+
+        strncpy(srv->err, msg, sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        json_t *response = json_pack("{siss}", "status", -1, "error", msg);
+        if (response != NULL) {
+            dime_socket_push(&clnt->sock, response, NULL, 0);
+            json_decref(response);
+        }
+
+        return -1;
+    }
+
+    /* The other server dialed us, so introduce ourselves in return */
+    if (!clnt->peer) {
+        if (peer_init(clnt) < 0) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+
+        if (peer_send_hello(clnt, srv) < 0) {
+            return -1;
+        }
+    }
+
+    clnt->node = strdup(node);
+    if (clnt->node == NULL || peer_apply(clnt, groups, 1) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return -1;
+    }
+
+    /* The next failure is retried quickly again */
+    dime_link_t *link = clnt->outbound ? peer_link(srv, clnt) : NULL;
+
+    if (link != NULL) {
+        link->backoff = 0;
+    }
+
+    /* Pick the peer's most preferred codec that this server allows */
+    for (size_t i = 0; i < json_array_size(compression); i++) {
+        const char *name = json_string_value(json_array_get(compression, i));
+        int codec = (name != NULL) ? dime_compress_from_str(name) : -1;
+
+        if (codec > DIME_COMPRESS_NONE && (srv->compress_codecs & (1u << codec))) {
+            if (dime_socket_init_compress(&clnt->sock, codec, srv->compress_levels[codec], srv->compress_threshold) < 0) {
+                strncpy(srv->err, strerror(errno), sizeof(srv->err));
+                srv->err[sizeof(srv->err) - 1] = '\0';
+
+                return -1;
+            }
+
+            break;
+        }
+    }
+
+    /*
+     * Both servers see the same pair of links to each other, so both
+     * agree to use the one dialed by the smaller node ID
+     */
+    dime_client_t *other = NULL;
+
+    for (size_t i = 0; i < srv->peers_len; i++) {
+        if (strcmp(srv->peers[i]->node, node) == 0) {
+            other = srv->peers[i];
+            break;
+        }
+    }
+
+    if (other != NULL) {
+        const char *dialer = clnt->outbound ? srv->node : node;
+        const char *other_dialer = other->outbound ? srv->node : node;
+
+        if (strcmp(dialer, other_dialer) >= 0) {
+            if (srv->verbosity >= 1) {
+                dime_info("Keeping %s as a standby link to node %s", clnt->addr, node);
+            }
+
+            return 0;
+        }
+
+        peer_deactivate(srv, other);
+    }
+
+    if (peer_activate(srv, clnt) < 0) {
+        return -1;
+    }
+
+    if (srv->verbosity >= 1) {
+        dime_info("Linked to node %s at %s", node, clnt->addr);
+    }
+
+    return 0;
+}
+
+int dime_peer_groups(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len) {
+    json_t *add = NULL, *remove = NULL;
+
+    if (!clnt->peer) {
+        strncpy(srv->err, "Client is not a peer", sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        json_t *response = json_pack("{siss}", "status", -1, "error", "Client is not a peer");
+        if (response != NULL) {
+            dime_socket_push(&clnt->sock, response, NULL, 0);
+            json_decref(response);
+        }
+
+        return -1;
+    }
+
+    json_unpack(jsondata, "{s?o}", "add", &add);
+    json_unpack(jsondata, "{s?o}", "remove", &remove);
+
+    if (peer_apply(clnt, add, 1) < 0 || peer_apply(clnt, remove, 0) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return -1;
+    }
+
+    if (srv->verbosity >= 3) {
+        dime_info("Updated groups of node %s", clnt->node != NULL ? clnt->node : clnt->addr);
+    }
+
+    return 0;
+}
+
+int dime_peer_reply(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len) {
+    const char *error;
+
+    /* The other server refused the link before introducing itself */
+    if (clnt->node == NULL) {
+        if (json_unpack(jsondata, "{ss}", "error", &error) < 0) {
+            error = "unknown error";
+        }
+
+        strncpy(srv->err, "Link refused: ", sizeof(srv->err));
+        strncat(srv->err, error, sizeof(srv->err) - strlen(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return -1;
+    }
+
+    if (json_unpack(jsondata, "{ss}", "error", &error) == 0 && srv->verbosity >= 1) {
+        dime_warn("Node %s failed to deliver a message: %s", clnt->node != NULL ? clnt->node : clnt->addr, error);
+    }
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * peer.h - Server-to-server federation
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file peer.h
+ * @brief Server-to-server federation
+ * @author Nicholas West
+ * @date 2020
+ *
+ * Servers given each other's addresses with @c -P link up over TCP and
+ * behave as one large server. A link is an ordinary
+ * @link dime_client_t @endlink with its @c peer flag set, so it shares
+ * the event loop, buffering and compression of every other connection.
+ *
+ * When a link comes up, each side sends a "peer" message carrying its
+ * node ID and the groups that have members on it. Afterwards, a
+ * "groups" message is sent whenever a group gains its first member or
+ * loses its last one. A server forwards a "send" only to the peers
+ * that have members of the target group, and a "broadcast" to every
+ * peer, in both cases without a reply. Forwarded messages are only
+ * delivered locally and never forwarded again, so the servers must be
+ * fully meshed (each pair linked, from either side), and each message
+ * crosses each link at most once.
+ *
+ * If both sides of a pair dial each other, both links are kept, but
+ * only the one dialed by the server with the smaller node ID is used;
+ * the other takes over if it closes.
+ *
+ * A server dials its links without blocking, and dials a link again
+ * whenever it goes down, waiting twice as long after each failure up to
+ * @c DIME_LINK_BACKOFF_MAX seconds. Links dialed by other servers are
+ * only accepted if their "peer" message carries the secret given with
+ * @c -S, which is sent in the clear.
+ */
+
+#include <jansson.h>
+#include "client.h"
+#include "server.h"
+
+#ifndef __DIME_peer_H
+#define __DIME_peer_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Connect to another server
+ *
+ * Starts connecting to the server at @em addr, attaches the link to
+ * @em srv and queues a "peer" message on it. The event loop must start
+ * watching the returned client's file descriptor. The address is
+ * resolved before returning, but the connection completes in the
+ * background; if it fails, the first read or write on the link does.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param addr Address of the other server, as "host:port" or
+ * "[host]:port"
+ *
+ * @return The new link, or NULL on failure
+ */
+dime_client_t *dime_peer_connect(dime_server_t *srv, const char *addr);
+
+/**
+ * @brief Dial the links of a server that are due
+ *
+ * Dials the first link given with @c -P that is down and due to be
+ * dialed again. Links that cannot be dialed are retried later.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param ptimeleft Set to the seconds until the next link is due, or
+ * @c HUGE_VAL if there is none
+ *
+ * @return The new link, which the event loop must start watching
+ * before calling this function again, or NULL if no link is due
+ */
+dime_client_t *dime_peer_redial(dime_server_t *srv, double *ptimeleft);
+
+/**
+ * @brief Unregister a link from the server
+ *
+ * Called when a client is detached. If @em clnt was the link in use to
+ * its node, another link to the same node takes its place. If it was
+ * dialed by this server, it is dialed again later.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param clnt Pointer to a client, which need not be a link
+ */
+void dime_peer_remove(dime_server_t *srv, dime_client_t *clnt);
+
+/**
+ * @brief Check whether a peer has members of a group
+ *
+ * @param clnt Pointer to a link
+ * @param name Group name
+ *
+ * @return Nonzero if the group has members on the other side of the
+ * link, zero otherwise
+ */
+int dime_peer_has_group(dime_client_t *clnt, const char *name);
+
+/**
+ * @brief Notify peers that a group gained or lost its members
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param name Group name
+ * @param present Whether the group now has local members
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_peer_update(dime_server_t *srv, const char *name, int present);
+
+/**
+ * @brief Handle a "peer" command
+ *
+ * The "peer" command turns the connection into a link to another
+ * server. The JSON field @c node contains the other server's node ID,
+ * @c groups the groups with members on it, and @c compression the
+ * codecs it accepts in order of preference.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to the @link dime_server_t @endlink struct from
+ * which the client connection was accepted
+ * @param jsondata JSON portion of the message
+ * @param pbindata Binary portion of the message
+ * @param bindata_len Length of binary portion of the message
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_peer_hello(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len);
+
+/**
+ * @brief Handle a "groups" command
+ *
+ * The "groups" command updates the groups with members on the other
+ * side of a link. The JSON fields @c add and @c remove contain group
+ * names.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to the @link dime_server_t @endlink struct from
+ * which the client connection was accepted
+ * @param jsondata JSON portion of the message
+ * @param pbindata Binary portion of the message
+ * @param bindata_len Length of binary portion of the message
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_peer_groups(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len);
+
+/**
+ * @brief Handle a message without a command from a peer
+ *
+ * Forwarded messages are not acknowledged, so these are only the error
+ * responses of a peer that failed to deliver a message. They are
+ * logged and dropped.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to the @link dime_server_t @endlink struct from
+ * which the client connection was accepted
+ * @param jsondata JSON portion of the message
+ * @param pbindata Binary portion of the message
+ * @param bindata_len Length of binary portion of the message
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_peer_reply(dime_client_t *clnt, dime_server_t *srv, json_t *jsondata, void **pbindata, size_t bindata_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * probes.h - Static tracepoints
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file probes.h
+ * @brief Static tracepoints
+ * @author Nicholas West
+ * @date 2020
+ *
+ * If compiled with @c DIME_USE_USDT, the server has USDT probes (from
+ * SystemTap's @c sys/sdt.h) under the provider @c dime, which tools such
+ * as bpftrace can attach to in a running server. A probe that nothing is
+ * attached to is a single @c nop instruction. Without @c DIME_USE_USDT,
+ * the probes and their arguments compile to nothing.
+ *
+ * The probes and their arguments are:
+ * - @c accept: client fd, client address
+ * - @c close: client fd, client address, bytes received, bytes sent
+ * - @c frame: client fd, message length, binary length
+ * - @c command: client fd, command name
+ * - @c command_done: client fd, command name, result (negative on
+ *   failure)
+ * - @c enqueue: recipient fd, group name (NULL for a broadcast), message
+ *   length, recipient queue depth
+ * - @c wait_wake: client fd, queue depth
+ * - @c sync_drain: client fd, messages sent, queue depth left
+ * - @c write: client fd, bytes written, bytes left to write
+ *
+ * For example, to count the bytes sent to each group:
+ * @code
+ * bpftrace -e 'usdt:./dime:dime:enqueue /arg1/ { @[str(arg1)] = sum(arg2); }'
+ * @endcode
+ */
+
+#ifndef __DIME_probes_H
+#define __DIME_probes_H
+
+#ifdef DIME_USE_USDT
+
+#include <sys/sdt.h>
+
+#define DIME_PROBE2(name, a, b) DTRACE_PROBE2(dime, name, a, b)
+#define DIME_PROBE3(name, a, b, c) DTRACE_PROBE3(dime, name, a, b, c)
+#define DIME_PROBE4(name, a, b, c, d) DTRACE_PROBE4(dime, name, a, b, c, d)
+
+#else
+
+#define DIME_PROBE2(name, a, b) do {} while (0)
+#define DIME_PROBE3(name, a, b, c) do {} while (0)
+#define DIME_PROBE4(name, a, b, c, d) do {} while (0)
+
+#endif
+
+#endif
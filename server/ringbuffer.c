@@ -24,11 +24,8 @@ size_t dime_ringbuffer_read(dime_ringbuffer_t *ring, void *buf, size_t siz) {
     return dime_ringbuffer_discard(ring, dime_ringbuffer_peek(ring, buf, siz));
 }
 
-ssize_t dime_ringbuffer_write(dime_ringbuffer_t *ring, const void *buf, size_t siz) {
-    if (siz == 0) {
-        return 0;
-    }
-
+/* Make room for siz more bytes, keeping at least one byte free */
+static int dime_ringbuffer_grow(dime_ringbuffer_t *ring, size_t siz) {
     if (ring->len + siz >= ring->cap) {
         size_t ncap = (3 * (ring->len + siz)) / 2;
 
@@ -49,6 +46,18 @@ ssize_t dime_ringbuffer_write(dime_ringbuffer_t *ring, const void *buf, size_t s
         ring->cap = ncap;
     }
 
+    return 0;
+}
+
+ssize_t dime_ringbuffer_write(dime_ringbuffer_t *ring, const void *buf, size_t siz) {
+    if (siz == 0) {
+        return 0;
+    }
+
+    if (dime_ringbuffer_grow(ring, siz) < 0) {
+        return -1;
+    }
+
     size_t spaceleft = ring->cap - ring->end;
 
 	if (spaceleft < siz) {
@@ -104,6 +113,69 @@ size_t dime_ringbuffer_discard(dime_ringbuffer_t *ring, size_t siz) {
     return siz;
 }
 
+size_t dime_ringbuffer_segments(dime_ringbuffer_t *ring, void **segs, size_t *seg_lens) {
+    if (ring->len == 0) {
+        return 0;
+    }
+
+    size_t spaceleft = ring->cap - ring->begin;
+
+    segs[0] = ring->arr + ring->begin;
+
+    if (spaceleft < ring->len) {
+        seg_lens[0] = spaceleft;
+        segs[1] = ring->arr;
+        seg_lens[1] = ring->len - spaceleft;
+
+        return 2;
+    }
+
+    seg_lens[0] = ring->len;
+
+    return 1;
+}
+
+size_t dime_ringbuffer_space(dime_ringbuffer_t *ring, size_t siz, void **segs, size_t *seg_lens) {
+    if (dime_ringbuffer_grow(ring, siz) < 0) {
+        return 0;
+    }
+
+    /* One byte stays free, so a full ring never looks empty when grown */
+    size_t nfree = ring->cap - ring->len - 1;
+    size_t spaceleft = ring->cap - ring->end;
+
+    segs[0] = ring->arr + ring->end;
+
+    if (spaceleft < nfree) {
+        seg_lens[0] = spaceleft;
+        segs[1] = ring->arr;
+        seg_lens[1] = nfree - spaceleft;
+
+        return 2;
+    }
+
+    seg_lens[0] = nfree;
+
+    return 1;
+}
+
+size_t dime_ringbuffer_commit(dime_ringbuffer_t *ring, size_t siz) {
+    size_t nfree = ring->cap - ring->len - 1;
+
+    if (siz > nfree) {
+        siz = nfree;
+    }
+
+    ring->len += siz;
+    ring->end += siz;
+
+    if (ring->end >= ring->cap) {
+        ring->end -= ring->cap;
+    }
+
+    return siz;
+}
+
 size_t dime_ringbuffer_len(const dime_ringbuffer_t *ring) {
     return ring->len;
 }
@@ -49,6 +49,7 @@ extern "C" {
  * @see dime_ringbuffer_write
  * @see dime_ringbuffer_peek
  * @see dime_ringbuffer_discard
+ * @see dime_ringbuffer_segments
  */
 typedef struct {
     size_t len; /* Number of bytes in the buffer */
@@ -142,6 +143,63 @@ size_t dime_ringbuffer_peek(const dime_ringbuffer_t *ring,
  */
 size_t dime_ringbuffer_discard(dime_ringbuffer_t *ring, size_t siz);
 
+/**
+ * @brief Get the readable bytes of the ring buffer in place
+ *
+ * The readable bytes occupy at most two contiguous segments of the
+ * underlying array, which can be handed to e.g. @c writev without being
+ * copied, or modified in place. The pointers are invalidated by any call
+ * that adds or removes bytes.
+ *
+ * @param ring Pointer to a @c dime_ringbuffer_t struct
+ * @param segs Array of two pointers, set to the start of each segment
+ * @param seg_lens Array of two sizes, set to the length of each segment
+ *
+ * @return Number of segments (0, 1 or 2)
+ *
+ * @see dime_ringbuffer_peek
+ * @see dime_ringbuffer_discard
+ */
+size_t dime_ringbuffer_segments(dime_ringbuffer_t *ring,
+                                void **segs,
+                                size_t *seg_lens);
+
+/**
+ * @brief Get the writeable bytes of the ring buffer in place
+ *
+ * Grows the ring buffer until at least @em siz bytes can be written, then
+ * returns the free space as at most two contiguous segments, so that e.g.
+ * @c readv can fill it without an intermediate buffer. Bytes written there
+ * become readable once passed to @link dime_ringbuffer_commit @endlink.
+ *
+ * @param ring Pointer to a @c dime_ringbuffer_t struct
+ * @param siz Minimum number of writeable bytes
+ * @param segs Array of two pointers, set to the start of each segment
+ * @param seg_lens Array of two sizes, set to the length of each segment
+ *
+ * @return Number of segments (1 or 2), or 0 on failure
+ *
+ * @see dime_ringbuffer_commit
+ * @see dime_ringbuffer_segments
+ */
+size_t dime_ringbuffer_space(dime_ringbuffer_t *ring,
+                             size_t siz,
+                             void **segs,
+                             size_t *seg_lens);
+
+/**
+ * @brief Make bytes written in place readable
+ *
+ * @param ring Pointer to a @c dime_ringbuffer_t struct
+ * @param siz Number of bytes written to the segments returned by
+ * @link dime_ringbuffer_space @endlink
+ *
+ * @return Number of bytes committed (may be less than @em siz)
+ *
+ * @see dime_ringbuffer_space
+ */
+size_t dime_ringbuffer_commit(dime_ringbuffer_t *ring, size_t siz);
+
 /**
  * @brief Get the number of bytes in the ring buffer
  *
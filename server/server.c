@@ -6,6 +6,7 @@
 #   include <arpa/inet.h>
 #   include <fcntl.h>
 #   include <netinet/in.h>
+#   include <netinet/tcp.h>
 #   include <unistd.h>
 #   include <sys/select.h>
 #   include <sys/socket.h>
@@ -20,17 +21,26 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <math.h>
 
 #ifdef DIME_USE_LIBEV
 #   include <ev.h>
 #endif
 #include <jansson.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
 
 #include "client.h"
+#include "latency.h"
+#include "metrics.h"
+#include "peer.h"
+#include "probes.h"
 #include "server.h"
+#include "spill.h"
+#include "session.h"
 #include "table.h"
+#include "ttl.h"
 #include "deque.h"
 #include "socket.h"
 #include "log.h"
@@ -39,46 +49,13 @@
 #   define close closesocket
 #endif
 
-static int cmp_fd(const void *a, const void *b) {
-    return (*(const int *)b) - (*(const int *)a);
-}
-
-static uint64_t hash_fd(const void *a) {
-    return (*(const int *)a) * 0x9E3779B97F4A7BB9;
-}
-
-static int cmp_name(const void *a, const void *b) {
-    return strcmp(a, b);
-}
-
-/*
- * Note: FNV1a is currently used here to hash strings, but since this is a
- * network-enabled program, we may want to use a randomized hashing algorithm
- * like SipHash
- */
-static uint64_t hash_name(const void *a) {
-    uint64_t y = 0xCBF29CE484222325;
-
-    for (const char *s = a; *s != '\0'; s++) {
-        y = (y ^ *s) * 1099511628211;
-    }
-
-    return y;
-}
-
 int dime_server_init(dime_server_t *srv) {
     srv->err[0] = '\0';
+    srv->started = dime_socket_now();
 
-    if (dime_table_init(&srv->fd2clnt, cmp_fd, hash_fd) < 0) {
-        strncpy(srv->err, strerror(errno), sizeof(srv->err));
-        printf("%d %s\n", __LINE__, strerror(errno)); return -1;
-    }
-
-    if (dime_table_init(&srv->name2clnt, cmp_name, hash_name) < 0) {
+    if (dime_table_init(&srv->name2clnt, dime_table_cmp_str, dime_table_hash_str) < 0) {
         strncpy(srv->err, strerror(errno), sizeof(srv->err));
 
-        dime_table_destroy(&srv->fd2clnt);
-
         printf("%d %s\n", __LINE__, strerror(errno)); return -1;
     }
 
@@ -89,7 +66,6 @@ int dime_server_init(dime_server_t *srv) {
         strncpy(srv->err, strerror(errno), sizeof(srv->err));
 
         dime_table_destroy(&srv->name2clnt);
-        dime_table_destroy(&srv->fd2clnt);
 
         printf("%d %s\n", __LINE__, strerror(errno)); return -1;
     }
@@ -102,9 +78,149 @@ int dime_server_init(dime_server_t *srv) {
 
         free(srv->fds);
         dime_table_destroy(&srv->name2clnt);
-        dime_table_destroy(&srv->fd2clnt);
 
-        printf("%d %s\n", __LINE__, strerror(errno)); return -1;
+        dime_err("Could not allocate the list of socket paths (%s)", srv->err);
+
+        return -1;
+    }
+
+    srv->fdtab_cap = 64;
+    srv->fdtab = calloc(srv->fdtab_cap, sizeof(dime_fdent_t));
+    if (srv->fdtab == NULL) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+
+        free(srv->pathnames);
+        free(srv->fds);
+        dime_table_destroy(&srv->name2clnt);
+
+        dime_err("Could not allocate the file descriptor table (%s)", srv->err);
+
+        return -1;
+    }
+
+    srv->clnts_len = 0;
+    srv->clnts_cap = 16;
+    srv->clnts = malloc(srv->clnts_cap * sizeof(dime_client_t *));
+    if (srv->clnts == NULL) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+
+        free(srv->fdtab);
+        free(srv->pathnames);
+        free(srv->fds);
+        dime_table_destroy(&srv->name2clnt);
+
+        dime_err("Could not allocate the client list (%s)", srv->err);
+
+        return -1;
+    }
+
+    /* Grown along with clnts, so that adding to it cannot fail */
+    srv->ready = NULL;
+    srv->ready_len = 0;
+    srv->ready_cap = 0;
+
+    srv->peers_len = 0;
+    srv->peers_cap = 4;
+    srv->peers = malloc(srv->peers_cap * sizeof(dime_client_t *));
+    if (srv->peers == NULL) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+
+        free(srv->clnts);
+        free(srv->fdtab);
+        free(srv->pathnames);
+        free(srv->fds);
+        dime_table_destroy(&srv->name2clnt);
+
+        dime_err("Could not allocate the list of peers (%s)", srv->err);
+
+        return -1;
+    }
+
+    srv->held_len = 0;
+    srv->held_cap = 4;
+    srv->held = malloc(srv->held_cap * sizeof(dime_client_t *));
+    if (srv->held == NULL) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+
+        free(srv->peers);
+        free(srv->clnts);
+        free(srv->fdtab);
+        free(srv->pathnames);
+        free(srv->fds);
+        dime_table_destroy(&srv->name2clnt);
+
+        dime_err("Could not allocate the list of held sessions (%s)", srv->err);
+
+        return -1;
+    }
+
+    if (dime_table_init(&srv->sessions, dime_table_cmp_str, dime_table_hash_str) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+
+        free(srv->held);
+        free(srv->peers);
+        free(srv->clnts);
+        free(srv->fdtab);
+        free(srv->pathnames);
+        free(srv->fds);
+        dime_table_destroy(&srv->name2clnt);
+
+        dime_err("Could not allocate the session table (%s)", srv->err);
+
+        return -1;
+    }
+
+    if (dime_table_init(&srv->latency, dime_table_cmp_str, dime_table_hash_str) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+
+        dime_table_destroy(&srv->sessions);
+        free(srv->held);
+        free(srv->peers);
+        free(srv->clnts);
+        free(srv->fdtab);
+        free(srv->pathnames);
+        free(srv->fds);
+        dime_table_destroy(&srv->name2clnt);
+
+        dime_err("Could not allocate the latency table (%s)", srv->err);
+
+        return -1;
+    }
+
+    srv->latency_bcast = NULL;
+
+    if (srv->spill_dir == NULL) {
+        srv->spill_dir = getenv("TMPDIR");
+    }
+
+    dime_spill_init(&srv->spill, (srv->spill_dir != NULL) ? srv->spill_dir : "/tmp");
+
+    /* The timer wheel turns from the current tick */
+    srv->ttl_tick = (uint64_t)(srv->started / DIME_TTL_TICK);
+
+    /* Identifies this server to its peers */
+    unsigned char node[8];
+
+    if (RAND_bytes(node, sizeof(node)) != 1) {
+        strncpy(srv->err, "Could not generate node ID", sizeof(srv->err));
+
+        dime_ttl_destroy(srv);
+        dime_spill_destroy(&srv->spill);
+        dime_table_destroy(&srv->latency);
+        dime_table_destroy(&srv->sessions);
+        free(srv->held);
+        free(srv->peers);
+        free(srv->clnts);
+        free(srv->fdtab);
+        free(srv->pathnames);
+        free(srv->fds);
+        dime_table_destroy(&srv->name2clnt);
+
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(node); i++) {
+        snprintf(srv->node + 2 * i, 3, "%02x", node[i]);
     }
 
     if (srv->daemon) {
@@ -117,10 +233,21 @@ int dime_server_init(dime_server_t *srv) {
             strncpy(srv->err, strerror(errno), sizeof(srv->err));
 
             close(srv->fd);
-            dime_table_destroy(&srv->fd2clnt);
+            dime_ttl_destroy(srv);
+            dime_spill_destroy(&srv->spill);
+            dime_table_destroy(&srv->latency);
+            dime_table_destroy(&srv->sessions);
+            free(srv->held);
+            free(srv->peers);
+            free(srv->clnts);
+            free(srv->fdtab);
+            free(srv->pathnames);
+            free(srv->fds);
             dime_table_destroy(&srv->name2clnt);
 
-            printf("%d %s\n", __LINE__, strerror(errno)); return -1;
+            dime_err("Could not fork (%s)", srv->err);
+
+            return -1;
         } else if (pid != 0) {
             if (srv->verbosity >= 1) {
                 dime_info("Forked from main, PID is %ld", (long)pid);
@@ -131,7 +258,7 @@ int dime_server_init(dime_server_t *srv) {
 #endif
     }
 
-/*    if (srv->tls) {
+    if (srv->tls) {
         if (srv->certname == NULL) {
             if (srv->verbosity >= 1) {
                 dime_warn("Certificate file not given, TLS will be disabled");
@@ -182,10 +309,33 @@ int dime_server_init(dime_server_t *srv) {
 
             goto tls_break;
         }
+
+        /*
+         * Let reconnecting clients resume their session with a ticket,
+         * skipping the key exchange and certificate verification
+         */
+        SSL_CTX_clear_options(srv->tlsctx, SSL_OP_NO_TICKET);
+        SSL_CTX_set_session_cache_mode(srv->tlsctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_session_id_context(srv->tlsctx, (const unsigned char *)"dime", 4);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        SSL_CTX_set_num_tickets(srv->tlsctx, 2);
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+        /*
+         * Where the kernel and cipher allow it, have the kernel encrypt and
+         * decrypt records, so that writes skip OpenSSL entirely
+         */
+        if (srv->ktls) {
+            SSL_CTX_set_options(srv->tlsctx, SSL_OP_ENABLE_KTLS);
+        }
+#endif
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        /* Most clients just close the socket rather than send close_notify */
+        SSL_CTX_set_options(srv->tlsctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
     }
-tls_break:*/
+tls_break:
 
-    srv->serialization = DIME_NO_SERIALIZATION;
 
     return 0;
 }
@@ -204,15 +354,32 @@ void dime_server_destroy(dime_server_t *srv) {
 
     free(srv->fds);
 
-    dime_table_iter_t it;
+    /* Nobody is left to resume sessions */
+    srv->session_grace = 0;
 
-    dime_table_iter_init(&it, &srv->fd2clnt);
+    while (srv->clnts_len > 0) {
+        dime_client_t *clnt = srv->clnts[srv->clnts_len - 1];
 
-    while (dime_table_iter_next(&it)) {
-        dime_client_destroy(it.val);
-        free(it.val);
+        dime_server_detach(srv, clnt);
+        dime_client_destroy(clnt);
+        free(clnt);
+    }
+
+    while (srv->held_len > 0) {
+        dime_client_t *clnt = srv->held[srv->held_len - 1];
+
+        dime_client_destroy(clnt);
+        free(clnt);
+    }
+
+    for (size_t i = 0; i < srv->fdtab_cap; i++) {
+        if (srv->fdtab[i].type == DIME_FDENT_SCRAPE) {
+            dime_metrics_close(srv, srv->fdtab[i].u.scrape);
+        }
     }
 
+    dime_table_iter_t it;
+
     dime_table_iter_init(&it, &srv->name2clnt);
 
     while (dime_table_iter_next(&it)) {
@@ -223,8 +390,145 @@ void dime_server_destroy(dime_server_t *srv) {
         free(group);
     }
 
-    dime_table_destroy(&srv->fd2clnt);
+    if (srv->udp_mode != DIME_UDP_NONE) {
+        close(srv->udp_fd);
+    }
+
+    free(srv->held);
+    free(srv->peers);
+    free(srv->ready);
+    free(srv->clnts);
+    free(srv->fdtab);
+    dime_latency_destroy(srv);
+    dime_spill_destroy(&srv->spill);
+    dime_ttl_destroy(srv);
+    dime_table_destroy(&srv->sessions);
     dime_table_destroy(&srv->name2clnt);
+
+    if (srv->tlsctx != NULL) {
+        SSL_CTX_free(srv->tlsctx);
+    }
+}
+
+int dime_server_fdtab_reserve(dime_server_t *srv, int fd) {
+    if ((size_t)fd < srv->fdtab_cap) {
+        return 0;
+    }
+
+    size_t ncap = srv->fdtab_cap;
+
+    while (ncap <= (size_t)fd) {
+        ncap = (ncap * 3) / 2;
+    }
+
+    dime_fdent_t *ntab = realloc(srv->fdtab, ncap * sizeof(dime_fdent_t));
+    if (ntab == NULL) {
+        return -1;
+    }
+
+    memset(ntab + srv->fdtab_cap, 0, (ncap - srv->fdtab_cap) * sizeof(dime_fdent_t));
+
+    srv->fdtab = ntab;
+    srv->fdtab_cap = ncap;
+
+    return 0;
+}
+
+static int dime_server_listen(dime_server_t *srv, dime_server_fd_t *srvfd) {
+    if (dime_server_fdtab_reserve(srv, srvfd->fd) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        return -1;
+    }
+
+    dime_fdent_t *ent = &srv->fdtab[srvfd->fd];
+
+    ent->type = DIME_FDENT_LISTENER;
+    ent->events = DIME_FDENT_READ;
+    ent->thread = 0;
+    ent->u.srvfd = srvfd;
+
+    if (listen(srvfd->fd, srv->backlog) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Leave a client's remaining messages for a later wakeup */
+static void server_ready_add(dime_server_t *srv, dime_client_t *clnt) {
+    assert(!clnt->ready && srv->ready_len < srv->ready_cap);
+
+    clnt->ready = 1;
+    clnt->ready_idx = srv->ready_len;
+    srv->ready[srv->ready_len++] = clnt;
+}
+
+static void server_ready_remove(dime_server_t *srv, dime_client_t *clnt) {
+    if (!clnt->ready) {
+        return;
+    }
+
+    srv->ready_len--;
+    srv->ready[clnt->ready_idx] = srv->ready[srv->ready_len];
+    srv->ready[clnt->ready_idx]->ready_idx = clnt->ready_idx;
+
+    clnt->ready = 0;
+}
+
+int dime_server_attach(dime_server_t *srv, dime_client_t *clnt) {
+    if (dime_server_fdtab_reserve(srv, clnt->fd) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        return -1;
+    }
+
+    if (srv->clnts_len >= srv->clnts_cap) {
+        size_t ncap = (srv->clnts_cap * 3) / 2;
+        dime_client_t **nclnts = realloc(srv->clnts, ncap * sizeof(dime_client_t *));
+        if (nclnts == NULL) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            return -1;
+        }
+
+        srv->clnts = nclnts;
+        srv->clnts_cap = ncap;
+    }
+
+    if (srv->ready_cap < srv->clnts_cap) {
+        dime_client_t **nready = realloc(srv->ready, srv->clnts_cap * sizeof(dime_client_t *));
+        if (nready == NULL) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            return -1;
+        }
+
+        srv->ready = nready;
+        srv->ready_cap = srv->clnts_cap;
+    }
+
+    dime_fdent_t *ent = &srv->fdtab[clnt->fd];
+
+    ent->type = DIME_FDENT_CLIENT;
+    ent->events = DIME_FDENT_READ;
+    ent->thread = 0;
+    ent->u.clnt = clnt;
+
+    clnt->idx = srv->clnts_len;
+    srv->clnts[srv->clnts_len++] = clnt;
+
+    return 0;
+}
+
+void dime_server_detach(dime_server_t *srv, dime_client_t *clnt) {
+    assert(clnt->idx < srv->clnts_len && srv->clnts[clnt->idx] == clnt);
+
+    dime_peer_remove(srv, clnt);
+    server_ready_remove(srv, clnt);
+
+    srv->clnts_len--;
+    srv->clnts[clnt->idx] = srv->clnts[srv->clnts_len];
+    srv->clnts[clnt->idx]->idx = clnt->idx;
+
+    memset(&srv->fdtab[clnt->fd], 0, sizeof(dime_fdent_t));
 }
 
 int dime_server_add(dime_server_t *srv, int protocol, ...) {
@@ -305,6 +609,7 @@ int dime_server_add(dime_server_t *srv, int protocol, ...) {
 
     case DIME_TCP:
     case DIME_WS:
+    case DIME_METRICS:
         {
             uint16_t port = va_arg(args, unsigned int);
             va_end(args);
@@ -351,6 +656,26 @@ int dime_server_add(dime_server_t *srv, int protocol, ...) {
                 }
             }
 
+#ifndef _WIN32
+            /* Restarted servers can rebind while old connections linger in TIME_WAIT */
+            int yes = 1;
+
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&yes, sizeof(int));
+#endif
+
+            /*
+             * Accepted sockets inherit their buffer sizes from the
+             * listener, and the TCP window scale is fixed before accept
+             */
+            if ((srv->sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (void *)&srv->sndbuf, sizeof(int)) < 0) ||
+                (srv->rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void *)&srv->rcvbuf, sizeof(int)) < 0)) {
+                strncpy(srv->err, strerror(errno), sizeof(srv->err));
+
+                close(fd);
+
+                return -1;
+            }
+
             if (bind(fd, (struct sockaddr *)&addr, addrlen) < 0) {
                 strncpy(srv->err, strerror(errno), sizeof(srv->err));
 
@@ -376,7 +701,183 @@ int dime_server_add(dime_server_t *srv, int protocol, ...) {
     return 0;
 }
 
+/*
+ * Handle the complete messages in a client's buffer, up to the budget of
+ * one wakeup. Returns 0 once the buffer holds no complete message or a
+ * sync waits for the outbuffer to drain, 1 if the budget ran out first,
+ * or -1 if a message was malformed
+ */
+static int server_dispatch(dime_server_t *srv, dime_client_t *clnt) {
+    unsigned int msgs = 0;
+    size_t bytes = 0;
+
+    while (1) {
+        /* Replies to later commands go out after a sync that is still being sent */
+        if (clnt->syncing) {
+            return 0;
+        }
+
+        if ((srv->budget_msgs > 0 && msgs >= srv->budget_msgs) ||
+            (srv->budget_bytes > 0 && bytes >= srv->budget_bytes)) {
+            return 1;
+        }
+
+        json_t *jsondata;
+        void *bindata;
+        size_t bindata_len;
+
+        ssize_t n = dime_socket_pop(&clnt->sock, &jsondata, &bindata, &bindata_len);
+
+        if (n < 0) {
+            return -1;
+        } else if (n == 0) {
+            return 0;
+        }
+
+        const char *cmd;
+
+        msgs++;
+        bytes += n;
+
+        clnt->msgs_in++;
+        srv->msgs_in++;
+
+        DIME_PROBE3(frame, clnt->fd, n, bindata_len);
+
+        if (json_unpack(jsondata, "{ss}", "command", &cmd) < 0) {
+            /* Just let this case propagate, it'll be caught below */
+            cmd = "";
+        }
+
+        DIME_PROBE2(command, clnt->fd, cmd);
+
+        if (srv->verbosity >= 3) {
+            dime_info("Got DiME message with command \"%s\" from %s", cmd, clnt->addr);
+        }
+
+        int err;
+
+        /*
+         * As more commands are added, this section of code
+         * might be more efficient as a table of function
+         * pointers
+         */
+        if (strcmp(cmd, "handshake") == 0) {
+            err = dime_client_handshake(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "join") == 0) {
+            err = dime_client_join(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "leave") == 0) {
+            err = dime_client_leave(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "send") == 0) {
+            err = dime_client_send(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "broadcast") == 0) {
+            err = dime_client_broadcast(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "sync") == 0) {
+            err = dime_client_sync(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "wait") == 0) {
+            err = dime_client_wait(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "devices") == 0) {
+            err = dime_client_devices(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "stats") == 0) {
+            err = dime_client_stats(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "latency") == 0) {
+            err = dime_latency_query(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "peer") == 0) {
+            err = dime_peer_hello(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (strcmp(cmd, "groups") == 0) {
+            err = dime_peer_groups(clnt, srv, jsondata, &bindata, bindata_len);
+        } else if (clnt->peer && cmd[0] == '\0') {
+            err = dime_peer_reply(clnt, srv, jsondata, &bindata, bindata_len);
+        } else {
+            err = -1;
+
+            strncpy(srv->err, "Unknown command", sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            json_t *response = json_pack("{siss}", "status", -1, "error", "Unknown command");
+            if (response != NULL) {
+                dime_socket_push(&clnt->sock, response, NULL, 0);
+                json_decref(response);
+            }
+        }
+
+        DIME_PROBE3(command_done, clnt->fd, cmd, err);
+
+        if (err < 0 && srv->verbosity >= 1) {
+            dime_warn("Failed to handle command \"%s\" from %s: %s", cmd, clnt->addr, srv->err);
+        }
+
+        /* A link that could not be set up is closed (and dialed again if it was dialed) */
+        int unlinked = err < 0 && (strcmp(cmd, "peer") == 0 || (clnt->peer && clnt->node == NULL));
+
+        json_decref(jsondata);
+        free(bindata);
+
+        if (unlinked) {
+            strncpy(clnt->sock.err, srv->err, sizeof(clnt->sock.err));
+            clnt->sock.err[sizeof(clnt->sock.err) - 1] = '\0';
+
+            return -1;
+        }
+    }
+}
+
+/*
+ * Send more of a sync that waits for the outbuffer to drain. Returns 0
+ * once it is done, so the commands held back by it can be handled
+ */
+static int server_sync_resume(dime_server_t *srv, dime_client_t *clnt) {
+    int ret = dime_client_sync_resume(clnt, srv);
+
+    if (ret < 0 && srv->verbosity >= 1) {
+        dime_warn("Failed to handle command \"sync\" from %s: %s", clnt->addr, srv->err);
+    }
+
+    return (ret > 0) ? 1 : 0;
+}
+
 #ifdef DIME_USE_LIBEV
+/* Handle the messages in a client's buffer. Returns -1 if the client was closed */
+static int ev_client_dispatch(struct ev_loop *loop, dime_client_t *clnt) {
+    dime_server_t *srv = clnt->srv;
+    int ret = server_dispatch(srv, clnt);
+
+    if (ret < 0) {
+        /* A malformed message only costs its sender the connection */
+        if (srv->verbosity >= 1) {
+            dime_err("Invalid message from %s (%s), closing", clnt->addr, clnt->sock.err);
+        }
+
+        ev_io_stop(loop, &clnt->sock.rwatcher);
+        ev_io_stop(loop, &clnt->sock.wwatcher);
+
+        dime_server_detach(srv, clnt);
+
+        dime_client_destroy(clnt);
+        free(clnt);
+
+        return -1;
+    }
+
+    if (ret > 0) {
+        /* Stop reading until the rest is handled, so the sender backs off */
+        ev_io_stop(loop, &clnt->sock.rwatcher);
+        server_ready_add(srv, clnt);
+
+        if (!ev_is_active(&srv->ready_prepare)) {
+            ev_prepare_start(loop, &srv->ready_prepare);
+            ev_idle_start(loop, &srv->ready_idle);
+        }
+    } else if (clnt->syncing) {
+        /* Stop reading until the sync is sent, as the sender waits for it */
+        ev_io_stop(loop, &clnt->sock.rwatcher);
+    } else {
+        ev_io_start(loop, &clnt->sock.rwatcher);
+    }
+
+    return 0;
+}
+
 static void ev_client_writable(struct ev_loop *loop, ev_io *watcher, int revents) {
     dime_client_t *clnt = watcher->data;
     dime_server_t *srv = clnt->srv;
@@ -389,7 +890,7 @@ static void ev_client_writable(struct ev_loop *loop, ev_io *watcher, int revents
         ev_io_stop(loop, watcher);
         ev_io_stop(loop, &clnt->sock.rwatcher);
 
-        dime_table_remove(&srv->fd2clnt, &clnt->fd);
+        dime_server_detach(srv, clnt);
 
         dime_client_destroy(clnt);
         free(clnt);
@@ -408,7 +909,7 @@ static void ev_client_writable(struct ev_loop *loop, ev_io *watcher, int revents
         ev_io_stop(loop, watcher);
         ev_io_stop(loop, &clnt->sock.rwatcher);
 
-        dime_table_remove(&srv->fd2clnt, &clnt->fd);
+        dime_server_detach(srv, clnt);
 
         dime_client_destroy(clnt);
         free(clnt);
@@ -416,11 +917,26 @@ static void ev_client_writable(struct ev_loop *loop, ev_io *watcher, int revents
         return;
     }
 
+    clnt->bytes_out += n;
+    srv->bytes_out += n;
+
+    DIME_PROBE3(write, clnt->fd, n, dime_socket_sendlen(&clnt->sock));
+
+    if (clnt->traces_len > 0) {
+        dime_latency_written(clnt);
+    }
+
     if (srv->verbosity >= 3) {
         dime_info("Sent %zd bytes of data to %s", n, clnt->addr);
     }
 
-    if (dime_socket_sendlen(&clnt->sock) == 0) {
+    dime_client_outbuf(clnt, srv);
+
+    if (clnt->syncing && server_sync_resume(srv, clnt) == 0 && ev_client_dispatch(loop, clnt) < 0) {
+        return;
+    }
+
+    if (!dime_socket_wantwrite(&clnt->sock)) {
         ev_io_stop(loop, watcher);
     }
 }
@@ -437,7 +953,7 @@ static void ev_client_readable(struct ev_loop *loop, ev_io *watcher, int revents
         ev_io_stop(loop, watcher);
         ev_io_stop(loop, &clnt->sock.wwatcher);
 
-        dime_table_remove(&srv->fd2clnt, &clnt->fd);
+        dime_server_detach(srv, clnt);
 
         dime_client_destroy(clnt);
         free(clnt);
@@ -447,19 +963,28 @@ static void ev_client_readable(struct ev_loop *loop, ev_io *watcher, int revents
 
     ssize_t n = dime_socket_recvpartial(&clnt->sock);
 
-    if (n <= 0) {
-        if (srv->verbosity >= 1) {
+    /* Nothing to read yet, e.g. during a TLS handshake */
+    if (n < 0 && errno == EAGAIN) {
+        if (dime_socket_wantwrite(&clnt->sock) && !ev_is_active(&clnt->sock.wwatcher)) {
+            ev_io_start(loop, &clnt->sock.wwatcher);
+        }
+
+        return;
+    }
+
+    if (n <= 0) {
+        if (srv->verbosity >= 1) {
             if (n == 0) {
                 dime_info("Connection closed from %s", clnt->addr);
             } else {
-                dime_err("Read failed on %s (%s), closing", clnt->addr, strerror(errno));
+                dime_err("Read failed on %s (%s), closing", clnt->addr, clnt->sock.err);
             }
         }
 
         ev_io_stop(loop, watcher);
         ev_io_stop(loop, &clnt->sock.wwatcher);
 
-        dime_table_remove(&srv->fd2clnt, &clnt->fd);
+        dime_server_detach(srv, clnt);
 
         dime_client_destroy(clnt);
         free(clnt);
@@ -467,84 +992,221 @@ static void ev_client_readable(struct ev_loop *loop, ev_io *watcher, int revents
         return;
     }
 
+    clnt->bytes_in += n;
+    srv->bytes_in += n;
+
     if (srv->verbosity >= 3) {
         dime_info("Received %zd bytes of data from %s", n, clnt->addr);
     }
 
-    while (1) {
-        json_t *jsondata;
-        void *bindata;
-        size_t bindata_len;
+    ev_client_dispatch(loop, clnt);
+}
 
-        n = dime_socket_pop(&clnt->sock, &jsondata, &bindata, &bindata_len);
+static void ev_ready_idle(struct ev_loop *loop, ev_idle *watcher, int revents) {
+    /* Only keeps the poll from blocking, so that ev_ready_prepare runs again right away */
+}
 
-        if (n > 0) {
-            const char *cmd;
+static void ev_ready_prepare(struct ev_loop *loop, ev_prepare *watcher, int revents) {
+    dime_server_t *srv = watcher->data;
 
-            if (json_unpack(jsondata, "{ss}", "command", &cmd) < 0) {
-                /* Just let this case propagate, it'll be caught below */
-                cmd = "";
-            }
+    /*
+     * Each client with messages left over gets one budget per wakeup.
+     * This runs before the poll, so that the clients that run out of
+     * budget while reading are only handled here on the next wakeup.
+     */
+    for (size_t i = 0; i < srv->ready_len; i++) {
+        dime_client_t *clnt = srv->ready[i];
 
-            if (srv->verbosity >= 3) {
-                dime_info("Got DiME message with command \"%s\" from %s", cmd, clnt->addr);
+        int ret = server_dispatch(srv, clnt);
+
+        if (ret < 0) {
+            if (srv->verbosity >= 1) {
+                dime_err("Invalid message from %s (%s), closing", clnt->addr, clnt->sock.err);
             }
 
-            int err;
+            ev_io_stop(loop, &clnt->sock.rwatcher);
+            ev_io_stop(loop, &clnt->sock.wwatcher);
 
-            /*
-             * As more commands are added, this section of code
-             * might be more efficient as a table of function
-             * pointers
-             */
-            if (strcmp(cmd, "handshake") == 0) {
-                err = dime_client_handshake(clnt, srv, jsondata, &bindata, bindata_len);
-            } else if (strcmp(cmd, "join") == 0) {
-                err = dime_client_join(clnt, srv, jsondata, &bindata, bindata_len);
-            } else if (strcmp(cmd, "leave") == 0) {
-                err = dime_client_leave(clnt, srv, jsondata, &bindata, bindata_len);
-            } else if (strcmp(cmd, "send") == 0) {
-                err = dime_client_send(clnt, srv, jsondata, &bindata, bindata_len);
-            } else if (strcmp(cmd, "broadcast") == 0) {
-                err = dime_client_broadcast(clnt, srv, jsondata, &bindata, bindata_len);
-            } else if (strcmp(cmd, "sync") == 0) {
-                err = dime_client_sync(clnt, srv, jsondata, &bindata, bindata_len);
-            } else if (strcmp(cmd, "wait") == 0) {
-                err = dime_client_wait(clnt, srv, jsondata, &bindata, bindata_len);
-            } else if (strcmp(cmd, "devices") == 0) {
-                err = dime_client_devices(clnt, srv, jsondata, &bindata, bindata_len);
-            } else {
-                err = -1;
+            /* Detaching moves the last ready client into this slot */
+            dime_server_detach(srv, clnt);
 
-                strncpy(srv->err, "Unknown command", sizeof(srv->err));
-                srv->err[sizeof(srv->err) - 1] = '\0';
+            dime_client_destroy(clnt);
+            free(clnt);
 
-                json_t *response = json_pack("{siss}", "status", -1, "error", "Unknown command");
-                if (response != NULL) {
-                    dime_socket_push(&clnt->sock, response, NULL, 0);
-                    json_decref(response);
-                }
-            }
+            i--;
+        } else if (ret == 0) {
+            server_ready_remove(srv, clnt);
 
-            if (err < 0 && srv->verbosity >= 1) {
-                dime_warn("Failed to handle command \"%s\" from %s: %s", cmd, clnt->addr, srv->err);
+            /* A sync waiting for the outbuffer to drain restarts reading once it is sent */
+            if (!clnt->syncing) {
+                ev_io_start(loop, &clnt->sock.rwatcher);
             }
 
-            json_decref(jsondata);
-            free(bindata);
-        } else if (n < 0) {
-            strncpy(srv->err, strerror(errno), sizeof(srv->err));
-
-            ev_unloop(loop, EVUNLOOP_ALL);
-        } else {
-            break;
+            i--;
         }
     }
+
+    if (srv->ready_len == 0) {
+        ev_prepare_stop(loop, watcher);
+        ev_idle_stop(loop, &srv->ready_idle);
+    }
+}
+
+static void ev_client_timeout(struct ev_loop *loop, ev_timer *watcher, int revents) {
+    dime_client_t *clnt = watcher->data;
+    dime_server_t *srv = clnt->srv;
+
+    if (dime_socket_timeleft(&clnt->sock) > 0) {
+        return;
+    }
+
+    if (srv->verbosity >= 1) {
+        dime_err("WebSocket handshake from %s timed out, closing", clnt->addr);
+    }
+
+    ev_io_stop(loop, &clnt->sock.rwatcher);
+    ev_io_stop(loop, &clnt->sock.wwatcher);
+
+    dime_server_detach(srv, clnt);
+
+    dime_client_destroy(clnt);
+    free(clnt);
+}
+
+static void ev_client_watch(struct ev_loop *loop, dime_client_t *clnt) {
+    ev_io_init(&clnt->sock.rwatcher, ev_client_readable, clnt->fd, EV_READ);
+    ev_io_init(&clnt->sock.wwatcher, ev_client_writable, clnt->fd, EV_WRITE);
+    ev_timer_init(&clnt->sock.twatcher, ev_client_timeout, 0., 0.);
+    clnt->sock.loop = loop;
+    clnt->sock.rwatcher.data = clnt;
+    clnt->sock.wwatcher.data = clnt;
+    clnt->sock.twatcher.data = clnt;
+
+    ev_io_start(loop, &clnt->sock.rwatcher);
+
+    /* Links to other servers introduce themselves right away */
+    if (dime_socket_wantwrite(&clnt->sock)) {
+        ev_io_start(loop, &clnt->sock.wwatcher);
+    }
+}
+
+static void ev_session_timeout(struct ev_loop *loop, ev_timer *watcher, int revents) {
+    /* Only wakes the loop, so that ev_session_prepare runs */
+}
+
+static void ev_session_prepare(struct ev_loop *loop, ev_prepare *watcher, int revents) {
+    dime_server_t *srv = watcher->data;
+    double timeleft = dime_session_expire(srv);
+
+    ev_timer_stop(loop, &srv->session_timer);
+
+    if (timeleft != HUGE_VAL) {
+        ev_timer_set(&srv->session_timer, timeleft, 0.);
+        ev_timer_start(loop, &srv->session_timer);
+    }
+}
+
+static void ev_ttl_timeout(struct ev_loop *loop, ev_timer *watcher, int revents) {
+    /* Only wakes the loop, so that ev_ttl_prepare runs */
+}
+
+static void ev_ttl_prepare(struct ev_loop *loop, ev_prepare *watcher, int revents) {
+    dime_server_t *srv = watcher->data;
+    double timeleft = dime_ttl_expire(srv);
+
+    ev_timer_stop(loop, &srv->ttl_timer);
+
+    if (timeleft != HUGE_VAL) {
+        ev_timer_set(&srv->ttl_timer, timeleft, 0.);
+        ev_timer_start(loop, &srv->ttl_timer);
+    }
+}
+
+static void ev_link_timeout(struct ev_loop *loop, ev_timer *watcher, int revents) {
+    /* Only wakes the loop, so that ev_link_prepare runs */
+}
+
+static void ev_link_prepare(struct ev_loop *loop, ev_prepare *watcher, int revents) {
+    dime_server_t *srv = watcher->data;
+    dime_client_t *clnt;
+    double timeleft;
+
+    while ((clnt = dime_peer_redial(srv, &timeleft)) != NULL) {
+        ev_client_watch(loop, clnt);
+    }
+
+    ev_timer_stop(loop, &srv->link_timer);
+
+    if (timeleft != HUGE_VAL) {
+        ev_timer_set(&srv->link_timer, timeleft, 0.);
+        ev_timer_start(loop, &srv->link_timer);
+    }
+}
+
+static void ev_scrape_ready(struct ev_loop *loop, ev_io *watcher, int revents) {
+    dime_scrape_t *scrape = watcher->data;
+    dime_server_t *srv = scrape->srv;
+
+    int events = dime_metrics_serve(srv, scrape);
+
+    if (events <= 0) {
+        ev_io_stop(loop, watcher);
+        ev_timer_stop(loop, &scrape->timer);
+
+        dime_metrics_close(srv, scrape);
+    } else if (events == DIME_FDENT_WRITE && !(watcher->events & EV_WRITE)) {
+        ev_io_stop(loop, watcher);
+        ev_io_set(watcher, scrape->fd, EV_WRITE);
+        ev_io_start(loop, watcher);
+    }
+}
+
+static void ev_scrape_timeout(struct ev_loop *loop, ev_timer *watcher, int revents) {
+    dime_scrape_t *scrape = watcher->data;
+    dime_server_t *srv = scrape->srv;
+
+    if (srv->verbosity >= 1) {
+        dime_warn("Metrics request on fd %d timed out, closing", scrape->fd);
+    }
+
+    ev_io_stop(loop, &scrape->watcher);
+
+    dime_metrics_close(srv, scrape);
+}
+
+static void ev_server_signal(struct ev_loop *loop, ev_signal *watcher, int revents) {
+    ev_break(loop, EVBREAK_ALL);
+}
+
+static void ev_metrics_prepare(struct ev_loop *loop, ev_prepare *watcher, int revents) {
+    /* The loop's time is updated when it wakes up */
+    dime_metrics_lag(watcher->data, ev_time() - ev_now(loop));
 }
 
 static void ev_server_readable(struct ev_loop *loop, ev_io *watcher, int revents) {
     dime_server_fd_t *srvfd = watcher->data;
     dime_server_t *srv = srvfd->srv;
+
+    if (srvfd->protocol == DIME_METRICS) {
+        dime_scrape_t *scrape = dime_metrics_accept(srv, watcher->fd);
+
+        if (scrape == NULL) {
+            dime_err("Failed to accept a metrics request from fd %d (%s)", watcher->fd, srv->err);
+            srv->err[0] = '\0';
+
+            return;
+        }
+
+        ev_io_init(&scrape->watcher, ev_scrape_ready, scrape->fd, EV_READ);
+        ev_timer_init(&scrape->timer, ev_scrape_timeout, DIME_METRICS_TIMEOUT, 0.);
+        scrape->watcher.data = scrape;
+        scrape->timer.data = scrape;
+        ev_io_start(loop, &scrape->watcher);
+        ev_timer_start(loop, &scrape->timer);
+
+        return;
+    }
+
     dime_client_t *clnt = malloc(sizeof(dime_client_t));
 
     if (clnt == NULL) {
@@ -567,6 +1229,8 @@ static void ev_server_readable(struct ev_loop *loop, ev_io *watcher, int revents
         return;
     }
 
+    srv->accepts++;
+
     /* Attempt to make sockets non-blocking for network connections */
 #ifdef __unix__
     if (srvfd->protocol != DIME_UNIX) {
@@ -589,8 +1253,17 @@ static void ev_server_readable(struct ev_loop *loop, ev_io *watcher, int revents
 
     clnt->srv = srv;
 
+    if (srvfd->protocol != DIME_UNIX &&
+        dime_socket_init_tcp(&clnt->sock, srv->nodelay, srv->quickack, srv->cork) < 0 &&
+        srv->verbosity >= 1) {
+        dime_warn("Failed to set TCP options for %s (%s)", clnt->addr, clnt->sock.err);
+    }
+
     if (srvfd->protocol == DIME_WS) {
-        if (dime_socket_init_ws(&clnt->sock) < 0) {
+        if (dime_socket_init_ws(&clnt->sock,
+                                (srv->compress_codecs & (1u << DIME_COMPRESS_ZLIB)) != 0,
+                                srv->compress_levels[DIME_COMPRESS_ZLIB],
+                                srv->compress_threshold) < 0) {
             dime_err("Failed to complete WebSocket handhake for incoming connection %s (%s)", clnt->addr, clnt->sock.err);
 
             dime_client_destroy(clnt);
@@ -600,22 +1273,23 @@ static void ev_server_readable(struct ev_loop *loop, ev_io *watcher, int revents
         }
     }
 
-    if (dime_table_insert(&srv->fd2clnt, &clnt->fd, clnt) < 0) {
-        strncpy(srv->err, strerror(errno), sizeof(srv->err));
-
+    if (dime_server_attach(srv, clnt) < 0) {
         dime_client_destroy(clnt);
         free(clnt);
 
         ev_unloop(loop, EVUNLOOP_ALL);
+
+        return;
     }
 
-    ev_io_init(&clnt->sock.rwatcher, ev_client_readable, clnt->fd, EV_READ);
-    ev_io_init(&clnt->sock.wwatcher, ev_client_writable, clnt->fd, EV_WRITE);
-    clnt->sock.loop = loop;
-    clnt->sock.rwatcher.data = clnt;
-    clnt->sock.wwatcher.data = clnt;
+    ev_client_watch(loop, clnt);
 
-    ev_io_start(loop, &clnt->sock.rwatcher);
+    if (srvfd->protocol == DIME_WS) {
+        ev_timer_set(&clnt->sock.twatcher, dime_socket_timeleft(&clnt->sock), 0.);
+        ev_timer_start(loop, &clnt->sock.twatcher);
+    }
+
+    DIME_PROBE2(accept, clnt->fd, clnt->addr);
 
     if (srv->verbosity >= 1) {
         dime_info("Opened new connection from %s", clnt->addr);
@@ -636,19 +1310,131 @@ int dime_server_loop(dime_server_t *srv) {
         ev_io_start(loop, &srv->fds[i].watcher);
         srv->fds[i].watcher.data = &srv->fds[i];
 
-        if (listen(srv->fds[i].fd, 0) < 0) {
-            strncpy(srv->err, strerror(errno), sizeof(srv->err));
-
+        if (dime_server_listen(srv, &srv->fds[i]) < 0) {
             printf("%d %s\n", __LINE__, strerror(errno)); return -1;
         }
     }
 
-    srv = srv;
+    ev_prepare_init(&srv->link_prepare, ev_link_prepare);
+    ev_timer_init(&srv->link_timer, ev_link_timeout, 0., 0.);
+    srv->link_prepare.data = srv;
+    ev_prepare_start(loop, &srv->link_prepare);
+
+    ev_prepare_init(&srv->session_prepare, ev_session_prepare);
+    ev_timer_init(&srv->session_timer, ev_session_timeout, 0., 0.);
+    srv->session_prepare.data = srv;
+    ev_prepare_start(loop, &srv->session_prepare);
+
+    ev_prepare_init(&srv->ttl_prepare, ev_ttl_prepare);
+    ev_timer_init(&srv->ttl_timer, ev_ttl_timeout, 0., 0.);
+    srv->ttl_prepare.data = srv;
+    ev_prepare_start(loop, &srv->ttl_prepare);
+
+    /* Started when a client has messages left over */
+    ev_prepare_init(&srv->ready_prepare, ev_ready_prepare);
+    ev_idle_init(&srv->ready_idle, ev_ready_idle);
+    srv->ready_prepare.data = srv;
+
+    if (srv->metrics) {
+        ev_prepare_init(&srv->metrics_prepare, ev_metrics_prepare);
+        srv->metrics_prepare.data = srv;
+        ev_prepare_start(loop, &srv->metrics_prepare);
+    }
+
+    static const int signals[] = {
+        SIGINT,
+        SIGTERM,
+#ifdef SIGHUP
+        SIGHUP
+#endif
+    };
+
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        ev_signal_init(&srv->signals[i], ev_server_signal, signals[i]);
+        ev_signal_start(loop, &srv->signals[i]);
+    }
+
     ev_loop(loop, 0);
 
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        ev_signal_stop(loop, &srv->signals[i]);
+    }
+
     return 0;
 }
 #else
+/* Written to by the signal handler, so that select wakes up and the loop returns */
+static int select_sigpipe[2] = {-1, -1};
+
+static void select_signal(int signal) {
+    int err = errno;
+    char c = 0;
+
+    /* If the pipe is full, the loop is woken up already */
+    ssize_t n = write(select_sigpipe[1], &c, 1);
+
+    (void)n;
+    errno = err;
+}
+
+/* Handle the messages in a client's buffer. Returns -1 if the client was closed */
+static int select_dispatch(dime_server_t *srv, dime_client_t *clnt, fd_set *rfds, fd_set *wfds) {
+    int ret = server_dispatch(srv, clnt);
+
+    if (ret < 0) {
+        /* A malformed message only costs its sender the connection */
+        if (srv->verbosity >= 1) {
+            dime_err("Invalid message from %s (%s), closing", clnt->addr, clnt->sock.err);
+        }
+
+        dime_server_detach(srv, clnt);
+
+        FD_CLR(clnt->fd, &rfds[0]);
+        FD_CLR(clnt->fd, &wfds[0]);
+
+        dime_client_destroy(clnt);
+        free(clnt);
+
+        return -1;
+    }
+
+    if (ret > 0 || clnt->syncing) {
+        /*
+         * Stop reading until the rest is handled, so the sender backs off,
+         * or until the sync is sent, as the sender waits for it
+         */
+        FD_CLR(clnt->fd, &rfds[0]);
+        srv->fdtab[clnt->fd].events &= ~DIME_FDENT_READ;
+
+        if (ret > 0) {
+            server_ready_add(srv, clnt);
+        }
+    } else if (!(srv->fdtab[clnt->fd].events & DIME_FDENT_READ)) {
+        FD_SET(clnt->fd, &rfds[0]);
+        srv->fdtab[clnt->fd].events |= DIME_FDENT_READ;
+    }
+
+    return 0;
+}
+
+/* Resume a metrics request, and watch its descriptor for what it waits on */
+static void select_scrape(dime_server_t *srv, dime_scrape_t *scrape, fd_set *rfds, fd_set *wfds) {
+    int fd = scrape->fd;
+    int events = dime_metrics_serve(srv, scrape);
+
+    if (events <= 0) {
+        FD_CLR(fd, &rfds[0]);
+        FD_CLR(fd, &wfds[0]);
+
+        dime_metrics_close(srv, scrape);
+    } else if (events == DIME_FDENT_WRITE && !(srv->fdtab[fd].events & DIME_FDENT_WRITE)) {
+        FD_CLR(fd, &rfds[0]);
+        FD_SET(fd, &wfds[0]);
+
+        srv->fdtab[fd].events = DIME_FDENT_WRITE;
+    }
+}
+
 int dime_server_loop(dime_server_t *srv) {
     int maxfd = -1;
     fd_set rfds[2], wfds[2];
@@ -659,7 +1445,7 @@ int dime_server_loop(dime_server_t *srv) {
     for (size_t i = 0; i < srv->fds_len; i++) {
         FD_SET(srv->fds[i].fd, &rfds[0]);
 
-        if (listen(srv->fds[i].fd, 0) < 0) {
+        if (dime_server_listen(srv, &srv->fds[i]) < 0) {
             printf("%d %s\n", __LINE__, strerror(errno)); return -1;
         }
 
@@ -668,31 +1454,129 @@ int dime_server_loop(dime_server_t *srv) {
         }
     }
 
+    if (pipe(select_sigpipe) < 0 || dime_server_fdtab_reserve(srv, select_sigpipe[0]) < 0) {
+        strncpy(srv->err, strerror(errno), sizeof(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        dime_err("Could not create a pipe for signals (%s)", srv->err);
+
+        return -1;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(select_sigpipe[i], F_GETFL, 0);
+
+        if (flags >= 0) {
+            fcntl(select_sigpipe[i], F_SETFL, flags | O_NONBLOCK);
+        }
+    }
+
+    FD_SET(select_sigpipe[0], &rfds[0]);
+
+    if (maxfd < select_sigpipe[0] + 1) {
+        maxfd = select_sigpipe[0] + 1;
+    }
+
+    signal(SIGINT, select_signal);
+    signal(SIGTERM, select_signal);
+#ifdef SIGHUP
+    signal(SIGHUP, select_signal);
+#endif
+
+    /* Time until the earliest WebSocket upgrade or session deadline, or 0 to dial the links first */
+    double timeout = (srv->links_len > 0) ? 0 : HUGE_VAL;
+
     while (1) {
         memcpy(&rfds[1], &rfds[0], sizeof(fd_set));
         memcpy(&wfds[1], &wfds[0], sizeof(fd_set));
 
-        if (select(maxfd, &rfds[1], &wfds[1], NULL, NULL) < 0) {
+        struct timeval tv, *ptv = NULL;
+
+        if (timeout != HUGE_VAL) {
+            tv.tv_sec = timeout;
+            tv.tv_usec = (timeout - tv.tv_sec) * 1e6;
+            ptv = &tv;
+        }
+
+        if (select(maxfd, &rfds[1], &wfds[1], NULL, ptv) < 0) {
+            /* The signal's byte in the pipe is seen on the next pass */
+            if (errno == EINTR) {
+                continue;
+            }
+
             printf("%d %s\n", __LINE__, strerror(errno)); return -1;
         }
 
+        if (FD_ISSET(select_sigpipe[0], &rfds[1])) {
+            break;
+        }
+
+        double woke = srv->metrics ? dime_socket_now() : 0;
+
+        /*
+         * Each client with messages left over gets one budget per wakeup.
+         * This runs before the descriptor scan, so that the clients that
+         * run out of budget while reading wait for the next wakeup.
+         */
+        for (size_t i = 0; i < srv->ready_len; i++) {
+            dime_client_t *clnt = srv->ready[i];
+
+            int ret = server_dispatch(srv, clnt);
+
+            if (ret < 0) {
+                if (srv->verbosity >= 1) {
+                    dime_err("Invalid message from %s (%s), closing", clnt->addr, clnt->sock.err);
+                }
+
+                /* Detaching moves the last ready client into this slot */
+                dime_server_detach(srv, clnt);
+
+                FD_CLR(clnt->fd, &rfds[0]);
+                FD_CLR(clnt->fd, &wfds[0]);
+                FD_CLR(clnt->fd, &wfds[1]);
+
+                dime_client_destroy(clnt);
+                free(clnt);
+
+                i--;
+            } else if (ret == 0) {
+                server_ready_remove(srv, clnt);
+
+                /* A sync waiting for the outbuffer to drain restarts reading once it is sent */
+                if (!clnt->syncing) {
+                    FD_SET(clnt->fd, &rfds[0]);
+                    srv->fdtab[clnt->fd].events |= DIME_FDENT_READ;
+                }
+
+                i--;
+            }
+        }
+
         for (int i = 3; i < maxfd; i++) {
             dime_client_t *clnt = NULL;
 
+            dime_fdent_t *ent = &srv->fdtab[i];
+
             if (FD_ISSET(i, &rfds[1])) {
-                clnt = dime_table_search(&srv->fd2clnt, &i);
+                if (ent->type == DIME_FDENT_LISTENER) {
+                    dime_server_fd_t *srvfd = ent->u.srvfd;
+
+                    if (srvfd->protocol == DIME_METRICS) {
+                        dime_scrape_t *scrape = dime_metrics_accept(srv, i);
 
-                if (clnt == NULL) {
-                    dime_server_fd_t *srvfd = NULL;
+                        if (scrape == NULL) {
+                            dime_err("Failed to accept a metrics request from fd %d (%s)", i, srv->err);
+                            srv->err[0] = '\0';
 
-                    for (size_t j = 0; j < srv->fds_len; j++) {
-                        if (srv->fds[j].fd == i) {
-                            srvfd = &srv->fds[j];
-                            break;
+                            continue;
+                        }
+
+                        FD_SET(scrape->fd, &rfds[0]);
+
+                        if (maxfd < scrape->fd + 1) {
+                            maxfd = scrape->fd + 1;
                         }
-                    }
 
-                    if (srvfd == NULL) {
                         continue;
                     }
 
@@ -719,6 +1603,8 @@ int dime_server_loop(dime_server_t *srv) {
                         continue;
                     }
 
+                    srv->accepts++;
+
                     /* Attempt to make sockets non-blocking for network connections */
     #ifdef __unix__
                     if (srvfd->protocol != DIME_UNIX) {
@@ -742,8 +1628,17 @@ int dime_server_loop(dime_server_t *srv) {
 
                     clnt->srv = srv;
 
+                    if (srvfd->protocol != DIME_UNIX &&
+                        dime_socket_init_tcp(&clnt->sock, srv->nodelay, srv->quickack, srv->cork) < 0 &&
+                        srv->verbosity >= 1) {
+                        dime_warn("Failed to set TCP options for %s (%s)", clnt->addr, clnt->sock.err);
+                    }
+
                     if (srvfd->protocol == DIME_WS) {
-                        if (dime_socket_init_ws(&clnt->sock) < 0) {
+                        if (dime_socket_init_ws(&clnt->sock,
+                                                (srv->compress_codecs & (1u << DIME_COMPRESS_ZLIB)) != 0,
+                                                srv->compress_levels[DIME_COMPRESS_ZLIB],
+                                                srv->compress_threshold) < 0) {
                             dime_err("Failed to complete WebSocket handhake for incoming connection %s (%s)", clnt->addr, clnt->sock.err);
 
                             dime_client_destroy(clnt);
@@ -753,11 +1648,11 @@ int dime_server_loop(dime_server_t *srv) {
                         }
                     }
 
-                    if (dime_table_insert(&srv->fd2clnt, &clnt->fd, clnt) < 0) {
-                        strncpy(srv->err, strerror(errno), sizeof(srv->err));
-
+                    if (dime_server_attach(srv, clnt) < 0) {
                         dime_client_destroy(clnt);
                         free(clnt);
+
+                        continue;
                     }
 
                     FD_SET(fd, &rfds[0]);
@@ -766,24 +1661,33 @@ int dime_server_loop(dime_server_t *srv) {
                         maxfd = fd + 1;
                     }
 
+                    DIME_PROBE2(accept, clnt->fd, clnt->addr);
+
                     if (srv->verbosity >= 1) {
                         dime_info("Opened new connection from %s", clnt->addr);
                     }
 
                     clnt = NULL;
-                } else {
+                } else if (ent->type == DIME_FDENT_SCRAPE) {
+                    select_scrape(srv, ent->u.scrape, rfds, wfds);
+                } else if (ent->type == DIME_FDENT_CLIENT) {
+                    clnt = ent->u.clnt;
+
                     ssize_t n = dime_socket_recvpartial(&clnt->sock);
 
-                    if (n <= 0) {
+                    /* Nothing to read yet, e.g. during a TLS handshake */
+                    if (n < 0 && errno == EAGAIN) {
+                        n = 0;
+                    } else if (n <= 0) {
                         if (srv->verbosity >= 1) {
                             if (n == 0) {
                                 dime_info("Connection closed from %s", clnt->addr);
                             } else {
-                                dime_err("Read failed on %s (%s), closing", clnt->addr, strerror(errno));
+                                dime_err("Read failed on %s (%s), closing", clnt->addr, clnt->sock.err);
                             }
                         }
 
-                        dime_table_remove(&srv->fd2clnt, &clnt->fd);
+                        dime_server_detach(srv, clnt);
 
                         FD_CLR(clnt->fd, &rfds[0]);
                         FD_CLR(clnt->fd, &wfds[0]);
@@ -794,91 +1698,31 @@ int dime_server_loop(dime_server_t *srv) {
                         continue;
                     }
 
-                    if (srv->verbosity >= 3) {
+                    clnt->bytes_in += n;
+                    srv->bytes_in += n;
+
+                    if (srv->verbosity >= 3 && n > 0) {
                         dime_info("Received %zd bytes of data from %s", n, clnt->addr);
                     }
 
-                    while (1) {
-                        json_t *jsondata;
-                        void *bindata;
-                        size_t bindata_len;
-
-                        n = dime_socket_pop(&clnt->sock, &jsondata, &bindata, &bindata_len);
-
-                        if (n > 0) {
-                            const char *cmd;
-
-                            if (json_unpack(jsondata, "{ss}", "command", &cmd) < 0) {
-                                /* Just let this case propagate, it'll be caught below */
-                                cmd = "";
-                            }
-
-                            if (srv->verbosity >= 3) {
-                                dime_info("Got DiME message with command \"%s\" from %s", cmd, clnt->addr);
-                            }
-
-                            int err;
-
-                            /*
-                             * As more commands are added, this section of code
-                             * might be more efficient as a table of function
-                             * pointers
-                             */
-                            if (strcmp(cmd, "handshake") == 0) {
-                                err = dime_client_handshake(clnt, srv, jsondata, &bindata, bindata_len);
-                            } else if (strcmp(cmd, "join") == 0) {
-                                err = dime_client_join(clnt, srv, jsondata, &bindata, bindata_len);
-                            } else if (strcmp(cmd, "leave") == 0) {
-                                err = dime_client_leave(clnt, srv, jsondata, &bindata, bindata_len);
-                            } else if (strcmp(cmd, "send") == 0) {
-                                err = dime_client_send(clnt, srv, jsondata, &bindata, bindata_len);
-                            } else if (strcmp(cmd, "broadcast") == 0) {
-                                err = dime_client_broadcast(clnt, srv, jsondata, &bindata, bindata_len);
-                            } else if (strcmp(cmd, "sync") == 0) {
-                                err = dime_client_sync(clnt, srv, jsondata, &bindata, bindata_len);
-                            } else if (strcmp(cmd, "wait") == 0) {
-                                err = dime_client_wait(clnt, srv, jsondata, &bindata, bindata_len);
-                            } else if (strcmp(cmd, "devices") == 0) {
-                                err = dime_client_devices(clnt, srv, jsondata, &bindata, bindata_len);
-                            } else {
-                                err = -1;
-
-                                strncpy(srv->err, "Unknown command", sizeof(srv->err));
-                                srv->err[sizeof(srv->err) - 1] = '\0';
-
-                                json_t *response = json_pack("{siss}", "status", -1, "error", "Unknown command");
-                                if (response != NULL) {
-                                    dime_socket_push(&clnt->sock, response, NULL, 0);
-                                    json_decref(response);
-                                }
-                            }
-
-                            if (err < 0 && srv->verbosity >= 1) {
-                                dime_warn("Failed to handle command \"%s\" from %s: %s", cmd, clnt->addr, srv->err);
-                            }
-
-                            json_decref(jsondata);
-                            free(bindata);
-                        } else if (n < 0) {
-                            strncpy(srv->err, strerror(errno), sizeof(srv->err));
-
-                            printf("%d %s\n", __LINE__, strerror(errno)); return -1;
-                        } else {
-                            break;
-                        }
-                    }
+                    select_dispatch(srv, clnt, rfds, wfds);
                 }
             }
 
             if (FD_ISSET(i, &wfds[1])) {
-                if (clnt == NULL) {
-                    clnt = dime_table_search(&srv->fd2clnt, &i);
+                /* Accepting a client may have grown the table */
+                ent = &srv->fdtab[i];
 
-                    if (clnt == NULL) {
-                        continue;
-                    }
+                if (ent->type == DIME_FDENT_SCRAPE) {
+                    select_scrape(srv, ent->u.scrape, rfds, wfds);
                 }
 
+                if (ent->type != DIME_FDENT_CLIENT) {
+                    continue;
+                }
+
+                clnt = ent->u.clnt;
+
                 ssize_t n = dime_socket_sendpartial(&clnt->sock);
 
                 /* Note: The server should close the socket here, not crash */
@@ -887,7 +1731,7 @@ int dime_server_loop(dime_server_t *srv) {
                         dime_err("Write failed on %s (%s), closing", clnt->addr, strerror(errno));
                     }
 
-                    dime_table_remove(&srv->fd2clnt, &clnt->fd);
+                    dime_server_detach(srv, clnt);
 
                     FD_CLR(clnt->fd, &rfds[0]);
                     FD_CLR(clnt->fd, &wfds[0]);
@@ -898,26 +1742,134 @@ int dime_server_loop(dime_server_t *srv) {
                     continue;
                 }
 
+                clnt->bytes_out += n;
+                srv->bytes_out += n;
+
+                DIME_PROBE3(write, clnt->fd, n, dime_socket_sendlen(&clnt->sock));
+
+                if (clnt->traces_len > 0) {
+                    dime_latency_written(clnt);
+                }
+
                 if (srv->verbosity >= 3) {
                     dime_info("Sent %zd bytes of data to %s", n, clnt->addr);
                 }
+
+                dime_client_outbuf(clnt, srv);
+
+                if (clnt->syncing && server_sync_resume(srv, clnt) == 0) {
+                    select_dispatch(srv, clnt, rfds, wfds);
+                }
             }
         }
 
-        for (int i = 3; i < maxfd; i++) {
-            if (FD_ISSET(i, &rfds[0])) {
-                dime_client_t *clnt = dime_table_search(&srv->fd2clnt, &i);
+        /* Poll without blocking while messages are left over */
+        timeout = (srv->ready_len > 0) ? 0 : HUGE_VAL;
 
-                if (clnt != NULL) {
-                    if (dime_socket_sendlen(&clnt->sock) > 0) {
-                        FD_SET(i, &wfds[0]);
-                    } else {
-                        FD_CLR(i, &wfds[0]);
-                    }
+        /* Links that are due are dialed, and introduce themselves right away */
+        dime_client_t *link;
+        double linkleft;
+
+        while ((link = dime_peer_redial(srv, &linkleft)) != NULL) {
+            FD_SET(link->fd, &rfds[0]);
+
+            if (maxfd < link->fd + 1) {
+                maxfd = link->fd + 1;
+            }
+        }
+
+        if (linkleft < timeout) {
+            timeout = linkleft;
+        }
+
+        for (size_t i = 0; i < srv->clnts_len; i++) {
+            dime_client_t *clnt = srv->clnts[i];
+            dime_fdent_t *ent = &srv->fdtab[clnt->fd];
+
+            double timeleft = dime_socket_timeleft(&clnt->sock);
+
+            if (timeleft <= 0) {
+                if (srv->verbosity >= 1) {
+                    dime_err("WebSocket handshake from %s timed out, closing", clnt->addr);
                 }
+
+                /* Detaching moves the last client into this slot */
+                dime_server_detach(srv, clnt);
+
+                FD_CLR(clnt->fd, &rfds[0]);
+                FD_CLR(clnt->fd, &wfds[0]);
+
+                dime_client_destroy(clnt);
+                free(clnt);
+
+                i--;
+
+                continue;
+            } else if (timeleft < timeout) {
+                timeout = timeleft;
+            }
+
+            if (dime_socket_wantwrite(&clnt->sock)) {
+                if (!(ent->events & DIME_FDENT_WRITE)) {
+                    FD_SET(clnt->fd, &wfds[0]);
+                    ent->events |= DIME_FDENT_WRITE;
+                }
+            } else if (ent->events & DIME_FDENT_WRITE) {
+                FD_CLR(clnt->fd, &wfds[0]);
+                ent->events &= ~DIME_FDENT_WRITE;
             }
         }
+
+        double now = dime_socket_now();
+
+        for (size_t i = 0; i < srv->scrapes_len; i++) {
+            dime_scrape_t *scrape = srv->scrapes[i];
+            double timeleft = scrape->deadline - now;
+
+            if (timeleft <= 0) {
+                if (srv->verbosity >= 1) {
+                    dime_warn("Metrics request on fd %d timed out, closing", scrape->fd);
+                }
+
+                FD_CLR(scrape->fd, &rfds[0]);
+                FD_CLR(scrape->fd, &wfds[0]);
+
+                /* Closing moves the last request into this slot */
+                dime_metrics_close(srv, scrape);
+
+                i--;
+            } else if (timeleft < timeout) {
+                timeout = timeleft;
+            }
+        }
+
+        double timeleft = dime_session_expire(srv);
+
+        if (timeleft < timeout) {
+            timeout = timeleft;
+        }
+
+        timeleft = dime_ttl_expire(srv);
+
+        if (timeleft < timeout) {
+            timeout = timeleft;
+        }
+
+        if (srv->metrics) {
+            dime_metrics_lag(srv, dime_socket_now() - woke);
+        }
     }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+#ifdef SIGHUP
+    signal(SIGHUP, SIG_DFL);
+#endif
+
+    close(select_sigpipe[0]);
+    close(select_sigpipe[1]);
+
+    return 0;
 }
 #if 0
 
@@ -932,7 +1884,7 @@ int dime_server_loop(dime_server_t *srv) {
         }
 
         for (size_t i = srv->fds_len; i < pollfds_len; i++) {
-            dime_client_t *clnt = dime_table_search(&srv->fd2clnt, &pollfds[i].fd);
+            dime_client_t *clnt = srv->fdtab[pollfds[i].fd].u.clnt;
             assert(clnt != NULL);
 
             if (pollfds[i].revents & POLLHUP) {
@@ -940,7 +1892,7 @@ int dime_server_loop(dime_server_t *srv) {
                     dime_info("Closed connection from %s", clnt->addr);
                 }
 
-                dime_table_remove(&srv->fd2clnt, &clnt->fd);
+                dime_server_detach(srv, clnt);
 
                 dime_client_destroy(clnt);
                 free(clnt);
@@ -960,11 +1912,11 @@ int dime_server_loop(dime_server_t *srv) {
                         if (n == 0) {
                             dime_info("Connection closed from %s", clnt->addr);
                         } else {
-                            dime_err("Read failed on %s (%s), closing", clnt->addr, strerror(errno));
+                            dime_err("Read failed on %s (%s), closing", clnt->addr, clnt->sock.err);
                         }
                     }
 
-                    dime_table_remove(&srv->fd2clnt, &clnt->fd);
+                    dime_server_detach(srv, clnt);
 
                     dime_client_destroy(clnt);
                     free(clnt);
@@ -1063,7 +2015,7 @@ int dime_server_loop(dime_server_t *srv) {
                         dime_err("Write failed on %s (%s), closing", clnt->addr, strerror(errno));
                     }
 
-                    dime_table_remove(&srv->fd2clnt, &clnt->fd);
+                    dime_server_detach(srv, clnt);
 
                     dime_client_destroy(clnt);
                     free(clnt);
@@ -1083,7 +2035,7 @@ int dime_server_loop(dime_server_t *srv) {
 
         /* Iterate in reverse order for better cache locality */
         for (size_t i = pollfds_len - 1; i >= srv->fds_len; i--) {
-            dime_client_t *clnt = dime_table_search(&srv->fd2clnt, &pollfds[i].fd);
+            dime_client_t *clnt = srv->fdtab[pollfds[i].fd].u.clnt;
             assert(clnt != NULL);
 
             if (dime_socket_sendlen(&clnt->sock) > 0) {
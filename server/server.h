@@ -33,11 +33,19 @@
 
 #include <stdint.h>
 
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <netinet/in.h>
+#endif
+
 #ifdef DIME_USE_LIBEV
 #   include <ev.h>
 #endif
 #include <openssl/ssl.h>
 
+#include "compress.h"
+#include "spill.h"
 #include "table.h"
 
 #ifndef __DIME_server_H
@@ -67,9 +75,105 @@ typedef struct {
 enum dime_protocol {
     DIME_UNIX,
     DIME_TCP,
-    DIME_WS
+    DIME_WS,
+    DIME_METRICS
+};
+
+enum dime_udp_mode {
+    DIME_UDP_NONE,
+    DIME_UDP_MULTICAST,
+    DIME_UDP_FANOUT
 };
 
+struct __dime_client;
+struct __dime_scrape;
+struct __dime_latency;
+
+enum dime_fdent_type {
+    DIME_FDENT_UNUSED,
+    DIME_FDENT_LISTENER,
+    DIME_FDENT_CLIENT,
+    DIME_FDENT_SCRAPE
+};
+
+enum dime_fdent_events {
+    DIME_FDENT_READ = 1,
+    DIME_FDENT_WRITE = 2
+};
+
+/**
+ * @brief Per-file descriptor loop state
+ *
+ * File descriptors are small, dense integers, so the server keeps an
+ * array of these indexed directly by file descriptor rather than a
+ * hash table. Besides the owning listener or client, each entry holds
+ * the event loop's interest flags for the descriptor and the worker
+ * thread that services it.
+ */
+typedef struct {
+    int type;            /** One of @c dime_fdent_type */
+    unsigned int events; /** Interest flags, from @c dime_fdent_events */
+    unsigned int thread; /** Index of the owning worker thread */
+
+    union {
+        dime_server_fd_t *srvfd;      /** Listener (if DIME_FDENT_LISTENER) */
+        struct __dime_client *clnt;   /** Client (if DIME_FDENT_CLIENT) */
+        struct __dime_scrape *scrape; /** Metrics request (if DIME_FDENT_SCRAPE) */
+    } u;
+} dime_fdent_t;
+
+/** Number of buckets in the histogram of event loop lag */
+#define DIME_LAG_BUCKETS 6
+
+/** Number of buckets in the histogram of queue depths, but for the last */
+#define DIME_QUEUE_BUCKETS 6
+
+/** Most metrics requests served at once */
+#define DIME_METRICS_CONNS 16
+
+/** Default number of messages handled from one client per wakeup */
+#define DIME_BUDGET_MSGS 64
+
+/** Default number of bytes of messages handled from one client per wakeup */
+#define DIME_BUDGET_BYTES 1048576
+
+/** Number of slots in the timer wheel of expiring messages (see ttl.h) */
+#define DIME_TTL_SLOTS 256
+
+/** Seconds between two slots of the timer wheel */
+#define DIME_TTL_TICK 0.1
+
+/**
+ * @brief Slot of the timer wheel of expiring messages
+ *
+ * Holds the clients whose queues are to be checked when the wheel
+ * reaches the slot, on this turn or a later one.
+ */
+typedef struct {
+    struct __dime_client **clnts; /** Array of clients */
+    size_t len;                   /** Length of client array */
+    size_t cap;                   /** Capacity of client array */
+} dime_ttl_slot_t;
+
+/** Seconds before a link that went down is first dialed again */
+#define DIME_LINK_BACKOFF_MIN 0.5
+
+/** Most seconds between two attempts to dial a link */
+#define DIME_LINK_BACKOFF_MAX 30
+
+/**
+ * @brief Link to another server given with @c -P
+ *
+ * The link is dialed again whenever it goes down, waiting twice as
+ * long after each failed attempt (see peer.h).
+ */
+typedef struct {
+    const char *addr;           /** Address of the other server */
+    struct __dime_client *clnt; /** Connection dialed to it, or NULL while it is down */
+    double retry;               /** When to dial it again while it is down */
+    double backoff;             /** Seconds to wait after the next failure, or 0 */
+} dime_link_t;
+
 /**
  * @brief Client's state
  *
@@ -78,12 +182,20 @@ enum dime_protocol {
 typedef struct {
     char err[81]; /** Error string */
 
-    unsigned int daemon : 1; /** Daemon flag */
-    unsigned int tls : 1;    /** TLS flag */
-    unsigned int zlib : 1;   /** zlib flag */
-    unsigned int ws : 1;     /** WebSocket flag */
+    unsigned int daemon : 1;   /** Daemon flag */
+    unsigned int tls : 1;      /** TLS flag */
+    unsigned int ktls : 1;     /** Kernel TLS offload flag */
+    unsigned int ws : 1;       /** WebSocket flag */
+    unsigned int nodelay : 1;  /** Set TCP_NODELAY on connections */
+    unsigned int quickack : 1; /** Set TCP_QUICKACK on connections */
+    unsigned int cork : 1;     /** Cork connections while bursts are written */
+    unsigned int metrics : 1;  /** Serve metrics, and time each wakeup of the loop */
     char : 0;
 
+    int backlog; /** Backlog of pending connections on each listener */
+    int sndbuf;  /** SO_SNDBUF of TCP connections, or 0 for the default */
+    int rcvbuf;  /** SO_RCVBUF of TCP connections, or 0 for the default */
+
     dime_server_fd_t *fds;
     size_t fds_len;
     size_t fds_cap;
@@ -99,13 +211,114 @@ typedef struct {
 
     unsigned int verbosity; /** Verbosity level */
     unsigned int threads;   /** Number of worker threads */
+
+    unsigned int compress_codecs;           /** Bitmask of codecs clients may negotiate */
+    int compress_levels[DIME_COMPRESS_MAX]; /** Compression level of each codec */
+    size_t compress_threshold;              /** Size of the smallest message to compress */
+
+    int udp_mode;                 /** Datagram channel, from @c dime_udp_mode */
+    int udp_fd;                   /** Datagram socket (if udp_mode is set) */
+    struct sockaddr_in udp_group; /** Multicast group (if DIME_UDP_MULTICAST) */
+    struct in_addr udp_iface;     /** Interface of the multicast group */
+    uint32_t udp_seq;             /** Sequence number of the next multicast datagram */
+    uint32_t udp_ids;             /** Number of datagram source IDs handed out */
+    size_t udp_clnts;             /** Number of clients receiving datagrams */
+    size_t udp_max;               /** Size of the largest datagram */
+
     int protocol;           /** Protocol to use */
-    int serialization;      /** Serialization method */
 
     int fd;                 /** File descriptor */
-    dime_table_t fd2clnt;   /** File descriptor-to-client translation table */
     dime_table_t name2clnt; /** Name-to-client translation table */
     SSL_CTX *tlsctx;        /** OpenSSL context */
+
+    dime_fdent_t *fdtab; /** File descriptor-indexed loop state */
+    size_t fdtab_cap;    /** Capacity of fdtab */
+
+    struct __dime_client **clnts; /** Dense array of live clients */
+    size_t clnts_len;             /** Length of client array */
+    size_t clnts_cap;             /** Capacity of client array */
+
+    unsigned int budget_msgs;     /** Messages handled per client per wakeup, or 0 for no limit */
+    size_t budget_bytes;          /** Bytes of messages handled per client per wakeup, or 0 for no limit */
+    struct __dime_client **ready; /** Dense array of clients with messages left over */
+    size_t ready_len;             /** Length of ready client array */
+    size_t ready_cap;             /** Capacity of ready client array */
+#ifdef DIME_USE_LIBEV
+    ev_prepare ready_prepare;     /** Handles the left over messages before each poll */
+    ev_idle ready_idle;           /** Keeps the poll from blocking while messages are left over */
+    ev_signal signals[3];         /** Stop the loop on SIGINT, SIGTERM or SIGHUP */
+#endif
+
+    dime_link_t *links;      /** Other servers to link to */
+    size_t links_len;        /** Length of links */
+    const char *link_secret; /** Secret that links dialed by other servers present, or NULL */
+    char node[17];           /** Node ID, unique to this process */
+#ifdef DIME_USE_LIBEV
+    ev_prepare link_prepare; /** Dials the links that are due before each poll */
+    ev_timer link_timer;     /** Wakes the loop when a link is due */
+#endif
+
+    struct __dime_client **peers; /** Links in use, one per other server */
+    size_t peers_len;             /** Length of peer array */
+    size_t peers_cap;             /** Capacity of peer array */
+
+    double started;       /** Time at which the server started */
+    uint64_t accepts;     /** Connections accepted */
+    uint64_t msgs_total;  /** Messages relayed */
+    uint64_t msgs_undecodable; /** Copies of forwarded messages dropped as their recipient cannot decode them */
+    size_t msgs_live;     /** Messages in memory */
+    size_t msgs_bytes;    /** Size of the messages in memory, including spilled portions */
+    size_t outbuf_bytes;  /** Bytes in the outbuffers of all clients */
+    uint64_t bytes_in;    /** Bytes received on all connections */
+    uint64_t bytes_out;   /** Bytes sent on all connections */
+    uint64_t msgs_in;     /** Messages received on all connections */
+    uint64_t msgs_out;    /** Messages relayed to all clients */
+
+    uint64_t lag[DIME_LAG_BUCKETS]; /** Wakeups of the loop, by time spent handling them */
+    double lag_sum;                 /** Seconds spent handling wakeups */
+
+    size_t queue_depth[DIME_QUEUE_BUCKETS + 1]; /** Clients with messages queued, by bucket of their queue depth */
+    size_t queued_msgs;                         /** Messages queued for all clients, counting shared ones once per client */
+    size_t queued_bytes;                        /** Size of the queues of all clients */
+
+    struct __dime_scrape *scrapes[DIME_METRICS_CONNS]; /** Metrics requests being served */
+    size_t scrapes_len;                                /** Number of metrics requests being served */
+#ifdef DIME_USE_LIBEV
+    ev_prepare metrics_prepare;     /** Times each wakeup of the loop */
+#endif
+
+    unsigned int latency_sample;          /** Messages per traced message, or 0 to disable tracing */
+    dime_table_t latency;                 /** Group name-to-latency histograms (see latency.h) */
+    struct __dime_latency *latency_bcast; /** Latency histograms of broadcasts */
+
+    size_t mem_max;        /** Bytes of messages and outbuffers kept in memory before spilling more, or 0 for no limit */
+    const char *spill_dir; /** Directory to spill messages to, or NULL for $TMPDIR or /tmp */
+    dime_spill_t spill;    /** Binary portions of spilled messages (see spill.h) */
+
+    double ttl_default;     /** Seconds messages are kept queued if no TTL applies, or 0 for no limit */
+    const char **ttl_names; /** Groups with their own default TTL */
+    double *ttl_secs;       /** Default TTL of each of those groups */
+    size_t ttl_len;         /** Length of ttl_names */
+    dime_ttl_slot_t ttl_wheel[DIME_TTL_SLOTS]; /** Timer wheel of clients with messages that expire */
+    uint64_t ttl_tick;                         /** Next tick of the wheel to handle */
+    size_t ttl_clnts;                          /** Number of clients in the wheel */
+    uint64_t msgs_expired;                     /** Queued copies of messages dropped as expired */
+#ifdef DIME_USE_LIBEV
+    ev_prepare ttl_prepare; /** Expires messages before each poll */
+    ev_timer ttl_timer;     /** Wakes the loop when the wheel has clients due */
+#endif
+
+    double session_grace;        /** Seconds a session is held, or 0 to disable sessions */
+    size_t session_max;          /** Bytes queued for a held session before dropping messages */
+    size_t session_held_max;     /** Sessions held at once, beyond which closed sessions are not held */
+    dime_table_t sessions;       /** Session name-to-session translation table */
+    struct __dime_client **held; /** Dense array of held clients */
+    size_t held_len;             /** Length of held client array */
+    size_t held_cap;             /** Capacity of held client array */
+#ifdef DIME_USE_LIBEV
+    ev_prepare session_prepare;  /** Expires held sessions before each poll */
+    ev_timer session_timer;      /** Wakes the loop when a held session expires */
+#endif
 } dime_server_t;
 
 /**
@@ -133,10 +346,51 @@ void dime_server_destroy(dime_server_t *srv);
 
 int dime_server_add(dime_server_t *srv, int protocol, ...);
 
+/**
+ * @brief Grow the file descriptor table to hold a descriptor
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param fd File descriptor
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_server_fdtab_reserve(dime_server_t *srv, int fd);
+
+/**
+ * @brief Register a newly accepted client with the server
+ *
+ * Adds the client to the file descriptor table and to the dense array
+ * of live clients.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param clnt Pointer to an initialized client
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ *
+ * @see dime_server_detach
+ */
+int dime_server_attach(dime_server_t *srv, struct __dime_client *clnt);
+
+/**
+ * @brief Unregister a client from the server
+ *
+ * Removes the client from the file descriptor table and the dense array
+ * of live clients. Does not destroy the client itself.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param clnt Pointer to a previously attached client
+ *
+ * @see dime_server_attach
+ */
+void dime_server_detach(dime_server_t *srv, struct __dime_client *clnt);
+
 /**
  * @brief Run the event loop for the server
  *
- * This function does not return until either the process is sent a @c SIGINT or @c SIGTERM signal, or it encounters an irrecoverable error.
+ * This function does not return until either the process is sent a @c SIGINT, @c SIGTERM or @c SIGHUP signal, or it encounters an irrecoverable error.
+ * The signal handlers only wake the loop, which then returns, so that the caller shuts the server down outside of signal context.
  *
  * @param srv Pointer to a @link dime_server_t @endlink struct
  *
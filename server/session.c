@@ -0,0 +1,372 @@
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <sys/socket.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include "client.h"
+#include "deque.h"
+#include "log.h"
+#include "server.h"
+#include "session.h"
+#include "socket.h"
+#include "table.h"
+#include "ttl.h"
+
+/* Replace the client "from" with "to" in each of the groups of "to" */
+static void session_regroup(dime_client_t *to, dime_client_t *from) {
+    for (size_t i = 0; i < to->groups_len; i++) {
+        dime_group_t *group = to->groups[i];
+
+        for (size_t j = 0; j < group->clnts_len; j++) {
+            if (group->clnts[j] == from) {
+                group->clnts[j] = to;
+
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Swap the queues, group memberships and sessions of two clients. One
+ * of them must not be in any group.
+ */
+static void session_swap(dime_client_t *a, dime_client_t *b) {
+    dime_group_t **groups = a->groups;
+    size_t groups_len = a->groups_len;
+    size_t groups_cap = a->groups_cap;
+    dime_deque_t queue = a->queue;
+    size_t queue_bytes = a->queue_bytes;
+    size_t queue_urgent = a->queue_urgent;
+    dime_session_t *sess = a->session;
+
+    /* Each client's place in the timer wheel follows its queue */
+    double a_expires = a->expires;
+    double b_expires = b->expires;
+
+    dime_ttl_reset(a->srv, a, 0);
+    dime_ttl_reset(b->srv, b, 0);
+
+    a->groups = b->groups;
+    a->groups_len = b->groups_len;
+    a->groups_cap = b->groups_cap;
+    a->queue = b->queue;
+    a->queue_bytes = b->queue_bytes;
+    a->queue_urgent = b->queue_urgent;
+    a->session = b->session;
+
+    b->groups = groups;
+    b->groups_len = groups_len;
+    b->groups_cap = groups_cap;
+    b->queue = queue;
+    b->queue_bytes = queue_bytes;
+    b->queue_urgent = queue_urgent;
+    b->session = sess;
+
+    dime_ttl_reset(a->srv, a, b_expires);
+    dime_ttl_reset(b->srv, b, a_expires);
+
+    session_regroup(a, b);
+    session_regroup(b, a);
+
+    if (a->session != NULL) {
+        a->session->clnt = a;
+    }
+
+    if (b->session != NULL) {
+        b->session->clnt = b;
+    }
+}
+
+/* Allocate a client without a connection to take over a session */
+static dime_client_t *session_held_new(dime_client_t *clnt) {
+    dime_client_t *held = malloc(sizeof(dime_client_t));
+    if (held == NULL) {
+        return NULL;
+    }
+
+    memset(held, 0, sizeof(dime_client_t));
+
+    held->fd = -1;
+    held->serialization = clnt->serialization;
+    held->dimeb_format = clnt->dimeb_format;
+    held->srv = clnt->srv;
+
+    held->addr = strdup(clnt->addr);
+    if (held->addr == NULL) {
+        free(held);
+
+        return NULL;
+    }
+
+    held->groups_len = 0;
+    held->groups_cap = 4;
+
+    held->groups = malloc(sizeof(dime_group_t *) * held->groups_cap);
+    if (held->groups == NULL) {
+        free(held->addr);
+        free(held);
+
+        return NULL;
+    }
+
+    if (dime_deque_init(&held->queue) < 0) {
+        free(held->groups);
+        free(held->addr);
+        free(held);
+
+        return NULL;
+    }
+
+    return held;
+}
+
+/* Remove a held client from the server's dense array of held clients */
+static void session_unhold(dime_server_t *srv, dime_client_t *held) {
+    srv->held_len--;
+    srv->held[held->idx] = srv->held[srv->held_len];
+    srv->held[held->idx]->idx = held->idx;
+}
+
+static void session_close(dime_server_t *srv, dime_session_t *sess) {
+    dime_table_remove(&srv->sessions, sess->name);
+
+    if (sess->held) {
+        session_unhold(srv, sess->clnt);
+    }
+
+    sess->clnt->session = NULL;
+
+    free(sess->name);
+    free(sess);
+}
+
+int dime_session_open(dime_client_t *clnt, dime_server_t *srv, const char *name, const char *token, json_t *response) {
+    if (srv->session_grace <= 0) {
+        return json_object_set_new(response, "session", json_false());
+    }
+
+    if (clnt->session != NULL) {
+        strncpy(srv->err, "Client already has a session: ", sizeof(srv->err));
+        strncat(srv->err, clnt->session->name, sizeof(srv->err) - strlen(srv->err));
+        srv->err[sizeof(srv->err) - 1] = '\0';
+
+        return -1;
+    }
+
+    dime_session_t *sess = dime_table_search(&srv->sessions, name);
+    int resumed = 0;
+    size_t lost = 0;
+
+    if (sess != NULL) {
+        /* Tokens all have the same length, so only their contents need a constant-time compare */
+        if (token == NULL || strlen(token) != sizeof(sess->token) - 1 ||
+            CRYPTO_memcmp(token, sess->token, sizeof(sess->token) - 1) != 0) {
+            strncpy(srv->err, "Session is in use: ", sizeof(srv->err));
+            strncat(srv->err, name, sizeof(srv->err) - strlen(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+
+        dime_client_t *old = sess->clnt;
+
+        /* The old connection is presumed broken; its EOF destroys it */
+        if (old->fd >= 0) {
+            shutdown(old->fd, SHUT_RDWR);
+        }
+
+        /* Queued messages were prepared for the old serialization */
+        if (clnt->groups_len == 0 && dime_deque_len(&clnt->queue) == 0 &&
+            old->serialization == clnt->serialization && old->dimeb_format == clnt->dimeb_format) {
+            if (sess->held) {
+                session_unhold(srv, old);
+            }
+
+            session_swap(clnt, old);
+
+            resumed = 1;
+            lost = sess->lost;
+
+            sess->held = 0;
+            sess->lost = 0;
+
+            if (old->fd < 0) {
+                dime_client_destroy(old);
+                free(old);
+            }
+
+            if (srv->verbosity >= 1) {
+                dime_info("%s resumed session \"%s\" with %zu queued messages", clnt->addr, name, dime_deque_len(&clnt->queue));
+            }
+        } else if (sess->held) {
+            dime_client_destroy(old);
+            free(old);
+        } else {
+            session_close(srv, sess);
+        }
+    }
+
+    if (!resumed) {
+        sess = malloc(sizeof(dime_session_t));
+        if (sess == NULL) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+
+        unsigned char bytes[16];
+
+        if (RAND_bytes(bytes, sizeof(bytes)) != 1) {
+            free(sess);
+
+            strncpy(srv->err, "Could not generate session token", sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+            snprintf(sess->token + 2 * i, 3, "%02x", bytes[i]);
+        }
+
+        sess->name = strdup(name);
+        if (sess->name == NULL || dime_table_insert(&srv->sessions, sess->name, sess) < 0) {
+            free(sess->name);
+            free(sess);
+
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+
+        sess->clnt = clnt;
+        sess->held = 0;
+        sess->lost = 0;
+
+        clnt->session = sess;
+
+        if (srv->verbosity >= 2) {
+            dime_info("%s opened session \"%s\"", clnt->addr, name);
+        }
+    }
+
+    json_t *reply = json_pack("{sssb}", "token", sess->token, "resumed", resumed);
+    if (reply == NULL) {
+        return -1;
+    }
+
+    if (resumed) {
+        json_object_set_new(reply, "lost", json_integer(lost));
+    }
+
+    return json_object_set_new(response, "session", reply);
+}
+
+void dime_session_release(dime_server_t *srv, dime_client_t *clnt) {
+    dime_session_t *sess = clnt->session;
+
+    if (sess == NULL) {
+        return;
+    }
+
+    if (sess->held || clnt->peer || srv->session_grace <= 0) {
+        session_close(srv, sess);
+
+        return;
+    }
+
+    if (srv->held_len >= srv->session_held_max) {
+        if (srv->verbosity >= 1) {
+            dime_warn("Could not hold session \"%s\" of %s (%zu sessions are held already)", sess->name, clnt->addr, srv->held_len);
+        }
+
+        session_close(srv, sess);
+
+        return;
+    }
+
+    dime_client_t *held = session_held_new(clnt);
+
+    if (held != NULL && srv->held_len >= srv->held_cap) {
+        size_t ncap = (srv->held_cap * 3) / 2;
+
+        dime_client_t **nheld = realloc(srv->held, sizeof(dime_client_t *) * ncap);
+        if (nheld == NULL) {
+            dime_client_destroy(held);
+            free(held);
+
+            held = NULL;
+        } else {
+            srv->held = nheld;
+            srv->held_cap = ncap;
+        }
+    }
+
+    if (held == NULL) {
+        if (srv->verbosity >= 1) {
+            dime_warn("Could not hold session \"%s\" of %s (%s)", sess->name, clnt->addr, strerror(errno));
+        }
+
+        session_close(srv, sess);
+
+        return;
+    }
+
+    session_swap(held, clnt);
+
+    sess->held = 1;
+    sess->expires = dime_socket_now() + srv->session_grace;
+    sess->lost = 0;
+
+    held->idx = srv->held_len;
+    srv->held[srv->held_len++] = held;
+
+    if (srv->verbosity >= 1) {
+        dime_info("Holding session \"%s\" of %s for %g seconds", sess->name, clnt->addr, srv->session_grace);
+    }
+}
+
+double dime_session_expire(dime_server_t *srv) {
+    if (srv->held_len == 0) {
+        return HUGE_VAL;
+    }
+
+    double now = dime_socket_now();
+    double next = HUGE_VAL;
+
+    /* Destroying a held client moves the last one into its slot */
+    for (size_t i = srv->held_len; i-- > 0;) {
+        dime_client_t *held = srv->held[i];
+        dime_session_t *sess = held->session;
+
+        if (sess->expires > now) {
+            if (sess->expires < next) {
+                next = sess->expires;
+            }
+
+            continue;
+        }
+
+        if (srv->verbosity >= 1) {
+            dime_info("Session \"%s\" of %s expired", sess->name, held->addr);
+        }
+
+        dime_client_destroy(held);
+        free(held);
+    }
+
+    return (next == HUGE_VAL) ? next : next - now;
+}
@@ -0,0 +1,131 @@
+/*
+ * session.h - Resumable client sessions
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file session.h
+ * @brief Resumable client sessions
+ * @author Nicholas West
+ * @date 2020
+ *
+ * Clients that name a session in their handshake are given a resume
+ * token. When such a client's connection closes, its queue and group
+ * memberships are moved to a "held" client without a connection, which
+ * stays in its groups and keeps queueing messages for up to @c -s
+ * seconds. A client that presents the session's name and token within
+ * that time takes over the held queue and groups, as if it had never
+ * disconnected.
+ *
+ * While a session is held, the oldest messages in its queue are dropped
+ * once it grows past a number of bytes, so that an abandoned session
+ * cannot exhaust the server's memory. The number of dropped messages is
+ * reported to the client that resumes it. At most a set number of
+ * sessions are held at once; sessions whose connection closes beyond
+ * that are closed as well.
+ *
+ * A client may also resume a session whose previous connection is still
+ * open, e.g. when it reconnects before the server has noticed that the
+ * old connection broke. The old connection is then shut down.
+ */
+
+#include <stddef.h>
+
+#include <jansson.h>
+#include "client.h"
+#include "server.h"
+
+#ifndef __DIME_session_H
+#define __DIME_session_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default number of seconds a session is held after its connection closes */
+#define DIME_SESSION_GRACE 30
+
+/** Default number of bytes queued for a held session before dropping messages */
+#define DIME_SESSION_MAX (16 << 20)
+
+/** Default number of sessions held at once */
+#define DIME_SESSION_HELD_MAX 1024
+
+/**
+ * @brief Session state
+ *
+ * Owned by exactly one client at a time, either a live connection or a
+ * held client.
+ */
+typedef struct __dime_session dime_session_t;
+
+struct __dime_session {
+    char *name;     /** Session name */
+    char token[33]; /** Resume token, as a hex string */
+
+    dime_client_t *clnt; /** Client that owns the session */
+
+    int held;       /** Whether the session is held */
+    double expires; /** Time at which a held session is dropped */
+    size_t lost;    /** Messages dropped while held */
+};
+
+/**
+ * @brief Open or resume a session during a handshake
+ *
+ * Handles the @c session and @c token fields of a "handshake" command,
+ * and sets the @c session field of its response to false (if sessions
+ * are disabled) or to the session's token, whether it was resumed, and
+ * if so, how many messages were dropped while it was held.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param name Session name
+ * @param token Resume token, or NULL for a new session
+ * @param response Response to the handshake
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_session_open(dime_client_t *clnt, dime_server_t *srv, const char *name, const char *token, json_t *response);
+
+/**
+ * @brief Hold or close a client's session
+ *
+ * Called when a client is destroyed. If the session can be held, the
+ * client's queue and group memberships are moved to a new held client,
+ * so that destroying the original client leaves both untouched.
+ * Otherwise, the session is closed.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param clnt Pointer to a client, which need not have a session
+ */
+void dime_session_release(dime_server_t *srv, dime_client_t *clnt);
+
+/**
+ * @brief Drop held sessions whose grace period has passed
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ *
+ * @return Seconds until the next held session expires, or @c HUGE_VAL
+ * if no session is held
+ */
+double dime_session_expire(dime_server_t *srv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,20 +6,35 @@
 #   include <arpa/inet.h>
 #   include <fcntl.h>
 #   include <unistd.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
 #   include <sys/socket.h>
+#   include <sys/uio.h>
 #endif
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <ev.h>
 #include <jansson.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <zlib.h>
 
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+#include "compress.h"
 #include "ringbuffer.h"
 #include "socket.h"
 
@@ -35,28 +50,8 @@ typedef struct {
     uint32_t bindata_len;
 } dime_header_t;
 
-static const size_t SENDBUFLEN = 200000000;
-static const size_t RECVBUFLEN = 200000000;
-
-static int dime_socket_setnonblocking(dime_socket_t *sock, int nonblocking) {
-#ifdef _WIN32
-    unsigned long _nonblocking = nonblocking;
-    return ioctlsocket(sock->fd, FIONBIO, &_nonblocking);
-#else
-    int flags = fcntl(sock->fd, F_GETFL, 0);
-    if (flags < 0) {
-        return -1;
-    }
-
-    if (nonblocking) {
-        flags |= O_NONBLOCK;
-    } else {
-        flags &= ~O_NONBLOCK;
-    }
-
-    return fcntl(sock->fd, F_SETFL, flags);
-#endif
-}
+/* Free space kept in the inbuffer before each read */
+static const size_t RECVBUFLEN = 65536;
 
 int dime_socket_init(dime_socket_t *sock, int fd) {
     sock->fd = fd;
@@ -74,13 +69,43 @@ int dime_socket_init(dime_socket_t *sock, int fd) {
         return -1;
     }
 
+    if (dime_ringbuffer_init(&sock->ubuf) < 0) {
+        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+        dime_ringbuffer_destroy(&sock->wbuf);
+        dime_ringbuffer_destroy(&sock->rbuf);
+
+        return -1;
+    }
+
+    if (dime_ringbuffer_init(&sock->wlens) < 0) {
+        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+        dime_ringbuffer_destroy(&sock->ubuf);
+        dime_ringbuffer_destroy(&sock->wbuf);
+        dime_ringbuffer_destroy(&sock->rbuf);
+
+        return -1;
+    }
+
+    sock->wleft = 0;
+    sock->lane = DIME_LANE_BULK;
+    sock->ulast = 0;
+
 #ifdef DIME_USE_LIBEV
     sock->loop = NULL;
 #endif
 
     sock->tls.enabled = 0;
+    sock->tls.handshaking = 0;
+    sock->tls.want_write = 0;
+    sock->tls.retry = 0;
+    sock->tls.plain_len = 0;
+    sock->tls.ktls = 0;
     sock->ws.enabled = 0;
-    sock->zlib.enabled = 0;
+    sock->ws.upgrading = 0;
+    sock->tcp.quickack = 0;
+    sock->tcp.cork = 0;
+    sock->tcp.corked = 0;
+    sock->compress.codec = DIME_COMPRESS_NONE;
 
     return 0;
 }
@@ -88,75 +113,106 @@ int dime_socket_init(dime_socket_t *sock, int fd) {
 void dime_socket_destroy(dime_socket_t *sock) {
     dime_ringbuffer_destroy(&sock->rbuf);
     dime_ringbuffer_destroy(&sock->wbuf);
+    dime_ringbuffer_destroy(&sock->ubuf);
+    dime_ringbuffer_destroy(&sock->wlens);
 
     if (sock->tls.enabled) {
-        SSL_shutdown(sock->tls.ctx);
+        if (!sock->tls.handshaking) {
+            SSL_shutdown(sock->tls.ctx);
+        }
+
         SSL_free(sock->tls.ctx);
     }
 
-    if (sock->ws.enabled) {
+    if (sock->ws.enabled || sock->ws.upgrading) {
         dime_ringbuffer_destroy(&sock->ws.rbuf);
+
+        if (sock->ws.inflate_init) {
+            inflateEnd(&sock->ws.inflate);
+        }
     }
 
-    if (sock->zlib.enabled) {
-        dime_ringbuffer_destroy(&sock->zlib.rbuf);
-        deflateEnd(&sock->zlib.ctx);
+#ifdef DIME_USE_LIBEV
+    if (sock->loop != NULL) {
+        ev_timer_stop(sock->loop, &sock->twatcher);
     }
+#endif
 
     shutdown(sock->fd, SHUT_RDWR);
     close(sock->fd);
 }
 
-int dime_socket_init_ws(dime_socket_t *sock) {
-    if (dime_socket_setnonblocking(sock, 0) < 0) {
-        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+double dime_socket_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
+int dime_socket_init_ws(dime_socket_t *sock, int deflate, int level, size_t threshold) {
+    if (dime_ringbuffer_init(&sock->ws.rbuf) < 0) {
+        strncpy(sock->err, strerror(errno), sizeof(sock->err));
         return -1;
     }
 
-    char *http_hdr;
-    size_t http_len, http_cap;
+    /* Whether permessage-deflate may be accepted, until it is negotiated */
+    sock->ws.deflate = deflate;
+    sock->ws.level = level;
+    sock->ws.threshold = threshold;
 
-    http_len = 0;
-    http_cap = 500;
-    http_hdr = malloc(http_cap);
+    sock->ws.fragmented = 0;
+    sock->ws.compressed = 0;
+    sock->ws.closed = 0;
+    sock->ws.inflate_init = 0;
+    memset(&sock->ws.inflate, 0, sizeof(sock->ws.inflate));
+    sock->ws.inflated = 0;
+    sock->ws.msg_left = 0;
+    sock->ws.hdr_seen = 0;
 
-    if (http_hdr == NULL) {
-        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+    /* The upgrade request is parsed from the inbuffer as it arrives */
+    sock->ws.upgrading = 1;
+    sock->ws.deadline = dime_socket_now() + DIME_WS_TIMEOUT;
 
-        return -1;
-    }
+    return 0;
+}
 
-    do {
-        ssize_t nrecvd = recv(sock->fd, http_hdr + http_len, http_cap - http_len, 0);
+/* Returns 1 once the upgrade is complete, 0 if more data is needed, or -1 */
+static int dime_socket_upgrade(dime_socket_t *sock) {
+    size_t http_len = dime_ringbuffer_len(&sock->rbuf);
 
-        if (nrecvd < 0) {
-            strncpy(sock->err, strerror(errno), sizeof(sock->err));
+    if (http_len > DIME_WS_HDRMAX) {
+        http_len = DIME_WS_HDRMAX;
+    }
 
-            free(http_hdr);
+    char *http_hdr = malloc(http_len + 1);
 
-            return -1;
-        }
+    if (http_hdr == NULL) {
+        strncpy(sock->err, strerror(errno), sizeof(sock->err));
 
-        http_len += nrecvd;
+        return -1;
+    }
 
-        if (http_len >= http_cap) {
-            http_cap = (http_cap * 3) / 2;
-            char *nbuf = realloc(http_hdr, http_cap);
+    dime_ringbuffer_peek(&sock->rbuf, http_hdr, http_len);
+    http_hdr[http_len] = '\0';
 
-            if (nbuf == NULL) {
-                strncpy(sock->err, strerror(errno), sizeof(sock->err));
+    char *end = strstr(http_hdr, "\r\n\r\n");
 
-                free(http_hdr);
+    if (end == NULL) {
+        free(http_hdr);
 
-                return -1;
-            }
+        if (http_len >= DIME_WS_HDRMAX) {
+            strncpy(sock->err, "HTTP header too large", sizeof(sock->err));
 
-            http_hdr = nbuf;
+            return -1;
         }
 
-        http_hdr[http_len] = '\0';
-    } while (strstr(http_hdr, "\r\n\r\n") == NULL);
+        return 0;
+    }
+
+    /* Anything after the header is WebSocket data */
+    dime_ringbuffer_discard(&sock->rbuf, end + 4 - http_hdr);
+    end[2] = '\0';
 
     char *line, *saveptr;
 
@@ -165,7 +221,7 @@ int dime_socket_init_ws(dime_socket_t *sock) {
     char method[8];
     int major, minor;
 
-    if (sscanf(line, "%7s %*s HTTP/%d.%d", method, &major, &minor) != 3) {
+    if (line == NULL || sscanf(line, "%7s %*s HTTP/%d.%d", method, &major, &minor) != 3) {
         strncpy(sock->err, "Invalid HTTP response", sizeof(sock->err));
 
         free(http_hdr);
@@ -189,9 +245,9 @@ int dime_socket_init_ws(dime_socket_t *sock) {
         return -1;
     }
 
-    char *connection, *upgrade, *sec_ws_key, *sec_ws_version;
+    char *connection, *upgrade, *sec_ws_key, *sec_ws_version, *sec_ws_extensions;
 
-    connection = upgrade = sec_ws_key = sec_ws_version = NULL;
+    connection = upgrade = sec_ws_key = sec_ws_version = sec_ws_extensions = NULL;
 
     while ((line = strtok_r(NULL, "\r\n", &saveptr)) != NULL) {
         char *delimiter = strstr(line, ": ");
@@ -218,6 +274,8 @@ int dime_socket_init_ws(dime_socket_t *sock) {
             sec_ws_key = val;
         } else if (strcmp(key, "Sec-WebSocket-Version") == 0) {
             sec_ws_version = val;
+        } else if (strcmp(key, "Sec-WebSocket-Extensions") == 0) {
+            sec_ws_extensions = val;
         }
     }
 
@@ -256,64 +314,70 @@ int dime_socket_init_ws(dime_socket_t *sock) {
 
     EVP_EncodeBlock((unsigned char *)b64_sha1sum, sha1sum, 20);
 
+    /*
+     * Both directions compress each message from scratch, so no deflate
+     * state is kept between messages. Offers restricting our window are
+     * declined, as are extensions other than permessage-deflate.
+     */
+    sock->ws.deflate = sock->ws.deflate && sec_ws_extensions != NULL &&
+                       strstr(sec_ws_extensions, "permessage-deflate") != NULL &&
+                       strstr(sec_ws_extensions, "server_max_window_bits") == NULL;
+
     free(http_hdr);
 
-    char response[200];
+    char response[300];
 
     int response_len = snprintf(response, sizeof(response),
                                 "HTTP/%d.%d 101 Switching Protocols\r\n"
                                 "Connection: Upgrade\r\n"
                                 "Upgrade: websocket\r\n"
-                                "Sec-WebSocket-Accept: %s\r\n\r\n",
-                                major, minor, b64_sha1sum);
+                                "Sec-WebSocket-Accept: %s\r\n"
+                                "%s\r\n",
+                                major, minor, b64_sha1sum,
+                                sock->ws.deflate ? "Sec-WebSocket-Extensions: permessage-deflate; "
+                                                   "server_no_context_takeover; "
+                                                   "client_no_context_takeover\r\n" : "");
 
     assert(response_len >= 0 && response_len < sizeof(response));
 
-    if (send(sock->fd, response, response_len, 0) < 0) {
-        strncpy(sock->err, strerror(errno), sizeof(sock->err));
-
+    /* Queued before the socket is switched over, so it isn't framed */
+    if (dime_socket_push_frame(sock, response, response_len) < 0) {
         return -1;
     }
 
-    /* Reset the original socket flags */
-    if (dime_socket_setnonblocking(sock, 1) < 0) {
-        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+    while (dime_ringbuffer_len(&sock->rbuf) > 0) {
+        char buf[4096];
+        size_t n = dime_ringbuffer_read(&sock->rbuf, buf, sizeof(buf));
 
-        return 0;
+        if (dime_ringbuffer_write(&sock->ws.rbuf, buf, n) < 0) {
+            strncpy(sock->err, strerror(errno), sizeof(sock->err));
+            return -1;
+        }
     }
 
+    sock->ws.upgrading = 0;
     sock->ws.enabled = 1;
 
-    if (dime_ringbuffer_init(&sock->ws.rbuf) < 0) {
-        strncpy(sock->err, strerror(errno), sizeof(sock->err));
-        return -1;
-    }
-
-    return 0;
+    return 1;
 }
 
 int dime_socket_init_tls(dime_socket_t *sock, SSL_CTX *tlsctx) {
-    /* Ensure the underlying socket is blocking for the TLS handshake */
-    if (dime_socket_setnonblocking(sock, 0) < 0) {
-        strncpy(sock->err, strerror(errno), sizeof(sock->err));
-
-        return 0;
-    }
+    /* The peer should wait for our reply before starting the handshake */
+    if (dime_ringbuffer_len(&sock->rbuf) > 0) {
+        strncpy(sock->err, "Unexpected data before TLS handshake", sizeof(sock->err));
 
-    assert(dime_ringbuffer_len(&sock->rbuf) == 0);
-
-    while (dime_ringbuffer_len(&sock->wbuf) > 0) {
-        if (dime_socket_sendpartial(sock) < 0) {
-            return -1;
-        }
+        return -1;
     }
 
     sock->tls.ctx = SSL_new(tlsctx);
     if (sock->tls.ctx == NULL) {
+        ERR_error_string_n(ERR_get_error(), sock->err, sizeof(sock->err));
+
         return -1;
     }
 
-    SSL_set_mode(sock->tls.ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+    /* The outbuffer is copied out anew for each write, so retries may move */
+    SSL_set_mode(sock->tls.ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
     if (SSL_set_fd(sock->tls.ctx, sock->fd) <= 0) {
         ERR_error_string_n(ERR_get_error(), sock->err, sizeof(sock->err));
@@ -323,24 +387,68 @@ int dime_socket_init_tls(dime_socket_t *sock, SSL_CTX *tlsctx) {
         return -1;
     }
 
-    if (SSL_accept(sock->tls.ctx) <= 0) {
-        ERR_error_string_n(ERR_get_error(), sock->err, sizeof(sock->err));
+    SSL_set_accept_state(sock->tls.ctx);
 
-        SSL_free(sock->tls.ctx);
+    /* Anything already queued, e.g. the handshake reply, precedes TLS */
+    sock->tls.plain_len = dime_ringbuffer_len(&sock->wbuf);
+    sock->tls.want_write = 0;
+    sock->tls.retry = 0;
+    sock->tls.ktls = 0;
+    sock->tls.handshaking = 1;
+    sock->tls.enabled = 1;
 
-        return -1;
-    }
+    return 0;
+}
 
-    /* Reset the original socket flags */
-    if (dime_socket_setnonblocking(sock, 1) < 0) {
-        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+/*
+ * Classify a failed TLS operation: zero if it should be retried once the
+ * socket is readable (or writable, if want_write is set), negative if the
+ * connection has failed
+ */
+static int dime_socket_tls_error(dime_socket_t *sock, int ret) {
+    switch (SSL_get_error(sock->tls.ctx, ret)) {
+    case SSL_ERROR_WANT_WRITE:
+        sock->tls.want_write = 1;
+        return 0;
 
+    case SSL_ERROR_WANT_READ:
         return 0;
+
+    case SSL_ERROR_ZERO_RETURN:
+        strncpy(sock->err, "Connection closed", sizeof(sock->err));
+        return -1;
+
+    case SSL_ERROR_SYSCALL:
+        strncpy(sock->err, (errno != 0) ? strerror(errno) : "Connection closed", sizeof(sock->err));
+        return -1;
+
+    default:
+        ERR_error_string_n(ERR_get_error(), sock->err, sizeof(sock->err));
+        return -1;
     }
+}
 
-    sock->tls.enabled = 1;
+/* Returns 1 once the handshake is done, 0 if it would block, or -1 */
+static int dime_socket_handshake(dime_socket_t *sock) {
+    sock->tls.want_write = 0;
 
-    return 0;
+    ERR_clear_error();
+
+    int ret = SSL_do_handshake(sock->tls.ctx);
+
+    if (ret == 1) {
+        sock->tls.handshaking = 0;
+
+        /*
+         * OpenSSL has flushed everything it had to write by now, so with
+         * kTLS the outbuffer can go to the socket directly from here on
+         */
+        sock->tls.ktls = BIO_get_ktls_send(SSL_get_wbio(sock->tls.ctx));
+
+        return 1;
+    }
+
+    return dime_socket_tls_error(sock, ret);
 }
 
 ssize_t dime_socket_push(dime_socket_t *sock, const json_t *jsondata, const void *bindata, size_t bindata_len) {
@@ -356,289 +464,1100 @@ ssize_t dime_socket_push(dime_socket_t *sock, const json_t *jsondata, const void
     return ret;
 }
 
-ssize_t dime_socket_push_str(dime_socket_t *sock, const char *jsonstr, const void *bindata, size_t bindata_len) {
-    dime_header_t hdr;
+int dime_socket_init_compress(dime_socket_t *sock, int codec, int level, size_t threshold) {
+    if (codec != DIME_COMPRESS_NONE && !dime_compress_available(codec)) {
+        strncpy(sock->err, "Compression codec not available", sizeof(sock->err));
+        return -1;
+    }
 
-#ifdef DIME_USE_LIBEV
-    if (dime_ringbuffer_len(&sock->wbuf) == 0 && sock->loop != NULL) {
-        ev_io_start(sock->loop, &sock->wwatcher);
+    sock->compress.codec = codec;
+    sock->compress.level = level;
+    sock->compress.threshold = threshold;
+
+    return 0;
+}
+
+int dime_socket_init_tcp(dime_socket_t *sock, int nodelay, int quickack, int cork) {
+    int yes = 1;
+
+    if (nodelay && setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, (void *)&yes, sizeof(yes)) < 0) {
+        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+        return -1;
     }
+
+#ifdef TCP_QUICKACK
+    sock->tcp.quickack = quickack;
 #endif
 
-    memcpy(hdr.magic, "DiME", 4);
+#ifdef TCP_CORK
+    sock->tcp.cork = cork;
+#endif
 
-    size_t ws_len = 0;
-    size_t jsondata_len = strlen(jsonstr);
+    return 0;
+}
 
-    hdr.jsondata_len = htonl(jsondata_len);
-    hdr.bindata_len = htonl(bindata_len);
+void dime_socket_cork(dime_socket_t *sock) {
+#ifdef TCP_CORK
+    int yes = 1;
 
-    if (sock->ws.enabled) {
-        uint8_t ws_hdr[10];
-        ws_hdr[0] = 0x82;
+    if (sock->tcp.cork && !sock->tcp.corked &&
+        setsockopt(sock->fd, IPPROTO_TCP, TCP_CORK, (void *)&yes, sizeof(yes)) >= 0) {
+        sock->tcp.corked = 1;
+    }
+#endif
+}
 
-        size_t payload_len = 12 + jsondata_len + bindata_len;
+void dime_socket_lane(dime_socket_t *sock, int lane) {
+    sock->lane = lane;
+}
 
-        if (payload_len < 126) {
-            ws_hdr[1] = payload_len;
+/* Outbuffer of the lane that messages are added to */
+static dime_ringbuffer_t *dime_socket_outbuf(dime_socket_t *sock) {
+    return (sock->lane == DIME_LANE_URGENT) ? &sock->ubuf : &sock->wbuf;
+}
 
-            ws_len = 2;
-        } else if (payload_len < (1 << 16)) {
-            ws_hdr[1] = 126;
-            ws_hdr[2] = (payload_len >> 8) & 0xFF;
-            ws_hdr[3] = payload_len & 0xFF;
+/* Begin a write, framing payload_len bytes as a WebSocket frame if needed */
+static ssize_t dime_socket_push_begin(dime_socket_t *sock, uint8_t ws_b0, size_t payload_len) {
+#ifdef DIME_USE_LIBEV
+    if (dime_socket_sendlen(sock) == 0 && sock->loop != NULL) {
+        ev_io_start(sock->loop, &sock->wwatcher);
+    }
+#endif
 
-            ws_len = 4;
-        } else {
-            assert((payload_len & (1ull << 63)) == 0);
+    size_t ws_len = 0;
 
-            ws_hdr[1] = 127;
-            ws_hdr[2] = (payload_len >> 56) & 0xFF;
-            ws_hdr[3] = (payload_len >> 48) & 0xFF;
-            ws_hdr[4] = (payload_len >> 40) & 0xFF;
-            ws_hdr[5] = (payload_len >> 32) & 0xFF;
-            ws_hdr[6] = (payload_len >> 24) & 0xFF;
-            ws_hdr[7] = (payload_len >> 16) & 0xFF;
-            ws_hdr[8] = (payload_len >> 8) & 0xFF;
-            ws_hdr[9] = payload_len & 0xFF;
+    if (sock->ws.enabled) {
+        ws_len = (payload_len < 126) ? 2 : (payload_len < (1 << 16)) ? 4 : 10;
+    }
 
-            ws_len = 10;
-        }
+    /* Urgent messages may only be sent where a bulk message ends */
+    if (sock->lane == DIME_LANE_BULK) {
+        size_t msg_len = ws_len + payload_len;
 
-        if (dime_ringbuffer_write(&sock->wbuf, ws_hdr, ws_len) < ws_len) {
+        if (dime_ringbuffer_write(&sock->wlens, &msg_len, sizeof(msg_len)) < 0) {
             strncpy(sock->err, strerror(errno), sizeof(sock->err));
             return -1;
         }
     }
 
-    if (dime_ringbuffer_write(&sock->wbuf, &hdr, 12) < 12 ||
-        dime_ringbuffer_write(&sock->wbuf, jsonstr, jsondata_len) < jsondata_len ||
-        dime_ringbuffer_write(&sock->wbuf, bindata, bindata_len) < bindata_len) {
+    if (!sock->ws.enabled) {
+        return 0;
+    }
+
+    uint8_t ws_hdr[10];
+
+    ws_hdr[0] = ws_b0;
+
+    if (payload_len < 126) {
+        ws_hdr[1] = payload_len;
+    } else if (payload_len < (1 << 16)) {
+        ws_hdr[1] = 126;
+        ws_hdr[2] = (payload_len >> 8) & 0xFF;
+        ws_hdr[3] = payload_len & 0xFF;
+    } else {
+        assert((payload_len & (1ull << 63)) == 0);
+
+        ws_hdr[1] = 127;
+        ws_hdr[2] = (payload_len >> 56) & 0xFF;
+        ws_hdr[3] = (payload_len >> 48) & 0xFF;
+        ws_hdr[4] = (payload_len >> 40) & 0xFF;
+        ws_hdr[5] = (payload_len >> 32) & 0xFF;
+        ws_hdr[6] = (payload_len >> 24) & 0xFF;
+        ws_hdr[7] = (payload_len >> 16) & 0xFF;
+        ws_hdr[8] = (payload_len >> 8) & 0xFF;
+        ws_hdr[9] = payload_len & 0xFF;
+    }
 
+    if (dime_ringbuffer_write(dime_socket_outbuf(sock), ws_hdr, ws_len) < (ssize_t)ws_len) {
         strncpy(sock->err, strerror(errno), sizeof(sock->err));
         return -1;
     }
 
-    return 12 + ws_len + jsondata_len + bindata_len;
+    return ws_len;
 }
 
-ssize_t dime_socket_pop(dime_socket_t *sock, json_t **jsondata, void **bindata, size_t *bindata_len) {
-    if (sock->ws.enabled) {
-        while (1) {
-            uint8_t ws_hdr[14], mask[4];
-            size_t hdr_len, frame_len;
-
-            size_t nread = dime_ringbuffer_peek(&sock->ws.rbuf, ws_hdr, 14);
-
-            if ((ws_hdr[1] & ~0x80) < 126 && nread >= 6) {
-                hdr_len = 6;
-                frame_len = ws_hdr[1] & ~0x80;
-
-                mask[0] = ws_hdr[2];
-                mask[1] = ws_hdr[3];
-                mask[2] = ws_hdr[4];
-                mask[3] = ws_hdr[5];
-            } else if ((ws_hdr[1] & ~0x80) == 126 && nread >= 8) {
-                hdr_len = 8;
-                frame_len = ((size_t)ws_hdr[2] << 8) | ws_hdr[3];
-
-                mask[0] = ws_hdr[4];
-                mask[1] = ws_hdr[5];
-                mask[2] = ws_hdr[6];
-                mask[3] = ws_hdr[7];
-            } else if ((ws_hdr[1] & ~0x80) == 127 && nread == 14) {
-                hdr_len = 14;
-                frame_len = ((size_t)ws_hdr[2] << 56) |
-                            ((size_t)ws_hdr[3] << 48) |
-                            ((size_t)ws_hdr[4] << 40) |
-                            ((size_t)ws_hdr[5] << 32) |
-                            ((size_t)ws_hdr[6] << 24) |
-                            ((size_t)ws_hdr[7] << 16) |
-                            ((size_t)ws_hdr[8] << 8) |
-                            ws_hdr[9];
-
-                mask[0] = ws_hdr[10];
-                mask[1] = ws_hdr[11];
-                mask[2] = ws_hdr[12];
-                mask[3] = ws_hdr[13];
-            } else {
-                break;
-            }
+/*
+ * Compress a message with permessage-deflate. Returns 1 and a buffer to
+ * be freed on success, 0 if the message should be sent uncompressed, or
+ * -1 on failure
+ */
+static int dime_socket_ws_deflate(dime_socket_t *sock, size_t nparts, const void **parts, const size_t *part_lens, unsigned char **pout, size_t *pout_len) {
+    size_t len = 0;
+
+    for (size_t i = 0; i < nparts; i++) {
+        if (part_lens[i] > UINT_MAX) {
+            return 0;
+        }
 
-            if ((ws_hdr[1] & 0x80) == 0) {
-                return -1;
-            }
+        len += part_lens[i];
+    }
 
-            size_t msgsiz = hdr_len + frame_len;
-            unsigned char *msg = malloc(msgsiz);
-            if (msg == NULL) {
-                return -1;
-            }
+    if (len < sock->ws.threshold) {
+        return 0;
+    }
 
-            if (dime_ringbuffer_peek(&sock->ws.rbuf, msg, msgsiz) == msgsiz) {
-                unsigned char *frame = msg + hdr_len;
+    z_stream strm;
 
-                for (size_t i = 0; i < frame_len; i++) {
-                    frame[i] ^= mask[i & 3];
-                }
+    memset(&strm, 0, sizeof(strm));
 
-                if (dime_ringbuffer_write(&sock->rbuf, frame, frame_len) < 0) {
-                    strncpy(sock->err, strerror(errno), sizeof(sock->err));
+    /* Raw deflate, per RFC 7692 */
+    if (deflateInit2(&strm, sock->ws.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        strncpy(sock->err, "Failed to initialize zlib", sizeof(sock->err));
+        return -1;
+    }
 
-                    free(msg);
+    size_t cap = deflateBound(&strm, len) + 16;
+    unsigned char *out = malloc(cap);
 
-                    return -1;
-                }
+    if (out == NULL || cap > UINT_MAX) {
+        deflateEnd(&strm);
+        free(out);
 
-                dime_ringbuffer_discard(&sock->ws.rbuf, msgsiz);
-                free(msg);
-            } else {
-                free(msg);
-                break;
-            }
-        }
+        return (out == NULL) ? -1 : 0;
     }
 
-    dime_header_t hdr;
+    strm.next_out = out;
+    strm.avail_out = cap;
 
-    if (dime_ringbuffer_peek(&sock->rbuf, &hdr, 12) == 12) {
-        if (memcmp(&hdr, "DiME", 4) != 0) {
-            strncpy(sock->err, "Invalid DiME header", sizeof(sock->err));
-            return -1;
-        }
+    int err = Z_OK;
 
-        hdr.jsondata_len = ntohl(hdr.jsondata_len);
-        hdr.bindata_len = ntohl(hdr.bindata_len);
+    for (size_t i = 0; i < nparts && err == Z_OK; i++) {
+        strm.next_in = (unsigned char *)parts[i];
+        strm.avail_in = part_lens[i];
 
-        size_t msgsiz = 12 + hdr.jsondata_len + hdr.bindata_len;
+        err = deflate(&strm, (i + 1 < nparts) ? Z_NO_FLUSH : Z_SYNC_FLUSH);
 
-        void *buf = malloc(msgsiz);
-        if (buf == NULL) {
-            strncpy(sock->err, strerror(errno), sizeof(sock->err));
-            return -1;
+        /* Z_BUF_ERROR only means that this part was empty */
+        if (err == Z_BUF_ERROR) {
+            err = Z_OK;
         }
+    }
 
-        if (dime_ringbuffer_peek(&sock->rbuf, buf, msgsiz) == msgsiz) {
-            json_error_t jsonerr;
-            json_t *jsondata_p = json_loadb((char *)buf + 12, hdr.jsondata_len, 0, &jsonerr);
-            if (jsondata_p == NULL) {
-                strncpy(sock->err, jsonerr.text, sizeof(sock->err));
+    size_t out_len = strm.total_out;
 
-                free(buf);
+    deflateEnd(&strm);
 
-                return -1;
-            }
+    /* The trailing empty block (00 00 FF FF) is implied */
+    if (err != Z_OK || out_len < 4 || out_len - 4 >= len) {
+        free(out);
+        return 0;
+    }
 
-            void *bindata_p = malloc(hdr.bindata_len);
+    *pout = out;
+    *pout_len = out_len - 4;
 
-            if (bindata_p == NULL) {
+    return 1;
+}
+
+/* Add a message made up of several parts to the outbuffer */
+static ssize_t dime_socket_push_parts(dime_socket_t *sock, size_t nparts, const void **parts, const size_t *part_lens) {
+    if (sock->ws.enabled && sock->ws.deflate) {
+        unsigned char *z;
+        size_t z_len;
+
+        int ret = dime_socket_ws_deflate(sock, nparts, parts, part_lens, &z, &z_len);
+
+        if (ret < 0) {
+            return -1;
+        } else if (ret > 0) {
+            /* FIN, RSV1 (compressed) and binary opcode */
+            ssize_t ws_len = dime_socket_push_begin(sock, 0xC2, z_len);
+
+            if (ws_len < 0 || dime_ringbuffer_write(dime_socket_outbuf(sock), z, z_len) < 0) {
                 strncpy(sock->err, strerror(errno), sizeof(sock->err));
 
-                json_decref(jsondata_p);
-                free(buf);
+                free(z);
 
                 return -1;
             }
 
-            memcpy(bindata_p, (unsigned char *)buf + 12 + hdr.jsondata_len, hdr.bindata_len);
-
-            *jsondata = jsondata_p;
-            *bindata = bindata_p;
-            *bindata_len = hdr.bindata_len;
+            free(z);
 
-            dime_ringbuffer_discard(&sock->rbuf, msgsiz);
-
-            free(buf);
-            return msgsiz;
+            return ws_len + z_len;
         }
-
-        free(buf);
     }
 
-    return 0;
-}
+    size_t len = 0;
 
-ssize_t dime_socket_sendpartial(dime_socket_t *sock) {
-    void *buf = malloc(SENDBUFLEN);
-    if (buf == NULL) {
-        return -1;
+    for (size_t i = 0; i < nparts; i++) {
+        len += part_lens[i];
     }
 
-    size_t nread = dime_ringbuffer_peek(&sock->wbuf, buf, SENDBUFLEN);
-    ssize_t nsent;
-
-    if (sock->tls.enabled) {
-        nsent = SSL_write(sock->tls.ctx, buf, nread);
-    } else {
-        nsent = send(sock->fd, buf, nread, 0);
+    ssize_t ws_len = dime_socket_push_begin(sock, 0x82, len);
+    if (ws_len < 0) {
+        return -1;
     }
 
-    if (nsent < 0) {
-        if (sock->tls.enabled) {
-            ERR_error_string_n(ERR_get_error(), sock->err, sizeof(sock->err));
-        } else {
+    dime_ringbuffer_t *out = dime_socket_outbuf(sock);
+
+    for (size_t i = 0; i < nparts; i++) {
+        if (dime_ringbuffer_write(out, parts[i], part_lens[i]) < 0) {
             strncpy(sock->err, strerror(errno), sizeof(sock->err));
+            return -1;
         }
-
-        free(buf);
-
-        return -1;
     }
 
-    dime_ringbuffer_discard(&sock->wbuf, nsent);
-    free(buf);
-
-    return nsent;
+    return ws_len + len;
 }
 
-ssize_t dime_socket_recvpartial(dime_socket_t *sock) {
-    void *buf = malloc(RECVBUFLEN);
-    if (buf == NULL) {
-        strncpy(sock->err, strerror(errno), sizeof(sock->err));
-        return -1;
-    }
+ssize_t dime_socket_push_str(dime_socket_t *sock, const char *jsonstr, const void *bindata, size_t bindata_len) {
+    dime_header_t hdr;
 
-    ssize_t nrecvd;
+    size_t jsondata_len = strlen(jsonstr);
 
-    if (sock->tls.enabled) {
-        nrecvd = SSL_read(sock->tls.ctx, buf, RECVBUFLEN);
-    } else {
-        nrecvd = recv(sock->fd, buf, RECVBUFLEN, 0);
-    }
+    memcpy(hdr.magic, "DiME", 4);
 
-    if (nrecvd < 0) {
-        if (sock->tls.enabled) {
-            ERR_error_string_n(ERR_get_error(), sock->err, sizeof(sock->err));
-        } else {
-            strncpy(sock->err, strerror(errno), sizeof(sock->err));
-        }
+    hdr.jsondata_len = htonl(jsondata_len);
+    hdr.bindata_len = htonl(bindata_len);
 
-        free(buf);
+    const void *parts[3] = {&hdr, jsonstr, bindata};
+    size_t part_lens[3] = {12, jsondata_len, bindata_len};
 
-        return -1;
-    }
+    return dime_socket_push_parts(sock, 3, parts, part_lens);
+}
 
-    dime_ringbuffer_t *rbuf;
+ssize_t dime_socket_push_frame(dime_socket_t *sock, const void *frame, size_t frame_len) {
+    return dime_socket_push_parts(sock, 1, &frame, &frame_len);
+}
 
-    if (sock->ws.enabled) {
-        rbuf = &sock->ws.rbuf;
-    } else if (sock->zlib.enabled) {
-        rbuf = &sock->zlib.rbuf;
-    } else {
-        rbuf = &sock->rbuf;
+/*
+ * XOR len bytes with the WebSocket mask, starting phase bytes into the
+ * mask. Masks are applied a vector or word at a time, since browsers
+ * mask every frame they send.
+ */
+static void dime_ws_unmask(unsigned char *buf, size_t len, const uint8_t mask[4], size_t phase) {
+    uint8_t m[8];
+    size_t i = 0;
+
+    for (size_t k = 0; k < 8; k++) {
+        m[k] = mask[(phase + k) & 3];
     }
 
-    if (dime_ringbuffer_write(rbuf, buf, nrecvd) < 0) {
-        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+    uint32_t m32;
+    uint64_t m64;
 
-        free(buf);
+    memcpy(&m32, m, 4);
+    memcpy(&m64, m, 8);
 
-        return -1;
-    }
+#if defined(__AVX2__)
+    __m256i m256 = _mm256_set1_epi32(m32);
 
-    free(buf);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
 
-    return nrecvd;
+        _mm256_storeu_si256((__m256i *)(buf + i), _mm256_xor_si256(v, m256));
+    }
+#endif
+
+#if defined(__SSE2__)
+    __m128i m128 = _mm_set1_epi32(m32);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+
+        _mm_storeu_si128((__m128i *)(buf + i), _mm_xor_si128(v, m128));
+    }
+#else
+    (void)m32;
+#endif
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+
+        memcpy(&v, buf + i, 8);
+        v ^= m64;
+        memcpy(buf + i, &v, 8);
+    }
+
+    for (; i < len; i++) {
+        buf[i] ^= m[i & 3];
+    }
+}
+
+/*
+ * Parse the header of the next DiME message, returning 1 and the sizes of
+ * its parts, 0 if nread bytes are not a whole header yet, or -1. Unless
+ * capped is set, only the sizes in a compressed frame are capped, as
+ * those are allocated before the frame has arrived.
+ */
+static int dime_socket_header(dime_socket_t *sock, const unsigned char *hdr, size_t nread, int capped, size_t *hdr_len, size_t *jsondata_len, size_t *binlen, size_t *body_len) {
+    if (nread < 12) {
+        return 0;
+    } else if (memcmp(hdr, "DiME", 4) == 0) {
+        *hdr_len = 12;
+    } else if (memcmp(hdr, "DiMZ", 4) == 0) {
+        if (nread < DIME_COMPRESS_HDRLEN) {
+            return 0;
+        }
+
+        *hdr_len = DIME_COMPRESS_HDRLEN;
+    } else {
+        strncpy(sock->err, "Invalid DiME header", sizeof(sock->err));
+        return -1;
+    }
+
+    uint32_t lens[3];
+    memcpy(lens, hdr + 4, sizeof(lens));
+
+    *jsondata_len = ntohl(lens[0]);
+    *binlen = ntohl(lens[1]);
+
+    if ((capped || *hdr_len == DIME_COMPRESS_HDRLEN) &&
+        (*jsondata_len > DIME_MSG_MAX || *binlen > DIME_MSG_MAX - *jsondata_len)) {
+        strncpy(sock->err, "Message too large", sizeof(sock->err));
+        return -1;
+    }
+
+    if (*hdr_len == 12) {
+        *body_len = *jsondata_len + *binlen;
+        return 1;
+    }
+
+    *body_len = ntohl(lens[2]);
+
+    /* No codec makes data bigger than this, and unknown codecs have no bound */
+    if (*body_len > dime_compress_bound(hdr[16], *jsondata_len + *binlen)) {
+        strncpy(sock->err, "Invalid compressed frame", sizeof(sock->err));
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * Find bytes [off, off + len) of the ring buffer in place, as at most two
+ * contiguous pieces
+ */
+static size_t dime_ws_range(dime_ringbuffer_t *ring, size_t off, size_t len, unsigned char **pieces, size_t *piece_lens) {
+    void *segs[2];
+    size_t seg_lens[2];
+    size_t nsegs = dime_ringbuffer_segments(ring, segs, seg_lens);
+    size_t n = 0;
+
+    for (size_t i = 0; i < nsegs && len > 0; i++) {
+        if (off >= seg_lens[i]) {
+            off -= seg_lens[i];
+            continue;
+        }
+
+        size_t piece_len = seg_lens[i] - off;
+
+        if (piece_len > len) {
+            piece_len = len;
+        }
+
+        pieces[n] = (unsigned char *)segs[i] + off;
+        piece_lens[n++] = piece_len;
+
+        off = 0;
+        len -= piece_len;
+    }
+
+    return n;
+}
+
+/*
+ * Move WebSocket payload to the inbuffer. The DiME headers in it are
+ * followed as it goes by, so a small compressed message can't inflate to
+ * more than the DiME messages it holds claim to be.
+ */
+static int dime_socket_ws_write(dime_socket_t *sock, const unsigned char *buf, size_t len) {
+    if (dime_ringbuffer_write(&sock->rbuf, buf, len) < 0) {
+        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+        return -1;
+    }
+
+    if (len <= sock->ws.msg_left) {
+        sock->ws.msg_left -= len;
+        return 0;
+    }
+
+    /* Bytes from the start of the next header to the end of the inbuffer */
+    size_t left = sock->ws.hdr_seen + (len - sock->ws.msg_left);
+
+    sock->ws.msg_left = 0;
+
+    while (left > 0) {
+        unsigned char hdr[DIME_COMPRESS_HDRLEN];
+        unsigned char *pieces[2];
+        size_t piece_lens[2];
+        size_t nread = (left < sizeof(hdr)) ? left : sizeof(hdr);
+        size_t npieces = dime_ws_range(&sock->rbuf, dime_ringbuffer_len(&sock->rbuf) - left, nread, pieces, piece_lens);
+
+        memcpy(hdr, pieces[0], piece_lens[0]);
+
+        if (npieces > 1) {
+            memcpy(hdr + piece_lens[0], pieces[1], piece_lens[1]);
+        }
+
+        size_t hdr_len, jsondata_len, binlen, body_len;
+        int ret = dime_socket_header(sock, hdr, nread, 1, &hdr_len, &jsondata_len, &binlen, &body_len);
+
+        if (ret < 0) {
+            return -1;
+        } else if (ret == 0) {
+            break;
+        }
+
+        if (left < hdr_len + body_len) {
+            sock->ws.msg_left = hdr_len + body_len - left;
+            left = 0;
+        } else {
+            left -= hdr_len + body_len;
+        }
+    }
+
+    sock->ws.hdr_seen = left;
+
+    return 0;
+}
+
+/* Inflate part of a compressed message into the inbuffer */
+static int dime_socket_ws_inflate(dime_socket_t *sock, const unsigned char *in, size_t in_len) {
+    z_stream *strm = &sock->ws.inflate;
+    unsigned char out[16384];
+
+    while (in_len > 0) {
+        size_t chunk = (in_len > UINT_MAX) ? UINT_MAX : in_len;
+
+        strm->next_in = (unsigned char *)in;
+        strm->avail_in = chunk;
+
+        do {
+            strm->next_out = out;
+            strm->avail_out = sizeof(out);
+
+            int err = inflate(strm, Z_SYNC_FLUSH);
+
+            if (err != Z_OK && err != Z_BUF_ERROR && err != Z_STREAM_END) {
+                strncpy(sock->err, "Invalid compressed WebSocket message", sizeof(sock->err));
+                return -1;
+            }
+
+            sock->ws.inflated += sizeof(out) - strm->avail_out;
+
+            /* However many DiME messages it holds, no more than the largest one */
+            if (sock->ws.inflated > DIME_COMPRESS_HDRLEN + DIME_MSG_MAX) {
+                strncpy(sock->err, "Compressed WebSocket message too large", sizeof(sock->err));
+                return -1;
+            }
+
+            if (dime_socket_ws_write(sock, out, sizeof(out) - strm->avail_out) < 0) {
+                return -1;
+            }
+
+            if (err != Z_OK) {
+                break;
+            }
+        } while (strm->avail_out == 0 || strm->avail_in > 0);
+
+        in += chunk;
+        in_len -= chunk;
+    }
+
+    return 0;
+}
+
+/* Queue a control frame, which goes out ahead of nothing but whole frames */
+static int dime_socket_ws_control(dime_socket_t *sock, uint8_t opcode, const void *payload, size_t payload_len) {
+    int lane = sock->lane;
+
+    /* Control frames may be sent between any two frames */
+    sock->lane = DIME_LANE_URGENT;
+
+    if (dime_socket_push_begin(sock, 0x80 | opcode, payload_len) < 0 ||
+        dime_ringbuffer_write(&sock->ubuf, payload, payload_len) < 0) {
+        strncpy(sock->err, strerror(errno), sizeof(sock->err));
+
+        sock->lane = lane;
+
+        return -1;
+    }
+
+    sock->lane = lane;
+
+    return 0;
+}
+
+/*
+ * Move the payloads of complete WebSocket frames from the WebSocket
+ * inbuffer to the inbuffer, unmasking them in place. DiME messages are a
+ * byte stream, so frame and message boundaries need not line up with
+ * them. Control frames are answered here.
+ */
+static int dime_socket_ws_unframe(dime_socket_t *sock) {
+    dime_ringbuffer_t *ring = &sock->ws.rbuf;
+
+    while (!sock->ws.closed) {
+        uint8_t ws_hdr[14], mask[4];
+        size_t hdr_len, frame_len;
+
+        size_t nread = dime_ringbuffer_peek(ring, ws_hdr, 14);
+
+        if (nread < 2) {
+            break;
+        }
+
+        int fin = ws_hdr[0] & 0x80;
+        int rsv1 = ws_hdr[0] & 0x40;
+        int opcode = ws_hdr[0] & 0x0F;
+        uint8_t len7 = ws_hdr[1] & 0x7F;
+
+        /* Clients must mask, and only compression uses a reserved bit */
+        if ((ws_hdr[1] & 0x80) == 0 || (ws_hdr[0] & 0x30) != 0 ||
+            (rsv1 && (!sock->ws.deflate || opcode == 0x0 || (opcode & 0x8)))) {
+            strncpy(sock->err, "Invalid WebSocket frame", sizeof(sock->err));
+            return -1;
+        }
+
+        /* Control frames can't be fragmented, and fit in a small header */
+        if ((opcode & 0x8) && (!fin || len7 > 125)) {
+            strncpy(sock->err, "Invalid WebSocket control frame", sizeof(sock->err));
+            return -1;
+        }
+
+        hdr_len = (len7 < 126) ? 6 : (len7 == 126) ? 8 : 14;
+
+        if (nread < hdr_len) {
+            break;
+        }
+
+        if (len7 < 126) {
+            frame_len = len7;
+        } else if (len7 == 126) {
+            frame_len = ((size_t)ws_hdr[2] << 8) | ws_hdr[3];
+        } else {
+            frame_len = ((size_t)ws_hdr[2] << 56) |
+                        ((size_t)ws_hdr[3] << 48) |
+                        ((size_t)ws_hdr[4] << 40) |
+                        ((size_t)ws_hdr[5] << 32) |
+                        ((size_t)ws_hdr[6] << 24) |
+                        ((size_t)ws_hdr[7] << 16) |
+                        ((size_t)ws_hdr[8] << 8) |
+                        ws_hdr[9];
+        }
+
+        memcpy(mask, ws_hdr + hdr_len - 4, 4);
+
+        if (dime_ringbuffer_len(ring) - hdr_len < frame_len) {
+            break;
+        }
+
+        unsigned char *pieces[2];
+        size_t piece_lens[2];
+        size_t npieces = dime_ws_range(ring, hdr_len, frame_len, pieces, piece_lens);
+
+        dime_ws_unmask(pieces[0], (npieces > 0) ? piece_lens[0] : 0, mask, 0);
+
+        if (npieces > 1) {
+            dime_ws_unmask(pieces[1], piece_lens[1], mask, piece_lens[0]);
+        }
+
+        switch (opcode) {
+        case 0x1:
+        case 0x2:
+            if (sock->ws.fragmented) {
+                strncpy(sock->err, "Expected WebSocket continuation frame", sizeof(sock->err));
+                return -1;
+            }
+
+            sock->ws.compressed = (rsv1 != 0);
+
+            if (sock->ws.compressed) {
+                int err = sock->ws.inflate_init ? inflateReset(&sock->ws.inflate) : inflateInit2(&sock->ws.inflate, -15);
+
+                if (err != Z_OK) {
+                    strncpy(sock->err, "Failed to initialize zlib", sizeof(sock->err));
+                    return -1;
+                }
+
+                sock->ws.inflate_init = 1;
+                sock->ws.inflated = 0;
+            }
+
+            /* Fallthrough */
+
+        case 0x0:
+            if (opcode == 0x0 && !sock->ws.fragmented) {
+                strncpy(sock->err, "Unexpected WebSocket continuation frame", sizeof(sock->err));
+                return -1;
+            }
+
+            sock->ws.fragmented = !fin;
+
+            for (size_t i = 0; i < npieces; i++) {
+                int err;
+
+                if (sock->ws.compressed) {
+                    err = dime_socket_ws_inflate(sock, pieces[i], piece_lens[i]);
+                } else {
+                    err = dime_socket_ws_write(sock, pieces[i], piece_lens[i]);
+                }
+
+                if (err < 0) {
+                    return -1;
+                }
+            }
+
+            /* Restore the empty block stripped from the end of the message */
+            if (fin && sock->ws.compressed &&
+                dime_socket_ws_inflate(sock, (const unsigned char *)"\x00\x00\xFF\xFF", 4) < 0) {
+                return -1;
+            }
+
+            break;
+
+        case 0x8:
+        case 0x9:
+            {
+                unsigned char payload[125];
+
+                memcpy(payload, pieces[0], (npieces > 0) ? piece_lens[0] : 0);
+
+                if (npieces > 1) {
+                    memcpy(payload + piece_lens[0], pieces[1], piece_lens[1]);
+                }
+
+                if (opcode == 0x9) {
+                    /* Pong with the ping's payload */
+                    if (dime_socket_ws_control(sock, 0xA, payload, frame_len) < 0) {
+                        return -1;
+                    }
+                } else {
+                    /* Echo the status code; the peer then closes the connection */
+                    if (dime_socket_ws_control(sock, 0x8, payload, (frame_len >= 2) ? 2 : 0) < 0) {
+                        return -1;
+                    }
+
+                    sock->ws.closed = 1;
+                }
+            }
+
+            break;
+
+        case 0xA:
+            break;
+
+        default:
+            strncpy(sock->err, "Unknown WebSocket opcode", sizeof(sock->err));
+            return -1;
+        }
+
+        dime_ringbuffer_discard(ring, hdr_len + frame_len);
+    }
+
+    /* Nothing after a close frame is read */
+    if (sock->ws.closed) {
+        dime_ringbuffer_discard(ring, dime_ringbuffer_len(ring));
+    }
+
+    return 0;
+}
+
+ssize_t dime_socket_pop(dime_socket_t *sock, json_t **jsondata, void **bindata, size_t *bindata_len) {
+    /* The inbuffer holds a partial HTTP request until the upgrade is done */
+    if (sock->ws.upgrading) {
+        return 0;
+    }
+
+    if (sock->ws.enabled && dime_socket_ws_unframe(sock) < 0) {
+        return -1;
+    }
+
+    unsigned char hdr[DIME_COMPRESS_HDRLEN];
+    size_t nread = dime_ringbuffer_peek(&sock->rbuf, hdr, DIME_COMPRESS_HDRLEN);
+    size_t hdr_len, jsondata_len, binlen, body_len;
+
+    int ret = dime_socket_header(sock, hdr, nread, 0, &hdr_len, &jsondata_len, &binlen, &body_len);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    size_t msgsiz = hdr_len + body_len;
+
+    if (dime_ringbuffer_len(&sock->rbuf) < msgsiz) {
+        return 0;
+    }
+
+    /*
+     * The whole message is buffered, so it is consumed as it is parsed. The
+     * JSON is parsed in place unless it wraps around the end of the ring,
+     * and the binary data is copied once, into the buffer handed back.
+     */
+    dime_ringbuffer_discard(&sock->rbuf, hdr_len);
+
+    void *segs[2];
+    size_t seg_lens[2];
+
+    dime_ringbuffer_segments(&sock->rbuf, segs, seg_lens);
+
+    unsigned char *buf = NULL;
+    unsigned char *body = segs[0];
+
+    if (hdr_len == DIME_COMPRESS_HDRLEN) {
+        /* Decompressed straight into the binary data buffer, JSON first */
+        buf = malloc(jsondata_len + binlen + 1);
+        if (buf == NULL) {
+            strncpy(sock->err, strerror(errno), sizeof(sock->err));
+            return -1;
+        }
+
+        unsigned char *in = body;
+
+        if (seg_lens[0] < body_len) {
+            in = malloc(body_len);
+            if (in == NULL) {
+                strncpy(sock->err, strerror(errno), sizeof(sock->err));
+
+                free(buf);
+
+                return -1;
+            }
+
+            dime_ringbuffer_peek(&sock->rbuf, in, body_len);
+        }
+
+        ret = dime_decompress(hdr[16], in, body_len, buf, jsondata_len + binlen);
+
+        if (in != body) {
+            free(in);
+        }
+
+        if (ret < 0) {
+            strncpy(sock->err, "Invalid compressed frame", sizeof(sock->err));
+
+            free(buf);
+
+            return -1;
+        }
+
+        body = buf;
+    } else if (seg_lens[0] < jsondata_len) {
+        buf = malloc(jsondata_len);
+        if (buf == NULL) {
+            strncpy(sock->err, strerror(errno), sizeof(sock->err));
+            return -1;
+        }
+
+        dime_ringbuffer_peek(&sock->rbuf, buf, jsondata_len);
+
+        body = buf;
+    }
+
+    json_error_t jsonerr;
+    json_t *jsondata_p = json_loadb((char *)body, jsondata_len, 0, &jsonerr);
+    if (jsondata_p == NULL) {
+        strncpy(sock->err, jsonerr.text, sizeof(sock->err));
+
+        free(buf);
+
+        return -1;
+    }
+
+    void *bindata_p;
+
+    if (hdr_len == DIME_COMPRESS_HDRLEN) {
+        /* Slide the binary data down over the parsed JSON */
+        memmove(buf, buf + jsondata_len, binlen);
+
+        bindata_p = buf;
+
+        dime_ringbuffer_discard(&sock->rbuf, body_len);
+    } else {
+        free(buf);
+
+        bindata_p = malloc(binlen);
+        if (bindata_p == NULL) {
+            strncpy(sock->err, strerror(errno), sizeof(sock->err));
+
+            json_decref(jsondata_p);
+
+            return -1;
+        }
+
+        dime_ringbuffer_discard(&sock->rbuf, jsondata_len);
+        dime_ringbuffer_read(&sock->rbuf, bindata_p, binlen);
+    }
+
+    *jsondata = jsondata_p;
+    *bindata = bindata_p;
+    *bindata_len = binlen;
+
+    return msgsiz;
+}
+
+/* Trim segments to at most lim bytes */
+static size_t dime_socket_trimsegs(size_t nsegs, size_t *seg_lens, size_t lim) {
+    if (seg_lens[0] >= lim) {
+        seg_lens[0] = lim;
+        return 1;
+    }
+
+    if (nsegs == 2 && seg_lens[0] + seg_lens[1] > lim) {
+        seg_lens[1] = lim - seg_lens[0];
+    }
+
+    return nsegs;
+}
+
+/* Account for nsent bytes of the bulk lane having been sent */
+static void dime_socket_bulksent(dime_socket_t *sock, size_t nsent) {
+    while (nsent > 0) {
+        if (sock->wleft == 0) {
+            dime_ringbuffer_read(&sock->wlens, &sock->wleft, sizeof(sock->wleft));
+        }
+
+        size_t n = (nsent < sock->wleft) ? nsent : sock->wleft;
+
+        sock->wleft -= n;
+        nsent -= n;
+    }
+}
+
+ssize_t dime_socket_sendpartial(dime_socket_t *sock) {
+    /* TLS proper only starts once the plaintext prefix has been sent */
+    int tls = sock->tls.enabled && sock->tls.plain_len == 0;
+
+    if (tls) {
+        sock->tls.want_write = 0;
+
+        if (sock->tls.handshaking) {
+            int ret = dime_socket_handshake(sock);
+
+            if (ret <= 0) {
+                return ret;
+            }
+        }
+    }
+
+    /*
+     * The urgent lane goes first, but only between bulk messages, and never
+     * before the plaintext prefix. A retried SSL_write must be given the
+     * same buffer as before, so it sticks to the lane it started on.
+     */
+    int urgent;
+
+    if (tls && !sock->tls.ktls && sock->tls.retry) {
+        urgent = sock->ulast;
+    } else {
+        urgent = sock->wleft == 0 && sock->tls.plain_len == 0 &&
+                 dime_ringbuffer_len(&sock->ubuf) > 0;
+    }
+
+    dime_ringbuffer_t *out = urgent ? &sock->ubuf : &sock->wbuf;
+
+    /* Send straight from the outbuffer rather than copying it out first */
+    void *segs[2];
+    size_t seg_lens[2];
+    size_t nsegs = dime_ringbuffer_segments(out, segs, seg_lens);
+
+    if (nsegs == 0) {
+        return 0;
+    }
+
+    if (sock->tls.plain_len > 0) {
+        nsegs = dime_socket_trimsegs(nsegs, seg_lens, sock->tls.plain_len);
+    }
+
+    /* Stop at the end of the current bulk message if urgent ones are waiting */
+    if (!urgent && dime_ringbuffer_len(&sock->ubuf) > 0 && !sock->tls.retry) {
+        size_t lim = sock->wleft;
+
+        if (lim == 0) {
+            dime_ringbuffer_peek(&sock->wlens, &lim, sizeof(lim));
+        }
+
+        nsegs = dime_socket_trimsegs(nsegs, seg_lens, lim);
+    }
+
+    ssize_t nsent;
+
+    if (tls && !sock->tls.ktls) {
+        /* SSL_write only takes one buffer; the next call gets the rest */
+        int len = (seg_lens[0] > INT_MAX) ? INT_MAX : seg_lens[0];
+
+        ERR_clear_error();
+
+        nsent = SSL_write(sock->tls.ctx, segs[0], len);
+
+        if (nsent <= 0) {
+            nsent = dime_socket_tls_error(sock, nsent);
+        }
+    } else {
+        /* With kTLS, the kernel encrypts whatever is written to the socket */
+#ifdef _WIN32
+        nsent = send(sock->fd, segs[0], seg_lens[0], 0);
+#else
+        struct iovec iov[2];
+
+        for (size_t i = 0; i < nsegs; i++) {
+            iov[i].iov_base = (void *)segs[i];
+            iov[i].iov_len = seg_lens[i];
+        }
+
+        nsent = writev(sock->fd, iov, nsegs);
+#endif
+
+        if (nsent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                nsent = 0;
+            } else {
+                strncpy(sock->err, strerror(errno), sizeof(sock->err));
+            }
+        }
+    }
+
+    if (nsent < 0) {
+        return -1;
+    }
+
+    if (sock->tls.plain_len > 0) {
+        sock->tls.plain_len -= nsent;
+    }
+
+    dime_ringbuffer_discard(out, nsent);
+
+    if (!urgent) {
+        dime_socket_bulksent(sock, nsent);
+    }
+
+    sock->ulast = urgent;
+    sock->tls.retry = tls && !sock->tls.ktls && nsent == 0;
+
+#ifdef TCP_CORK
+    /* Flush the last partial packet of a burst */
+    if (sock->tcp.corked && dime_socket_sendlen(sock) == 0) {
+        int no = 0;
+
+        setsockopt(sock->fd, IPPROTO_TCP, TCP_CORK, (void *)&no, sizeof(no));
+        sock->tcp.corked = 0;
+    }
+#endif
+
+    return nsent;
+}
+
+/*
+ * SSL_read only takes one buffer, so this reads segment by segment. Every
+ * record OpenSSL has buffered is drained before returning, as the event
+ * loops only wake up for bytes still on the socket.
+ */
+static ssize_t dime_socket_tls_recv(dime_socket_t *sock, dime_ringbuffer_t *rbuf) {
+    ssize_t nrecvd = 0;
+
+    do {
+        void *segs[2];
+        size_t seg_lens[2];
+
+        if (dime_ringbuffer_space(rbuf, RECVBUFLEN, segs, seg_lens) == 0) {
+            strncpy(sock->err, strerror(errno), sizeof(sock->err));
+            return -1;
+        }
+
+        int len = (seg_lens[0] > INT_MAX) ? INT_MAX : seg_lens[0];
+
+        ERR_clear_error();
+
+        int ret = SSL_read(sock->tls.ctx, segs[0], len);
+
+        if (ret <= 0) {
+            /* Whatever stopped this read happens again on the next call */
+            if (nrecvd > 0) {
+                break;
+            }
+
+            int err = SSL_get_error(sock->tls.ctx, ret);
+
+            /* A closed socket without a close_notify is still just closed */
+            if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && ret == 0 && ERR_peek_error() == 0)) {
+                return 0;
+            } else if (dime_socket_tls_error(sock, ret) == 0) {
+                errno = EAGAIN;
+            }
+
+            return -1;
+        }
+
+        dime_ringbuffer_commit(rbuf, ret);
+        nrecvd += ret;
+    } while (SSL_has_pending(sock->tls.ctx));
+
+    return nrecvd;
+}
+
+ssize_t dime_socket_recvpartial(dime_socket_t *sock) {
+    if (sock->tls.handshaking) {
+        int ret = dime_socket_handshake(sock);
+
+        if (ret < 0) {
+            return -1;
+        } else if (ret == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    dime_ringbuffer_t *rbuf;
+
+    if (sock->ws.enabled) {
+        rbuf = &sock->ws.rbuf;
+    } else {
+        rbuf = &sock->rbuf;
+    }
+
+    ssize_t nrecvd;
+
+    if (sock->tls.enabled) {
+        nrecvd = dime_socket_tls_recv(sock, rbuf);
+    } else {
+        /* Read straight into the inbuffer; it only grows while messages are partial */
+        void *segs[2];
+        size_t seg_lens[2];
+
+        size_t nsegs = dime_ringbuffer_space(rbuf, RECVBUFLEN, segs, seg_lens);
+        if (nsegs == 0) {
+            strncpy(sock->err, strerror(errno), sizeof(sock->err));
+            return -1;
+        }
+
+#ifdef _WIN32
+        nrecvd = recv(sock->fd, segs[0], seg_lens[0], 0);
+#else
+        struct iovec iov[2];
+
+        for (size_t i = 0; i < nsegs; i++) {
+            iov[i].iov_base = segs[i];
+            iov[i].iov_len = seg_lens[i];
+        }
+
+        nrecvd = readv(sock->fd, iov, nsegs);
+#endif
+
+        if (nrecvd < 0) {
+            strncpy(sock->err, strerror(errno), sizeof(sock->err));
+            return -1;
+        }
+
+        dime_ringbuffer_commit(rbuf, nrecvd);
+    }
+
+    if (nrecvd < 0) {
+        return -1;
+    }
+
+#ifdef TCP_QUICKACK
+    if (sock->tcp.quickack) {
+        int yes = 1;
+
+        setsockopt(sock->fd, IPPROTO_TCP, TCP_QUICKACK, (void *)&yes, sizeof(yes));
+    }
+#endif
+
+    if (sock->ws.upgrading && dime_socket_upgrade(sock) < 0) {
+        return -1;
+    }
+
+    return nrecvd;
 }
 
 int dime_socket_fd(const dime_socket_t *sock) {
@@ -646,7 +1565,29 @@ int dime_socket_fd(const dime_socket_t *sock) {
 }
 
 size_t dime_socket_sendlen(const dime_socket_t *sock) {
-    return dime_ringbuffer_len(&sock->wbuf);
+    return dime_ringbuffer_len(&sock->wbuf) + dime_ringbuffer_len(&sock->ubuf);
+}
+
+size_t dime_socket_urgentlen(const dime_socket_t *sock) {
+    if (sock->tls.retry && !sock->ulast) {
+        return SIZE_MAX;
+    }
+
+    size_t ahead = (sock->wleft > sock->tls.plain_len) ? sock->wleft : sock->tls.plain_len;
+
+    return ahead + dime_ringbuffer_len(&sock->ubuf);
+}
+
+int dime_socket_wantwrite(const dime_socket_t *sock) {
+    return dime_socket_sendlen(sock) > 0 || sock->tls.want_write;
+}
+
+double dime_socket_timeleft(const dime_socket_t *sock) {
+    if (!sock->ws.upgrading) {
+        return HUGE_VAL;
+    }
+
+    return sock->ws.deadline - dime_socket_now();
 }
 
 size_t dime_socket_recvlen(const dime_socket_t *sock) {
@@ -31,6 +31,9 @@
  * - The JSON portion of the data
  * - The binary portion of the data
  *
+ * If compression has been enabled, messages may also be sent and
+ * received as compressed frames (see compress.h).
+ *
  * Both input and output from the underlying file descriptor is buffered
  * via @link dime_ringbuffer_t @endlink ring buffers. The @c read and
  * @c write syscalls and parsing/building data from the buffers is
@@ -57,6 +60,29 @@
 extern "C" {
 #endif
 
+/** Largest HTTP header accepted for a WebSocket upgrade */
+#define DIME_WS_HDRMAX 8192
+
+/** Seconds a peer is given to complete a WebSocket upgrade */
+#define DIME_WS_TIMEOUT 10
+
+/**
+ * Largest JSON and binary portions of a message accepted from a peer,
+ * where they are sized before the message has arrived: in a compressed
+ * frame, or in a compressed WebSocket message
+ */
+#define DIME_MSG_MAX ((size_t)1 << 30)
+
+/**
+ * @brief Outbuffers that messages can be added to
+ *
+ * @see dime_socket_lane
+ */
+enum dime_socket_lane {
+    DIME_LANE_BULK,  /** Sent in order */
+    DIME_LANE_URGENT /** Sent between two messages of the bulk lane */
+};
+
 /**
  * @brief Asynchronous DiME socket
  *
@@ -73,6 +99,8 @@ extern "C" {
  * @see dime_socket_fd
  * @see dime_socket_sendlen
  * @see dime_socket_recvlen
+ * @see dime_socket_wantwrite
+ * @see dime_socket_lane
  */
 typedef struct {
     int fd; /** File descriptor */
@@ -80,25 +108,56 @@ typedef struct {
     dime_ringbuffer_t rbuf; /** Inbuffer */
     dime_ringbuffer_t wbuf; /** Outbuffer */
 
+    dime_ringbuffer_t ubuf;  /** Outbuffer of the urgent lane */
+    dime_ringbuffer_t wlens; /** Length of each message in wbuf, as a size_t */
+    size_t wleft;            /** Bytes left of the message being sent from wbuf, or 0 */
+    int lane;                /** Lane messages are added to, from @c dime_socket_lane */
+    int ulast;               /** Non-zero if the last write was from ubuf */
+
     struct {
-        int enabled;
+        int enabled;      /** Non-zero once TLS has been enabled */
+        int handshaking;  /** Non-zero until the TLS handshake completes */
+        int want_write;   /** Non-zero if OpenSSL is waiting to write */
+        int retry;        /** Non-zero if the last write must be retried as is */
+        size_t plain_len; /** Bytes of the outbuffer to send before TLS */
+        int ktls;         /** Non-zero if the kernel encrypts writes (kTLS) */
         SSL *ctx;
     } tls;
 
     struct {
         int enabled;
+        int upgrading;    /** Non-zero until the HTTP upgrade completes */
+        double deadline;  /** Time by which the upgrade must complete */
+        int deflate;      /** Non-zero if permessage-deflate was negotiated */
+        int level;        /** Compression level for outgoing messages */
+        size_t threshold; /** Size of the smallest message to compress */
+        int fragmented;   /** Non-zero inside a fragmented message */
+        int compressed;   /** Non-zero if the current message is compressed */
+        int closed;       /** Non-zero once a close frame was received */
+        int inflate_init; /** Non-zero once inflate has been initialized */
+        z_stream inflate;
+        size_t inflated;  /** Bytes the current message has inflated to */
+        size_t msg_left;  /** Bytes of the DiME message being unframed to come */
+        size_t hdr_seen;  /** Bytes of the next DiME header unframed so far */
         dime_ringbuffer_t rbuf;
     } ws;
 
     struct {
-        int enabled;
-        z_stream ctx;
-        dime_ringbuffer_t rbuf;
-    } zlib;
+        int quickack; /** Non-zero to re-enable TCP_QUICKACK after each read */
+        int cork;     /** Non-zero to cork bursts of messages */
+        int corked;   /** Non-zero while TCP_CORK is set */
+    } tcp;
+
+    struct {
+        int codec;        /** Codec for outgoing messages, or DIME_COMPRESS_NONE */
+        int level;        /** Compression level */
+        size_t threshold; /** Size of the smallest message to compress */
+    } compress;
 
 #ifdef DIME_USE_LIBEV
     ev_io rwatcher;
     ev_io wwatcher;
+    ev_timer twatcher;
     struct ev_loop *loop;
 #endif
 
@@ -135,9 +194,13 @@ void dime_socket_destroy(dime_socket_t *sock);
 /**
  * @brief Enable TLS encryption on the socket
  *
-
- * Performs a TLS handshake on the underlying socket. Subsequent reads/writes from the socket will be encrypted anddecrypted via TLS.
-
+ * Begins a TLS handshake on the underlying socket without blocking.
+ * Data already in the outbuffer is sent in plaintext first; the
+ * handshake is then driven by subsequent calls to
+ * @link dime_socket_recvpartial @endlink and
+ * @link dime_socket_sendpartial @endlink as the socket becomes readable
+ * or writable (see @link dime_socket_wantwrite @endlink). Subsequent
+ * reads/writes from the socket will be encrypted and decrypted via TLS.
  *
  * @param sock Pointer to a @link dime_socket_t @endlink struct
  * @param ctx OpenSSL context
@@ -145,39 +208,107 @@ void dime_socket_destroy(dime_socket_t *sock);
  * @return A nonnegative value on success, or a negative value on
  * failure
  *
- * @todo Make this non-blocking
- * @see dime_socket_init_zlib
+ * @see dime_socket_init_compress
  */
 int dime_socket_init_tls(dime_socket_t *sock, SSL_CTX *ctx);
 
 /**
  * @brief Enable WebSocket protocol on the socket
  *
+ * Does not block. The HTTP upgrade request is parsed incrementally by
+ * @link dime_socket_recvpartial @endlink as it arrives, and the
+ * response is queued on the outbuffer. No DiME messages are popped
+ * until the upgrade completes. Requests with headers larger than
+ * @ref DIME_WS_HDRMAX bytes are rejected, and peers that take longer
+ * than @ref DIME_WS_TIMEOUT seconds should be disconnected (see
+ * @link dime_socket_timeleft @endlink).
+ *
+ * Fragmented messages, pings and close frames are handled. If
+ * @em deflate is non-zero and the peer offers permessage-deflate,
+ * incoming compressed messages are inflated, and outgoing messages of at
+ * least @em threshold bytes are compressed.
+ *
  * @param sock Pointer to a @link dime_socket_t @endlink struct
+ * @param deflate Non-zero to accept permessage-deflate
+ * @param level zlib compression level for outgoing messages
+ * @param threshold Size of the smallest outgoing message to compress
  *
  * @return A nonnegative value on success, or a negative value on
  * failure
- *
- * @todo Make this non-blocking
  */
-int dime_socket_init_ws(dime_socket_t *sock);
+int dime_socket_init_ws(dime_socket_t *sock, int deflate, int level, size_t threshold);
 
 /**
- * @brief Enable zlib compression on the socket
+ * @brief Enable compression on the socket
  *
-
- * Subsequent reads/writes on the socket will be (de)compressed via zlib.
-
+ * Records the codec negotiated with the peer. Messages are not
+ * compressed by @link dime_socket_push @endlink; callers build frames
+ * with @link dime_compress_frame @endlink, so that one frame can be
+ * shared between sockets, and send them with
+ * @link dime_socket_push_frame @endlink. Compressed frames are accepted
+ * from the peer regardless of this setting.
  *
  * @param sock Pointer to a @link dime_socket_t @endlink struct
+ * @param codec A value from @link dime_compress_codec @endlink
+ * @param level Compression level
+ * @param threshold Size of the smallest message to compress
  *
  * @return A nonnegative value on success, or a negative value on
  * failure
  *
- * @todo Make this non-blocking
  * @see dime_socket_init_tls
  */
-int dime_socket_init_zlib(dime_socket_t *sock);
+int dime_socket_init_compress(dime_socket_t *sock, int codec, int level, size_t threshold);
+
+/**
+ * @brief Set TCP options on the socket
+ *
+ * @em nodelay disables Nagle's algorithm, so that small replies are sent
+ * immediately. @em quickack acknowledges incoming data immediately
+ * rather than waiting to piggyback the ACK on a reply; Linux clears this
+ * after a while, so it is set again after each read. @em cork allows
+ * @link dime_socket_cork @endlink to batch bursts of messages into full
+ * packets. Options the platform lacks are ignored.
+ *
+ * @param sock Pointer to a @link dime_socket_t @endlink struct
+ * @param nodelay Non-zero to set @c TCP_NODELAY
+ * @param quickack Non-zero to set @c TCP_QUICKACK
+ * @param cork Non-zero to allow @c TCP_CORK
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_socket_init_tcp(dime_socket_t *sock, int nodelay, int quickack, int cork);
+
+/**
+ * @brief Batch the messages about to be added to the outbuffer
+ *
+ * Holds back partially filled packets until the outbuffer has been sent
+ * in full, so that a burst of messages, e.g. a reply to a @c sync
+ * command, goes out in as few packets as possible. Does nothing unless
+ * enabled with @link dime_socket_init_tcp @endlink.
+ *
+ * @param sock Pointer to a @link dime_socket_t @endlink struct
+ *
+ * @see dime_socket_sendpartial
+ */
+void dime_socket_cork(dime_socket_t *sock);
+
+/**
+ * @brief Choose the lane that messages are added to
+ *
+ * Messages added to @c DIME_LANE_URGENT are sent as soon as the message
+ * being sent from @c DIME_LANE_BULK has been sent in full, ahead of the
+ * rest of the bulk lane. Messages never overlap, but the peer sees them
+ * out of order, so callers must only use the urgent lane for messages
+ * that the peer can take at any point between the messages in the bulk
+ * lane (see @link dime_socket_urgentlen @endlink). Messages go to the
+ * bulk lane by default.
+ *
+ * @param sock Pointer to a @link dime_socket_t @endlink struct
+ * @param lane A value from @link dime_socket_lane @endlink
+ */
+void dime_socket_lane(dime_socket_t *sock, int lane);
 
 /**
  * @brief Adds a DiME message to the outbuffer
@@ -229,6 +360,26 @@ ssize_t dime_socket_push_str(dime_socket_t *sock,
                              const void *bindata,
                              size_t bindata_len);
 
+/**
+ * @brief Adds a pre-built frame to the outbuffer
+ *
+ * Adds @em frame, which must be a complete DiME message or compressed
+ * frame, to the outbuffer without altering it. Useful for sending the
+ * same compressed frame over multiple sockets.
+ *
+ * @param sock Pointer to a @link dime_socket_t @endlink struct
+ * @param frame Frame to send
+ * @param frame_len Length of @em frame
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ *
+ * @see dime_socket_push_str
+ */
+ssize_t dime_socket_push_frame(dime_socket_t *sock,
+                               const void *frame,
+                               size_t frame_len);
+
 /**
  * @brief Attempts to get a DiME message from the inbuffer
  *
@@ -264,8 +415,9 @@ ssize_t dime_socket_pop(dime_socket_t *sock,
  *
  * @param sock Pointer to a @link dime_socket_t @endlink struct
  *
- * @return Number of bytes sent on success, or a negative value on
- * failure
+ * @return Number of bytes sent on success (possibly zero, if the socket
+ * is not ready or a TLS handshake is in progress), or a negative value
+ * on failure
  *
  * @see dime_socket_push
  * @see dime_socket_recvpartial
@@ -281,8 +433,10 @@ ssize_t dime_socket_sendpartial(dime_socket_t *sock);
  *
  * @param sock Pointer to a @link dime_socket_t @endlink struct
  *
- * @return Number of bytes received on success, or a negative value on
- * failure
+ * @return Number of bytes received on success, zero if the connection
+ * was closed, or a negative value on failure. If nothing could be read
+ * without blocking, e.g. during a TLS handshake, @c errno is set to
+ * @c EAGAIN and the socket should be polled again.
  *
  * @see dime_socket_pop
  * @see dime_socket_sendpartial
@@ -303,10 +457,54 @@ int dime_socket_fd(const dime_socket_t *sock);
  *
  * @param sock Pointer to a @link dime_socket_t @endlink struct
  *
- * @return Number of bytes in the outbuffer
+ * @return Number of bytes in the outbuffer, in either lane
  */
 size_t dime_socket_sendlen(const dime_socket_t *sock);
 
+/**
+ * @brief Get the position of the next message of the urgent lane
+ *
+ * @param sock Pointer to a @link dime_socket_t @endlink struct
+ *
+ * @return Number of bytes that will be sent before a message added to
+ * the urgent lane now, or @c SIZE_MAX if that is not known yet (a TLS
+ * write from the bulk lane has to be retried)
+ *
+ * @see dime_socket_lane
+ * @see dime_socket_sendlen
+ */
+size_t dime_socket_urgentlen(const dime_socket_t *sock);
+
+/**
+ * @brief Check whether the socket needs to be polled for writing
+ *
+ * True if the outbuffer is not empty, or if a TLS handshake is waiting
+ * for the socket to become writable.
+ *
+ * @param sock Pointer to a @link dime_socket_t @endlink struct
+ *
+ * @return Non-zero if @link dime_socket_sendpartial @endlink should be
+ * called once the socket is writable
+ */
+int dime_socket_wantwrite(const dime_socket_t *sock);
+
+/**
+ * @brief Get the time left for the peer to complete a WebSocket upgrade
+ *
+ * @param sock Pointer to a @link dime_socket_t @endlink struct
+ *
+ * @return Seconds until the deadline, zero or negative if it has
+ * passed, or @c HUGE_VAL if no upgrade is pending
+ */
+double dime_socket_timeleft(const dime_socket_t *sock);
+
+/**
+ * @brief Get the time on the clock used for deadlines
+ *
+ * @return Seconds on a monotonic clock
+ */
+double dime_socket_now(void);
+
 /**
  * @brief Get the number of bytes in the inbuffer of the socket
  *
@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+#include "spill.h"
+
+/* The file grows by at least this much at a time, to limit remapping */
+#define SPILL_GROW (64 << 20)
+
+void dime_spill_init(dime_spill_t *spill, const char *dir) {
+    spill->dir = dir;
+    spill->fd = -1;
+
+    spill->map = NULL;
+    spill->cap = 0;
+    spill->end = 0;
+
+    spill->holes = NULL;
+    spill->holes_len = 0;
+    spill->holes_cap = 0;
+
+    spill->bytes = 0;
+}
+
+void dime_spill_destroy(dime_spill_t *spill) {
+#ifndef _WIN32
+    if (spill->map != NULL) {
+        munmap(spill->map, spill->cap);
+    }
+
+    if (spill->fd >= 0) {
+        close(spill->fd);
+    }
+#endif
+
+    free(spill->holes);
+}
+
+#ifndef _WIN32
+/* Grow the file and its mapping to hold at least cap bytes */
+static int spill_grow(dime_spill_t *spill, size_t cap) {
+    if (spill->fd < 0) {
+        size_t path_len = strlen(spill->dir) + sizeof("/dime-spill-XXXXXX");
+
+        char *path = malloc(path_len);
+        if (path == NULL) {
+            return -1;
+        }
+
+        snprintf(path, path_len, "%s/dime-spill-XXXXXX", spill->dir);
+
+        spill->fd = mkstemp(path);
+
+        /* Nothing else needs to find the file, and it goes away with us */
+        if (spill->fd >= 0) {
+            unlink(path);
+        }
+
+        free(path);
+
+        if (spill->fd < 0) {
+            return -1;
+        }
+    }
+
+    size_t ncap = spill->cap + spill->cap / 2;
+
+    if (ncap < spill->cap + SPILL_GROW) {
+        ncap = spill->cap + SPILL_GROW;
+    }
+
+    if (ncap < cap) {
+        ncap = cap;
+    }
+
+    /*
+     * Allocate the blocks up front: writing to a hole of a full disk
+     * through the mapping would raise SIGBUS instead of failing here
+     */
+    int err = posix_fallocate(spill->fd, (off_t)spill->cap, (off_t)(ncap - spill->cap));
+
+    if (err != 0) {
+        if (ftruncate(spill->fd, (off_t)spill->cap) < 0) {
+            /* The next attempt starts over with a new file */
+            if (spill->map == NULL) {
+                close(spill->fd);
+                spill->fd = -1;
+            }
+        }
+
+        errno = err;
+
+        return -1;
+    }
+
+    char *map = mmap(NULL, ncap, PROT_READ | PROT_WRITE, MAP_SHARED, spill->fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    if (spill->map != NULL) {
+        munmap(spill->map, spill->cap);
+    }
+
+    spill->map = map;
+    spill->cap = ncap;
+
+    return 0;
+}
+#endif
+
+int dime_spill_write(dime_spill_t *spill, const void *buf, size_t len, size_t *poff) {
+#ifdef _WIN32
+    errno = ENOSYS;
+
+    return -1;
+#else
+    size_t i;
+
+    /* First fit among the free extents, otherwise at the end */
+    for (i = 0; i < spill->holes_len; i++) {
+        if (spill->holes[i].len >= len) {
+            break;
+        }
+    }
+
+    size_t off;
+
+    if (i < spill->holes_len) {
+        off = spill->holes[i].off;
+
+        spill->holes[i].off += len;
+        spill->holes[i].len -= len;
+
+        if (spill->holes[i].len == 0) {
+            spill->holes_len--;
+            memmove(spill->holes + i, spill->holes + i + 1, (spill->holes_len - i) * sizeof(spill->holes[0]));
+        }
+    } else {
+        if (spill->end + len > spill->cap && spill_grow(spill, spill->end + len) < 0) {
+            return -1;
+        }
+
+        off = spill->end;
+        spill->end += len;
+    }
+
+    memcpy(spill->map + off, buf, len);
+
+    /* Start writing the pages back, so that they can be evicted */
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = off - off % page;
+
+    msync(spill->map + begin, off + len - begin, MS_ASYNC);
+
+    spill->bytes += len;
+    *poff = off;
+
+    return 0;
+#endif
+}
+
+const void *dime_spill_ptr(const dime_spill_t *spill, size_t off) {
+    return spill->map + off;
+}
+
+void dime_spill_free(dime_spill_t *spill, size_t off, size_t len) {
+    spill->bytes -= len;
+
+    /* Give the disk space back once the store is empty */
+    if (spill->bytes == 0) {
+        spill->end = 0;
+        spill->holes_len = 0;
+
+#ifndef _WIN32
+        munmap(spill->map, spill->cap);
+
+        /* Closing the unlinked file frees its space just the same */
+        if (ftruncate(spill->fd, 0) < 0) {
+            close(spill->fd);
+            spill->fd = -1;
+        }
+#endif
+
+        spill->map = NULL;
+        spill->cap = 0;
+
+        return;
+    }
+
+    if (off + len == spill->end) {
+        spill->end = off;
+
+        /* The last free extent may now end there too */
+        if (spill->holes_len > 0 &&
+            spill->holes[spill->holes_len - 1].off + spill->holes[spill->holes_len - 1].len == spill->end) {
+            spill->holes_len--;
+            spill->end = spill->holes[spill->holes_len].off;
+        }
+
+        return;
+    }
+
+    size_t i = 0;
+
+    while (i < spill->holes_len && spill->holes[i].off < off) {
+        i++;
+    }
+
+    int prev = (i > 0 && spill->holes[i - 1].off + spill->holes[i - 1].len == off);
+    int next = (i < spill->holes_len && off + len == spill->holes[i].off);
+
+    if (prev && next) {
+        spill->holes[i - 1].len += len + spill->holes[i].len;
+        spill->holes_len--;
+        memmove(spill->holes + i, spill->holes + i + 1, (spill->holes_len - i) * sizeof(spill->holes[0]));
+    } else if (prev) {
+        spill->holes[i - 1].len += len;
+    } else if (next) {
+        spill->holes[i].off = off;
+        spill->holes[i].len += len;
+    } else {
+        if (spill->holes_len >= spill->holes_cap) {
+            size_t ncap = (spill->holes_cap == 0) ? 8 : (3 * spill->holes_cap) / 2;
+
+            void *holes = realloc(spill->holes, ncap * sizeof(spill->holes[0]));
+
+            /* The extent is lost until the store is emptied */
+            if (holes == NULL) {
+                return;
+            }
+
+            spill->holes = holes;
+            spill->holes_cap = ncap;
+        }
+
+        memmove(spill->holes + i + 1, spill->holes + i, (spill->holes_len - i) * sizeof(spill->holes[0]));
+
+        spill->holes[i].off = off;
+        spill->holes[i].len = len;
+        spill->holes_len++;
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * spill.h - File-backed store for queued messages
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file spill.h
+ * @brief File-backed store for queued messages
+ * @author Nicholas West
+ * @date 2020
+ *
+ * Holds the binary portions of queued messages that do not fit in the
+ * server's memory budget (see @c -M). They are written to a memory
+ * mapping of an unlinked temporary file, so the kernel can write them
+ * back and evict them, and are copied to a client's outbuffer from the
+ * mapping only as the outbuffer drains. Space freed by sent messages is reused, and the file is
+ * truncated once nothing is left in it.
+ */
+
+#include <stddef.h>
+
+#ifndef __DIME_spill_H
+#define __DIME_spill_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of the smallest binary portion worth spilling */
+#define DIME_SPILL_MIN 4096
+
+/** Bytes in an outbuffer above which spilled messages wait to be sent */
+#define DIME_SPILL_WATERMARK ((size_t)1 << 20)
+
+/**
+ * @brief File-backed store
+ *
+ * @see dime_spill_init
+ * @see dime_spill_destroy
+ * @see dime_spill_write
+ * @see dime_spill_ptr
+ * @see dime_spill_free
+ */
+typedef struct {
+    const char *dir; /* Directory of the file */
+    int fd;          /* Unlinked file, or -1 until something is spilled */
+
+    char *map;  /* Mapping of the whole file */
+    size_t cap; /* Size of the file */
+    size_t end; /* End of the last extent in use */
+
+    struct {
+        size_t off; /* Offset of free extent */
+        size_t len; /* Length of free extent */
+    } *holes;         /* Free extents before end, sorted by offset */
+    size_t holes_len; /* Number of free extents */
+    size_t holes_cap; /* Capacity of free extent array */
+
+    size_t bytes; /* Bytes in use */
+} dime_spill_t;
+
+/**
+ * @brief Initialize a new store
+ *
+ * The file is only created once something is written to the store.
+ *
+ * @param spill Pointer to a @c dime_spill_t struct
+ * @param dir Directory to create the file in, which must outlive the
+ * store
+ *
+ * @see dime_spill_destroy
+ */
+void dime_spill_init(dime_spill_t *spill, const char *dir);
+
+/**
+ * @brief Free resources used by a store
+ *
+ * @param spill Pointer to a @c dime_spill_t struct
+ *
+ * @see dime_spill_init
+ */
+void dime_spill_destroy(dime_spill_t *spill);
+
+/**
+ * @brief Copy bytes into the store
+ *
+ * @param spill Pointer to a @c dime_spill_t struct
+ * @param buf Bytes to copy
+ * @param len Number of bytes to copy
+ * @param poff Set to the offset of the bytes in the store
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ *
+ * @see dime_spill_free
+ */
+int dime_spill_write(dime_spill_t *spill, const void *buf, size_t len, size_t *poff);
+
+/**
+ * @brief Get a pointer to bytes in the store
+ *
+ * The pointer is valid until the next call to
+ * @link dime_spill_write @endlink or @link dime_spill_free @endlink.
+ *
+ * @param spill Pointer to a @c dime_spill_t struct
+ * @param off Offset from @link dime_spill_write @endlink
+ *
+ * @return Pointer to the bytes
+ */
+const void *dime_spill_ptr(const dime_spill_t *spill, size_t off);
+
+/**
+ * @brief Release bytes in the store for reuse
+ *
+ * @param spill Pointer to a @c dime_spill_t struct
+ * @param off Offset from @link dime_spill_write @endlink
+ * @param len Number of bytes written there
+ */
+void dime_spill_free(dime_spill_t *spill, size_t off, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,6 +16,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "table.h"
 
@@ -90,6 +91,25 @@ static int dime_table_grow(dime_table_t *tbl) {
     return 1;
 }
 
+int dime_table_cmp_str(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+/*
+ * Note: FNV1a is currently used here to hash strings, but since this is a
+ * network-enabled program, we may want to use a randomized hashing algorithm
+ * like SipHash
+ */
+uint64_t dime_table_hash_str(const void *a) {
+    uint64_t y = 0xCBF29CE484222325;
+
+    for (const char *s = a; *s != '\0'; s++) {
+        y = (y ^ *s) * 1099511628211;
+    }
+
+    return y;
+}
+
 int dime_table_init(dime_table_t *tbl, int (*cmp_f)(const void *, const void *), uint64_t (*hash_f)(const void *)) {
     tbl->cap = 32;
     tbl->arr = malloc(tbl->cap * sizeof(dime_table_elem_t));
@@ -96,6 +96,35 @@ int dime_table_init(dime_table_t *tbl,
                     int (*cmp_f)(const void *, const void *),
                     uint64_t (*hash_f)(const void *));
 
+/**
+ * @brief Compare two string keys
+ *
+ * Comparison function for tables keyed by NUL-terminated strings.
+ *
+ * @param a First key
+ * @param b Second key
+ *
+ * @return Zero if the keys are equal, nonzero otherwise
+ *
+ * @see dime_table_init
+ * @see dime_table_hash_str
+ */
+int dime_table_cmp_str(const void *a, const void *b);
+
+/**
+ * @brief Hash a string key
+ *
+ * Hashing function for tables keyed by NUL-terminated strings.
+ *
+ * @param a Key
+ *
+ * @return Hash of the key
+ *
+ * @see dime_table_init
+ * @see dime_table_cmp_str
+ */
+uint64_t dime_table_hash_str(const void *a);
+
 /**
  * @brief Free resources used by a table
  *
@@ -0,0 +1,962 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+#include <openssl/evp.h>
+#include "server.h"
+#include "transcode.h"
+
+/* Maximum nesting depth of arrays and associative arrays */
+#define DIME_TRANSCODE_MAXDEPTH 512
+
+enum dimeb_type {
+    DIMEB_NULL = 0x00,
+    DIMEB_TRUE = 0x01,
+    DIMEB_FALSE = 0x02,
+
+    DIMEB_I8 = 0x03,
+    DIMEB_I16 = 0x04,
+    DIMEB_I32 = 0x05,
+    DIMEB_I64 = 0x06,
+    DIMEB_U8 = 0x07,
+    DIMEB_U16 = 0x08,
+    DIMEB_U32 = 0x09,
+    DIMEB_U64 = 0x0A,
+
+    DIMEB_SINGLE = 0x0B,
+    DIMEB_DOUBLE = 0x0C,
+    DIMEB_COMPLEX_SINGLE = 0x0D,
+    DIMEB_COMPLEX_DOUBLE = 0x0E,
+
+    DIMEB_MATRIX = 0x10,
+
+    DIMEB_STRING = 0x20,
+    DIMEB_ARRAY = 0x21,
+    DIMEB_ASSOCARRAY = 0x22,
+
+    DIMEB_V2 = 0xFF
+};
+
+/*
+ * Scalar and matrix element types, indexed by the low nibble of the
+ * type code. "swap" is the size of the unit that is byte-swapped, which
+ * differs from "size" for complex types (real and imaginary parts are
+ * swapped separately).
+ */
+static const struct {
+    const char *dtype;
+    size_t size;
+    size_t swap;
+} mattypes[] = {
+    [DIMEB_I8] = {"int8", 1, 1},
+    [DIMEB_I16] = {"int16", 2, 2},
+    [DIMEB_I32] = {"int32", 4, 4},
+    [DIMEB_I64] = {"int64", 8, 8},
+    [DIMEB_U8] = {"uint8", 1, 1},
+    [DIMEB_U16] = {"uint16", 2, 2},
+    [DIMEB_U32] = {"uint32", 4, 4},
+    [DIMEB_U64] = {"uint64", 8, 8},
+    [DIMEB_SINGLE] = {"float32", 4, 4},
+    [DIMEB_DOUBLE] = {"float64", 8, 8},
+    [DIMEB_COMPLEX_SINGLE] = {"complex64", 8, 4},
+    [DIMEB_COMPLEX_DOUBLE] = {"complex128", 16, 8}
+};
+
+/* Cursor over a dimeb payload */
+typedef struct {
+    const unsigned char *s;
+    size_t len;
+    size_t pos;
+    int little; /* Nonzero if numbers are little-endian */
+    int v2;     /* Nonzero if matrix data is aligned */
+} dimeb_reader_t;
+
+/* Growable output buffer, and the dimeb variant to write into it */
+typedef struct {
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    int little;
+    int v2;
+} dimeb_writer_t;
+
+static int format_variant(int format, int *little, int *v2) {
+    switch (format) {
+    case DIME_FORMAT_DIMEB:
+        *little = 0;
+        *v2 = 0;
+        return 0;
+
+    case DIME_FORMAT_DIMEB2_LE:
+        *little = 1;
+        *v2 = 1;
+        return 0;
+
+    case DIME_FORMAT_DIMEB2_BE:
+        *little = 0;
+        *v2 = 1;
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+/* Reverse the bytes of each unit-sized chunk of p, in place */
+static void swap_units(unsigned char *p, size_t len, size_t unit) {
+    if (unit <= 1) {
+        return;
+    }
+
+    for (size_t i = 0; i + unit <= len; i += unit) {
+        for (size_t j = 0; j < unit / 2; j++) {
+            unsigned char tmp = p[i + j];
+
+            p[i + j] = p[i + unit - 1 - j];
+            p[i + unit - 1 - j] = tmp;
+        }
+    }
+}
+
+static int rd_bytes(dimeb_reader_t *r, size_t n, const unsigned char **pp) {
+    if (r->len - r->pos < n) {
+        return -1;
+    }
+
+    *pp = r->s + r->pos;
+    r->pos += n;
+
+    return 0;
+}
+
+static int rd_uint(dimeb_reader_t *r, size_t n, uint64_t *px) {
+    const unsigned char *p;
+
+    if (rd_bytes(r, n, &p) < 0) {
+        return -1;
+    }
+
+    uint64_t x = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        x = (x << 8) | p[r->little ? n - 1 - i : i];
+    }
+
+    *px = x;
+
+    return 0;
+}
+
+static int rd_align(dimeb_reader_t *r) {
+    const unsigned char *p;
+
+    if (!r->v2) {
+        return 0;
+    }
+
+    return rd_bytes(r, (DIME_DIMEB2_ALIGN - r->pos % DIME_DIMEB2_ALIGN) % DIME_DIMEB2_ALIGN, &p);
+}
+
+static int rd_init(dimeb_reader_t *r, int format, const void *in, size_t in_len) {
+    if (format_variant(format, &r->little, &r->v2) < 0) {
+        return -1;
+    }
+
+    r->s = in;
+    r->len = in_len;
+    r->pos = 0;
+
+    if (r->v2) {
+        const unsigned char *hdr;
+
+        if (rd_bytes(r, DIME_DIMEB2_HDRLEN, &hdr) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int wr_put(dimeb_writer_t *w, const void *p, size_t n) {
+    if (w->len + n > w->cap) {
+        size_t ncap = w->cap;
+
+        while (w->len + n > ncap) {
+            ncap = (ncap * 3) / 2;
+        }
+
+        unsigned char *nbuf = realloc(w->buf, ncap);
+        if (nbuf == NULL) {
+            return -1;
+        }
+
+        w->buf = nbuf;
+        w->cap = ncap;
+    }
+
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+
+    return 0;
+}
+
+static int wr_u8(dimeb_writer_t *w, unsigned int x) {
+    unsigned char c = x;
+
+    return wr_put(w, &c, 1);
+}
+
+static int wr_uint(dimeb_writer_t *w, uint64_t x, size_t n) {
+    unsigned char s[8];
+
+    for (size_t i = 0; i < n; i++) {
+        s[w->little ? i : n - 1 - i] = x;
+        x >>= 8;
+    }
+
+    return wr_put(w, s, n);
+}
+
+static int wr_double(dimeb_writer_t *w, double x) {
+    uint64_t u;
+
+    memcpy(&u, &x, sizeof(u));
+
+    return wr_uint(w, u, 8);
+}
+
+static int wr_align(dimeb_writer_t *w) {
+    static const unsigned char zeros[DIME_DIMEB2_ALIGN];
+
+    if (!w->v2) {
+        return 0;
+    }
+
+    return wr_put(w, zeros, (DIME_DIMEB2_ALIGN - w->len % DIME_DIMEB2_ALIGN) % DIME_DIMEB2_ALIGN);
+}
+
+/* Write matrix data held in the byte order "little" */
+static int wr_matrix_data(dimeb_writer_t *w, const unsigned char *p, size_t n, size_t unit, int little) {
+    if (little == w->little || unit <= 1) {
+        return wr_put(w, p, n);
+    }
+
+    size_t off = w->len;
+
+    if (wr_put(w, p, n) < 0) {
+        return -1;
+    }
+
+    swap_units(w->buf + off, n, unit);
+
+    return 0;
+}
+
+static int wr_init(dimeb_writer_t *w, int format, size_t hint) {
+    if (format_variant(format, &w->little, &w->v2) < 0) {
+        return -1;
+    }
+
+    w->len = 0;
+    w->cap = hint + DIME_DIMEB2_ALIGN;
+    w->buf = malloc(w->cap);
+
+    if (w->buf == NULL) {
+        return -1;
+    }
+
+    if (w->v2) {
+        unsigned char hdr[DIME_DIMEB2_HDRLEN] = {DIMEB_V2, 'D', 'B', 0x02, w->little ? 'L' : 'B', 0, 0, 0};
+
+        wr_put(w, hdr, sizeof(hdr));
+    }
+
+    return 0;
+}
+
+static int rd_matrix_header(dimeb_reader_t *r, unsigned int t, unsigned int *prank, uint64_t *shape, size_t *pcount) {
+    const unsigned char *p;
+
+    if (rd_bytes(r, 1, &p) < 0) {
+        return -1;
+    }
+
+    *prank = p[0];
+
+    size_t count = 1;
+
+    for (unsigned int i = 0; i < *prank; i++) {
+        if (rd_uint(r, 4, &shape[i]) < 0) {
+            return -1;
+        }
+
+        if (shape[i] != 0 && count > SIZE_MAX / shape[i]) {
+            return -1;
+        }
+
+        count *= shape[i];
+    }
+
+    if (count > SIZE_MAX / mattypes[t].size || rd_align(r) < 0) {
+        return -1;
+    }
+
+    *pcount = count;
+
+    return 0;
+}
+
+static json_t *dimeb_decode(dimeb_reader_t *r, int depth);
+
+static json_t *dimeb_decode_matrix(dimeb_reader_t *r, unsigned int t) {
+    unsigned int rank;
+    uint64_t dims[255];
+    size_t count;
+
+    if (t < DIMEB_I8 || t > DIMEB_COMPLEX_DOUBLE || rd_matrix_header(r, t, &rank, dims, &count) < 0) {
+        return NULL;
+    }
+
+    size_t nbytes = count * mattypes[t].size;
+    const unsigned char *data;
+
+    if (rd_bytes(r, nbytes, &data) < 0 || nbytes > INT32_MAX) {
+        return NULL;
+    }
+
+    json_t *shape = json_array();
+    if (shape == NULL) {
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < rank; i++) {
+        if (json_array_append_new(shape, json_integer(dims[i])) < 0) {
+            json_decref(shape);
+            return NULL;
+        }
+    }
+
+    unsigned char *raw = malloc(nbytes + 1);
+    char *b64 = malloc(4 * ((nbytes + 2) / 3) + 1);
+    if (raw == NULL || b64 == NULL) {
+        free(raw);
+        free(b64);
+        json_decref(shape);
+        return NULL;
+    }
+
+    /* JSON matrix data is little-endian */
+    memcpy(raw, data, nbytes);
+
+    if (!r->little) {
+        swap_units(raw, nbytes, mattypes[t].swap);
+    }
+
+    EVP_EncodeBlock((unsigned char *)b64, raw, (int)nbytes);
+    free(raw);
+
+    json_t *obj = json_pack("{sssssoss}",
+                            "__dime_type", "matrix",
+                            "dtype", mattypes[t].dtype,
+                            "shape", shape,
+                            "data", b64);
+    free(b64);
+
+    return obj;
+}
+
+static json_t *dimeb_decode(dimeb_reader_t *r, int depth) {
+    const unsigned char *p;
+
+    if (depth > DIME_TRANSCODE_MAXDEPTH || rd_bytes(r, 1, &p) < 0) {
+        return NULL;
+    }
+
+    unsigned int t = p[0];
+
+    if ((t & 0xF0) == DIMEB_MATRIX) {
+        return dimeb_decode_matrix(r, t & 0x0F);
+    }
+
+    switch (t) {
+    case DIMEB_NULL:
+        return json_null();
+
+    case DIMEB_TRUE:
+        return json_true();
+
+    case DIMEB_FALSE:
+        return json_false();
+
+    case DIMEB_I8:
+    case DIMEB_I16:
+    case DIMEB_I32:
+    case DIMEB_I64:
+        {
+            size_t n = mattypes[t].size;
+            uint64_t u;
+
+            if (rd_uint(r, n, &u) < 0) {
+                return NULL;
+            }
+
+            /* Sign-extend */
+            if (n < 8 && (u >> (8 * n - 1)) != 0) {
+                u |= ~(uint64_t)0 << (8 * n);
+            }
+
+            return json_integer((json_int_t)(int64_t)u);
+        }
+
+    case DIMEB_U8:
+    case DIMEB_U16:
+    case DIMEB_U32:
+    case DIMEB_U64:
+        {
+            uint64_t u;
+
+            if (rd_uint(r, mattypes[t].size, &u) < 0) {
+                return NULL;
+            }
+
+            if (u > INT64_MAX) {
+                return json_real((double)u);
+            }
+
+            return json_integer((json_int_t)u);
+        }
+
+    case DIMEB_SINGLE:
+    case DIMEB_COMPLEX_SINGLE:
+        {
+            uint64_t u[2] = {0, 0};
+            uint32_t v[2];
+            float f[2];
+
+            if (rd_uint(r, 4, &u[0]) < 0 || (t == DIMEB_COMPLEX_SINGLE && rd_uint(r, 4, &u[1]) < 0)) {
+                return NULL;
+            }
+
+            v[0] = u[0];
+            v[1] = u[1];
+            memcpy(f, v, sizeof(f));
+
+            if (t == DIMEB_SINGLE) {
+                return json_real(f[0]);
+            }
+
+            return json_pack("{sssfsf}", "__dime_type", "complex", "real", (double)f[0], "imag", (double)f[1]);
+        }
+
+    case DIMEB_DOUBLE:
+    case DIMEB_COMPLEX_DOUBLE:
+        {
+            uint64_t u[2] = {0, 0};
+            double d[2];
+
+            if (rd_uint(r, 8, &u[0]) < 0 || (t == DIMEB_COMPLEX_DOUBLE && rd_uint(r, 8, &u[1]) < 0)) {
+                return NULL;
+            }
+
+            memcpy(d, u, sizeof(d));
+
+            if (t == DIMEB_DOUBLE) {
+                return json_real(d[0]);
+            }
+
+            return json_pack("{sssfsf}", "__dime_type", "complex", "real", d[0], "imag", d[1]);
+        }
+
+    case DIMEB_STRING:
+        {
+            uint64_t n;
+
+            if (rd_uint(r, 4, &n) < 0 || rd_bytes(r, n, &p) < 0) {
+                return NULL;
+            }
+
+            return json_stringn((const char *)p, n);
+        }
+
+    case DIMEB_ARRAY:
+    case DIMEB_ASSOCARRAY:
+        {
+            uint64_t n;
+
+            if (rd_uint(r, 4, &n) < 0) {
+                return NULL;
+            }
+
+            json_t *ret = (t == DIMEB_ARRAY) ? json_array() : json_object();
+            if (ret == NULL) {
+                return NULL;
+            }
+
+            for (uint64_t i = 0; i < n; i++) {
+                json_t *key = NULL;
+
+                if (t == DIMEB_ASSOCARRAY) {
+                    key = dimeb_decode(r, depth + 1);
+
+                    /* JSON objects only have string keys */
+                    if (!json_is_string(key)) {
+                        json_decref(key);
+                        json_decref(ret);
+                        return NULL;
+                    }
+                }
+
+                json_t *val = dimeb_decode(r, depth + 1);
+                if (val == NULL) {
+                    json_decref(key);
+                    json_decref(ret);
+                    return NULL;
+                }
+
+                int err;
+
+                if (t == DIMEB_ARRAY) {
+                    err = json_array_append_new(ret, val);
+                } else {
+                    err = json_object_set_new(ret, json_string_value(key), val);
+                    json_decref(key);
+                }
+
+                if (err < 0) {
+                    json_decref(ret);
+                    return NULL;
+                }
+            }
+
+            return ret;
+        }
+
+    default:
+        return NULL;
+    }
+}
+
+static int dimeb_encode_matrix(dimeb_writer_t *w, json_t *obj) {
+    const char *dtype, *data;
+    json_t *shape;
+
+    if (json_unpack(obj, "{sssoss}", "dtype", &dtype, "shape", &shape, "data", &data) < 0 || !json_is_array(shape)) {
+        return -1;
+    }
+
+    unsigned int t;
+
+    for (t = DIMEB_I8; t <= DIMEB_COMPLEX_DOUBLE; t++) {
+        if (strcmp(dtype, mattypes[t].dtype) == 0) {
+            break;
+        }
+    }
+
+    if (t > DIMEB_COMPLEX_DOUBLE || json_array_size(shape) > 255) {
+        return -1;
+    }
+
+    if (wr_u8(w, DIMEB_MATRIX | t) < 0 || wr_u8(w, json_array_size(shape)) < 0) {
+        return -1;
+    }
+
+    size_t count = 1;
+    size_t i;
+    json_t *dim;
+
+    json_array_foreach(shape, i, dim) {
+        if (!json_is_integer(dim) || json_integer_value(dim) < 0 || json_integer_value(dim) > UINT32_MAX) {
+            return -1;
+        }
+
+        uint32_t n = json_integer_value(dim);
+
+        if (n != 0 && count > SIZE_MAX / n) {
+            return -1;
+        }
+
+        count *= n;
+
+        if (wr_uint(w, n, 4) < 0) {
+            return -1;
+        }
+    }
+
+    if (wr_align(w) < 0) {
+        return -1;
+    }
+
+    size_t data_len = strlen(data);
+
+    if (data_len % 4 != 0 || data_len > INT32_MAX) {
+        return -1;
+    }
+
+    unsigned char *raw = malloc(3 * (data_len / 4) + 1);
+    if (raw == NULL) {
+        return -1;
+    }
+
+    int n = EVP_DecodeBlock(raw, (const unsigned char *)data, (int)data_len);
+    if (n < 0) {
+        free(raw);
+        return -1;
+    }
+
+    /* EVP_DecodeBlock counts padding characters as zero bytes */
+    for (size_t j = data_len; j > 0 && data[j - 1] == '='; j--) {
+        n--;
+    }
+
+    if (count > SIZE_MAX / mattypes[t].size || (size_t)n != count * mattypes[t].size) {
+        free(raw);
+        return -1;
+    }
+
+    int err = wr_matrix_data(w, raw, n, mattypes[t].swap, 1);
+    free(raw);
+
+    return err;
+}
+
+static int dimeb_encode(dimeb_writer_t *w, json_t *v, int depth) {
+    if (depth > DIME_TRANSCODE_MAXDEPTH) {
+        return -1;
+    }
+
+    switch (json_typeof(v)) {
+    case JSON_NULL:
+        return wr_u8(w, DIMEB_NULL);
+
+    case JSON_TRUE:
+        return wr_u8(w, DIMEB_TRUE);
+
+    case JSON_FALSE:
+        return wr_u8(w, DIMEB_FALSE);
+
+    case JSON_INTEGER:
+        if (wr_u8(w, DIMEB_I64) < 0) {
+            return -1;
+        }
+
+        return wr_uint(w, (uint64_t)(int64_t)json_integer_value(v), 8);
+
+    case JSON_REAL:
+        if (wr_u8(w, DIMEB_DOUBLE) < 0) {
+            return -1;
+        }
+
+        return wr_double(w, json_real_value(v));
+
+    case JSON_STRING:
+        {
+            size_t n = json_string_length(v);
+
+            if (n > UINT32_MAX || wr_u8(w, DIMEB_STRING) < 0 || wr_uint(w, n, 4) < 0) {
+                return -1;
+            }
+
+            return wr_put(w, json_string_value(v), n);
+        }
+
+    case JSON_ARRAY:
+        {
+            size_t i;
+            json_t *elem;
+
+            if (wr_u8(w, DIMEB_ARRAY) < 0 || wr_uint(w, json_array_size(v), 4) < 0) {
+                return -1;
+            }
+
+            json_array_foreach(v, i, elem) {
+                if (dimeb_encode(w, elem, depth + 1) < 0) {
+                    return -1;
+                }
+            }
+
+            return 0;
+        }
+
+    case JSON_OBJECT:
+        {
+            const char *dime_type = json_string_value(json_object_get(v, "__dime_type"));
+
+            if (dime_type != NULL && strcmp(dime_type, "complex") == 0) {
+                json_t *real = json_object_get(v, "real");
+                json_t *imag = json_object_get(v, "imag");
+
+                if (!json_is_number(real) || !json_is_number(imag)) {
+                    return -1;
+                }
+
+                if (wr_u8(w, DIMEB_COMPLEX_DOUBLE) < 0 ||
+                    wr_double(w, json_number_value(real)) < 0 ||
+                    wr_double(w, json_number_value(imag)) < 0) {
+                    return -1;
+                }
+
+                return 0;
+            } else if (dime_type != NULL && strcmp(dime_type, "matrix") == 0) {
+                return dimeb_encode_matrix(w, v);
+            }
+
+            const char *key;
+            json_t *val;
+
+            if (wr_u8(w, DIMEB_ASSOCARRAY) < 0 || wr_uint(w, json_object_size(v), 4) < 0) {
+                return -1;
+            }
+
+            json_object_foreach(v, key, val) {
+                size_t n = strlen(key);
+
+                if (wr_u8(w, DIMEB_STRING) < 0 || wr_uint(w, n, 4) < 0 || wr_put(w, key, n) < 0) {
+                    return -1;
+                }
+
+                if (dimeb_encode(w, val, depth + 1) < 0) {
+                    return -1;
+                }
+            }
+
+            return 0;
+        }
+
+    default:
+        return -1;
+    }
+}
+
+/* Copy one dimeb value between variants, without an intermediate tree */
+static int dimeb_recode(dimeb_reader_t *r, dimeb_writer_t *w, int depth) {
+    const unsigned char *p;
+
+    if (depth > DIME_TRANSCODE_MAXDEPTH || rd_bytes(r, 1, &p) < 0) {
+        return -1;
+    }
+
+    unsigned int t = p[0];
+
+    if (wr_u8(w, t) < 0) {
+        return -1;
+    }
+
+    if ((t & 0xF0) == DIMEB_MATRIX) {
+        unsigned int rank;
+        uint64_t dims[255];
+        size_t count;
+
+        t &= 0x0F;
+
+        if (t < DIMEB_I8 || t > DIMEB_COMPLEX_DOUBLE || rd_matrix_header(r, t, &rank, dims, &count) < 0) {
+            return -1;
+        }
+
+        if (wr_u8(w, rank) < 0) {
+            return -1;
+        }
+
+        for (unsigned int i = 0; i < rank; i++) {
+            if (wr_uint(w, dims[i], 4) < 0) {
+                return -1;
+            }
+        }
+
+        size_t nbytes = count * mattypes[t].size;
+
+        if (rd_bytes(r, nbytes, &p) < 0 || wr_align(w) < 0) {
+            return -1;
+        }
+
+        return wr_matrix_data(w, p, nbytes, mattypes[t].swap, r->little);
+    }
+
+    switch (t) {
+    case DIMEB_NULL:
+    case DIMEB_TRUE:
+    case DIMEB_FALSE:
+        return 0;
+
+    case DIMEB_I8:
+    case DIMEB_I16:
+    case DIMEB_I32:
+    case DIMEB_I64:
+    case DIMEB_U8:
+    case DIMEB_U16:
+    case DIMEB_U32:
+    case DIMEB_U64:
+    case DIMEB_SINGLE:
+    case DIMEB_DOUBLE:
+    case DIMEB_COMPLEX_SINGLE:
+    case DIMEB_COMPLEX_DOUBLE:
+        for (size_t i = 0; i < mattypes[t].size; i += mattypes[t].swap) {
+            uint64_t u;
+
+            if (rd_uint(r, mattypes[t].swap, &u) < 0 || wr_uint(w, u, mattypes[t].swap) < 0) {
+                return -1;
+            }
+        }
+
+        return 0;
+
+    case DIMEB_STRING:
+        {
+            uint64_t n;
+
+            if (rd_uint(r, 4, &n) < 0 || rd_bytes(r, n, &p) < 0) {
+                return -1;
+            }
+
+            if (wr_uint(w, n, 4) < 0) {
+                return -1;
+            }
+
+            return wr_put(w, p, n);
+        }
+
+    case DIMEB_ARRAY:
+    case DIMEB_ASSOCARRAY:
+        {
+            uint64_t n;
+
+            if (rd_uint(r, 4, &n) < 0 || wr_uint(w, n, 4) < 0) {
+                return -1;
+            }
+
+            if (t == DIMEB_ASSOCARRAY) {
+                n *= 2;
+            }
+
+            for (uint64_t i = 0; i < n; i++) {
+                if (dimeb_recode(r, w, depth + 1) < 0) {
+                    return -1;
+                }
+            }
+
+            return 0;
+        }
+
+    default:
+        return -1;
+    }
+}
+
+int dime_format_detect(int serialization, const void *bindata, size_t bindata_len) {
+    const unsigned char *s = bindata;
+
+    switch (serialization) {
+    case DIME_JSON:
+        return DIME_FORMAT_JSON;
+
+    case DIME_DIMEB:
+        if (bindata_len > 0 && s[0] == DIMEB_V2) {
+            if (bindata_len < DIME_DIMEB2_HDRLEN || s[1] != 'D' || s[2] != 'B' || s[3] != 0x02) {
+                return DIME_FORMAT_OPAQUE;
+            }
+
+            if (s[4] == 'L') {
+                return DIME_FORMAT_DIMEB2_LE;
+            } else if (s[4] == 'B') {
+                return DIME_FORMAT_DIMEB2_BE;
+            }
+
+            return DIME_FORMAT_OPAQUE;
+        }
+
+        return DIME_FORMAT_DIMEB;
+
+    default:
+        return DIME_FORMAT_OPAQUE;
+    }
+}
+
+int dime_transcode(int from, int to, const void *in, size_t in_len, void **pout, size_t *pout_len) {
+    if (from == DIME_FORMAT_OPAQUE || to == DIME_FORMAT_OPAQUE) {
+        return -1;
+    }
+
+    if (from == to) {
+        void *out = malloc(in_len > 0 ? in_len : 1);
+        if (out == NULL) {
+            return -1;
+        }
+
+        memcpy(out, in, in_len);
+
+        *pout = out;
+        *pout_len = in_len;
+
+        return 0;
+    }
+
+    if (from == DIME_FORMAT_JSON) {
+        json_error_t err;
+        dimeb_writer_t w;
+
+        json_t *v = json_loadb(in, in_len, JSON_DECODE_ANY, &err);
+        if (v == NULL) {
+            return -1;
+        }
+
+        if (wr_init(&w, to, in_len) < 0) {
+            json_decref(v);
+            return -1;
+        }
+
+        if (dimeb_encode(&w, v, 0) < 0) {
+            free(w.buf);
+            json_decref(v);
+            return -1;
+        }
+
+        json_decref(v);
+
+        *pout = w.buf;
+        *pout_len = w.len;
+
+        return 0;
+    }
+
+    dimeb_reader_t r;
+
+    if (rd_init(&r, from, in, in_len) < 0) {
+        return -1;
+    }
+
+    if (to == DIME_FORMAT_JSON) {
+        json_t *v = dimeb_decode(&r, 0);
+        if (v == NULL) {
+            return -1;
+        }
+
+        char *s = json_dumps(v, JSON_COMPACT | JSON_ENCODE_ANY);
+        json_decref(v);
+
+        if (s == NULL) {
+            return -1;
+        }
+
+        *pout = s;
+        *pout_len = strlen(s);
+
+        return 0;
+    }
+
+    dimeb_writer_t w;
+
+    if (wr_init(&w, to, in_len) < 0) {
+        return -1;
+    }
+
+    if (dimeb_recode(&r, &w, 0) < 0) {
+        free(w.buf);
+        return -1;
+    }
+
+    *pout = w.buf;
+    *pout_len = w.len;
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * transcode.h - Conversion between serialization methods
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file transcode.h
+ * @brief Conversion between serialization methods
+ * @author Nicholas West
+ * @date 2020
+ *
+ * Converts the binary portion of a DiME message between the "dimeb"
+ * and "json" serialization methods, and between the variants of dimeb.
+ * Both methods are language-neutral and describe the same set of
+ * values (null, booleans, numbers, complex numbers, matrices, strings,
+ * arrays and string-keyed associative arrays), so the server can
+ * translate between them on behalf of clients that only understand
+ * one. The "matlab" and "pickle" methods are opaque to the server and
+ * cannot be transcoded.
+ *
+ * dimeb v1 stores every number in network byte order. dimeb v2 begins
+ * with an 8-byte prologue (0xFF 'D' 'B' 0x02, then 'L' or 'B' for the
+ * byte order, then three zero bytes), stores every number in that byte
+ * order, and pads matrix data with zero bytes so that it starts at a
+ * multiple of 64 bytes from the start of the payload. A v2 client can
+ * then use matrices in place without swapping bytes or copying them.
+ * Since 0xFF is never a valid v1 type code, decoders can accept both
+ * variants.
+ */
+
+#include <stddef.h>
+
+#ifndef __DIME_transcode_H
+#define __DIME_transcode_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Alignment of matrix data in dimeb v2 payloads */
+#define DIME_DIMEB2_ALIGN 64
+
+/** Length of the dimeb v2 prologue */
+#define DIME_DIMEB2_HDRLEN 8
+
+/**
+ * @brief Encoding of a message's binary portion
+ *
+ * Finer-grained than @link dime_serialization @endlink, since the
+ * variants of dimeb have to be told apart to be transcoded.
+ */
+enum dime_format {
+    DIME_FORMAT_OPAQUE,    /** MATLAB, pickle or unknown; never transcoded */
+    DIME_FORMAT_JSON,      /** JSON */
+    DIME_FORMAT_DIMEB,     /** dimeb v1, network byte order */
+    DIME_FORMAT_DIMEB2_LE, /** dimeb v2, little-endian */
+    DIME_FORMAT_DIMEB2_BE  /** dimeb v2, big-endian */
+};
+
+/**
+ * @brief Determine the format of a serialized value
+ *
+ * @param serialization A value from @link dime_serialization @endlink
+ * @param bindata Serialized value
+ * @param bindata_len Length of @em bindata
+ *
+ * @return A value from @link dime_format @endlink
+ */
+int dime_format_detect(int serialization, const void *bindata, size_t bindata_len);
+
+/**
+ * @brief Convert a serialized value between formats
+ *
+ * Decodes @em in according to @em from and re-encodes it according to
+ * @em to. On success, @em *pout is set to a newly allocated buffer that
+ * the caller must free.
+ *
+ * Matrices in JSON carry their data in little-endian Fortran order, so
+ * matrix data is byte-swapped element-wise whenever the byte orders of
+ * the two formats differ.
+ *
+ * @param from Format of @em in, from @link dime_format @endlink
+ * @param to Desired format of the output
+ * @param in Serialized value
+ * @param in_len Length of @em in
+ * @param pout Pointer to the output buffer
+ * @param pout_len Pointer to the length of the output buffer
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure (malformed input, an opaque format, or a value that the
+ * target format cannot represent)
+ */
+int dime_transcode(int from, int to, const void *in, size_t in_len, void **pout, size_t *pout_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
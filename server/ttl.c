@@ -0,0 +1,143 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "client.h"
+#include "server.h"
+#include "socket.h"
+#include "ttl.h"
+
+double dime_ttl_default(const dime_server_t *srv, const char *name) {
+    if (name != NULL) {
+        for (size_t i = 0; i < srv->ttl_len; i++) {
+            if (strcmp(srv->ttl_names[i], name) == 0) {
+                return srv->ttl_secs[i];
+            }
+        }
+    }
+
+    return srv->ttl_default;
+}
+
+void dime_ttl_schedule(dime_server_t *srv, dime_client_t *clnt, double expires) {
+    if (clnt->expires == 0 || expires < clnt->expires) {
+        dime_ttl_reset(srv, clnt, expires);
+    }
+}
+
+void dime_ttl_reset(dime_server_t *srv, dime_client_t *clnt, double expires) {
+    size_t slot = 0;
+
+    if (expires > 0) {
+        /* The first tick that starts after the time, or the next one if it has passed */
+        uint64_t tick = (uint64_t)(expires / DIME_TTL_TICK) + 1;
+
+        if (tick < srv->ttl_tick) {
+            tick = srv->ttl_tick;
+        }
+
+        slot = tick % DIME_TTL_SLOTS;
+
+        if (clnt->expires > 0 && clnt->ttl_slot == slot) {
+            clnt->expires = expires;
+
+            return;
+        }
+    }
+
+    if (clnt->expires > 0) {
+        dime_ttl_slot_t *w = &srv->ttl_wheel[clnt->ttl_slot];
+
+        w->len--;
+        w->clnts[clnt->ttl_idx] = w->clnts[w->len];
+        w->clnts[clnt->ttl_idx]->ttl_idx = clnt->ttl_idx;
+
+        srv->ttl_clnts--;
+        clnt->expires = 0;
+    }
+
+    if (expires == 0) {
+        return;
+    }
+
+    dime_ttl_slot_t *w = &srv->ttl_wheel[slot];
+
+    if (w->len >= w->cap) {
+        size_t ncap = (w->cap == 0) ? 4 : (3 * w->cap) / 2;
+
+        dime_client_t **clnts = realloc(w->clnts, ncap * sizeof(dime_client_t *));
+
+        /* Only "sync" drops the client's expired messages then */
+        if (clnts == NULL) {
+            return;
+        }
+
+        w->clnts = clnts;
+        w->cap = ncap;
+    }
+
+    clnt->expires = expires;
+    clnt->ttl_slot = slot;
+    clnt->ttl_idx = w->len;
+
+    w->clnts[w->len] = clnt;
+    w->len++;
+
+    srv->ttl_clnts++;
+}
+
+double dime_ttl_expire(dime_server_t *srv) {
+    double now = dime_socket_now();
+    uint64_t tick = (uint64_t)(now / DIME_TTL_TICK);
+
+    if (tick >= srv->ttl_tick) {
+        /* After a long gap, one turn visits every slot */
+        uint64_t n = tick - srv->ttl_tick + 1;
+
+        if (n > DIME_TTL_SLOTS) {
+            n = DIME_TTL_SLOTS;
+        }
+
+        for (uint64_t k = 0; k < n && srv->ttl_clnts > 0; k++) {
+            dime_ttl_slot_t *w = &srv->ttl_wheel[(srv->ttl_tick + k) % DIME_TTL_SLOTS];
+
+            for (size_t i = 0; i < w->len;) {
+                dime_client_t *clnt = w->clnts[i];
+
+                /* Due on a later turn */
+                if (clnt->expires > now) {
+                    i++;
+                    continue;
+                }
+
+                /* Moves the client out of the slot, or makes it due later */
+                dime_client_expire(clnt, srv, now);
+            }
+        }
+
+        srv->ttl_tick = tick + 1;
+    }
+
+    if (srv->ttl_clnts == 0) {
+        return HUGE_VAL;
+    }
+
+    uint64_t k;
+
+    for (k = 0; k < DIME_TTL_SLOTS; k++) {
+        if (srv->ttl_wheel[(srv->ttl_tick + k) % DIME_TTL_SLOTS].len > 0) {
+            break;
+        }
+    }
+
+    double timeleft = (srv->ttl_tick + k) * DIME_TTL_TICK - now;
+
+    return (timeleft > 0) ? timeleft : 0;
+}
+
+void dime_ttl_destroy(dime_server_t *srv) {
+    for (size_t i = 0; i < DIME_TTL_SLOTS; i++) {
+        free(srv->ttl_wheel[i].clnts);
+    }
+}
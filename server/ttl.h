@@ -0,0 +1,106 @@
+/*
+ * ttl.h - Expiry of queued messages
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file ttl.h
+ * @brief Expiry of queued messages
+ * @author Nicholas West
+ * @date 2020
+ *
+ * A message sent with a "ttl" field, or to a group with a default TTL
+ * (see @c -T), is dropped from the queues it is in once that many
+ * seconds have passed, rather than waiting for clients that may never
+ * sync it. Expired messages are dropped when a "sync" reaches them, and
+ * also periodically, so that they do not pile up for clients that stop
+ * syncing altogether.
+ *
+ * The periodic check uses a hashed timer wheel of clients rather than
+ * of messages. A client is placed in the slot of the earliest time at
+ * which a message in its queue expires, so that only the queues with
+ * something to drop are scanned as the wheel turns. Clients due more
+ * than one turn ahead stay in their slot until their turn comes.
+ */
+
+#include <stddef.h>
+
+#include "client.h"
+#include "server.h"
+
+#ifndef __DIME_ttl_H
+#define __DIME_ttl_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Look up the default TTL of a group
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param name Group name, or NULL for broadcasts
+ *
+ * @return Default TTL in seconds, or 0 if messages do not expire
+ */
+double dime_ttl_default(const dime_server_t *srv, const char *name);
+
+/**
+ * @brief Make sure that a client's queue is checked by a given time
+ *
+ * Called when a message that expires is queued for the client.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param expires Time at which the message expires
+ *
+ * @see dime_ttl_reset
+ */
+void dime_ttl_schedule(dime_server_t *srv, dime_client_t *clnt, double expires);
+
+/**
+ * @brief Set when a client's queue is next checked
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param expires Time to check the queue, or 0 to take the client out
+ * of the timer wheel
+ *
+ * @see dime_ttl_schedule
+ */
+void dime_ttl_reset(dime_server_t *srv, dime_client_t *clnt, double expires);
+
+/**
+ * @brief Drop expired messages from the queues of the clients that are due
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ *
+ * @return Seconds until the next slot of the timer wheel with clients
+ * in it, or @c HUGE_VAL if it is empty
+ */
+double dime_ttl_expire(dime_server_t *srv);
+
+/**
+ * @brief Free the timer wheel of a server
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ */
+void dime_ttl_destroy(dime_server_t *srv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+#ifdef _WIN32
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#   pragma comment(lib, "Ws2_32.lib")
+#else
+#   include <arpa/inet.h>
+#   include <fcntl.h>
+#   include <netinet/in.h>
+#   include <unistd.h>
+#   include <sys/socket.h>
+#   include <sys/uio.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+#include "client.h"
+#include "server.h"
+#include "udp.h"
+
+#ifdef _WIN32
+#   define close closesocket
+#endif
+
+/* Parse a multicast group for -u, e.g. "239.255.0.1:5400@127.0.0.1" */
+static int udp_parse_group(dime_server_t *srv, const char *spec) {
+    char addr[INET_ADDRSTRLEN];
+    const char *port = strchr(spec, ':');
+
+    if (port == NULL || (size_t)(port - spec) >= sizeof(addr)) {
+        return -1;
+    }
+
+    memcpy(addr, spec, port - spec);
+    addr[port - spec] = '\0';
+
+    char *end;
+    unsigned long portnum = strtoul(port + 1, &end, 10);
+
+    if (portnum == 0 || portnum > 65535 || (*end != '\0' && *end != '@')) {
+        return -1;
+    }
+
+    memset(&srv->udp_group, 0, sizeof(srv->udp_group));
+    srv->udp_group.sin_family = AF_INET;
+    srv->udp_group.sin_port = htons(portnum);
+
+    if (inet_pton(AF_INET, addr, &srv->udp_group.sin_addr) != 1 ||
+        !IN_MULTICAST(ntohl(srv->udp_group.sin_addr.s_addr))) {
+        return -1;
+    }
+
+    srv->udp_iface.s_addr = htonl(INADDR_ANY);
+
+    if (*end == '@' && inet_pton(AF_INET, end + 1, &srv->udp_iface) != 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int dime_udp_init(dime_server_t *srv, const char *spec) {
+    int fd;
+
+    if (strcmp(spec, "fanout") == 0) {
+        /* Dual-stack, like the TCP listeners, to reach any client */
+        fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd < 0) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            return -1;
+        }
+
+        int no = 0;
+
+        if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&no, sizeof(int)) < 0) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            close(fd);
+
+            return -1;
+        }
+
+        srv->udp_mode = DIME_UDP_FANOUT;
+    } else {
+        if (udp_parse_group(srv, spec) < 0) {
+            strncpy(srv->err, "Invalid multicast group: ", sizeof(srv->err));
+            strncat(srv->err, spec, sizeof(srv->err) - strlen(srv->err));
+            srv->err[sizeof(srv->err) - 1] = '\0';
+
+            return -1;
+        }
+
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd < 0) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            return -1;
+        }
+
+        /* Stay on the local network, and reach clients on this host */
+        unsigned char ttl = 1, loop = 1;
+
+        if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, (void *)&ttl, sizeof(ttl)) < 0 ||
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, (void *)&loop, sizeof(loop)) < 0 ||
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, (void *)&srv->udp_iface, sizeof(srv->udp_iface)) < 0) {
+            strncpy(srv->err, strerror(errno), sizeof(srv->err));
+            close(fd);
+
+            return -1;
+        }
+
+        srv->udp_mode = DIME_UDP_MULTICAST;
+    }
+
+    if (srv->sndbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (void *)&srv->sndbuf, sizeof(int));
+    }
+
+    /* A full send buffer drops the datagram rather than stall the loop */
+#ifdef __unix__
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags >= 0) {
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+#endif
+
+    srv->udp_fd = fd;
+
+    return 0;
+}
+
+json_t *dime_udp_register(dime_client_t *clnt, dime_server_t *srv, uint16_t port) {
+    if (srv->udp_mode == DIME_UDP_NONE) {
+        return json_false();
+    }
+
+    if (srv->udp_mode == DIME_UDP_FANOUT) {
+        struct sockaddr_storage sa;
+        socklen_t salen = sizeof(sa);
+        struct sockaddr_in6 *dst = (struct sockaddr_in6 *)&clnt->udp_addr;
+
+        memset(dst, 0, sizeof(struct sockaddr_in6));
+        dst->sin6_family = AF_INET6;
+        dst->sin6_port = htons(port);
+
+        if (getpeername(clnt->fd, (struct sockaddr *)&sa, &salen) == 0 && sa.ss_family == AF_INET6) {
+            dst->sin6_addr = ((struct sockaddr_in6 *)&sa)->sin6_addr;
+        } else {
+            /* IPv4 addresses are mapped, and Unix domain clients are local */
+            uint32_t v4 = htonl(INADDR_LOOPBACK);
+
+            if (getpeername(clnt->fd, (struct sockaddr *)&sa, &salen) == 0 && sa.ss_family == AF_INET) {
+                v4 = ((struct sockaddr_in *)&sa)->sin_addr.s_addr;
+            }
+
+            dst->sin6_addr.s6_addr[10] = 0xFF;
+            dst->sin6_addr.s6_addr[11] = 0xFF;
+            memcpy(&dst->sin6_addr.s6_addr[12], &v4, 4);
+        }
+
+        clnt->udp_addrlen = sizeof(struct sockaddr_in6);
+        clnt->udp_seq = 0;
+    }
+
+    json_t *udp;
+
+    clnt->udp_id = ++srv->udp_ids;
+
+    if (srv->udp_mode == DIME_UDP_MULTICAST) {
+        char group[INET_ADDRSTRLEN], iface[INET_ADDRSTRLEN];
+
+        inet_ntop(AF_INET, &srv->udp_group.sin_addr, group, sizeof(group));
+        inet_ntop(AF_INET, &srv->udp_iface, iface, sizeof(iface));
+
+        udp = json_pack("{sIsssiss}", "id", (json_int_t)clnt->udp_id,
+                        "group", group,
+                        "port", (int)ntohs(srv->udp_group.sin_port),
+                        "interface", iface);
+    } else {
+        udp = json_pack("{sI}", "id", (json_int_t)clnt->udp_id);
+    }
+
+    if (udp != NULL) {
+        clnt->udp = 1;
+        srv->udp_clnts++;
+    }
+
+    return udp;
+}
+
+ssize_t dime_udp_send(dime_server_t *srv, const struct sockaddr *addr, socklen_t addrlen,
+                      uint32_t seq, uint32_t src,
+                      const char *jsondata, size_t jsondata_len,
+                      const void *bindata, size_t bindata_len) {
+    uint8_t hdr[DIME_UDP_HDRLEN];
+    uint32_t fields[4] = {
+        htonl(seq),
+        htonl(src),
+        htonl(jsondata_len),
+        htonl(bindata_len)
+    };
+
+    memcpy(hdr, "DiMU", 4);
+    memcpy(hdr + 4, fields, sizeof(fields));
+
+#ifdef _WIN32
+    WSABUF bufs[3] = {
+        {DIME_UDP_HDRLEN, (char *)hdr},
+        {jsondata_len, (char *)jsondata},
+        {bindata_len, (char *)bindata}
+    };
+    DWORD n;
+
+    if (WSASendTo(srv->udp_fd, bufs, 3, &n, 0, addr, addrlen, NULL, NULL) != 0) {
+        return -1;
+    }
+
+    return n;
+#else
+    struct iovec iov[3] = {
+        {hdr, DIME_UDP_HDRLEN},
+        {(void *)jsondata, jsondata_len},
+        {(void *)bindata, bindata_len}
+    };
+    struct msghdr mh;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = (void *)addr;
+    mh.msg_namelen = addrlen;
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 3;
+
+    return sendmsg(srv->udp_fd, &mh, 0);
+#endif
+}
@@ -0,0 +1,128 @@
+/*
+ * udp.h - Datagram channel for small broadcasts
+ * Copyright (c) 2020 Nicholas West, Hantao Cui, CURENT, et. al.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided "as is" and the author disclaims all
+ * warranties with regard to this software including all implied warranties
+ * of merchantability and fitness. In no event shall the author be liable
+ * for any special, direct, indirect, or consequential damages or any
+ * damages whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action, arising
+ * out of or in connection with the use or performance of this software.
+ */
+
+/**
+ * @file udp.h
+ * @brief Datagram channel for small broadcasts
+ * @author Nicholas West
+ * @date 2020
+ *
+ * Clients that ask for it in their handshake receive small broadcasts
+ * as UDP datagrams instead of through their queue, either sent once to
+ * an IPv4 multicast group shared by all of them or sent to each of them
+ * in turn ("fan-out"). Delivery is unreliable: datagrams may be lost or
+ * reordered, which clients detect with the sequence numbers. Larger
+ * broadcasts, broadcasts the sender marks @c reliable, and everything
+ * else still go through the clients' queues.
+ *
+ * A datagram consists of the following data:
+ * - A 4-byte magic value ("DiMU" in ASCII)
+ * - A 4 byte big-endian sequence number, counting every datagram sent
+ *   to the multicast group, or to the client in the case of fan-out
+ * - A 4 byte big-endian source ID, which identifies the client that
+ *   broadcast the message, so that multicast clients can drop their
+ *   own messages
+ * - A 4 byte big-endian value for the size in bytes of the JSON portion
+ *   of the message
+ * - A 4 byte big-endian value for the size in bytes of the binary
+ *   portion of the message
+ * - The JSON portion followed by the binary portion
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <sys/socket.h>
+#endif
+
+#include <jansson.h>
+#include "client.h"
+#include "server.h"
+
+#ifndef __DIME_udp_H
+#define __DIME_udp_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Length of the header of a datagram */
+#define DIME_UDP_HDRLEN 20
+
+/** Default size of the largest datagram, which fits in an Ethernet frame */
+#define DIME_UDP_MAX 1400
+
+/** Size of the largest datagram that IPv4 can carry */
+#define DIME_UDP_LIMIT 65507
+
+/**
+ * @brief Open the server's datagram socket
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param spec Either "fanout", or a multicast group as
+ * "<address>:<port>", optionally followed by "@<interface address>"
+ *
+ * @return A nonnegative value on success, or a negative value on
+ * failure
+ */
+int dime_udp_init(dime_server_t *srv, const char *spec);
+
+/**
+ * @brief Subscribe a client to datagrams
+ *
+ * Handles the @c udp field of a "handshake" command. For fan-out,
+ * datagrams are sent to @em port at the client's address.
+ *
+ * @param clnt Pointer to a @link dime_client_t @endlink struct
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param port UDP port on which the client receives datagrams
+ *
+ * @return The @c udp field of the response, or NULL on failure
+ */
+json_t *dime_udp_register(dime_client_t *clnt, dime_server_t *srv, uint16_t port);
+
+/**
+ * @brief Send a message as a datagram
+ *
+ * The header and both portions of the message are gathered into one
+ * datagram without copying them.
+ *
+ * @param srv Pointer to a @link dime_server_t @endlink struct
+ * @param addr Destination address
+ * @param addrlen Length of @em addr
+ * @param seq Sequence number
+ * @param src Source ID
+ * @param jsondata JSON portion of the message
+ * @param jsondata_len Length of JSON portion of the message
+ * @param bindata Binary portion of the message
+ * @param bindata_len Length of binary portion of the message
+ *
+ * @return Number of bytes sent, or a negative value on failure
+ */
+ssize_t dime_udp_send(dime_server_t *srv, const struct sockaddr *addr, socklen_t addrlen,
+                      uint32_t seq, uint32_t src,
+                      const char *jsondata, size_t jsondata_len,
+                      const void *bindata, size_t bindata_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
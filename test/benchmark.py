@@ -65,7 +65,7 @@ if __name__ == "__main__":
 
     for _ in trange(TEST_AVG_RUNS):
         socketfile = os.path.join(tempfile.gettempdir(), randstring(20))
-        dimeserver = subprocess.Popen(["../server/dime", "-f", socketfile])
+        dimeserver = subprocess.Popen(["../server/dime", "-l", "unix:" + socketfile])
         time.sleep(0.1)
 
         counter = mp.Value("Q", 0, lock = False)
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+
+import sys
+import os
+sys.path.append(os.path.join(os.getcwd(), "..", "client", "python"))
+
+import argparse
+import subprocess
+import threading
+import time
+
+from dime import DimeClient
+
+TEST_PORT = 5124
+TEST_NUM_PINGS = 2000
+TEST_NUM_BURSTS = 200
+TEST_BURST_SIZE = 32
+TEST_NUM_CONNECTS = 200
+
+CONFIGS = [
+    ("Default", []),
+    ("No TCP_NODELAY or TCP_CORK", ["-o", "nodelay=0,cork=0"]),
+    ("TCP_NODELAY without TCP_CORK", ["-o", "cork=0"]),
+    ("TCP_QUICKACK", ["-o", "quickack"]),
+    ("Backlog of 0", ["-o", "backlog=0"]),
+]
+
+def report(label, latencies):
+    latencies.sort()
+
+    p50 = latencies[len(latencies) // 2] * 1e6
+    p99 = latencies[int(len(latencies) * 0.99)] * 1e6
+    print(f"  {label}: p50 {p50:.0f} us, p99 {p99:.0f} us, max {latencies[-1] * 1e6:.0f} us")
+
+def ping(client):
+    """Round trips of a small variable sent to ourselves"""
+    latencies = []
+
+    for _ in range(TEST_NUM_PINGS):
+        t = time.perf_counter()
+        client.send("ping", "x")
+        client.sync()
+        latencies.append(time.perf_counter() - t)
+
+    return latencies
+
+def burst(sender, receiver):
+    """Time to sync a burst of small variables"""
+    latencies = []
+
+    for _ in range(TEST_NUM_BURSTS):
+        sender.send_r("burst", **{f"v{i}": float(i) for i in range(TEST_BURST_SIZE)})
+
+        t = time.perf_counter()
+        received = receiver.sync(TEST_BURST_SIZE)
+        latencies.append(time.perf_counter() - t)
+
+        assert len(received) == TEST_BURST_SIZE
+
+    return latencies
+
+def connect_storm():
+    """Time for many clients connecting at once to complete a handshake"""
+    latencies = [None] * TEST_NUM_CONNECTS
+    clients = [None] * TEST_NUM_CONNECTS
+    barrier = threading.Barrier(TEST_NUM_CONNECTS)
+
+    def connect(i):
+        barrier.wait()
+
+        t = time.perf_counter()
+
+        try:
+            clients[i] = DimeClient("tcp", "127.0.0.1", TEST_PORT)
+            latencies[i] = time.perf_counter() - t
+        except OSError:
+            pass
+
+    threads = [threading.Thread(target = connect, args = (i,)) for i in range(TEST_NUM_CONNECTS)]
+
+    for thread in threads:
+        thread.start()
+
+    for thread in threads:
+        thread.join()
+
+    for client in clients:
+        if client is not None:
+            client.close()
+
+    return [latency for latency in latencies if latency is not None]
+
+def run(label, serverargs):
+    dimeserver = subprocess.Popen(["../server/dime", "-l", f"tcp:{TEST_PORT}"] + serverargs)
+    time.sleep(0.1)
+
+    try:
+        print(f"{label}:")
+
+        client = DimeClient("tcp", "127.0.0.1", TEST_PORT, compression = "none")
+        client.join("ping")
+        client["x"] = 1.0
+
+        report("ping", ping(client))
+
+        sender = DimeClient("tcp", "127.0.0.1", TEST_PORT, compression = "none")
+        receiver = DimeClient("tcp", "127.0.0.1", TEST_PORT, compression = "none")
+        receiver.join("burst")
+
+        report(f"sync of {TEST_BURST_SIZE} variables", burst(sender, receiver))
+        latencies = connect_storm()
+
+        report(f"{TEST_NUM_CONNECTS} simultaneous connects ({TEST_NUM_CONNECTS - len(latencies)} failed)", latencies)
+
+        client.close()
+        sender.close()
+        receiver.close()
+    finally:
+        dimeserver.terminate()
+        dimeserver.wait()
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description = "Benchmark round trip latency of the DiME server with different socket options")
+    parser.add_argument("-o", action = "append", default = [], metavar = "OPTIONS",
+                        help = "benchmark only the given -o options for the server (may be repeated)")
+    cmdargs = parser.parse_args()
+
+    configs = CONFIGS
+
+    if cmdargs.o:
+        configs = [(f"-o {opts}", ["-o", opts]) for opts in cmdargs.o]
+
+    for label, serverargs in configs:
+        run(label, serverargs)
@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+
+import sys
+import os
+sys.path.append(os.path.join(os.getcwd(), "..", "client", "python"))
+
+import argparse
+import multiprocessing as mp
+import ssl
+import statistics
+import subprocess
+import tempfile
+import time
+
+from dime import DimeClient
+
+TEST_PORT = 5123
+TEST_RUN_TIME = 10
+TEST_NUM_STORM_PROCESSES = 8
+TEST_NUM_PINGS = 2000
+TEST_PAYLOAD_SIZE = 16 << 20
+TEST_NUM_PAYLOADS = 32
+
+def client_context():
+    ctx = ssl.create_default_context()
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+
+    return ctx
+
+def connect_rate(resume, duration):
+    ctx = client_context()
+    client = DimeClient("tcp", "127.0.0.1", TEST_PORT, tls = ctx)
+    client.devices()
+    client.close()
+
+    if not resume:
+        client.tls_session = None
+
+    n = 0
+    reused = 0
+    end = time.perf_counter() + duration
+
+    while time.perf_counter() < end:
+        client.open()
+        client.devices()
+        reused += client.conn.session_reused
+        client.close()
+
+        if not resume:
+            client.tls_session = None
+
+        n += 1
+
+    return n / duration, reused
+
+def storm(stop, counter, counter_mut, resume):
+    ctx = client_context()
+    client = DimeClient("tcp", "127.0.0.1", TEST_PORT, tls = ctx)
+    client.devices()
+    client.close()
+
+    while not stop.is_set():
+        if not resume:
+            client.tls_session = None
+
+        client.open()
+        client.devices()
+        client.close()
+
+        with counter_mut:
+            counter.value += 1
+
+def ping_latencies(client):
+    latencies = []
+
+    for _ in range(TEST_NUM_PINGS):
+        client["x"] = 1.0
+
+        t = time.perf_counter()
+        client.send("ping", "x")
+        client.sync()
+        latencies.append(time.perf_counter() - t)
+
+    latencies.sort()
+
+    return latencies
+
+def report(label, latencies):
+    p50 = latencies[len(latencies) // 2] * 1e6
+    p99 = latencies[int(len(latencies) * 0.99)] * 1e6
+    print(f"  {label}: p50 {p50:.0f} us, p99 {p99:.0f} us, max {latencies[-1] * 1e6:.0f} us")
+
+def ktls_tx_count():
+    try:
+        with open("/proc/net/tls_stat") as f:
+            for line in f:
+                key, value = line.split()
+
+                if key == "TlsTxSw":
+                    return int(value)
+    except OSError:
+        pass
+
+    return None
+
+def throughput(label, serverargs, tls):
+    dimeserver = subprocess.Popen(["../server/dime", "-l", f"tcp:{TEST_PORT}"] + serverargs)
+    time.sleep(0.1)
+
+    try:
+        ktls_before = ktls_tx_count()
+
+        sender = DimeClient("tcp", "127.0.0.1", TEST_PORT, compression = "none", tls = tls)
+        receiver = DimeClient("tcp", "127.0.0.1", TEST_PORT, compression = "none", tls = tls)
+        receiver.join("receiver")
+
+        sender["x"] = os.urandom(TEST_PAYLOAD_SIZE)
+
+        t = time.perf_counter()
+
+        for _ in range(TEST_NUM_PAYLOADS):
+            sender.send("receiver", "x")
+            receiver.sync()
+
+        elapsed = time.perf_counter() - t
+
+        ktls_after = ktls_tx_count()
+
+        if ktls_before is None:
+            ktls = "kTLS unavailable"
+        else:
+            ktls = f"{ktls_after - ktls_before} kTLS connections"
+
+        print(f"{label}: {TEST_NUM_PAYLOADS * TEST_PAYLOAD_SIZE / elapsed / 1e6:.1f} MB/s ({ktls})")
+
+        sender.close()
+        receiver.close()
+    finally:
+        dimeserver.terminate()
+        dimeserver.wait()
+
+def throughput_main(certfile, keyfile):
+    throughput("Plaintext", [], None)
+    throughput("User-space TLS", ["-c", certfile, "-k", keyfile, "-K"], client_context())
+    throughput("Kernel TLS", ["-c", certfile, "-k", keyfile], client_context())
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description = "Benchmark TLS connections to the DiME server")
+    parser.add_argument("--throughput", action = "store_true",
+                        help = "compare large-payload throughput of plaintext, user-space TLS and kernel TLS")
+    cmdargs = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp()
+    certfile = os.path.join(tmpdir, "cert.pem")
+    keyfile = os.path.join(tmpdir, "key.pem")
+
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes",
+                    "-keyout", keyfile, "-out", certfile, "-days", "1",
+                    "-subj", "/CN=localhost"], check = True, capture_output = True)
+
+    if cmdargs.throughput:
+        throughput_main(certfile, keyfile)
+        sys.exit(0)
+
+    dimeserver = subprocess.Popen(["../server/dime", "-l", f"tcp:{TEST_PORT}", "-c", certfile, "-k", keyfile])
+    time.sleep(0.1)
+
+    try:
+        for resume in (False, True):
+            rate, reused = connect_rate(resume, TEST_RUN_TIME)
+            print(f"TLS connects/s ({'resumed' if resume else 'full handshake'}): {rate:.1f} ({reused} resumed)")
+
+        # Round trips on an established plaintext connection
+        pinger = DimeClient("tcp", "127.0.0.1", TEST_PORT, compression = "none")
+        pinger.join("ping")
+
+        print("Latency of an existing client:")
+        report("idle", ping_latencies(pinger))
+
+        for resume in (False, True):
+            stop = mp.Event()
+            counter = mp.Value("Q", 0, lock = False)
+            counter_mut = mp.Lock()
+
+            procs = [mp.Process(target = storm, args = (stop, counter, counter_mut, resume)) for _ in range(TEST_NUM_STORM_PROCESSES)]
+            for proc in procs:
+                proc.start()
+
+            time.sleep(0.5)
+
+            t = time.perf_counter()
+            start = counter.value
+            latencies = ping_latencies(pinger)
+            rate = (counter.value - start) / (time.perf_counter() - t)
+
+            stop.set()
+            for proc in procs:
+                proc.join()
+
+            report(f"during {'resumed' if resume else 'full'} connect storm ({rate:.0f} connects/s)", latencies)
+
+        pinger.close()
+    finally:
+        dimeserver.terminate()
+        dimeserver.wait()
@@ -7,10 +7,21 @@ sh test_matlab_sync.sh
 sh test_matlab_tcp.sh
 sh test_matlab_wait.sh
 sh test_python_broadcast.sh
+sh test_python_compress.sh
 sh test_python_devices.sh
+sh test_python_federation.sh
+sh test_python_metrics.sh
+sh test_python_priority.sh
 sh test_python_send.sh
+sh test_python_session.sh
+sh test_python_spill.sh
+sh test_python_stats.sh
 sh test_python_sync.sh
 sh test_python_tcp.sh
+sh test_python_tls.sh
+sh test_python_transcode.sh
+sh test_python_ttl.sh
+sh test_python_udp.sh
 sh test_python_wait.sh
 #sh test_javascript_broadcast.sh
 #sh test_javascript_devices.sh
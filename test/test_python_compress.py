@@ -0,0 +1,64 @@
+import numpy as np
+import socket
+import struct
+import sys
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+d1 = DimeClient("ipc", sys.argv[1], compression = "zlib")
+d2 = DimeClient("ipc", sys.argv[1], compression = ["bogus", "zlib"])
+d3 = DimeClient("ipc", sys.argv[1])
+
+d1.join("d1")
+d2.join("d2")
+d3.join("d3")
+
+assert d1.compression == "zlib" and d1.compression_threshold > 0
+assert d2.compression == "zlib"
+assert d3.compression == "none"
+
+# Large, compressible variables are sent and relayed as compressed frames;
+# small ones and clients without compression are unaffected
+d1["a"] = np.zeros((200, 300))
+d1["b"] = np.arange(10000, dtype = np.int64).reshape(100, 100)
+d1["c"] = {"x": "y" * 10000, "z": [1, 2, 3]}
+d1["d"] = 3.5
+
+d1.broadcast("a", "b", "c", "d")
+
+d2.sync()
+d3.sync()
+
+for d in (d2, d3):
+    assert np.array_equal(d1["a"], d["a"])
+    assert np.array_equal(d1["b"], d["b"])
+    assert d1["c"] == d["c"]
+    assert d1["d"] == d["d"]
+
+# Incompressible data falls back to plain messages
+d3["e"] = np.random.bytes(100000)
+d3.send("d1", "e")
+
+d1.sync()
+
+assert d1["e"] == d3["e"]
+
+# A compressed body longer than its codec could make it is rejected, while
+# plain frames are only capped by what is actually sent
+def closed(frame):
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as conn:
+        conn.connect(sys.argv[1])
+        conn.settimeout(0.5)
+        conn.sendall(frame)
+
+        try:
+            return conn.recv(1) == b""
+        except socket.timeout:
+            return False
+
+assert closed(b"DiMZ" + struct.pack("!IIIB3x", 10, 10, 1 << 31, 1))
+assert closed(b"DiMZ" + struct.pack("!IIIB3x", 1 << 30, 1 << 30, 100, 1))
+assert not closed(b"DiME" + struct.pack("!II", 100, 3 << 30) + b"\0" * 1000)
@@ -0,0 +1,122 @@
+import json
+import numpy as np
+import socket
+import struct
+import sys
+import time
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+host = sys.argv[1]
+ports = [int(port) for port in sys.argv[2:5]]
+
+if sys.argv[5:] == ["relink"]:
+    d1 = DimeClient("tcp", host, ports[0])
+    d2 = DimeClient("tcp", host, ports[1])
+    d3 = DimeClient("tcp", host, ports[2])
+
+    d1.join("again")
+
+    for _ in range(100):
+        if "again" in d2.devices() and "again" in d3.devices():
+            break
+
+        time.sleep(0.05)
+    else:
+        raise AssertionError("Links were not dialed again")
+
+    d2["a"] = 1.0
+    d2.send("again", "a")
+
+    time.sleep(0.2)
+
+    assert d1.sync_r() == {"a": 1.0}
+
+    # Servers only link to each other with the secret
+    hello = json.dumps({"command": "peer", "node": "0123456789abcdef", "groups": ["spoofed"]}).encode()
+
+    with socket.create_connection((host, ports[0])) as sock:
+        sock.sendall(b"DiME" + struct.pack("!II", len(hello), 0) + hello)
+
+        while sock.recv(1024):
+            pass
+
+    assert "spoofed" not in d1.devices()
+
+    sys.exit()
+
+d1 = DimeClient("tcp", host, ports[0])
+d2 = DimeClient("tcp", host, ports[1])
+d3 = DimeClient("tcp", host, ports[2])
+d4 = DimeClient("tcp", host, ports[2])
+
+d1.join("d1", "shared")
+d2.join("d2")
+d3.join("d3")
+d4.join("shared")
+
+# Group membership reaches the other servers asynchronously
+for _ in range(100):
+    if all(set(d.devices()) == {"d1", "d2", "d3", "shared"} for d in (d1, d2, d3)):
+        break
+
+    time.sleep(0.05)
+else:
+    raise AssertionError("Group membership was not shared between servers")
+
+def sync_all(d):
+    """Receive variables one at a time, so duplicates are not merged"""
+    varnames = []
+
+    while True:
+        updates = d.sync_r(1)
+
+        if not updates:
+            return sorted(varnames)
+
+        varnames.extend(updates)
+        d.workspace.update(updates)
+
+d2["a"] = np.random.rand(500, 500)
+d2.send("shared", "a")
+
+d2["b"] = "hello"
+d2.send("d3", "b")
+
+d3["c"] = [1, 2, 3]
+d3.broadcast("c")
+
+# Forwarded variables are relayed asynchronously too
+time.sleep(0.5)
+
+assert sync_all(d1) == ["a", "c"]
+assert sync_all(d2) == ["c"]
+assert sync_all(d3) == ["b"]
+assert sync_all(d4) == ["a", "c"]
+
+assert np.array_equal(d1["a"], d2["a"])
+assert np.array_equal(d4["a"], d2["a"])
+assert d3["b"] == "hello"
+assert d1["c"] == d2["c"] == d4["c"] == [1, 2, 3]
+
+# Leaving a group is shared as well
+d1.leave("shared")
+d4.leave("shared")
+
+for _ in range(100):
+    if all(set(d.devices()) == {"d1", "d2", "d3"} for d in (d1, d2, d3)):
+        break
+
+    time.sleep(0.05)
+else:
+    raise AssertionError("Leaving a group was not shared between servers")
+
+try:
+    d2.send("shared", "a")
+except RuntimeError:
+    pass
+else:
+    raise AssertionError("Sent a variable to a group with no members")
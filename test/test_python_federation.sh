@@ -0,0 +1,54 @@
+#!/bin/sh -e
+
+printf "Running test_python_federation... "
+
+DIME_PORTS=`python3 <<HEREDOC
+import random
+import socket
+
+ports = []
+
+while len(ports) < 3:
+    port = random.randrange(1 << 10, 1 << 15)
+
+    try:
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as srv:
+            srv.bind(("", port))
+    except OSError:
+        pass
+    else:
+        if port not in ports:
+            ports.append(port)
+
+print(*ports)
+HEREDOC`
+
+set -- $DIME_PORTS
+
+../server/dime -l "tcp:$1" -S secret &
+DIME_PID1=$!
+sleep 0.2
+
+../server/dime -l "tcp:$2" -S secret -P "localhost:$1" &
+DIME_PID2=$!
+sleep 0.2
+
+../server/dime -l "tcp:$3" -S secret -P "localhost:$1" -P "localhost:$2" &
+DIME_PID3=$!
+sleep 0.2
+
+env PYTHONPATH="../client/python" python3 test_python_federation.py "localhost" "$1" "$2" "$3"
+
+# The other servers dial the first one again once it is back
+kill $DIME_PID1
+sleep 0.2
+
+../server/dime -l "tcp:$1" -S secret &
+DIME_PID1=$!
+sleep 0.2
+
+env PYTHONPATH="../client/python" python3 test_python_federation.py "localhost" "$1" "$2" "$3" relink
+
+kill $DIME_PID1 $DIME_PID2 $DIME_PID3
+
+printf "Done!\n"
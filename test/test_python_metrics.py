@@ -0,0 +1,84 @@
+import numpy as np
+import socket
+import sys
+import urllib.error
+import urllib.request
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+def scrape():
+    with urllib.request.urlopen("http://localhost:%s/metrics" % sys.argv[2]) as resp:
+        assert resp.headers["Content-Type"].startswith("application/openmetrics-text")
+
+        lines = resp.read().decode().splitlines()
+
+    assert lines[-1] == "# EOF"
+
+    return dict(line.rsplit(" ", 1) for line in lines if not line.startswith("#"))
+
+d1 = DimeClient("ipc", sys.argv[1])
+d2 = DimeClient("ipc", sys.argv[1])
+
+d2.join("slow")
+
+d1["a"] = np.zeros(1000)
+
+for i in range(5):
+    d1.send("slow", "a")
+
+d1.devices()
+
+metrics = scrape()
+
+assert metrics['dime_connections{kind="client"}'] == "2"
+assert metrics["dime_accepted_connections_total"] == "2"
+assert metrics["dime_routed_messages_total"] == "5"
+assert metrics["dime_live_messages"] == "5"
+assert metrics['dime_queue_depth_bucket{le="0.0"}'] == "1"
+assert metrics['dime_queue_depth_bucket{le="1.0"}'] == "1"
+assert metrics['dime_queue_depth_bucket{le="10.0"}'] == "2"
+assert int(metrics["dime_queued_bytes"]) > 5 * 8000
+assert metrics["dime_queue_depth_sum"] == "5"
+assert metrics['dime_group_members{group="slow"}'] == "1"
+assert metrics['dime_group_messages_total{group="slow"}'] == "5"
+assert metrics['dime_group_deliveries_total{group="slow"}'] == "5"
+assert int(metrics["dime_event_loop_lag_seconds_count"]) > 0
+assert 'dime_event_loop_lag_seconds_bucket{le="1.0"}' in metrics
+
+d2.sync()
+
+metrics = scrape()
+
+assert metrics["dime_live_messages"] == "0"
+assert metrics['dime_queue_depth_bucket{le="0.0"}'] == "2"
+assert metrics["dime_queue_depth_sum"] == "0"
+assert metrics["dime_queued_bytes"] == "0"
+assert metrics["dime_sent_messages_total"] == "5"
+assert int(metrics["dime_sent_bytes_total"]) > 5 * 8000
+
+try:
+    urllib.request.urlopen(urllib.request.Request("http://localhost:%s/metrics" % sys.argv[2], data = b""))
+    assert False
+except urllib.error.HTTPError as e:
+    assert e.code == 405
+
+# Idle connections hold up to all the slots, and further ones are refused
+idle = [socket.create_connection(("localhost", int(sys.argv[2]))) for i in range(16)]
+
+d1.devices()
+
+try:
+    scrape()
+    assert False
+except (urllib.error.URLError, ConnectionError):
+    pass
+
+for sock in idle:
+    sock.close()
+
+d1.devices()
+
+assert scrape()["dime_live_messages"] == "0"
@@ -0,0 +1,15 @@
+#!/bin/sh -e
+
+printf "Running test_python_metrics... "
+
+DIME_SOCKET="`mktemp -u`"
+../server/dime -l "unix:$DIME_SOCKET" -m 8897 &
+DIME_PID=$!
+
+sleep 0.2
+
+env PYTHONPATH="../client/python" python3 test_python_metrics.py "$DIME_SOCKET" 8897
+
+kill $DIME_PID
+
+printf "Done!\n"
@@ -0,0 +1,62 @@
+import numpy as np
+import sys
+import time
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+d1 = DimeClient("tcp", sys.argv[1], int(sys.argv[2]))
+d2 = DimeClient("tcp", sys.argv[1], int(sys.argv[2]))
+
+d1.join("d1")
+d2.join("d2")
+
+# Priority variables are queued ahead of the others
+d1["a"] = np.random.rand(100, 100)
+d1["b"] = np.random.rand(100, 100)
+d1["c"] = np.random.rand(100, 100)
+
+d2["a"] = None
+d2["b"] = None
+d2["c"] = None
+
+d1.send("d2", "a", "b")
+d1.send("d2", "c", priority = True)
+
+d2.sync(1)
+
+assert np.array_equal(d1["c"], d2["c"])
+assert d2["a"] is None and d2["b"] is None
+
+d2.sync()
+
+assert np.array_equal(d1["a"], d2["a"])
+assert np.array_equal(d1["b"], d2["b"])
+
+# A sync reply that is still being sent picks up priority variables
+# ahead of the variables it has not sent yet
+d1["bulk"] = np.random.rand(5000000)
+d1["urgent"] = 1.0
+
+for _ in range(3):
+    d1.send("d2", "bulk")
+
+d2._DimeClient__send({"command": "sync", "n": -1})
+time.sleep(0.5)
+
+d1.send("d2", "urgent", priority = True)
+
+varnames = []
+
+while True:
+    jsondata, _ = d2._DimeClient__recv()
+
+    if "status" in jsondata:
+        break
+
+    varnames.append(jsondata["varname"])
+
+assert sorted(varnames) == ["bulk", "bulk", "bulk", "urgent"]
+assert varnames[-1] != "urgent"
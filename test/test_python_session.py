@@ -0,0 +1,92 @@
+import numpy as np
+import sys
+import time
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+d1 = DimeClient("ipc", sys.argv[1], session = "dashboard")
+d2 = DimeClient("ipc", sys.argv[1])
+
+assert d1.session_token is not None and not d1.session_resumed
+
+d1.join("dashboard")
+
+# Messages sent while the connection is down are held for the session
+d2["a"] = 1.0
+d2.send("dashboard", "a")
+
+d1.close()
+time.sleep(0.1)
+
+d2["b"] = 2.0
+d2.send("dashboard", "b")
+d2.broadcast("b")
+
+assert "dashboard" in d2.devices()
+
+d1.open()
+
+assert d1.session_resumed and d1.session_lost == 0
+assert d1.sync_r(1) == {"a": 1.0}
+assert d1.sync_r(1) == {"b": 2.0}
+assert d1.sync_r(1) == {"b": 2.0}
+assert d1.sync_r(1) == {}
+
+# A client reconnecting before the old connection is noticed takes over
+d3 = DimeClient("ipc", sys.argv[1], session = "dashboard", session_token = d1.session_token)
+
+assert d3.session_resumed
+
+d2.send("dashboard", "a")
+
+assert d3.sync() == {"a"}
+
+# Sessions cannot be taken over without the token
+for token in (None, d1.session_token[:-1], d1.session_token + "0"):
+    try:
+        DimeClient("ipc", sys.argv[1], session = "dashboard", session_token = token)
+    except RuntimeError:
+        pass
+    else:
+        assert False
+
+# Held queues are bounded, dropping the oldest messages
+d3.close()
+time.sleep(0.1)
+
+for i in range(8):
+    d2["c"] = np.full(2048, float(i))
+    d2.send("dashboard", "c")
+
+d3.open()
+
+assert d3.session_resumed and d3.session_lost > 0
+assert d3.sync()
+assert d3["c"][0] == 7.0
+
+# Held sessions expire
+d3.close()
+time.sleep(1.5)
+
+assert "dashboard" not in d2.devices()
+
+d3.open()
+
+assert not d3.session_resumed
+
+# Only so many sessions are held at once
+held = [DimeClient("ipc", sys.argv[1], session = "held%d" % i) for i in range(3)]
+
+for d in held:
+    d.close()
+
+time.sleep(0.1)
+
+for d in held:
+    d.open()
+
+# Which one is not held depends on the order the server notices the closes
+assert sorted(d.session_resumed for d in held) == [False, True, True]
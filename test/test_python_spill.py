@@ -0,0 +1,75 @@
+import numpy as np
+import sys
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+d1 = DimeClient("ipc", sys.argv[1])
+d2 = DimeClient("ipc", sys.argv[1])
+
+d2.join("slow")
+
+# The server keeps 1 MiB of messages in memory and spills the rest
+for i in range(8):
+    d1["v%d" % i] = np.random.rand(50000)
+    d1.send("slow", "v%d" % i)
+
+stats = d1.stats()
+
+assert stats["server"]["messages_live"] == 8
+assert stats["server"]["messages_spilled"] > 0
+assert stats["server"]["messages_resident"] + stats["server"]["messages_spilled"] == stats["server"]["messages_bytes"]
+
+for i in range(8):
+    d2["v%d" % i] = None
+
+d2.sync(3)
+
+for i in range(3):
+    assert np.array_equal(d1["v%d" % i], d2["v%d" % i])
+
+assert d2["v3"] is None
+
+d2.sync()
+
+for i in range(3, 8):
+    assert np.array_equal(d1["v%d" % i], d2["v%d" % i])
+
+stats = d1.stats()
+
+assert stats["server"]["messages_live"] == 0
+assert stats["server"]["messages_spilled"] == 0 and stats["server"]["messages_bytes"] == 0
+
+# The space is reused once it is freed
+for i in range(8):
+    d1.send("slow", "v%d" % i)
+
+d2.sync()
+
+for i in range(8):
+    assert np.array_equal(d1["v%d" % i], d2["v%d" % i])
+
+# Spilled messages are read back as the socket drains, not all at once
+def rss_anon():
+    with open("/proc/%s/status" % sys.argv[2]) as f:
+        for line in f:
+            if line.startswith("RssAnon:"):
+                return int(line.split()[1]) * 1024
+
+d1["big"] = np.random.rand(1 << 17)
+
+for i in range(48):
+    d1.send("slow", "big")
+
+before = rss_anon()
+
+d2.sync()
+
+assert np.array_equal(d1["big"], d2["big"])
+assert rss_anon() - before < 16 << 20
+
+stats = d1.stats()
+
+assert stats["server"]["messages_live"] == 0
@@ -0,0 +1,15 @@
+#!/bin/sh -e
+
+printf "Running test_python_spill... "
+
+DIME_SOCKET="`mktemp -u`"
+../server/dime -l "unix:$DIME_SOCKET" -M 1048576 &
+DIME_PID=$!
+
+sleep 0.2
+
+env PYTHONPATH="../client/python" python3 test_python_spill.py "$DIME_SOCKET" "$DIME_PID"
+
+kill $DIME_PID
+
+printf "Done!\n"
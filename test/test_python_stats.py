@@ -0,0 +1,60 @@
+import numpy as np
+import sys
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+d1 = DimeClient("ipc", sys.argv[1])
+d2 = DimeClient("ipc", sys.argv[1], session = "consumer")
+
+d2.join("slow")
+
+d1["a"] = np.zeros(1000)
+
+for i in range(5):
+    d1.send("slow", "a")
+
+stats = d1.stats()
+
+assert stats["uptime"] > 0
+assert stats["server"]["accepts"] == 2
+assert stats["server"]["clients"] == 2
+assert stats["server"]["messages"] == 5
+assert stats["server"]["messages_live"] == 5
+
+group, = [g for g in stats["groups"] if g["name"] == "slow"]
+
+assert group["members"] == 1 and group["messages"] == 5
+assert group["bytes"] > 5 * 8000
+
+consumer, = [c for c in stats["clients"] if c["session"] == "consumer"]
+
+assert consumer["groups"] == ["slow"]
+assert consumer["queue"] == 5
+assert consumer["queue_bytes"] == group["bytes"]
+assert consumer["messages_out"] == 0
+
+d2.sync()
+
+stats = d2.stats()
+consumer, = [c for c in stats["clients"] if c["session"] == "consumer"]
+
+assert consumer["queue"] == 0 and consumer["queue_bytes"] == 0
+assert consumer["messages_out"] == 5
+assert consumer["bytes_out"] > 5 * 8000
+assert consumer["messages_in"] == 4
+assert stats["server"]["messages_live"] == 0 and stats["server"]["messages_bytes"] == 0
+
+latency = d1.latency(reset = True)
+
+assert latency["sample"] == 1
+assert latency["groups"]["slow"]["route"]["count"] == 5
+assert latency["groups"]["slow"]["queue"]["count"] == 5
+assert latency["stages"]["queue"]["p50"] >= latency["stages"]["queue"]["min"] > 0
+assert latency["broadcast"] is None
+
+latency = d1.latency()
+
+assert latency["stages"]["route"]["count"] == 0
@@ -0,0 +1,39 @@
+import numpy as np
+import signal
+import ssl
+import sys
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+def timeout(signum, frame):
+    raise RuntimeError("\"sync\" command timed out")
+
+ctx = ssl.create_default_context()
+ctx.check_hostname = False
+ctx.verify_mode = ssl.CERT_NONE
+
+d = DimeClient("tcp", sys.argv[1], int(sys.argv[2]), tls = ctx)
+d.join("d")
+
+rng = np.random.default_rng(0)
+
+signal.signal(signal.SIGALRM, timeout)
+signal.alarm(30)
+
+# Odd-sized records keep straddling the end of the server's inbuffer
+for i in range(5000):
+    d["a"] = rng.random(rng.integers(1, 1000))
+
+    d.send("d", "a")
+
+    a = d["a"]
+    del d["a"]
+
+    d.sync()
+
+    assert np.array_equal(a, d["a"])
+
+signal.alarm(0)
@@ -0,0 +1,38 @@
+#!/bin/sh -e
+
+printf "Running test_python_tls... "
+
+DIME_PORT=`python3 <<HEREDOC
+import random
+import socket
+
+while True:
+    port = random.randrange(1 << 10, 1 << 15)
+
+    try:
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as srv:
+            srv.bind(("", port))
+    except OSError:
+        pass
+    else:
+        break
+
+print(port)
+HEREDOC`
+
+DIME_CERTDIR="`mktemp -d`"
+
+openssl req -x509 -newkey rsa:2048 -nodes -keyout "$DIME_CERTDIR/key.pem" \
+    -out "$DIME_CERTDIR/cert.pem" -days 1 -subj "/CN=localhost" 2>/dev/null
+
+../server/dime -l "tcp:$DIME_PORT" -c "$DIME_CERTDIR/cert.pem" -k "$DIME_CERTDIR/key.pem" &
+DIME_PID=$!
+
+sleep 0.2
+
+env PYTHONPATH="../client/python" python3 test_python_tls.py "localhost" "$DIME_PORT"
+
+kill $DIME_PID
+rm -r "$DIME_CERTDIR"
+
+printf "Done!\n"
@@ -0,0 +1,66 @@
+import numpy as np
+import sys
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+d1 = DimeClient("ipc", sys.argv[1])
+d2 = DimeClient("ipc", sys.argv[1])
+d3 = DimeClient("ipc", sys.argv[1])
+
+d2.close()
+d2.open(use_json = True)
+
+d1.join("d1")
+d2.join("d2")
+d3.join("d3")
+
+assert d2.serialization == "json"
+
+d1["a"] = np.random.rand(50, 40)
+d1["b"] = {"x": [1, 2.5, "three", None, True], "y": complex(1, -2)}
+d1["c"] = np.arange(12, dtype = np.int32).reshape(3, 4) + 1j
+
+# A pickle client sending to a JSON client is asked to fall back to dimeb,
+# which the server then transcodes to JSON
+d1.send("d2", "a", "b", "c")
+
+assert d1.serialization == "dimeb"
+
+d2.sync()
+
+assert np.array_equal(d1["a"], d2["a"])
+assert d1["b"] == d2["b"]
+assert np.array_equal(d1["c"], d2["c"])
+
+# Pickle-to-pickle traffic is unaffected
+assert d3.serialization == "pickle"
+
+d3["d"] = {1, 2, 3}
+d3.send("d1", "d")
+
+d1.sync()
+
+assert d1["d"] == {1, 2, 3}
+
+# JSON is passed through to pickle clients untouched
+d2.send("d3", "a", "b")
+
+d3.sync()
+
+assert np.array_equal(d1["a"], d3["a"])
+assert d1["b"] == d3["b"]
+
+# Clients that agree on byte order exchange dimeb v2 untouched, and matrices
+# arrive as views over the received buffer
+assert d1.dimeb_version == 2 and d3.dimeb_version == 2
+
+d1["e"] = np.random.rand(30, 20)
+d1.send("d3", "e")
+
+d3.sync()
+
+assert np.array_equal(d1["e"], d3["e"])
+assert not d3["e"].flags.owndata
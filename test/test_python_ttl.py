@@ -0,0 +1,58 @@
+import numpy as np
+import sys
+import time
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+d1 = DimeClient("ipc", sys.argv[1])
+d2 = DimeClient("ipc", sys.argv[1])
+
+d2.join("slow", "telemetry")
+
+d1["a"] = np.random.rand(10)
+d1["b"] = np.random.rand(10)
+d1["c"] = np.random.rand(10)
+d1["e"] = np.random.rand(10)
+
+# Only the message with a TTL expires while it is queued
+d1.send("slow", "a", ttl = 0.3)
+d1.send("slow", "b")
+
+time.sleep(0.6)
+
+d2["a"] = None
+d2.sync()
+
+assert d2["a"] is None
+assert np.array_equal(d1["b"], d2["b"])
+assert d1.stats()["server"]["messages_expired"] == 1
+
+# The group's default TTL applies, and the timer drops the message without a "sync"
+d1.send("telemetry", "c")
+
+assert d1.stats()["server"]["messages_live"] == 1
+
+time.sleep(0.6)
+
+stats = d1.stats()
+
+assert stats["server"]["messages_live"] == 0
+assert stats["server"]["messages_expired"] == 2
+assert sum(clnt["messages_expired"] for clnt in stats["clients"]) == 2
+
+d2["c"] = None
+d2.sync()
+
+assert d2["c"] is None
+
+# A TTL of 0 overrides the group's default
+d1.send("telemetry", "e", ttl = 0)
+
+time.sleep(0.6)
+
+d2.sync()
+
+assert np.array_equal(d1["e"], d2["e"])
@@ -0,0 +1,15 @@
+#!/bin/sh -e
+
+printf "Running test_python_ttl... "
+
+DIME_SOCKET="`mktemp -u`"
+../server/dime -l "unix:$DIME_SOCKET" -T telemetry:0.3 &
+DIME_PID=$!
+
+sleep 0.2
+
+env PYTHONPATH="../client/python" python3 test_python_ttl.py "$DIME_SOCKET"
+
+kill $DIME_PID
+
+printf "Done!\n"
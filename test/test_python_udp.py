@@ -0,0 +1,73 @@
+import numpy as np
+import sys
+import time
+
+from dime import DimeClient
+
+if __name__ != "__main__":
+    raise RuntimeError()
+
+d1 = DimeClient("tcp", sys.argv[1], int(sys.argv[2]), udp = True)
+d2 = DimeClient("tcp", sys.argv[1], int(sys.argv[2]), udp = True)
+d3 = DimeClient("tcp", sys.argv[1], int(sys.argv[2]))
+
+assert d1.udp is not None
+assert d2.udp is not None
+
+# Small broadcasts arrive as datagrams
+for i in range(100):
+    d1["x"] = float(i)
+    d1.broadcast("x")
+
+# Large and reliable broadcasts still arrive through the queue
+d1["a"] = np.random.rand(100, 100)
+d1["b"] = 1.0
+d1.broadcast("a")
+d1.broadcast("b", reliable = True)
+
+time.sleep(0.1)
+
+assert d2.sync() == {"x", "a", "b"}
+assert d2["x"] == 99.0
+assert np.array_equal(d1["a"], d2["a"])
+assert d2.udp_seq is not None and d2.udp_lost == 0
+
+assert d3.sync() == {"x", "a", "b"}
+assert d3["x"] == 99.0
+
+# Clients do not receive their own broadcasts
+assert d1.sync() == set()
+
+# Whichever of a datagram and a queued copy was routed last is kept
+d1["y"] = 1.0
+d1.broadcast("y", reliable = True)
+d1["y"] = 2.0
+d1.broadcast("y")
+d1["z"] = 1.0
+d1.broadcast("z")
+d1["z"] = 2.0
+d1.broadcast("z", reliable = True)
+
+time.sleep(0.1)
+
+assert d2.sync() == {"y", "z"}
+assert d2["y"] == 2.0 and d2["z"] == 2.0
+
+# A client that cannot decode a datagram as sent gets a queued copy only
+d4 = DimeClient("tcp", sys.argv[1], int(sys.argv[2]), udp = True)
+d4.close()
+d4.open("tcp", sys.argv[1], int(sys.argv[2]), use_json = True, udp = True)
+
+seq = d2.udp_seq
+
+d1["w"] = 3.0
+d1.broadcast("w")
+
+time.sleep(0.1)
+
+assert d4.sync() == {"w"}
+assert d4["w"] == 3.0 and d4.udp_seq is None
+
+# With multicast, such a client keeps the others from getting datagrams
+assert d2.sync() == {"w"}
+assert (d2.udp_seq == seq) == (sys.argv[3:] == ["multicast"])
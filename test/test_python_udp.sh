@@ -0,0 +1,43 @@
+#!/bin/sh -e
+
+printf "Running test_python_udp... "
+
+DIME_PORTS=`python3 <<HEREDOC
+import random
+import socket
+
+ports = []
+
+while len(ports) < 2:
+    port = random.randrange(1 << 10, 1 << 15)
+
+    try:
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as srv, \
+             socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as dgram:
+            srv.bind(("", port))
+            dgram.bind(("", port))
+    except OSError:
+        pass
+    else:
+        if port not in ports:
+            ports.append(port)
+
+print(*ports)
+HEREDOC`
+
+set -- $DIME_PORTS
+
+../server/dime -l "tcp:$1" -u fanout &
+DIME_PID1=$!
+
+../server/dime -l "tcp:$2" -u "239.255.0.1:$2@127.0.0.1" &
+DIME_PID2=$!
+
+sleep 0.2
+
+env PYTHONPATH="../client/python" python3 test_python_udp.py "localhost" "$1"
+env PYTHONPATH="../client/python" python3 test_python_udp.py "localhost" "$2" multicast
+
+kill $DIME_PID1 $DIME_PID2
+
+printf "Done!\n"